@@ -0,0 +1,39 @@
+# Try to find the OSMesa (off-screen Mesa) library
+#
+# OSMESA_INCLUDE_DIR
+# OSMESA_LIBRARY
+# OSMESA_FOUND
+
+FIND_PATH(
+  OSMESA_INCLUDE_DIR GL/osmesa.h
+  ${CMAKE_INCLUDE_PATH}
+  $ENV{include}
+  /usr/include
+  /usr/local/include
+  /opt/local/include
+)
+
+FIND_LIBRARY(
+  OSMESA_LIBRARY
+  NAMES OSMesa OSMesa32 OSMesa16
+  PATH
+    /opt/local/lib
+    ${CMAKE_LIBRARY_PATH}
+    $ENV{lib}
+    /usr/lib
+    /usr/local/lib
+)
+
+IF (OSMESA_INCLUDE_DIR AND OSMESA_LIBRARY)
+   SET(OSMESA_FOUND TRUE)
+ENDIF (OSMESA_INCLUDE_DIR AND OSMESA_LIBRARY)
+
+IF (OSMESA_FOUND)
+   IF (NOT OSMesa_FIND_QUIETLY)
+      MESSAGE(STATUS "Found OSMesa: ${OSMESA_LIBRARY}")
+   ENDIF (NOT OSMesa_FIND_QUIETLY)
+ELSE (OSMESA_FOUND)
+   IF (OSMesa_FIND_REQUIRED)
+      MESSAGE(FATAL_ERROR "Could not find OSMesa")
+   ENDIF (OSMesa_FIND_REQUIRED)
+ENDIF (OSMESA_FOUND)
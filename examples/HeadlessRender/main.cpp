@@ -0,0 +1,79 @@
+/**
+ * HeadlessRender
+ * Renders a View and a Plotter without a display and checks the result
+ **/
+
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+#include <pangolin/pangolin.h>
+
+using namespace pangolin;
+using namespace std;
+
+void DrawRed(View& view)
+{
+    glClearColor(1, 0, 0, 1);
+    view.ActivateScissorAndClear();
+    glClearColor(0, 0, 0, 1);
+}
+
+// write bottom row first RGB image as binary PPM
+void WritePPM(const string& filename, const vector<unsigned char>& image, int w, int h)
+{
+    ofstream f(filename.c_str(), ios::binary);
+    f << "P6\n" << w << " " << h << "\n255\n";
+    for(int y = h-1; y >= 0; --y) {
+        f.write((const char*)&image[3*w*y], 3*w);
+    }
+}
+
+int main( int argc, char* argv[] )
+{
+    const int w = 640;
+    const int h = 480;
+
+    CreateHeadlessContextAndBind("HeadlessRender", w, h);
+
+    // left half cleared to red by its draw function
+    View& view = CreateDisplay()
+        .SetBounds(0.0, 1.0, 0.0, 0.5)
+        .SetDrawFunction(DrawRed);
+
+    // right half plots a sine wave
+    DataLog log;
+    for(int i = 0; i < 600; ++i) {
+        log.Log(sin(i / 50.0f));
+    }
+    Plotter& plotter = CreatePlotter("plot", &log);
+    plotter.SetBounds(0.0, 1.0, 0.5, 1.0);
+
+    FinishHeadlessFrame();
+
+    vector<unsigned char> image(3*w*h);
+    ReadFramebuffer(&image[0], GL_RGB, GL_UNSIGNED_BYTE);
+
+    if( argc > 1 ) {
+        WritePPM(argv[1], image, w, h);
+    }
+
+    const int vx = view.v.l + view.v.w/2;
+    const int vy = view.v.b + view.v.h/2;
+    const unsigned char* p = &image[3*(w*vy + vx)];
+    const bool view_ok = p[0] == 255 && p[1] == 0 && p[2] == 0;
+
+    int plotted = 0;
+    for(int y = plotter.v.b; y < plotter.v.b + plotter.v.h; ++y) {
+        for(int x = plotter.v.l; x < plotter.v.l + plotter.v.w; ++x) {
+            const unsigned char* q = &image[3*(w*y + x)];
+            if( q[0] || q[1] || q[2] ) ++plotted;
+        }
+    }
+
+    cout << "View: " << (view_ok ? "ok" : "FAILED") << endl;
+    cout << "Plotter: " << plotted << " pixels drawn" << endl;
+
+    return (view_ok && plotted > 0) ? 0 : 1;
+}
@@ -7,24 +7,38 @@
 
 #include <sys/stat.h>
 #include <iostream>
+#include <algorithm>
 
 #include <pangolin/pangolin.h>
 #include <pangolin/video.h>
+#include <pangolin/video_output.h>
 #include <pangolin/video/firewire.h>
+#include <pangolin/video/firewire_control.h>
+#include <pangolin/video_capture_thread.h>
 #include <pangolin/timer.h>
 
 #include <boost/thread.hpp>  
+#include <boost/bind.hpp>
 
 using namespace pangolin;
 using namespace std;
 
+// two step under / over exposure schedule at fixed gain
+ExposureSchedule BracketSchedule(uint32_t under_shutter, uint32_t over_shutter, uint32_t gain)
+{
+    std::vector<ExposureStep> steps;
+    steps.push_back(ExposureStep(under_shutter, gain));
+    steps.push_back(ExposureStep(over_shutter, gain));
+    return ExposureSchedule(steps);
+}
+
 int main( int argc, char* argv[] )
 {
     /*-----------------------------------------------------------------------
      *  SETUP SOURCE
      *-----------------------------------------------------------------------*/    
     
-    FirewireVideo video = FirewireVideo();
+    FirewireVideo video;
     video.LoadConfig();
     video.SetHDRRegister(false);
     video.SetMetaDataFlags( META_ALL_AND_ABS );
@@ -34,6 +48,18 @@ int main( int argc, char* argv[] )
     
     unsigned char* img = new unsigned char[video.SizeBytes()];
 
+    // register writes go through control queue so a slow bus never stalls
+    // the render loop. Direct calls below must hold its bus mutex once it
+    // is started, after the GUI has read the initial settings.
+    FirewireControlQueue control(video);
+
+    // dequeue camera frames on their own thread so that capture rate
+    // isn't tied to rendering and control logic below. Every frame is
+    // matched to the exposure schedule there, as the display skips frames.
+    VideoCaptureThread capture_thread(&video, 16);
+    capture_thread.SetFrameHandler(boost::bind(&FirewireControlQueue::ScheduleFrame, &control, _1));
+    capture_thread.Start();
+
     /*-----------------------------------------------------------------------
      *  GUI
      *-----------------------------------------------------------------------*/    
@@ -57,8 +83,9 @@ int main( int argc, char* argv[] )
     .SetBounds(0.0, 1.0, Attach::Pix(panel_width), 1.0)
     .SetAspect((float)w/h);
     
-    // OpenGl Texture for video frame
+    // OpenGl Texture for video frame, uploaded asynchronously
     GlTexture texVideo(w,h,GL_RGBA8);
+    texVideo.SetStreaming(3);
     
     /*-----------------------------------------------------------------------
      *  CONTROL PANEL
@@ -148,13 +175,24 @@ int main( int argc, char* argv[] )
     // Loop Variables
     bool save = false;    
     bool under_over = true;
+    int record_number = 0;
+
+    // exposure schedule step of frame in img, -1 if unknown or not in HDR mode
+    int hdr_step = -1;
+
+    // img holds a frame not yet seen by the display and AEC
+    bool new_frame = false;
+    
+    // LDR recordings are encoded live when an in process encoder is available
+    VideoOutput video_out;
     time_t start, end;
     uint32_t hdr_shutter[3];    
+    uint32_t hdr_gain = 0;
+    const float bracket_ev[3] = { -1, 0, 1 };
     uint32_t aec_shutter[3];    
     float max = video.GetFeatureQuantMax(DC1394_FEATURE_SHUTTER);
     float min = video.GetFeatureQuantMin(DC1394_FEATURE_SHUTTER);
 
-    int frame_count = 0;
     // AEC constants
     float threshold = video.CheckConfigLoaded() 
                     ? video.GetAECValue("AEC_THRESHOLD") / 1000 
@@ -162,6 +200,8 @@ int main( int argc, char* argv[] )
 
     //AEC Variables -- use to plot as well
     float new_under_shutter_time, new_over_shutter_time = 0;
+
+    control.Start();
     
     // loop until quit (e.g ESC key)
     for(int frame_number = 0; !ShouldQuit(); ++frame_number)
@@ -179,7 +219,9 @@ int main( int argc, char* argv[] )
          *  Refresh screen
          *-----------------------------------------------------------------------*/    
         
-        texVideo.Upload(img, vid_fmt.channels==1 ? GL_LUMINANCE:GL_RGB, GL_UNSIGNED_BYTE);
+        if(new_frame) {
+            texVideo.Upload(img, vid_fmt.channels==1 ? GL_LUMINANCE:GL_RGB, GL_UNSIGNED_BYTE);
+        }
         // Activate video viewport and render texture
         vVideo.ActivateScissorAndClear();
         texVideo.RenderToViewportFlipY();
@@ -190,36 +232,27 @@ int main( int argc, char* argv[] )
         
         // HDR MODE
 
-        // switch under over flag
-        under_over = under_over ? false : true;
-
-        //switch under over flag to under at frame sync
-        if (hdr && (frame_number == frame_count+100) ){
-            under_over = true;
-        }
+        // step 0 of the bracket schedule is the under exposure
+        under_over = (hdr_step == 0);
         
         // checks if hdr mode has been switched and sets register on
         if(Pushed(hdr.var->meta_gui_changed)){
             
-            frame_count = frame_number;
-            
+            control.Flush();
+            boost::mutex::scoped_lock bus_lock(control.BusMutex());
+
             if( hdr ){
 
                 cout << "[HDR]: HDR mode enabled" << endl;        
                 video.SetFeatureAuto(DC1394_FEATURE_SHUTTER);
-                float EV = video.GetFeatureValue(DC1394_FEATURE_EXPOSURE);
                 
                 cout << "[HDR]: HDR mode bracket range set at: " << endl;
-                for (int i = -1; i <= 1 ; i++){
-                    video.SetFeatureValue(DC1394_FEATURE_EXPOSURE, EV+i);
-                    sleep(1);
-                    cout << "> " << i << ": " << EV+i << " EV" << endl;
-                    hdr_shutter[i+1] = video.GetFeatureQuant(DC1394_FEATURE_SHUTTER);
-                } 
-
-                // set shutter values
-                video.SetHDRShutterFlags(hdr_shutter[0], hdr_shutter[2], hdr_shutter[0], hdr_shutter[2]); 
-                video.SetHDRRegister(true);
+                video.CalibrateBracket(capture_thread, img, bracket_ev, 3, hdr_shutter);
+
+                // run bracket as an exposure schedule, so frames can be
+                // identified from their embedded shutter and gain
+                hdr_gain = video.GetFeatureQuant(DC1394_FEATURE_GAIN);
+                video.StartExposureSchedule(BracketSchedule(hdr_shutter[0], hdr_shutter[2], hdr_gain));
                 
                //update aec values in gui
                ue_time.operator=(video.GetShutterMapAbs(hdr_shutter[0]));
@@ -247,9 +280,9 @@ int main( int argc, char* argv[] )
             // copy, don't modify original hdr shutter values so we can reset them
             memcpy(aec_shutter, hdr_shutter, sizeof(aec_shutter));
             
-            if(!AEC){
+            if(!AEC && hdr){
                 
-                video.SetHDRShutterFlags(hdr_shutter[0], hdr_shutter[2], hdr_shutter[0], hdr_shutter[2]); 
+                control.StartExposureSchedule(BracketSchedule(hdr_shutter[0], hdr_shutter[2], hdr_gain));
                 
                 //update aec values in gui
                 ue_time.operator=(video.GetShutterMapAbs(hdr_shutter[0]));
@@ -258,8 +291,9 @@ int main( int argc, char* argv[] )
         } 
         
         
-        // will only modify values if HDR mode is on
-        if (hdr && AEC){
+        // will only modify values if HDR mode is on. Each frame is measured
+        // once, so a slow camera doesn't have its correction applied repeatedly
+        if (hdr && AEC && new_frame && hdr_step >= 0){
             
             
             // calculate new shutter values and set them if >= threshold
@@ -271,7 +305,7 @@ int main( int argc, char* argv[] )
                 
                 if( (new_under_shutter_time < new_over_shutter_time) && (new_under_shutter_time > min) ){
                     aec_shutter[0] = video.GetShutterMapQuant(new_under_shutter_time); // replace new shutter time in array
-                    video.SetHDRShutterFlags(aec_shutter[0], aec_shutter[2], aec_shutter[0], aec_shutter[2]); // set registers
+                    control.StartExposureSchedule(BracketSchedule(aec_shutter[0], aec_shutter[2], hdr_gain)); // set registers
                 }
                 
             } else {
@@ -280,7 +314,7 @@ int main( int argc, char* argv[] )
                 
                 if( (new_over_shutter_time > new_under_shutter_time) && (new_over_shutter_time < max) ){
                     aec_shutter[2] = video.GetShutterMapQuant(new_over_shutter_time); // replace new shutter time in array
-                    video.SetHDRShutterFlags(aec_shutter[0], aec_shutter[2], aec_shutter[0], aec_shutter[2]); // set registers
+                    control.StartExposureSchedule(BracketSchedule(aec_shutter[0], aec_shutter[2], hdr_gain)); // set registers
                 }
                 
             }   
@@ -305,29 +339,32 @@ int main( int argc, char* argv[] )
              */
 
             if(Pushed(exposure.var->meta_gui_changed)){
-                video.SetFeatureValue(DC1394_FEATURE_EXPOSURE, exposure); 
-                video.SetFeatureAuto(DC1394_FEATURE_SHUTTER);
+                control.SetFeatureValue(DC1394_FEATURE_EXPOSURE, exposure); 
+                control.SetFeatureAuto(DC1394_FEATURE_SHUTTER).wait();
+                boost::mutex::scoped_lock bus_lock(control.BusMutex());
                 shutter.operator=(video.GetFeatureValue(DC1394_FEATURE_SHUTTER));
             }
             else{
-                video.SetFeatureValue(DC1394_FEATURE_SHUTTER, shutter);
+                control.SetFeatureValue(DC1394_FEATURE_SHUTTER, shutter);
             }
             
         }
 
         if ( manual ){    
-            video.SetFeatureValue(DC1394_FEATURE_BRIGHTNESS, brightness);
-            video.SetFeatureValue(DC1394_FEATURE_GAIN, gain);
-            video.SetFeatureValue(DC1394_FEATURE_GAMMA, gamma); 
-            video.SetFeatureValue(DC1394_FEATURE_SATURATION, saturation);
-            video.SetFeatureValue(DC1394_FEATURE_HUE, hue); 
-            video.SetFeatureQuant(DC1394_FEATURE_SHARPNESS, sharpness);
-            video.SetWhiteBalance(whitebalance_B_U, whitebalance_R_V);
+            control.SetFeatureValue(DC1394_FEATURE_BRIGHTNESS, brightness);
+            control.SetFeatureValue(DC1394_FEATURE_GAIN, gain);
+            control.SetFeatureValue(DC1394_FEATURE_GAMMA, gamma); 
+            control.SetFeatureValue(DC1394_FEATURE_SATURATION, saturation);
+            control.SetFeatureValue(DC1394_FEATURE_HUE, hue); 
+            control.SetFeatureQuant(DC1394_FEATURE_SHARPNESS, sharpness);
+            control.SetWhiteBalance(whitebalance_B_U, whitebalance_R_V);
         } 
 
         // resets all features to automatic mode and update trackbars
         else if( !manual && !hdr ) { 
             
+            boost::mutex::scoped_lock bus_lock(control.BusMutex());
+
             // set auto mode for all features and reset gamma and hue
             video.SetAllFeaturesAuto(); 
             video.ResetBrightness();
@@ -348,30 +385,41 @@ int main( int argc, char* argv[] )
 
         }
         
-        if( Pushed(capture) ) { video.SaveSingleFrame(img); } 
+        if( Pushed(capture) ) {
+            // one-shot capture needs exclusive use of the camera
+            capture_thread.Stop();
+            control.Flush();
+            {
+                boost::mutex::scoped_lock bus_lock(control.BusMutex());
+                video.SaveSingleFrame(img);
+            }
+            capture_thread.Start();
+        } 
         
         if( Pushed(capture_hdr) ){
             
+            capture_thread.Stop();
+            control.Flush();
+            boost::mutex::scoped_lock bus_lock(control.BusMutex());
+
             // see if response function has already been generated
             if (!video.CheckResponseFunction()) {
                 cout << "[HDR]: No response function found, generating one" << endl;
                 video.GetResponseFunction();
             }
             video.SetAllFeaturesAuto();
-            sleep(1);
             video.SetFeatureAuto(DC1394_FEATURE_SHUTTER);
-            float EV = video.GetFeatureValue(DC1394_FEATURE_EXPOSURE);
-            for (int i = -1; i <= 1 ; i++){
-                video.SetFeatureValue(DC1394_FEATURE_EXPOSURE, EV+i);
-                sleep(1);
-                cout << "[HDR]: image " << i+1 << " @ " << EV+i << "EV" << endl;
-                hdr_shutter[i+1] = video.GetFeatureQuant(DC1394_FEATURE_SHUTTER);
-            } 
+            
+            // stream while auto exposure settles
+            video.Start();
+            video.CalibrateBracket(video, img, bracket_ev, 3, hdr_shutter);
             
             cout << "[HDR]: EV range calibrated" << endl;
             
             // capture HDR images
             video.CaptureHDRFrame(img, 3, hdr_shutter);
+
+            capture_thread.Start();
                    
         } 
 
@@ -384,12 +432,21 @@ int main( int argc, char* argv[] )
             
             save = false; // set save flag to false
 
-            if(hdr){          
-                cout << "[VIDEO]: Processing HDR video" << endl;
-                boost::thread(&FirewireVideo::SaveHDRVideo, &video, frame_number);    
+            if( video_out.IsOpen() ){
+                // finishes encoding
+                video_out.Reset();
+                cout << "[VIDEO]: Video saved" << endl;
             } else {
-                 cout << "[VIDEO]: Processing LDR video" << endl;
-                boost::thread(&FirewireVideo::SaveVideo, &video);
+                // finish writing queued frames before processing video
+                video.StopEncoderPool();
+
+                if(hdr){          
+                    cout << "[VIDEO]: Processing HDR video" << endl;
+                    boost::thread(&FirewireVideo::SaveHDRVideo, &video, video.GetHDRBrackets());    
+                } else {
+                    cout << "[VIDEO]: Processing LDR video" << endl;
+                    boost::thread(&FirewireVideo::SaveVideo, &video);
+                }
             }
          
         }
@@ -398,26 +455,74 @@ int main( int argc, char* argv[] )
             cout << "[VIDEO]: Recording video" << endl;
             save = true; 
             time (&start); // get current time
-            frame_number = 0; 
-            recorded_frames.operator=(frame_number);
+            record_number = 0; 
+            video.ResetHDRBrackets();
+            
+            if( !hdr ){
+                mkdir("./video", 0755);
+                char time_stamp[64];
+                video.GetTimeStamp(time_stamp);
+                try {
+                    video_out.Open(video.GetVideoOutputUri("video", time_stamp, false, video.GetFramerate()));
+                    video_out.SetStream(w, h, video.PixFormat(), video.GetFramerate());
+                } catch (VideoException& e) {
+                    cout << "[VIDEO]: " << e.what() << " - saving frames instead" << endl;
+                    video_out.Reset();
+                }
+            }
+            
+            // encode on all but one core, dropping frames rather than stalling capture
+            if( !video_out.IsOpen() ){
+                video.StartEncoderPool(std::max(1, (int)boost::thread::hardware_concurrency() - 1), 64, JPEG_QUEUE_DROP);
+            }
+            recorded_frames.operator=(record_number);
             recorded_time.operator=(0);
             //boost::pool tp(10);
         }
 
         // save mode
         if ( save ){
-            video.RecordFrames(frame_number, img, true, true, hdr); 
-            recorded_frames.operator=(frame_number);
+            // exif settings are read on the control thread, following auto exposure
+            control.RefreshExifSettings();
+
+            // save every frame captured since last iteration
+            new_frame = false;
+            while( capture_thread.GrabNext(img, false) ){
+                new_frame = true;
+                hdr_step = capture_thread.LastFrameInfo().tag;
+
+                // dropped frames leave no gap in file numbering and break
+                // the bracket through the embedded frame counter
+                if( video_out.IsOpen() ){
+                    // keep camera meta data and capture time alongside each frame
+                    PvnFrameInfo info;
+                    video.ReadFrameInfo(img, hdr_step, 0, info);
+                    const basetime& host_time = capture_thread.LastFrameInfo().host_time;
+                    info.host_time_us = (int64_t)host_time.tv_sec * 1000000 + host_time.tv_usec;
+                    video_out.WriteFrame(img, info);
+                    record_number++;
+                } else if( video.SaveImage(record_number, img, w, h, hdr ? "hdr-video" : "video", !(hdr && video.SampleBits() > 8)) ){
+                    if(hdr) video.AddHDRFrame(img, record_number);
+                    record_number++;
+                }
+            }
+            recorded_frames.operator=(record_number);
             time (&end);
             recorded_time.operator=(difftime(end, start));
         } 
         else{
-            video.GrabOneShot(img);
+            // display only needs the latest frame
+            new_frame = capture_thread.GrabNewest(img, false);
+            if( new_frame ){
+                hdr_step = capture_thread.LastFrameInfo().tag;
+            }
         }
        
 
     }
 
+    control.Stop();
+    capture_thread.Stop();
     delete[] img;
 
     return 0;
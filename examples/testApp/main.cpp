@@ -18,7 +18,7 @@ using namespace std;
 
 int main( int argc, char* argv[] )
 {
-    FirewireVideo video = FirewireVideo();
+    FirewireVideo video;
     video.SetHDRRegister(false);
     video.SetMetaDataFlags( META_ALL_AND_ABS );
     video.SetAllFeaturesAuto();
@@ -22,8 +22,10 @@
 /* #undef HAVE_V4L */
 /* #undef HAVE_FFMPEG */
 /* #undef HAVE_OPENNI */
+#define HAVE_ZLIB
 #define HAVE_GLUT
 #define HAVE_FREEGLUT
+/* #undef HAVE_OSMESA */
 /* #undef HAVE_APPLE_OPENGL_FRAMEWORK */
 
 /// Platform
@@ -28,12 +28,15 @@
 #include <iostream>
 #include <sstream>
 #include <map>
+#include <stdexcept>
+#include <cstdlib>
 
 #include <boost/function.hpp>
 #include <boost/foreach.hpp>
 #define foreach BOOST_FOREACH
 
 #include "platform.h"
+#include "gl.h"
 #include "display.h"
 #include "display_internal.h"
 #include "simple_math.h"
@@ -54,10 +57,36 @@ namespace pangolin
   __thread PangolinGl* context = 0;
 
   PangolinGl::PangolinGl()
-   : quit(false), mouse_state(0), activeDisplay(0)
+   : is_headless(false), has_text(true),
+#ifdef HAVE_OSMESA
+     osmesa(0),
+#endif
+     quit(false), mouse_state(0), activeDisplay(0)
   {
   }
 
+  PangolinGl::~PangolinGl()
+  {
+#ifdef HAVE_OSMESA
+    if(osmesa) OSMesaDestroyContext(osmesa);
+#endif
+  }
+
+  // Create context name and make it current
+  static void AddContext(std::string name)
+  {
+    ContextMap::iterator ic = contexts.insert( name,new PangolinGl ).first;
+    context = ic->second;
+    View& dc = context->base;
+    dc.left = 0.0;
+    dc.bottom = 0.0;
+    dc.top = 1.0;
+    dc.right = 1.0;
+    dc.aspect = 0;
+    dc.handler = &StaticHandler;
+    context->is_fullscreen = false;
+  }
+
   void BindToContext(std::string name)
   {
     ContextMap::iterator ic = contexts.find(name);
@@ -65,16 +94,7 @@ namespace pangolin
     if( ic == contexts.end() )
     {
       // Create and add if not found
-      ic = contexts.insert( name,new PangolinGl ).first;
-      context = ic->second;
-      View& dc = context->base;
-      dc.left = 0.0;
-      dc.bottom = 0.0;
-      dc.top = 1.0;
-      dc.right = 1.0;
-      dc.aspect = 0;
-      dc.handler = &StaticHandler;
-      context->is_fullscreen = false;
+      AddContext(name);
     #ifdef HAVE_GLUT
       process::Resize(
         glutGet(GLUT_WINDOW_WIDTH),
@@ -96,7 +116,7 @@ namespace pangolin
   bool ShouldQuit()
   {
 #ifdef HAVE_GLUT
-    return context->quit || !glutGetWindow();
+    return context->quit || (!context->is_headless && !glutGetWindow());
 #else
     return context->quit;
 #endif
@@ -403,6 +423,103 @@ namespace pangolin
   }
 #endif // HAVE_GLUT
 
+#ifdef HAVE_OSMESA
+#define PANGOLIN_OSMESA_LOAD(type,name) \
+    if( OSMESAproc p = OSMesaGetProcAddress("gl" #name) ) __glew##name = (type)p;
+
+  // GLEW resolves entry points through GLX unless built with GLEW_OSMESA,
+  // giving libGL's dispatch rather than OSMesa's functions, so take the
+  // buffer object and framebuffer entry points Pangolin uses from OSMesa.
+  static void LoadOSMesaEntryPoints()
+  {
+    PANGOLIN_OSMESA_LOAD(PFNGLGENBUFFERSPROC, GenBuffers)
+    PANGOLIN_OSMESA_LOAD(PFNGLDELETEBUFFERSPROC, DeleteBuffers)
+    PANGOLIN_OSMESA_LOAD(PFNGLBINDBUFFERPROC, BindBuffer)
+    PANGOLIN_OSMESA_LOAD(PFNGLBUFFERDATAPROC, BufferData)
+    PANGOLIN_OSMESA_LOAD(PFNGLMAPBUFFERPROC, MapBuffer)
+    PANGOLIN_OSMESA_LOAD(PFNGLUNMAPBUFFERPROC, UnmapBuffer)
+    PANGOLIN_OSMESA_LOAD(PFNGLDRAWBUFFERSPROC, DrawBuffers)
+    PANGOLIN_OSMESA_LOAD(PFNGLGENFRAMEBUFFERSEXTPROC, GenFramebuffersEXT)
+    PANGOLIN_OSMESA_LOAD(PFNGLDELETEFRAMEBUFFERSEXTPROC, DeleteFramebuffersEXT)
+    PANGOLIN_OSMESA_LOAD(PFNGLBINDFRAMEBUFFEREXTPROC, BindFramebufferEXT)
+    PANGOLIN_OSMESA_LOAD(PFNGLFRAMEBUFFERTEXTURE2DEXTPROC, FramebufferTexture2DEXT)
+    PANGOLIN_OSMESA_LOAD(PFNGLCHECKFRAMEBUFFERSTATUSEXTPROC, CheckFramebufferStatusEXT)
+    PANGOLIN_OSMESA_LOAD(PFNGLGENRENDERBUFFERSEXTPROC, GenRenderbuffersEXT)
+    PANGOLIN_OSMESA_LOAD(PFNGLDELETERENDERBUFFERSEXTPROC, DeleteRenderbuffersEXT)
+    PANGOLIN_OSMESA_LOAD(PFNGLBINDRENDERBUFFEREXTPROC, BindRenderbufferEXT)
+    PANGOLIN_OSMESA_LOAD(PFNGLRENDERBUFFERSTORAGEEXTPROC, RenderbufferStorageEXT)
+    PANGOLIN_OSMESA_LOAD(PFNGLFRAMEBUFFERRENDERBUFFEREXTPROC, FramebufferRenderbufferEXT)
+  }
+#undef PANGOLIN_OSMESA_LOAD
+
+  void CreateHeadlessContextAndBind(string name, int w, int h)
+  {
+    if( contexts.find(name) != contexts.end() )
+      throw std::runtime_error("Pangolin context already exists: " + name);
+
+    AddContext(name);
+    context->is_headless = true;
+    context->is_double_buffered = false;
+
+    context->osmesa = OSMesaCreateContextExt(OSMESA_RGBA, 24, 8, 0, NULL);
+    context->osmesa_buffer.resize((size_t)w*h*4);
+    if( !context->osmesa ||
+        !OSMesaMakeCurrent(context->osmesa, &context->osmesa_buffer[0], GL_UNSIGNED_BYTE, w, h) )
+    {
+      contexts.erase(name);
+      context = 0;
+      throw std::runtime_error("Unable to create OSMesa context");
+    }
+
+    // Extension flags for this context. A GLX build of GLEW also sets up
+    // GLX, which fails without a display after the context part succeeded.
+    const GLenum glew_err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    if( glew_err != GLEW_OK && glew_err != GLEW_ERROR_NO_GLX_DISPLAY )
+#else
+    if( glew_err != GLEW_OK )
+#endif
+    {
+      contexts.erase(name);
+      context = 0;
+      throw std::runtime_error("Unable to initialise GLEW for OSMesa context");
+    }
+    LoadOSMesaEntryPoints();
+
+#ifdef HAVE_FREEGLUT
+    // GLUT bitmap text needs GLUT initialised, which needs a display
+    if( glutGet(GLUT_INIT_STATE) == 0 && getenv("DISPLAY") )
+    {
+      int argc = 0;
+      glutInit(&argc, 0);
+    }
+    context->has_text = glutGet(GLUT_INIT_STATE) != 0;
+#else
+    context->has_text = false;
+#endif
+
+    process::Resize(w,h);
+  }
+
+  void FinishHeadlessFrame()
+  {
+    RenderViews();
+    DisplayBase().Activate();
+    Viewport::DisableScissor();
+    glFinish();
+  }
+#endif // HAVE_OSMESA
+
+  void ReadFramebuffer(void* image, GLenum data_layout, GLenum data_type)
+  {
+    const Viewport& v = context->base.v;
+    GLint alignment;
+    glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(v.l, v.b, v.w, v.h, data_layout, data_type, image);
+    glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+  }
+
   void Viewport::Activate() const
   {
     glViewport(l,b,w,h);
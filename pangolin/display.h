@@ -150,6 +150,23 @@ namespace pangolin
   void TakeGlutCallbacks();
 #endif
 
+#ifdef HAVE_OSMESA
+  //! @brief Create an offscreen w x h OSMesa context and bind Pangolin to it.
+  //! Needs no display or GPU. Views, Plotters and GlFramebuffers render as
+  //! they would in a window; read the result with ReadFramebuffer().
+  //! Text (plot labels, Panels) needs GLUT, which is initialised here when
+  //! a display is available.
+  void CreateHeadlessContextAndBind(std::string name, int w = 640, int h = 480);
+
+  //! @brief Renders views and waits for rendering to complete, ready for
+  //! ReadFramebuffer(). Resets viewport to entire context and disables scissoring.
+  void FinishHeadlessFrame();
+#endif
+
+  //! @brief Read the pixels of the whole base view into image, bottom row
+  //! first with no row padding.
+  void ReadFramebuffer(void* image, GLenum data_layout = GL_RGB, GLenum data_type = GL_UNSIGNED_BYTE);
+
   //! @brief Unit for measuring quantities
   enum Unit {
     Fraction,
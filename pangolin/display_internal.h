@@ -36,12 +36,18 @@
 #include <GLConsole/GLConsole.h>
 #endif // HAVE_CVARS
 
+#ifdef HAVE_OSMESA
+#include <GL/osmesa.h>
+#include <vector>
+#endif // HAVE_OSMESA
+
 namespace pangolin
 {
 
   struct PangolinGl
   {
     PangolinGl();
+    ~PangolinGl();
 
     // Base container for displays
     View base;
@@ -57,6 +63,16 @@ namespace pangolin
     bool is_fullscreen;
     GLint windowed_size[2];
 
+    // Offscreen context with no window or input. GLUT bitmap text is only
+    // drawn once GLUT has been initialised.
+    bool is_headless;
+    bool has_text;
+
+#ifdef HAVE_OSMESA
+    OSMesaContext osmesa;
+    std::vector<unsigned char> osmesa_buffer;
+#endif // HAVE_OSMESA
+
     // State relating to interactivity
     bool quit;
     int had_input;
@@ -38,6 +38,7 @@
 #include <GL/gl.h>
 
 #include <math.h>
+#include <string.h>
 
 namespace pangolin
 {
@@ -59,6 +60,23 @@ struct GlTexture
   //! data_type normally one of GL_UNSIGNED_BYTE, GL_FLOAT
   void Upload(void* image, GLenum data_layout = GL_LUMINANCE, GLenum data_type = GL_FLOAT);
 
+  //! Stream Upload() through a ring of pixel buffer objects. Upload then
+  //! returns once the image is copied into a mapped buffer, leaving the
+  //! transfer to the texture to the driver. Stays synchronous if pixel
+  //! buffer objects are unsupported.
+  void SetStreaming(unsigned buffers = 2);
+
+  //! Map the next streaming buffer for an image to be written straight
+  //! into, e.g. by a decoder, and uploaded with UnmapUpload(). Rows are
+  //! tightly packed whatever GL_UNPACK_ALIGNMENT is set to.
+  //! Returns 0 when not streaming or the map fails.
+  void* MapUpload(GLenum data_layout = GL_LUMINANCE, GLenum data_type = GL_FLOAT);
+  void UnmapUpload();
+
+  //! Read the texture back, e.g. after rendering to it through a
+  //! GlFramebuffer. Rows are packed with no padding.
+  void Download(void* image, GLenum data_layout = GL_LUMINANCE, GLenum data_type = GL_FLOAT) const;
+
   void SetLinear();
   void SetNearestNeighbour();
 
@@ -69,6 +87,13 @@ struct GlTexture
   GLuint tid;
   GLint width;
   GLint height;
+
+  static const unsigned MAX_STREAM_BUFFERS = 3;
+  GLuint pbo[MAX_STREAM_BUFFERS];
+  unsigned num_pbo;
+  unsigned next_pbo;
+  GLenum pbo_layout;
+  GLenum pbo_type;
 };
 
 struct GlRenderBuffer
@@ -93,6 +118,12 @@ struct GlFramebuffer
   unsigned attachments;
 };
 
+//! Components per pixel of data_layout, e.g. 3 for GL_RGB
+GLint GlChannels(GLenum data_layout);
+
+//! Bytes per component of data_type, e.g. 4 for GL_FLOAT
+GLint GlDataTypeBytes(GLenum data_type);
+
 void glColorHSV( double hue, double s, double v );
 
 void glColorBin( int bin, int max_bins, double sat = 1.0, double val = 1.0 );
@@ -124,7 +155,8 @@ const static GLuint attachment_buffers[] = {
 //template<> struct GlDataTypeTrait<unsigned char>{ static const GLenum type = GL_UNSIGNED_BYTE; };
 
 inline GlTexture::GlTexture(GLint width, GLint height, GLint internal_format)
-  : internal_format(internal_format),width(width),height(height)
+  : internal_format(internal_format),width(width),height(height),
+    num_pbo(0),next_pbo(0),pbo_layout(GL_LUMINANCE),pbo_type(GL_FLOAT)
 {
   glGenTextures(1,&tid);
   Bind();
@@ -141,6 +173,7 @@ inline GlTexture::GlTexture(GLint width, GLint height, GLint internal_format)
 
 inline GlTexture::~GlTexture()
 {
+  if(num_pbo) glDeleteBuffers(num_pbo,pbo);
   glDeleteTextures(1,&tid);
 }
 
@@ -156,10 +189,78 @@ inline void GlTexture::Unbind() const
 
 inline void GlTexture::Upload(void* image, GLenum data_layout, GLenum data_type )
 {
+  if(num_pbo) {
+    void* buffer = MapUpload(data_layout,data_type);
+    if(buffer) {
+      memcpy(buffer,image,(size_t)width*height*GlChannels(data_layout)*GlDataTypeBytes(data_type));
+      UnmapUpload();
+      return;
+    }
+  }
+
   Bind();
   glTexSubImage2D(GL_TEXTURE_2D,0,0,0,width,height,data_layout,data_type,image);
 }
 
+inline void GlTexture::Download(void* image, GLenum data_layout, GLenum data_type) const
+{
+  GLint alignment;
+  glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  Bind();
+  glGetTexImage(GL_TEXTURE_2D, 0, data_layout, data_type, image);
+  Unbind();
+  glPixelStorei(GL_PACK_ALIGNMENT, alignment);
+}
+
+inline void GlTexture::SetStreaming(unsigned buffers)
+{
+  if(num_pbo) {
+    glDeleteBuffers(num_pbo,pbo);
+    num_pbo = 0;
+  }
+  if(!buffers) return;
+
+  // Buffer object entry points are only loaded once GLEW is initialised
+  if(!glGenBuffers) glewInit();
+  if(!glGenBuffers || !(GLEW_VERSION_2_1 || GLEW_ARB_pixel_buffer_object)) return;
+
+  num_pbo = buffers < MAX_STREAM_BUFFERS ? buffers : MAX_STREAM_BUFFERS;
+  next_pbo = 0;
+  glGenBuffers(num_pbo,pbo);
+}
+
+inline void* GlTexture::MapUpload(GLenum data_layout, GLenum data_type)
+{
+  if(!num_pbo) return 0;
+
+  pbo_layout = data_layout;
+  pbo_type = data_type;
+  next_pbo = (next_pbo+1) % num_pbo;
+
+  // Orphan the previous storage so mapping doesn't wait on a transfer
+  // still reading from it
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[next_pbo]);
+  glBufferData(GL_PIXEL_UNPACK_BUFFER, (GLsizeiptr)width*height*GlChannels(data_layout)*GlDataTypeBytes(data_type), 0, GL_STREAM_DRAW);
+  void* buffer = glMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  return buffer;
+}
+
+inline void GlTexture::UnmapUpload()
+{
+  // Buffer rows are tightly packed, as sized by MapUpload
+  GLint alignment;
+  glGetIntegerv(GL_UNPACK_ALIGNMENT, &alignment);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[next_pbo]);
+  glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+  Bind();
+  glTexSubImage2D(GL_TEXTURE_2D,0,0,0,width,height,pbo_layout,pbo_type,0);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, alignment);
+}
+
 inline void GlTexture::SetLinear()
 {
   Bind();
@@ -276,6 +377,26 @@ inline void GlFramebuffer::Unbind() const
   glBindFramebufferEXT(GL_FRAMEBUFFER_EXT, 0);
 }
 
+inline GLint GlChannels(GLenum data_layout)
+{
+  switch(data_layout) {
+  case GL_LUMINANCE_ALPHA: return 2;
+  case GL_RGB: case GL_BGR: return 3;
+  case GL_RGBA: case GL_BGRA: return 4;
+  default: return 1;
+  }
+}
+
+inline GLint GlDataTypeBytes(GLenum data_type)
+{
+  switch(data_type) {
+  case GL_SHORT: case GL_UNSIGNED_SHORT: return 2;
+  case GL_INT: case GL_UNSIGNED_INT: case GL_FLOAT: return 4;
+  case GL_DOUBLE: return 8;
+  default: return 1;
+  }
+}
+
 // h [0,360)
 // s [0,1]
 // v [0,1]
@@ -404,6 +404,9 @@ void Plotter::Render()
     }
   }
 
+  // Headless contexts without GLUT can't draw bitmap text
+  if( !context->has_text ) return;
+
   float ty = v.h-15;
   for (size_t i=0; i<log->labels.size(); ++i)
   {
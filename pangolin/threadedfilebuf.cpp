@@ -26,75 +26,234 @@
  */
 
 #include "threadedfilebuf.h"
+#include "timer.h"
 
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace std;
 
 namespace pangolin
 {
 
-threadedfilebuf::threadedfilebuf( const std::string& filename, unsigned int buffer_size_bytes )
-    : mem_buffer(0), mem_size(0), mem_start(0), mem_end(0)
+// O_DIRECT transfers must be aligned in memory, size and file offset
+const size_t DIRECT_ALIGN = 4096;
+
+threadedfilebuf::threadedfilebuf( const std::string& filename, unsigned int buffer_size_bytes,
+                                  const ThreadedFileOptions& options )
+    : fd(-1), direct(false), options(options), file_offset(0), allocated(0), synced(0),
+      mem_buffer(0), mem_size(0), mem_start(0), mem_end(0), closing(false), error(0)
 {
-    file.open(filename.c_str(), ios::out | ios::binary );
+    const int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+#ifdef O_DIRECT
+    if( options.direct ) {
+        fd = open(filename.c_str(), flags | O_DIRECT, 0644);
+        direct = (fd >= 0);
+        if(!direct) {
+            cerr << "[VIDEO]: Direct I/O not supported for " << filename << ", using buffered writes" << endl;
+        }
+    }
+#endif
+
+    if( fd < 0 ) {
+        fd = open(filename.c_str(), flags, 0644);
+    }
+
+#ifdef F_NOCACHE
+    if( fd >= 0 && options.direct ) {
+        direct = (fcntl(fd, F_NOCACHE, 1) != -1);
+    }
+#endif
 
+    if( fd < 0 ) {
+        error = errno;
+    }
+
+    // ring must hold whole aligned blocks for direct writes
     mem_max_size = buffer_size_bytes;
-    mem_buffer = new char[mem_max_size];
+    if( direct ) {
+        mem_max_size = ((buffer_size_bytes + DIRECT_ALIGN - 1) / DIRECT_ALIGN) * DIRECT_ALIGN;
+        void* mem = 0;
+        if( posix_memalign(&mem, DIRECT_ALIGN, mem_max_size) != 0 )
+            throw std::bad_alloc();
+        mem_buffer = (char*)mem;
+    }else{
+        mem_buffer = (char*)malloc(mem_max_size);
+        if( !mem_buffer )
+            throw std::bad_alloc();
+    }
+
+    memset(&stats, 0, sizeof(stats));
+    stats.ring_size = mem_max_size;
 
     write_thread = boost::thread(boost::ref(*this));
 }
 
 threadedfilebuf::~threadedfilebuf()
 {
-    if( write_thread.joinable() )
     {
-      write_thread.interrupt();
-      write_thread.join();
+        boost::unique_lock<boost::mutex> lock(update_mutex);
+        closing = true;
     }
+    cond_queued.notify_one();
+
+    if( write_thread.joinable() ) {
+        write_thread.join();
+    }
+
+    Finish();
+    free(mem_buffer);
+}
 
-    if( mem_buffer) delete mem_buffer;
-    file.close();
+ThreadedFileStats threadedfilebuf::Stats() const
+{
+    boost::unique_lock<boost::mutex> lock(update_mutex);
+    return stats;
+}
+
+std::string threadedfilebuf::Error() const
+{
+    boost::unique_lock<boost::mutex> lock(update_mutex);
+    return error ? strerror(error) : "";
 }
 
 std::streamsize threadedfilebuf::xsputn(const char* data, std::streamsize num_bytes)
 {
-    if( num_bytes > mem_max_size )
-        throw exception();
+    std::streamsize remaining = num_bytes;
+    bool stalled = false;
+    basetime stall_start = TimeNow();
 
+    while( remaining > 0 )
     {
-        boost::unique_lock<boost::mutex> lock(update_mutex);
+        {
+            boost::unique_lock<boost::mutex> lock(update_mutex);
+
+            // wait until there is space to write into buffer. Frames larger
+            // than the ring are queued in parts.
+            while( mem_size == mem_max_size && !error ) {
+                if( !stalled ) {
+                    stalled = true;
+                    stall_start = TimeNow();
+                    ++stats.stalls;
+                }
+                cond_dequeued.wait(lock);
+            }
 
-        // wait until there is space to write into buffer
-        while( mem_size + num_bytes > mem_max_size ) {
-            cond_dequeued.wait(lock);
+            // short count sets badbit on the stream
+            if( error ) {
+                return num_bytes - remaining;
+            }
+
+            const int free_bytes = mem_max_size - mem_size;
+            const int n = remaining < free_bytes ? (int)remaining : free_bytes;
+
+            // add image to end of mem_buffer
+            const int array_a_size = mem_max_size - mem_end;
+
+            if( n <= array_a_size )
+            {
+                // copy in one
+                memcpy(mem_buffer + mem_end, data, n);
+                mem_end += n;
+            }else{
+                const int array_b_size = n - array_a_size;
+                memcpy(mem_buffer + mem_end, data, array_a_size);
+                memcpy(mem_buffer, data+array_a_size, array_b_size);
+                mem_end = array_b_size;
+            }
+
+            if(mem_end == mem_max_size)
+                mem_end = 0;
+
+            mem_size += n;
+            data += n;
+            remaining -= n;
+
+            stats.bytes_queued += n;
+            if( (size_t)mem_size > stats.peak_occupancy )
+                stats.peak_occupancy = mem_size;
+
+            if( stalled && remaining == 0 )
+                stats.stall_seconds += TimeDiff_s(stall_start, TimeNow());
         }
 
-        // add image to end of mem_buffer
-        const int array_a_size =
-            (mem_start <= mem_end) ? (mem_max_size - mem_end) : (mem_start - mem_end);
+        cond_queued.notify_one();
+    }
 
-        if( num_bytes <= array_a_size )
-        {
-            // copy in one
-            memcpy(mem_buffer + mem_end, data, num_bytes);
-            mem_end += num_bytes;
-            mem_size += num_bytes;
-        }else{
-            const int array_b_size = num_bytes - array_a_size;
-            memcpy(mem_buffer + mem_end, data, array_a_size);
-            memcpy(mem_buffer, data+array_a_size, array_b_size);
-            mem_end = array_b_size;
-            mem_size += num_bytes;
+    return num_bytes;
+}
+
+threadedfilebuf::int_type threadedfilebuf::overflow(int_type c)
+{
+    if( traits_type::eq_int_type(c, traits_type::eof()) )
+        return traits_type::not_eof(c);
+
+    const char ch = traits_type::to_char_type(c);
+    return xsputn(&ch, 1) == 1 ? c : traits_type::eof();
+}
+
+bool threadedfilebuf::WriteFile(const char* data, size_t bytes)
+{
+    if( options.preallocate_bytes && file_offset + bytes > allocated ) {
+#ifdef _LINUX_
+        // reserve next chunk without changing file size, so a crashed
+        // recording isn't padded with zeros
+        const uint64_t want = file_offset + bytes + options.preallocate_bytes;
+        if( fallocate(fd, FALLOC_FL_KEEP_SIZE, allocated, want - allocated) == 0 )
+            allocated = want;
+        else
+            options.preallocate_bytes = 0;
+#else
+        options.preallocate_bytes = 0;
+#endif
+    }
+
+    while( bytes > 0 ) {
+        const ssize_t n = pwrite(fd, data, bytes, file_offset);
+        if( n < 0 ) {
+            if( errno == EINTR ) continue;
+            return false;
+        }
+        if( n == 0 ) {
+            errno = ENOSPC;
+            return false;
         }
+        data += n;
+        bytes -= n;
+        file_offset += n;
+    }
 
-        if(mem_end == mem_max_size)
-            mem_end = 0;
+    if( options.sync_bytes && file_offset - synced >= options.sync_bytes ) {
+        SyncFile();
     }
 
-    cond_queued.notify_one();
+    return true;
+}
 
-    return num_bytes;
+void threadedfilebuf::SyncFile()
+{
+#ifdef _LINUX_
+    fdatasync(fd);
+#else
+    fsync(fd);
+#endif
+
+#ifdef POSIX_FADV_DONTNEED
+    // written pages won't be read again, don't let them evict anything else
+    if( !direct ) {
+        posix_fadvise(fd, synced, file_offset - synced, POSIX_FADV_DONTNEED);
+    }
+#endif
+
+    synced = file_offset;
+
+    boost::unique_lock<boost::mutex> lock(update_mutex);
+    ++stats.syncs;
 }
 
 void threadedfilebuf::operator()()
@@ -106,33 +265,77 @@ void threadedfilebuf::operator()()
         {
             boost::unique_lock<boost::mutex> lock(update_mutex);
 
-            while( mem_size == 0 )
+            // direct writes wait for a whole block, the tail is written on close
+            const int min_write = direct ? (int)DIRECT_ALIGN : 1;
+            while( mem_size < min_write && !closing && !error )
                 cond_queued.wait(lock);
 
+            if( error || mem_size < min_write )
+                break;
+
             data_to_write =
                     (mem_start < mem_end) ?
                         mem_end - mem_start :
                         mem_max_size - mem_start;
-        }
 
-        std::streamsize bytes_written =
-            file.sputn(mem_buffer + mem_start, data_to_write );
+            if( direct )
+                data_to_write -= data_to_write % DIRECT_ALIGN;
+        }
 
-        if( bytes_written != data_to_write)
-            throw std::exception();
+        const bool ok = fd >= 0 && WriteFile(mem_buffer + mem_start, data_to_write);
 
         {
             boost::unique_lock<boost::mutex> lock(update_mutex);
 
-            mem_size -= data_to_write;
-            mem_start += data_to_write;
+            if( ok ) {
+                mem_size -= data_to_write;
+                mem_start += data_to_write;
+                stats.bytes_written += data_to_write;
 
-            if(mem_start == mem_max_size)
-                mem_start = 0;
+                if(mem_start == mem_max_size)
+                    mem_start = 0;
+            }else{
+                error = (fd >= 0) ? errno : error;
+                cerr << "[VIDEO]: Error writing file: " << strerror(error) << endl;
+            }
         }
 
         cond_dequeued.notify_all();
     }
 }
 
+void threadedfilebuf::Finish()
+{
+    if( fd < 0 )
+        return;
+
+    if( !error && mem_size > 0 ) {
+        // direct tail is less than a block and contiguous as ring is
+        // block aligned. Write whole block, then trim file to length.
+        const uint64_t length = file_offset + mem_size;
+        const int padded = direct ? (int)DIRECT_ALIGN : mem_size;
+        if( WriteFile(mem_buffer + mem_start, padded) ) {
+            stats.bytes_written += mem_size;
+            mem_size = 0;
+            if( ftruncate(fd, length) == 0 )
+                file_offset = length;
+        }else{
+            error = errno;
+            cerr << "[VIDEO]: Error writing file: " << strerror(error) << endl;
+        }
+    }
+
+    // drop preallocation beyond data
+    if( allocated > file_offset && ftruncate(fd, file_offset) != 0 ) {
+        cerr << "[VIDEO]: Unable to trim file: " << strerror(errno) << endl;
+    }
+
+    if( options.sync_bytes ) {
+        SyncFile();
+    }
+
+    close(fd);
+    fd = -1;
+}
+
 }
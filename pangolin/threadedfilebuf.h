@@ -31,6 +31,7 @@
 #include <iostream>
 #include <streambuf>
 #include <fstream>
+#include <stdint.h>
 
 #include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
@@ -39,26 +40,78 @@
 namespace pangolin
 {
 
+struct ThreadedFileOptions
+{
+    ThreadedFileOptions()
+        : direct(false), preallocate_bytes(0), sync_bytes(0)
+    {}
+
+    //! Bypass page cache (O_DIRECT). Writes are whole pages from an aligned
+    //! ring, falls back to buffered writes if the filesystem refuses.
+    bool direct;
+
+    //! Reserve file space in chunks of this size ahead of writing (0 = off)
+    uint64_t preallocate_bytes;
+
+    //! fdatasync after this many bytes (0 = never). For buffered writes the
+    //! synced range is also dropped from the page cache.
+    uint64_t sync_bytes;
+};
+
+struct ThreadedFileStats
+{
+    uint64_t bytes_queued;
+    uint64_t bytes_written;
+    uint64_t stalls;            // writes which waited for space in ring
+    double stall_seconds;       // total time writers waited
+    size_t peak_occupancy;      // most bytes held in ring
+    size_t ring_size;
+    uint64_t syncs;
+};
+
 class threadedfilebuf : public std::streambuf
 {
 public:
-    threadedfilebuf(const std::string& filename, unsigned int buffer_size_bytes);
+    threadedfilebuf(const std::string& filename, unsigned int buffer_size_bytes,
+                    const ThreadedFileOptions& options = ThreadedFileOptions());
     ~threadedfilebuf();
 
     void operator()();
 
+    ThreadedFileStats Stats() const;
+
+    //! Description of write error, empty if none
+    std::string Error() const;
+
+    bool Direct() const { return direct; }
+
 protected:
     //! Override streambuf::xsputn for asynchronous write
     std::streamsize xsputn(const char * s, std::streamsize n);
+    int_type overflow(int_type c);
+
+    bool WriteFile(const char* data, size_t bytes);
+    void SyncFile();
+    void Finish();
+
+    int fd;
+    bool direct;
+    ThreadedFileOptions options;
+    uint64_t file_offset;
+    uint64_t allocated;
+    uint64_t synced;
 
-    std::filebuf file;
     char* mem_buffer;
     int mem_size;
     int mem_max_size;
     int mem_start;
     int mem_end;
+    bool closing;
+    int error;
+
+    ThreadedFileStats stats;
 
-    boost::mutex update_mutex;
+    mutable boost::mutex update_mutex;
     boost::condition_variable cond_queued;
     boost::condition_variable cond_dequeued;
     boost::thread write_thread;
@@ -32,6 +32,7 @@
 
 #ifdef _UNIX_
 #include <sys/time.h>
+#include <unistd.h>
 #endif
 
 #ifdef _WIN_
@@ -115,8 +116,15 @@ inline basetime TimeAdd(basetime t1, basetime t2)
 
 inline basetime WaitUntil(basetime t)
 {
-    // TODO: use smarter sleep!
     basetime currtime = TimeNow();
+#ifdef _UNIX_
+    // sleep for all but the last millisecond, then spin
+    const double sleep_s = TimeDiff_s(currtime,t) - 1E-3;
+    if( sleep_s > 0 ) {
+        usleep((useconds_t)(sleep_s * 1E6));
+        currtime = TimeNow();
+    }
+#endif
     while( TimeDiff_s(currtime,t) > 0 )
         currtime = TimeNow();
     return currtime;
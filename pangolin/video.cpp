@@ -48,6 +48,10 @@
 #endif
 
 #include "video/pvn_video.h"
+#include "video/sim.h"
+#include "video/demosaic.h"
+#include "video/yuv_convert.h"
+#include "video_capture_thread.h"
 
 #include <boost/algorithm/string.hpp>
 #include <boost/algorithm/string/trim.hpp>
@@ -65,10 +69,28 @@ namespace pangolin
 const VideoPixelFormat SupportedVideoPixelFormats[] =
 {
     {"GRAY8", 1, {8}, 8, false},
+    {"GRAY12P", 1, {12}, 12, false},
     {"GRAY16LE", 1, {16}, 16, false},
+    {"GRAY16BE", 1, {16}, 16, false},
     {"RGB24", 3, {8,8,8}, 24, false},
     {"BGR24", 3, {8,8,8}, 24, false},
     {"YUYV422", 3, {4,2,2}, 16, false},
+    {"UYVY422", 3, {4,2,2}, 16, false},
+    {"UYYVYY411", 3, {4,1,1}, 12, false},
+    {"RGB48LE", 3, {16,16,16}, 48, false},
+    {"RGB48BE", 3, {16,16,16}, 48, false},
+    {"BAYER_RGGB8", 1, {8}, 8, false},
+    {"BAYER_GRBG8", 1, {8}, 8, false},
+    {"BAYER_GBRG8", 1, {8}, 8, false},
+    {"BAYER_BGGR8", 1, {8}, 8, false},
+    {"BAYER_RGGB16LE", 1, {16}, 16, false},
+    {"BAYER_GRBG16LE", 1, {16}, 16, false},
+    {"BAYER_GBRG16LE", 1, {16}, 16, false},
+    {"BAYER_BGGR16LE", 1, {16}, 16, false},
+    {"BAYER_RGGB16BE", 1, {16}, 16, false},
+    {"BAYER_GRBG16BE", 1, {16}, 16, false},
+    {"BAYER_GBRG16BE", 1, {16}, 16, false},
+    {"BAYER_BGGR16BE", 1, {16}, 16, false},
     {"",0,{0,0,0,0},0,0}
 };
 
@@ -244,7 +266,112 @@ VideoInterface* OpenVideo(std::string str_uri)
             std::istringstream iss(uri.params["realtime"]);
             iss >> realtime;
         }
-        video = new PvnVideo(uri.url.c_str(), realtime);
+        std::string stream;
+        if(uri.params.find("stream")!=uri.params.end()){
+            stream = uri.params["stream"];
+        }
+        PvnVideo* pvn = new PvnVideo(uri.url.c_str(), realtime, stream);
+        if(uri.params.find("prefetch")!=uri.params.end()){
+            int prefetch = 0;
+            std::istringstream iss(uri.params["prefetch"]);
+            iss >> prefetch;
+            pvn->SetPrefetch(prefetch);
+        }
+        if(uri.params.find("speed")!=uri.params.end()){
+            double speed = 1.0;
+            std::istringstream iss(uri.params["speed"]);
+            iss >> speed;
+            pvn->SetPlaybackSpeed(speed);
+        }
+        video = pvn;
+    }else if(!uri.scheme.compare("thread")) {
+        unsigned int buffers = 8;
+        if(uri.params.find("buffers")!=uri.params.end()){
+            std::istringstream iss(uri.params["buffers"]);
+            iss >> buffers;
+        }
+        VideoInterface* subvid = OpenVideo(uri.url);
+        video = new VideoCaptureThread(subvid, buffers, true);
+    }else if(!uri.scheme.compare("sim")) {
+        int width = 640;
+        int height = 480;
+        float fps = 30;
+        int latency = 2;
+        float noise = 0;
+        if(uri.params.find("size")!=uri.params.end()){
+            std::istringstream iss(uri.params["size"]);
+            iss >> width;
+            iss.get();
+            iss >> height;
+        }
+        if(uri.params.find("fps")!=uri.params.end()){
+            std::istringstream iss(uri.params["fps"]);
+            iss >> fps;
+        }
+        if(uri.params.find("latency")!=uri.params.end()){
+            std::istringstream iss(uri.params["latency"]);
+            iss >> latency;
+        }
+        if(uri.params.find("noise")!=uri.params.end()){
+            std::istringstream iss(uri.params["noise"]);
+            iss >> noise;
+        }
+        video = new SimVideo(width, height, fps, latency, uri.url, noise);
+    }else if(!uri.scheme.compare("demosaic")) {
+        string outfmt = "RGB24";
+        DemosaicMethod method = DEMOSAIC_MHC;
+        string pattern;
+        if(uri.params.find("fmt")!=uri.params.end()){
+            outfmt = uri.params["fmt"];
+        }
+        if(uri.params.find("method")!=uri.params.end()){
+            method = DemosaicMethodFromString(uri.params["method"]);
+        }
+        if(uri.params.find("pattern")!=uri.params.end()){
+            pattern = uri.params["pattern"];
+        }
+        VideoInterface* subvid = OpenVideo(uri.url);
+        video = new DemosaicVideo(subvid, outfmt, method, pattern);
+    }else if( !uri.scheme.compare("convert") ) {
+        string outfmt = "RGB24";
+        string method = "point";
+        unsigned width = 0;
+        unsigned height = 0;
+        unsigned threads = 0;
+        if(uri.params.find("fmt")!=uri.params.end()){
+            outfmt = uri.params["fmt"];
+        }
+        if(uri.params.find("size")!=uri.params.end()){
+            std::istringstream iss(uri.params["size"]);
+            iss >> width;
+            iss.get();
+            iss >> height;
+        }
+        if(uri.params.find("method")!=uri.params.end()){
+            method = uri.params["method"];
+        }
+        if(uri.params.find("threads")!=uri.params.end()){
+            std::istringstream iss(uri.params["threads"]);
+            iss >> threads;
+        }
+        VideoInterface* subvid = OpenVideo(uri.url);
+        const bool resize = (width && width != subvid->Width()) || (height && height != subvid->Height());
+        if( !resize && IsYuvFormat(subvid->PixFormat()) && IsYuvOutputFormat(outfmt) ) {
+            video = new YuvVideo(subvid, outfmt, threads);
+        }else{
+#ifdef HAVE_FFMPEG
+            try {
+                video = new FfmpegConverter(subvid, outfmt, FfmpegMethodFromString(method), width, height, threads);
+            }catch(const VideoException&) {
+                delete subvid;
+                throw;
+            }
+#else
+            const string infmt = subvid->PixFormat();
+            delete subvid;
+            throw VideoException("Conversion from " + infmt + " to " + outfmt + " requires FFMPEG");
+#endif
+        }
     }else
 #ifdef HAVE_FFMPEG
     if(!uri.scheme.compare("ffmpeg") || !uri.scheme.compare("file") || !uri.scheme.compare("files") ){
@@ -253,20 +380,23 @@ VideoInterface* OpenVideo(std::string str_uri)
             outfmt = uri.params["fmt"];
         }
         int video_stream = -1;
+        int decode_ahead = 4;
+        int codec_threads = 0;
         if(uri.params.find("stream")!=uri.params.end()){
             std::istringstream iss(uri.params["stream"]);
             iss >> video_stream;
         }
-        video = new FfmpegVideo(uri.url.c_str(), outfmt, "", false, video_stream);
+        if(uri.params.find("ahead")!=uri.params.end()){
+            std::istringstream iss(uri.params["ahead"]);
+            iss >> decode_ahead;
+        }
+        if(uri.params.find("threads")!=uri.params.end()){
+            std::istringstream iss(uri.params["threads"]);
+            iss >> codec_threads;
+        }
+        video = new FfmpegVideo(uri.url.c_str(), outfmt, "", false, video_stream, decode_ahead, codec_threads);
     }else if( !uri.scheme.compare("mjpeg")) {
         video = new FfmpegVideo(uri.url.c_str(),"RGB24", "MJPEG" );
-    }else if( !uri.scheme.compare("convert") ) {
-        string outfmt = "RGB24";
-        if(uri.params.find("fmt")!=uri.params.end()){
-            outfmt = uri.params["fmt"];
-        }
-        VideoInterface* subvid = OpenVideo(uri.url);
-        video = new FfmpegConverter(subvid,outfmt,FFMPEG_POINT);
     }else
 #endif //HAVE_FFMPEG
 #ifdef HAVE_V4L
@@ -36,11 +36,16 @@
 // Video URI's take the following form:
 //  scheme:[param1=value1,param2=value2,...]//device
 //
-// scheme = file | dc1394 | v4l | convert | mjpeg
+// scheme = file | dc1394 | v4l | convert | demosaic | mjpeg | thread | sim
 //
 // file/files - read PVN file format (pangolin video) or other formats using ffmpeg
 //  e.g. "file:[realtime=1]///home/user/video/movie.pvn"
+//  e.g. "file:[stream=over]///home/user/video/brackets.pvn" (PVN stream by name or number)
+//  e.g. "file:[prefetch=16]///home/user/video/movie.pvn" (PVN frames to read ahead)
+//  e.g. "file:[realtime=1,speed=0.5]///home/user/video/movie.pvn" (PVN playback speed)
 //  e.g. "file:[stream=1]///home/user/video/movie.avi"
+//  e.g. "file:[ahead=8,threads=4]///home/user/video/movie.mp4" (frames decoded
+//       ahead on a separate thread, 0 = decode in GrabNext; decoder threads)
 //  e.g. "files:///home/user/seqiemce/foo%03d.jpeg"
 //
 // dc1394 - capture video through a firewire camera
@@ -50,11 +55,32 @@
 // v4l - capture video from a Video4Linux (USB) camera (normally YUVY422 format)
 //  e.g. "v4l:///dev/video0"
 //
-// convert - use FFMPEG to convert between video pixel formats
+// convert - convert between video pixel formats. Packed YUV (YUYV422, UYVY422,
+//           UYYVYY411) to RGB24, BGR24 or GRAY8 is done natively across
+//           threads=N rows bands (default one per core), else using FFMPEG.
+//           size=WxH rescales with method=point (default, also threaded),
+//           fast_bilinear, bilinear, bicubic, area, lanczos, ...
 //  e.g. "convert:[fmt=RGB24]//v4l:///dev/video0"
+//  e.g. "convert:[fmt=GRAY8,threads=2]//dc1394:[fmt=YUV422P]//0"
+//  e.g. "convert:[fmt=RGB24,size=320x240,method=area]//v4l:///dev/video0"
+//
+// demosaic - interpolate a bayer video (BAYER_RGGB8, BAYER_BGGR16BE, ...) to
+//            RGB24 or RGB48LE with method=bilinear or mhc (default).
+//            pattern=RGGB|GRBG|GBRG|BGGR treats a GRAY8/GRAY16LE source as bayer.
+//  e.g. "demosaic://dc1394:[fmt=FORMAT7_0]//0" (camera set to RAW8 / RAW16)
+//  e.g. "demosaic:[method=bilinear,pattern=BGGR]//dc1394:[fmt=GRAY8]//0"
 //
 // mjpeg - capture from (possibly networked) motion jpeg stream using FFMPEG
 //  e.g. "mjpeg://http://127.0.0.1/?action=stream"
+//
+// thread - grab from another video URI on a dedicated capture thread
+//  e.g. "thread:[buffers=8]//dc1394:[fps=60]//0"
+//
+// sim - simulated IIDC camera rendering a radiance map (PFM) through a
+//       response curve. Empty path gives a synthetic test pattern, fps=0
+//       runs as fast as possible.
+//  e.g. "sim:[size=640x480,fps=30,latency=2,noise=2]//"
+//  e.g. "sim:[fps=15]///home/user/scene%03d.pfm"
 
 namespace pangolin
 {
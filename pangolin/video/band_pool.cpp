@@ -0,0 +1,97 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "band_pool.h"
+
+#include <algorithm>
+
+namespace pangolin
+{
+
+BandPool::BandPool(unsigned threads)
+    : threads(threads ? threads : std::max(1u, boost::thread::hardware_concurrency())),
+      running(true), fn(0), bands(0), next_band(0), bands_done(0)
+{
+    for(unsigned i=1; i < this->threads; ++i) {
+        workers.create_thread(boost::ref(*this));
+    }
+}
+
+BandPool::~BandPool()
+{
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        running = false;
+    }
+    job.notify_all();
+    workers.join_all();
+}
+
+void BandPool::Run(unsigned bands, const BandFunction& fn)
+{
+    if( threads == 1 || bands == 1 ) {
+        for(unsigned b=0; b < bands; ++b) fn(b);
+        return;
+    }
+
+    boost::unique_lock<boost::mutex> lock(mutex);
+    this->fn = &fn;
+    this->bands = bands;
+    next_band = 0;
+    bands_done = 0;
+    job.notify_all();
+
+    while( RunBand(lock) ) {}
+    while( bands_done < bands ) done.wait(lock);
+    this->fn = 0;
+}
+
+bool BandPool::RunBand(boost::unique_lock<boost::mutex>& lock)
+{
+    if( next_band >= bands ) return false;
+
+    const unsigned band = next_band++;
+    const BandFunction& f = *fn;
+
+    lock.unlock();
+    f(band);
+    lock.lock();
+
+    if( ++bands_done == bands ) done.notify_all();
+    return true;
+}
+
+void BandPool::operator()()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while( running ) {
+        if( !RunBand(lock) ) job.wait(lock);
+    }
+}
+
+}
@@ -0,0 +1,81 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PANGOLIN_BAND_POOL_H
+#define PANGOLIN_BAND_POOL_H
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+namespace pangolin
+{
+
+//! Runs a job split into bands (of image rows, say) on a persistent pool
+//! of threads. The calling thread works on bands too, so threads = 1
+//! starts no workers. Bands are handed out in order, so giving a few per
+//! thread evens out cores that are busy elsewhere.
+class BandPool
+{
+public:
+    typedef boost::function<void (unsigned band)> BandFunction;
+
+    //! threads = 0 uses one per core
+    BandPool(unsigned threads = 0);
+    ~BandPool();
+
+    unsigned Threads() const { return threads; }
+
+    //! Call fn for each band in [0,bands), returning once all are done.
+    //! Run may be called from one thread at a time.
+    void Run(unsigned bands, const BandFunction& fn);
+
+    //! Worker body
+    void operator()();
+
+protected:
+    BandPool(const BandPool&);
+    BandPool& operator=(const BandPool&);
+
+    //! Run the next band if any is left. lock is held on entry and exit.
+    bool RunBand(boost::unique_lock<boost::mutex>& lock);
+
+    unsigned threads;
+    bool running;
+
+    const BandFunction* fn;
+    unsigned bands, next_band, bands_done;
+
+    boost::mutex mutex;
+    boost::condition_variable job;
+    boost::condition_variable done;
+    boost::thread_group workers;
+};
+
+}
+
+#endif // PANGOLIN_BAND_POOL_H
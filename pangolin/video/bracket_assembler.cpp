@@ -0,0 +1,161 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "bracket_assembler.h"
+
+namespace pangolin
+{
+
+// shutter is the low 12 bits of both the bank register and the metadata
+const uint32_t SHUTTER_MASK = 0xfff;
+
+BracketAssembler::BracketAssembler()
+    : period(1), pos(0), last_frame_counter(0),
+      completed(0), resyncs(0), skipped(0)
+{
+    for(unsigned int i=0; i < MAX_BRACKET_SIZE; ++i) {
+        banks[i] = prev_banks[i] = 0;
+    }
+    partial.size = 0;
+}
+
+void BracketAssembler::SetBanks(uint32_t shut0, uint32_t shut1, uint32_t shut2, uint32_t shut3)
+{
+    for(unsigned int i=0; i < MAX_BRACKET_SIZE; ++i) {
+        prev_banks[i] = banks[i];
+    }
+    banks[0] = shut0 & SHUTTER_MASK;
+    banks[1] = shut1 & SHUTTER_MASK;
+    banks[2] = shut2 & SHUTTER_MASK;
+    banks[3] = shut3 & SHUTTER_MASK;
+
+    UpdatePeriod();
+}
+
+void BracketAssembler::SetBank(unsigned int bank, uint32_t shutter)
+{
+    if(bank >= MAX_BRACKET_SIZE) return;
+
+    prev_banks[bank] = banks[bank];
+    banks[bank] = shutter & SHUTTER_MASK;
+
+    UpdatePeriod();
+}
+
+void BracketAssembler::UpdatePeriod()
+{
+    // smallest repeating cycle, e.g. (under,over,under,over) gives pairs
+    if(banks[0] == banks[1] && banks[0] == banks[2] && banks[0] == banks[3]) {
+        period = 1;
+    }else if(banks[0] == banks[2] && banks[1] == banks[3]) {
+        period = 2;
+    }else{
+        period = 4;
+    }
+
+    if(pos >= period) {
+        ++resyncs;
+        pos = 0;
+    }
+}
+
+void BracketAssembler::Reset()
+{
+    pos = 0;
+    completed = 0;
+    resyncs = 0;
+    skipped = 0;
+}
+
+bool BracketAssembler::Matches(unsigned int bank, uint32_t shutter) const
+{
+    return shutter == banks[bank] || shutter == prev_banks[bank];
+}
+
+int BracketAssembler::Exposure(uint32_t shutter) const
+{
+    shutter &= SHUTTER_MASK;
+    for(unsigned int i=0; i < period; ++i) {
+        if(Matches(i, shutter)) return i;
+    }
+    return -1;
+}
+
+bool BracketAssembler::Start(uint32_t shutter, uint32_t frame_counter, int index, HDRBracket& bracket)
+{
+    if(!Matches(0, shutter)) {
+        ++skipped;
+        return false;
+    }
+
+    partial.index[0] = index;
+    partial.shutter[0] = shutter;
+    last_frame_counter = frame_counter;
+    pos = 1;
+
+    if(pos == period) {
+        partial.size = period;
+        bracket = partial;
+        pos = 0;
+        ++completed;
+        return true;
+    }
+    return false;
+}
+
+bool BracketAssembler::Push(uint32_t shutter, uint32_t frame_counter, int index, HDRBracket& bracket)
+{
+    shutter &= SHUTTER_MASK;
+
+    if(pos == 0) {
+        return Start(shutter, frame_counter, index, bracket);
+    }
+
+    if(frame_counter != last_frame_counter + 1 || !Matches(pos, shutter)) {
+        // frame dropped or bank out of sequence - partial set is unusable
+        skipped += pos;
+        ++resyncs;
+        pos = 0;
+        return Start(shutter, frame_counter, index, bracket);
+    }
+
+    partial.index[pos] = index;
+    partial.shutter[pos] = shutter;
+    last_frame_counter = frame_counter;
+
+    if(++pos == period) {
+        partial.size = period;
+        bracket = partial;
+        pos = 0;
+        ++completed;
+        return true;
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,103 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PANGOLIN_BRACKET_ASSEMBLER_H
+#define PANGOLIN_BRACKET_ASSEMBLER_H
+
+#include <stdint.h>
+
+namespace pangolin
+{
+
+//! Maximum number of exposures in a bracket (number of camera HDR banks)
+const unsigned int MAX_BRACKET_SIZE = 4;
+
+//! A complete set of exposures, in HDR bank order
+struct HDRBracket
+{
+    unsigned int size;
+    int index[MAX_BRACKET_SIZE];        // caller supplied frame index
+    uint32_t shutter[MAX_BRACKET_SIZE]; // quantised shutter read from frame
+};
+
+//! Groups a stream of frames into complete HDR brackets by matching the
+//! shutter embedded in each frame against the programmed HDR banks.
+//! Dropped or out of sequence frames discard the partial bracket and the
+//! assembler resyncs on the next frame from the first bank. All operations
+//! are O(1) per frame.
+class BracketAssembler
+{
+public:
+    BracketAssembler();
+
+    //! Program the bank cycle. The previous programming remains valid for
+    //! frames still in flight which were exposed with the old settings.
+    void SetBanks(uint32_t shut0, uint32_t shut1, uint32_t shut2, uint32_t shut3);
+
+    //! Reprogram a single bank, e.g. as a rolling exposure schedule advances
+    void SetBank(unsigned int bank, uint32_t shutter);
+
+    //! Discard any partial bracket and reset counters
+    void Reset();
+
+    //! Add the next frame. frame_counter is the camera frame counter and is
+    //! used to detect dropped frames. Returns true when bracket holds a
+    //! newly completed set.
+    bool Push(uint32_t shutter, uint32_t frame_counter, int index, HDRBracket& bracket);
+
+    //! Position of shutter within the bracket, or -1 if it matches no bank
+    int Exposure(uint32_t shutter) const;
+
+    //! Number of exposures per bracket
+    unsigned int Size() const { return period; }
+
+    unsigned long BracketsCompleted() const { return completed; }
+    unsigned long Resyncs() const { return resyncs; }
+    unsigned long FramesSkipped() const { return skipped; }
+
+protected:
+    bool Matches(unsigned int bank, uint32_t shutter) const;
+    bool Start(uint32_t shutter, uint32_t frame_counter, int index, HDRBracket& bracket);
+    void UpdatePeriod();
+
+    uint32_t banks[MAX_BRACKET_SIZE];
+    uint32_t prev_banks[MAX_BRACKET_SIZE];
+    unsigned int period;
+
+    HDRBracket partial;
+    unsigned int pos;
+    uint32_t last_frame_counter;
+
+    unsigned long completed;
+    unsigned long resyncs;
+    unsigned long skipped;
+};
+
+}
+
+#endif // PANGOLIN_BRACKET_ASSEMBLER_H
@@ -0,0 +1,487 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "demosaic.h"
+
+#include <stdint.h>
+
+#include <boost/algorithm/string/case_conv.hpp>
+
+using namespace std;
+
+namespace pangolin
+{
+
+namespace
+{
+
+const char* PatternNames[] = { "RGGB", "GRBG", "GBRG", "BGGR" };
+
+// Rows are widened to int and split into even and odd columns, so that all
+// neighbours of a site are found at unit stride and the kernels below
+// vectorise. Each half has a border of one element either side.
+struct HalfRows
+{
+    // even[k] is column 2k, odd[k] is column 2k+1, for k in [-1,n]
+    int32_t* even;
+    int32_t* odd;
+};
+
+inline int32_t Swap16(uint16_t v)
+{
+    return (int32_t)(uint16_t)((v << 8) | (v >> 8));
+}
+
+// Widen and split row, mirroring about the edge pixels (101 reflection) so
+// that borders keep the bayer phase of the interior.
+template<typename T>
+void WidenRow(const T* src, int w, bool swap, HalfRows& dst)
+{
+    const int n_odd = w / 2;
+    const int n_even = w - n_odd;
+
+    if( swap ) {
+        for(int k=0; k < n_odd; ++k) {
+            dst.even[k] = Swap16(src[2*k]);
+            dst.odd[k] = Swap16(src[2*k+1]);
+        }
+        if( n_even > n_odd ) dst.even[n_odd] = Swap16(src[w-1]);
+    }else{
+        for(int k=0; k < n_odd; ++k) {
+            dst.even[k] = src[2*k];
+            dst.odd[k] = src[2*k+1];
+        }
+        if( n_even > n_odd ) dst.even[n_odd] = src[w-1];
+    }
+
+    // columns -1, -2 mirror 1, 2
+    dst.odd[-1] = dst.odd[0];
+    dst.even[-1] = dst.even[1];
+
+    // columns w, w+1 mirror w-2, w-3
+    if( w & 1 ) {
+        dst.odd[n_odd] = dst.odd[n_odd-1];
+        dst.even[n_even] = dst.even[n_even-2];
+    }else{
+        dst.even[n_even] = dst.even[n_even-1];
+        dst.odd[n_odd] = dst.odd[n_odd-2];
+    }
+}
+
+// Sites of one column parity in a five row window. c[j] are the halves of
+// that parity for rows y-2..y+2, d[j] the other parity offset so that the
+// left neighbour of site k is d[j][k] and the right d[j][k+1].
+struct Sites
+{
+    const int32_t* c[5];
+    const int32_t* d[5];
+    int n;
+};
+
+template<typename O>
+inline O Output(int32_t v16, int32_t maxval, int shift)
+{
+    int32_t v = (v16 + 8) >> 4;
+    v = v < 0 ? 0 : v;
+    v = v > maxval ? maxval : v;
+    return (O)(v >> shift);
+}
+
+// Each loop below writes a single plane, keeping the number of run time
+// alias checks within what the vectoriser will emit. Counts are read into
+// locals as byte stores could otherwise alias them.
+
+template<typename O>
+void CopySites(const Sites& s, int32_t maxval, int shift, O* out)
+{
+    const int32_t* c = s.c[2];
+    const int count = s.n;
+    for(int k=0; k < count; ++k) out[k] = Output<O>(16 * c[k], maxval, shift);
+}
+
+// Colour to the left and right of a green site
+template<DemosaicMethod M, typename O>
+void GreenSitesHorizontal(const Sites& s, int32_t maxval, int shift, O* out)
+{
+    const int32_t *n2 = s.c[0], *c = s.c[2], *s2 = s.c[4];
+    const int32_t *dn = s.d[1], *dc = s.d[2], *ds = s.d[3];
+    const int count = s.n;
+    for(int k=0; k < count; ++k) {
+        int32_t v;
+        if( M == DEMOSAIC_BILINEAR ) {
+            v = 8 * (dc[k] + dc[k+1]);
+        }else{
+            v = 10 * c[k] + 8 * (dc[k] + dc[k+1])
+                - 2 * (c[k-1] + c[k+1] + dn[k] + dn[k+1] + ds[k] + ds[k+1])
+                + n2[k] + s2[k];
+        }
+        out[k] = Output<O>(v, maxval, shift);
+    }
+}
+
+// Colour above and below a green site
+template<DemosaicMethod M, typename O>
+void GreenSitesVertical(const Sites& s, int32_t maxval, int shift, O* out)
+{
+    const int32_t *n2 = s.c[0], *n = s.c[1], *c = s.c[2], *sc = s.c[3], *s2 = s.c[4];
+    const int32_t *dn = s.d[1], *ds = s.d[3];
+    const int count = s.n;
+    for(int k=0; k < count; ++k) {
+        int32_t v;
+        if( M == DEMOSAIC_BILINEAR ) {
+            v = 8 * (n[k] + sc[k]);
+        }else{
+            v = 10 * c[k] + 8 * (n[k] + sc[k])
+                - 2 * (n2[k] + s2[k] + dn[k] + dn[k+1] + ds[k] + ds[k+1])
+                + c[k-1] + c[k+1];
+        }
+        out[k] = Output<O>(v, maxval, shift);
+    }
+}
+
+// Green at a red or blue site
+template<DemosaicMethod M, typename O>
+void ColourSitesGreen(const Sites& s, int32_t maxval, int shift, O* out)
+{
+    const int32_t *n2 = s.c[0], *n = s.c[1], *c = s.c[2], *sc = s.c[3], *s2 = s.c[4];
+    const int32_t *dc = s.d[2];
+    const int count = s.n;
+    for(int k=0; k < count; ++k) {
+        const int32_t cross = n[k] + sc[k] + dc[k] + dc[k+1];
+        int32_t v;
+        if( M == DEMOSAIC_BILINEAR ) {
+            v = 4 * cross;
+        }else{
+            v = 8 * c[k] + 4 * cross - 2 * (n2[k] + s2[k] + c[k-1] + c[k+1]);
+        }
+        out[k] = Output<O>(v, maxval, shift);
+    }
+}
+
+// Opposite colour (on the diagonals) at a red or blue site
+template<DemosaicMethod M, typename O>
+void ColourSitesOpposite(const Sites& s, int32_t maxval, int shift, O* out)
+{
+    const int32_t *n2 = s.c[0], *c = s.c[2], *s2 = s.c[4];
+    const int32_t *dn = s.d[1], *ds = s.d[3];
+    const int count = s.n;
+    for(int k=0; k < count; ++k) {
+        const int32_t diag = dn[k] + dn[k+1] + ds[k] + ds[k+1];
+        int32_t v;
+        if( M == DEMOSAIC_BILINEAR ) {
+            v = 4 * diag;
+        }else{
+            v = 12 * c[k] + 4 * diag - 3 * (n2[k] + s2[k] + c[k-1] + c[k+1]);
+        }
+        out[k] = Output<O>(v, maxval, shift);
+    }
+}
+
+// Interleave planes [parity][r,g,b] of half rows into a row of rgb
+template<typename O>
+void Interleave(O* const plane[2][3], int w, O* out)
+{
+    const O *re = plane[0][0], *ge = plane[0][1], *be = plane[0][2];
+    const O *ro = plane[1][0], *go = plane[1][1], *bo = plane[1][2];
+    const int pairs = w / 2;
+    for(int k=0; k < pairs; ++k) {
+        out[6*k+0] = re[k];
+        out[6*k+1] = ge[k];
+        out[6*k+2] = be[k];
+        out[6*k+3] = ro[k];
+        out[6*k+4] = go[k];
+        out[6*k+5] = bo[k];
+    }
+    if( w & 1 ) {
+        out[6*pairs+0] = re[pairs];
+        out[6*pairs+1] = ge[pairs];
+        out[6*pairs+2] = be[pairs];
+    }
+}
+
+template<DemosaicMethod M, typename T, typename O>
+void DemosaicImage(const T* raw, int w, int h, BayerPattern pattern, bool swap, O* rgb)
+{
+    const int n_half = w - w/2;
+    const int half_stride = n_half + 2;
+    vector<int32_t> rows(5 * 2 * half_stride);
+    HalfRows slots[5];
+    for(int i=0; i < 5; ++i) {
+        slots[i].even = &rows[(2*i) * half_stride + 1];
+        slots[i].odd = &rows[(2*i+1) * half_stride + 1];
+    }
+
+    // output planes [parity][r,g,b]
+    vector<O> planes(6 * n_half);
+    O* plane[2][3];
+    for(int p=0; p < 2; ++p)
+        for(int i=0; i < 3; ++i)
+            plane[p][i] = &planes[(3*p+i) * n_half];
+
+    const int32_t maxval = sizeof(T) == 1 ? 0xff : 0xffff;
+    const int shift = 8 * (sizeof(T) - sizeof(O));
+
+    // whether row 0 contains red and starts with green
+    const bool red_row0 = pattern == BAYER_RGGB || pattern == BAYER_GRBG;
+    const bool green_first0 = pattern == BAYER_GRBG || pattern == BAYER_GBRG;
+
+    // source row held by each slot. Any five row window (reflected at the
+    // image edges) maps to distinct slots modulo 5.
+    int loaded[5] = { -1, -1, -1, -1, -1 };
+
+    for(int y=0; y < h; ++y) {
+        Sites sites[2];
+        sites[0].n = n_half;
+        sites[1].n = w / 2;
+
+        for(int j=0; j < 5; ++j) {
+            int sy = y + j - 2;
+            if( sy < 0 ) sy = -sy;
+            if( sy >= h ) sy = 2*h - 2 - sy;
+            const int slot = sy % 5;
+            if( loaded[slot] != sy ) {
+                WidenRow(raw + (size_t)sy * w, w, swap, slots[slot]);
+                loaded[slot] = sy;
+            }
+            // even site k has neighbours odd k-1 and k, odd site k has even k and k+1
+            sites[0].c[j] = slots[slot].even;
+            sites[0].d[j] = slots[slot].odd - 1;
+            sites[1].c[j] = slots[slot].odd;
+            sites[1].d[j] = slots[slot].even;
+        }
+
+        const bool odd_row = y & 1;
+        const bool red_row = red_row0 != odd_row;
+        const int gp = (green_first0 != odd_row) ? 0 : 1;
+        const int cp = 1 - gp;
+
+        // red and blue are to the left and right of green on red rows
+        const int hc = red_row ? 0 : 2;
+        const int vc = 2 - hc;
+
+        CopySites(sites[gp], maxval, shift, plane[gp][1]);
+        GreenSitesHorizontal<M>(sites[gp], maxval, shift, plane[gp][hc]);
+        GreenSitesVertical<M>(sites[gp], maxval, shift, plane[gp][vc]);
+
+        CopySites(sites[cp], maxval, shift, plane[cp][hc]);
+        ColourSitesGreen<M>(sites[cp], maxval, shift, plane[cp][1]);
+        ColourSitesOpposite<M>(sites[cp], maxval, shift, plane[cp][vc]);
+
+        Interleave(plane, w, rgb + (size_t)y * w * 3);
+    }
+}
+
+template<typename T, typename O>
+void DemosaicImage(DemosaicMethod method, const T* raw, int w, int h,
+                   BayerPattern pattern, bool swap, O* rgb)
+{
+    if( method == DEMOSAIC_BILINEAR ) {
+        DemosaicImage<DEMOSAIC_BILINEAR>(raw, w, h, pattern, swap, rgb);
+    }else{
+        DemosaicImage<DEMOSAIC_MHC>(raw, w, h, pattern, swap, rgb);
+    }
+}
+
+inline bool IsBigEndianHost()
+{
+    const uint16_t one = 1;
+    return *(const unsigned char*)&one == 0;
+}
+
+}
+
+bool BayerFormatFromString(const std::string& format, BayerPattern& pattern,
+                           int& bits, bool& big_endian)
+{
+    if( format.compare(0, 6, "BAYER_") || format.size() < 11 ) {
+        return false;
+    }
+
+    const string name = format.substr(6, 4);
+    const string depth = format.substr(10);
+
+    int p = 0;
+    while( p < 4 && name.compare(PatternNames[p]) ) ++p;
+    if( p == 4 ) return false;
+
+    if( !depth.compare("8") ) {
+        bits = 8;
+        big_endian = false;
+    }else if( !depth.compare("16LE") ) {
+        bits = 16;
+        big_endian = false;
+    }else if( !depth.compare("16BE") ) {
+        bits = 16;
+        big_endian = true;
+    }else{
+        return false;
+    }
+
+    pattern = (BayerPattern)p;
+    return true;
+}
+
+std::string BayerFormatToString(BayerPattern pattern, int bits, bool big_endian)
+{
+    string format = string("BAYER_") + PatternNames[pattern];
+    if( bits == 8 ) return format + "8";
+    return format + (big_endian ? "16BE" : "16LE");
+}
+
+DemosaicMethod DemosaicMethodFromString(const std::string& method)
+{
+    const string m = boost::to_lower_copy(method);
+    if( !m.compare("bilinear") ) return DEMOSAIC_BILINEAR;
+    if( !m.compare("mhc") ) return DEMOSAIC_MHC;
+    throw VideoException("Unknown demosaic method", method);
+}
+
+void Demosaic(const unsigned char* raw, unsigned w, unsigned h,
+              const std::string& raw_format, unsigned char* rgb,
+              const std::string& rgb_format, DemosaicMethod method)
+{
+    BayerPattern pattern;
+    int bits;
+    bool big_endian;
+
+    if( !BayerFormatFromString(raw_format, pattern, bits, big_endian) ) {
+        throw VideoException("Demosaic: not a bayer format", raw_format);
+    }
+    if( w < 3 || h < 3 ) {
+        throw VideoException("Demosaic: image too small");
+    }
+
+    const bool rgb48 = !rgb_format.compare("RGB48LE");
+    if( !rgb48 && rgb_format.compare("RGB24") ) {
+        throw VideoException("Demosaic: unsupported output format", rgb_format);
+    }
+
+    if( bits == 8 ) {
+        if( rgb48 ) {
+            throw VideoException("Demosaic: 8 bit source must be demosaiced to RGB24");
+        }
+        DemosaicImage(method, raw, w, h, pattern, false, rgb);
+    }else{
+        const uint16_t* raw16 = (const uint16_t*)raw;
+        const bool swap = big_endian != IsBigEndianHost();
+        if( rgb48 ) {
+            DemosaicImage(method, raw16, w, h, pattern, swap, (uint16_t*)rgb);
+        }else{
+            DemosaicImage(method, raw16, w, h, pattern, swap, rgb);
+        }
+    }
+}
+
+DemosaicVideo::DemosaicVideo(VideoInterface* src, const std::string& rgb_format,
+                             DemosaicMethod method, const std::string& pattern)
+    : src(src), rgb_format(rgb_format), method(method)
+{
+    raw_format = src->PixFormat();
+
+    if( !pattern.empty() ) {
+        const string p = boost::to_upper_copy(pattern);
+        int i = 0;
+        while( i < 4 && p.compare(PatternNames[i]) ) ++i;
+        if( i == 4 ) {
+            throw VideoException("Unknown bayer pattern", pattern);
+        }
+        if( !raw_format.compare("GRAY8") ) {
+            raw_format = BayerFormatToString((BayerPattern)i, 8);
+        }else if( !raw_format.compare("GRAY16LE") ) {
+            raw_format = BayerFormatToString((BayerPattern)i, 16, false);
+        }else if( IsBayerFormat(raw_format) ) {
+            BayerPattern old; int bits; bool big_endian;
+            BayerFormatFromString(raw_format, old, bits, big_endian);
+            raw_format = BayerFormatToString((BayerPattern)i, bits, big_endian);
+        }
+    }
+
+    if( !IsBayerFormat(raw_format) ) {
+        throw VideoException("Demosaic: source is not a bayer video", raw_format);
+    }
+    if( rgb_format.compare("RGB24") && rgb_format.compare("RGB48LE") ) {
+        throw VideoException("Demosaic: unsupported output format", rgb_format);
+    }
+
+    raw.resize(src->SizeBytes());
+}
+
+DemosaicVideo::~DemosaicVideo()
+{
+    delete src;
+}
+
+unsigned DemosaicVideo::Width() const
+{
+    return src->Width();
+}
+
+unsigned DemosaicVideo::Height() const
+{
+    return src->Height();
+}
+
+size_t DemosaicVideo::SizeBytes() const
+{
+    return (size_t)Width() * Height() * VideoFormatFromString(rgb_format).bpp / 8;
+}
+
+std::string DemosaicVideo::PixFormat() const
+{
+    return rgb_format;
+}
+
+void DemosaicVideo::Start()
+{
+    src->Start();
+}
+
+void DemosaicVideo::Stop()
+{
+    src->Stop();
+}
+
+bool DemosaicVideo::GrabNext( unsigned char* image, bool wait )
+{
+    if( src->GrabNext(&raw[0], wait) ) {
+        Demosaic(&raw[0], Width(), Height(), raw_format, image, rgb_format, method);
+        return true;
+    }
+    return false;
+}
+
+bool DemosaicVideo::GrabNewest( unsigned char* image, bool wait )
+{
+    if( src->GrabNewest(&raw[0], wait) ) {
+        Demosaic(&raw[0], Width(), Height(), raw_format, image, rgb_format, method);
+        return true;
+    }
+    return false;
+}
+
+}
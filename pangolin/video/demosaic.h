@@ -0,0 +1,118 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PANGOLIN_DEMOSAIC_H
+#define PANGOLIN_DEMOSAIC_H
+
+#include <pangolin/pangolin.h>
+#include <pangolin/video.h>
+
+#include <vector>
+
+namespace pangolin
+{
+
+//! Colour filter layout, named by the first two rows of the sensor
+enum BayerPattern
+{
+    BAYER_RGGB,
+    BAYER_GRBG,
+    BAYER_GBRG,
+    BAYER_BGGR
+};
+
+enum DemosaicMethod
+{
+    //! average of nearest samples of each colour
+    DEMOSAIC_BILINEAR,
+    //! gradient corrected linear interpolation (Malvar, He and Cutler 2004)
+    DEMOSAIC_MHC
+};
+
+//! Parse pixel formats "BAYER_RGGB8", "BAYER_GRBG16LE", "BAYER_BGGR16BE", ...
+//! Returns false if format is not a bayer format.
+bool BayerFormatFromString(const std::string& format, BayerPattern& pattern,
+                           int& bits, bool& big_endian);
+
+inline bool IsBayerFormat(const std::string& format)
+{
+    BayerPattern pattern; int bits; bool big_endian;
+    return BayerFormatFromString(format, pattern, bits, big_endian);
+}
+
+//! Pixel format name of pattern at 8 bits or 16 bits of given endianness
+std::string BayerFormatToString(BayerPattern pattern, int bits, bool big_endian = false);
+
+DemosaicMethod DemosaicMethodFromString(const std::string& method);
+
+//! Demosaic a tightly packed w x h image of pixel format raw_format to
+//! interleaved RGB24 or RGB48LE. 16 bit sources written to RGB24 keep the
+//! most significant byte. Images must be at least 3 x 3.
+//!
+//! Rows are widened once into a five row window with mirrored borders (which
+//! keeps the bayer phase) and interpolated with fixed point kernels written
+//! to be vectorised by the compiler, so cost is a few ns per pixel.
+void Demosaic(const unsigned char* raw, unsigned w, unsigned h,
+              const std::string& raw_format, unsigned char* rgb,
+              const std::string& rgb_format = "RGB24",
+              DemosaicMethod method = DEMOSAIC_MHC);
+
+//! Convert stage presenting a bayer video (or a GRAY8 / GRAY16LE video
+//! reinterpreted with a given pattern) as RGB24 or RGB48LE.
+class DemosaicVideo : public VideoInterface
+{
+public:
+    //! pattern overrides the format reported by src, e.g. "RGGB"
+    DemosaicVideo(VideoInterface* src, const std::string& rgb_format = "RGB24",
+                  DemosaicMethod method = DEMOSAIC_MHC,
+                  const std::string& pattern = "");
+    ~DemosaicVideo();
+
+    // Implement VideoInterface
+    unsigned Width() const;
+    unsigned Height() const;
+    size_t SizeBytes() const;
+    std::string PixFormat() const;
+
+    void Start();
+    void Stop();
+
+    bool GrabNext( unsigned char* image, bool wait = true );
+    bool GrabNewest( unsigned char* image, bool wait = true );
+
+protected:
+    VideoInterface* src;
+    std::string raw_format;
+    std::string rgb_format;
+    DemosaicMethod method;
+    std::vector<unsigned char> raw;
+};
+
+}
+
+#endif // PANGOLIN_DEMOSAIC_H
@@ -0,0 +1,262 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/video/exif.h>
+
+#include <math.h>
+#include <string.h>
+
+namespace pangolin
+{
+
+const size_t EXIF_HEADER_SIZE = 6; // "Exif\0\0" preceeds TIFF header
+const size_t TIFF_HEADER_SIZE = 8;
+const size_t IFD_ENTRY_SIZE = 12;
+
+const uint16_t TIFF_ASCII = 2;
+const uint16_t TIFF_SHORT = 3;
+const uint16_t TIFF_LONG = 4;
+const uint16_t TIFF_RATIONAL = 5;
+const uint16_t TIFF_SRATIONAL = 10;
+
+const uint16_t TAG_MAKE = 0x010f;
+const uint16_t TAG_MODEL = 0x0110;
+const uint16_t TAG_EXIF_IFD = 0x8769;
+const uint16_t TAG_EXPOSURE_TIME = 0x829a;
+const uint16_t TAG_FNUMBER = 0x829d;
+const uint16_t TAG_EXIF_VERSION = 0x9000;
+const uint16_t TAG_EXPOSURE_BIAS = 0x9204;
+const uint16_t TAG_COLOR_SPACE = 0xa001;
+const uint16_t TAG_GAIN_CONTROL = 0xa407;
+const uint16_t TAG_WHITE_BALANCE = 0xa403;
+
+namespace
+{
+
+uint32_t gcd(uint32_t a, uint32_t b)
+{
+    while(b) {
+        const uint32_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+// rational approximation to 6 significant digits, reduced
+void FloatToRational(float v, int32_t& num, int32_t& den)
+{
+    den = 1000000;
+    while(den > 1 && fabs(v) * den > 2147483647.0f) den /= 10;
+    num = (int32_t)floor(v * den + 0.5f);
+    const uint32_t g = gcd(num < 0 ? -num : num, den);
+    if(g > 1) {
+        num /= (int32_t)g;
+        den /= (int32_t)g;
+    }
+}
+
+}
+
+ExifBuilder::ExifBuilder()
+{
+    Clear();
+}
+
+void ExifBuilder::Clear()
+{
+    ifd0.clear();
+    exif_ifd.clear();
+
+    Entry& version = exif_ifd[TAG_EXIF_VERSION];
+    version.type = 7; // UNDEFINED
+    version.count = 4;
+    version.value.assign((const unsigned char*)"0220", (const unsigned char*)"0220" + 4);
+}
+
+void ExifBuilder::SetMake(const std::string& make)
+{
+    SetAscii(ifd0, TAG_MAKE, make);
+}
+
+void ExifBuilder::SetModel(const std::string& model)
+{
+    SetAscii(ifd0, TAG_MODEL, model);
+}
+
+void ExifBuilder::SetExposureTime(float seconds)
+{
+    int32_t num, den;
+    FloatToRational(seconds, num, den);
+    SetRational(exif_ifd, TAG_EXPOSURE_TIME, TIFF_RATIONAL, num, den);
+}
+
+void ExifBuilder::SetFNumber(uint32_t numerator, uint32_t denominator)
+{
+    SetRational(exif_ifd, TAG_FNUMBER, TIFF_RATIONAL, numerator, denominator);
+}
+
+void ExifBuilder::SetExposureBias(float ev)
+{
+    int32_t num, den;
+    FloatToRational(ev, num, den);
+    SetRational(exif_ifd, TAG_EXPOSURE_BIAS, TIFF_SRATIONAL, num, den);
+}
+
+void ExifBuilder::SetColorSpace(uint16_t space)
+{
+    SetShort(exif_ifd, TAG_COLOR_SPACE, space);
+}
+
+void ExifBuilder::SetWhiteBalance(uint16_t mode)
+{
+    SetShort(exif_ifd, TAG_WHITE_BALANCE, mode);
+}
+
+void ExifBuilder::SetGainControl(uint16_t gain_control)
+{
+    SetShort(exif_ifd, TAG_GAIN_CONTROL, gain_control);
+}
+
+void ExifBuilder::SetAscii(std::map<uint16_t,Entry>& ifd, uint16_t tag, const std::string& str)
+{
+    Entry& e = ifd[tag];
+    e.type = TIFF_ASCII;
+    e.count = str.size() + 1;
+    e.value.assign(str.begin(), str.end());
+    e.value.push_back(0);
+}
+
+void ExifBuilder::SetShort(std::map<uint16_t,Entry>& ifd, uint16_t tag, uint16_t v)
+{
+    Entry& e = ifd[tag];
+    e.type = TIFF_SHORT;
+    e.count = 1;
+    e.value.resize(2);
+    e.value[0] = v & 0xff;
+    e.value[1] = v >> 8;
+}
+
+void ExifBuilder::SetRational(std::map<uint16_t,Entry>& ifd, uint16_t tag, uint16_t type, int32_t num, int32_t den)
+{
+    Entry& e = ifd[tag];
+    e.type = type;
+    e.count = 1;
+    e.value.resize(8);
+    for(int i = 0; i < 4; ++i) {
+        e.value[i] = ((uint32_t)num >> (8*i)) & 0xff;
+        e.value[4+i] = ((uint32_t)den >> (8*i)) & 0xff;
+    }
+}
+
+void ExifBuilder::Put16(size_t pos, uint16_t v)
+{
+    data[pos] = v & 0xff;
+    data[pos+1] = v >> 8;
+}
+
+void ExifBuilder::Put32(size_t pos, uint32_t v)
+{
+    for(int i = 0; i < 4; ++i) {
+        data[pos+i] = (v >> (8*i)) & 0xff;
+    }
+}
+
+// Writes directory at offset (relative to TIFF header) with values longer
+// than 4 bytes placed from data_offset, which is advanced past them.
+void ExifBuilder::WriteIFD(const std::map<uint16_t,Entry>& ifd, size_t offset, size_t& data_offset)
+{
+    size_t pos = EXIF_HEADER_SIZE + offset;
+    Put16(pos, ifd.size());
+    pos += 2;
+
+    for(std::map<uint16_t,Entry>::const_iterator i = ifd.begin(); i != ifd.end(); ++i) {
+        const Entry& e = i->second;
+        Put16(pos, i->first);
+        Put16(pos+2, e.type);
+        Put32(pos+4, e.count);
+        if(e.value.size() <= 4) {
+            Put32(pos+8, 0);
+            memcpy(&data[pos+8], &e.value[0], e.value.size());
+        }else{
+            Put32(pos+8, data_offset);
+            memcpy(&data[EXIF_HEADER_SIZE + data_offset], &e.value[0], e.value.size());
+            // values start on word boundary
+            data_offset += (e.value.size() + 1) & ~1;
+        }
+        pos += IFD_ENTRY_SIZE;
+    }
+
+    // no next IFD
+    Put32(pos, 0);
+}
+
+const std::vector<unsigned char>& ExifBuilder::Build()
+{
+    // pointer to Exif sub-IFD, value filled in once offset is known
+    Entry& exif_pointer = ifd0[TAG_EXIF_IFD];
+    exif_pointer.type = TIFF_LONG;
+    exif_pointer.count = 1;
+    exif_pointer.value.assign(4, 0);
+
+    size_t size0 = 0, size1 = 0;
+    for(std::map<uint16_t,Entry>::const_iterator i = ifd0.begin(); i != ifd0.end(); ++i) {
+        if(i->second.value.size() > 4) size0 += (i->second.value.size() + 1) & ~1;
+    }
+    for(std::map<uint16_t,Entry>::const_iterator i = exif_ifd.begin(); i != exif_ifd.end(); ++i) {
+        if(i->second.value.size() > 4) size1 += (i->second.value.size() + 1) & ~1;
+    }
+
+    const size_t ifd0_offset = TIFF_HEADER_SIZE;
+    const size_t ifd0_data = ifd0_offset + 2 + ifd0.size() * IFD_ENTRY_SIZE + 4;
+    const size_t exif_offset = ifd0_data + size0;
+    const size_t exif_data = exif_offset + 2 + exif_ifd.size() * IFD_ENTRY_SIZE + 4;
+    const size_t tiff_size = exif_data + size1;
+
+    for(int i = 0; i < 4; ++i) {
+        exif_pointer.value[i] = (exif_offset >> (8*i)) & 0xff;
+    }
+
+    data.assign(EXIF_HEADER_SIZE + tiff_size, 0);
+    memcpy(&data[0], "Exif\0\0", EXIF_HEADER_SIZE);
+
+    // little endian TIFF header
+    data[EXIF_HEADER_SIZE] = 'I';
+    data[EXIF_HEADER_SIZE+1] = 'I';
+    Put16(EXIF_HEADER_SIZE+2, 42);
+    Put32(EXIF_HEADER_SIZE+4, ifd0_offset);
+
+    size_t data_offset = ifd0_data;
+    WriteIFD(ifd0, ifd0_offset, data_offset);
+    data_offset = exif_data;
+    WriteIFD(exif_ifd, exif_offset, data_offset);
+
+    return data;
+}
+
+}
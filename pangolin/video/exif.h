@@ -0,0 +1,89 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PANGOLIN_EXIF_H
+#define PANGOLIN_EXIF_H
+
+#include <stdint.h>
+#include <map>
+#include <string>
+#include <vector>
+
+namespace pangolin
+{
+
+//! Serialises a minimal EXIF block (little endian TIFF with IFD0 and an
+//! Exif sub-IFD) in memory, ready to be written as the APP1 marker of a
+//! JPEG while it is being compressed. This replaces reopening and
+//! rewriting each saved file with Exiv2.
+class ExifBuilder
+{
+public:
+    ExifBuilder();
+
+    void Clear();
+
+    // IFD0
+    void SetMake(const std::string& make);
+    void SetModel(const std::string& model);
+
+    // Exif sub-IFD
+    void SetExposureTime(float seconds);
+    void SetFNumber(uint32_t numerator, uint32_t denominator);
+    void SetExposureBias(float ev);
+    void SetColorSpace(uint16_t space);         // 1 = sRGB
+    void SetWhiteBalance(uint16_t mode);        // 0 = auto, 1 = manual
+    void SetGainControl(uint16_t gain_control); // 0 = none, 1 = low gain up, 2 = high gain up
+
+    //! APP1 payload, starting with the "Exif\0\0" identifier
+    const std::vector<unsigned char>& Build();
+
+protected:
+    struct Entry
+    {
+        uint16_t type;
+        uint32_t count;
+        std::vector<unsigned char> value;
+    };
+
+    void SetAscii(std::map<uint16_t,Entry>& ifd, uint16_t tag, const std::string& str);
+    void SetShort(std::map<uint16_t,Entry>& ifd, uint16_t tag, uint16_t v);
+    void SetRational(std::map<uint16_t,Entry>& ifd, uint16_t tag, uint16_t type, int32_t num, int32_t den);
+    void WriteIFD(const std::map<uint16_t,Entry>& ifd, size_t offset, size_t& data_offset);
+
+    void Put16(size_t pos, uint16_t v);
+    void Put32(size_t pos, uint32_t v);
+
+    std::map<uint16_t,Entry> ifd0;
+    std::map<uint16_t,Entry> exif_ifd;
+    std::vector<unsigned char> data;
+};
+
+}
+
+#endif // PANGOLIN_EXIF_H
@@ -0,0 +1,158 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "exposure_schedule.h"
+
+namespace pangolin
+{
+
+// shutter and gain are the low 12 bits of both bank registers and meta data
+const uint32_t EXPOSURE_MASK = 0xfff;
+
+ExposureSchedule::ExposureSchedule()
+{
+    SetSteps(std::vector<ExposureStep>(1));
+}
+
+ExposureSchedule::ExposureSchedule(const std::vector<ExposureStep>& steps)
+{
+    SetSteps(steps);
+}
+
+void ExposureSchedule::SetSteps(const std::vector<ExposureStep>& new_steps)
+{
+    steps = new_steps;
+    if(steps.empty()) steps.push_back(ExposureStep());
+
+    for(size_t i=0; i < steps.size(); ++i) {
+        steps[i].shutter &= EXPOSURE_MASK;
+        steps[i].gain &= EXPOSURE_MASK;
+    }
+
+    const int n = steps.size();
+    for(int b=0; b < HDR_BANKS; ++b) {
+        bank_step[b] = b % n;
+        prev_bank_step[b] = bank_step[b];
+    }
+    synced = false;
+    bank_origin = 0;
+    step_origin = 0;
+    last_frame_counter = 0;
+}
+
+ExposureStep ExposureSchedule::Bank(int bank) const
+{
+    return steps[bank_step[bank]];
+}
+
+bool ExposureSchedule::Matches(int step, uint32_t shutter, uint32_t gain) const
+{
+    return steps[step].shutter == shutter && steps[step].gain == gain;
+}
+
+int ExposureSchedule::Resync(uint32_t shutter, uint32_t gain, uint32_t frame_counter)
+{
+    // find the bank holding these settings. While banks repeat a step the
+    // bank is ambiguous, though the step is not.
+    int bank = -1;
+    int found = 0;
+    for(int i=0; i < HDR_BANKS; ++i) {
+        if(Matches(bank_step[i], shutter, gain)) {
+            bank = i;
+            ++found;
+        }
+    }
+
+    if(found == 1) {
+        synced = true;
+        bank_origin = frame_counter - bank;
+        step_origin = frame_counter - bank_step[bank];
+        return bank_step[bank];
+    }else if(found > 1) {
+        return bank_step[bank];
+    }
+
+    // bank rewrite hasn't landed yet, frame exposed with old contents
+    for(int i=0; i < HDR_BANKS; ++i) {
+        if(Matches(prev_bank_step[i], shutter, gain)) {
+            return prev_bank_step[i];
+        }
+    }
+    return -1;
+}
+
+int ExposureSchedule::OnFrame(uint32_t shutter, uint32_t gain, std::vector<BankWrite>& writes)
+{
+    return OnFrame(shutter, gain, last_frame_counter + 1, writes);
+}
+
+int ExposureSchedule::OnFrame(uint32_t shutter, uint32_t gain, uint32_t frame_counter, std::vector<BankWrite>& writes)
+{
+    shutter &= EXPOSURE_MASK;
+    gain &= EXPOSURE_MASK;
+    writes.clear();
+    last_frame_counter = frame_counter;
+
+    int step = -1;
+    if(synced) {
+        const int b = (frame_counter - bank_origin) % HDR_BANKS;
+        if(Matches(bank_step[b], shutter, gain)) {
+            step = bank_step[b];
+        }else if(Matches(prev_bank_step[b], shutter, gain)) {
+            step = prev_bank_step[b];
+        }else{
+            // lost track of banks, e.g. HDR mode restarted
+            synced = false;
+        }
+    }
+    if(!synced) {
+        step = Resync(shutter, gain, frame_counter);
+    }
+
+    if(!synced || !Rolling()) {
+        return step;
+    }
+
+    // Bring each bank in line with the step due at its next exposure. With
+    // no frames dropped only the bank which exposed this frame changes.
+    const uint32_t n = steps.size();
+    const int b = (frame_counter - bank_origin) % HDR_BANKS;
+    for(int i=1; i <= HDR_BANKS; ++i) {
+        const int bank = (b + i) % HDR_BANKS;
+        const int due = (frame_counter + i - step_origin) % n;
+        if(bank_step[bank] != due) {
+            prev_bank_step[bank] = bank_step[bank];
+            bank_step[bank] = due;
+            writes.push_back(BankWrite(bank, steps[due]));
+        }
+    }
+
+    return step;
+}
+
+}
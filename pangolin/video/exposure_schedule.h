@@ -0,0 +1,121 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PANGOLIN_EXPOSURE_SCHEDULE_H
+#define PANGOLIN_EXPOSURE_SCHEDULE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+namespace pangolin
+{
+
+//! Number of camera HDR register banks
+const int HDR_BANKS = 4;
+
+//! One exposure of a schedule, quantised register values
+struct ExposureStep
+{
+    ExposureStep() : shutter(0), gain(0) {}
+    ExposureStep(uint32_t shutter, uint32_t gain) : shutter(shutter), gain(gain) {}
+    uint32_t shutter;
+    uint32_t gain;
+};
+
+//! HDR bank register write requested by a rolling schedule
+struct BankWrite
+{
+    BankWrite() : bank(0) {}
+    BankWrite(int bank, const ExposureStep& step) : bank(bank), step(step) {}
+    int bank;
+    ExposureStep step;
+};
+
+//! Cyclic sequence of (shutter, gain) exposures run on the camera HDR banks.
+//!
+//! Schedules of 1, 2 or 4 steps tile the banks, so are programmed once and
+//! need no further register writes. Others (3 steps, or more than 4) roll
+//! through the banks: as each frame arrives, the bank which exposed it is
+//! rewritten with the step due 4 frames later, giving the write 3 frame
+//! intervals to land. Either way steps are exposed in order 0,1,..,N-1.
+//!
+//! The camera moves to the next bank every frame, so the bank behind a
+//! frame follows from its frame counter. Banks whose frames were dropped
+//! before reaching OnFrame are rewritten along with the next frame that
+//! does, so a rolling schedule recovers from drops rather than stalling.
+//! OnFrame should still be fed from the capture thread, as every frame
+//! missed risks a bank exposing a stale step.
+//!
+//! The step which produced a frame is identified from the shutter and gain
+//! embedded in it, so steps should differ in at least one of them.
+class ExposureSchedule
+{
+public:
+    ExposureSchedule();
+    ExposureSchedule(const std::vector<ExposureStep>& steps);
+
+    void SetSteps(const std::vector<ExposureStep>& steps);
+    const std::vector<ExposureStep>& Steps() const { return steps; }
+    size_t Size() const { return steps.size(); }
+
+    //! True if banks are rewritten per frame (steps don't tile the banks)
+    bool Rolling() const { return HDR_BANKS % steps.size() != 0; }
+
+    //! Bank contents to program before enabling HDR mode
+    ExposureStep Bank(int bank) const;
+
+    //! Identify the step which exposed a frame from its embedded shutter,
+    //! gain and frame counter. Returns step index, or -1 if no bank matches.
+    //! writes is set to the bank writes needed to keep a rolling schedule
+    //! on track, empty if none.
+    int OnFrame(uint32_t shutter, uint32_t gain, uint32_t frame_counter, std::vector<BankWrite>& writes);
+
+    //! As above, for frames without an embedded frame counter. Frames are
+    //! then assumed to arrive without drops.
+    int OnFrame(uint32_t shutter, uint32_t gain, std::vector<BankWrite>& writes);
+
+protected:
+    bool Matches(int step, uint32_t shutter, uint32_t gain) const;
+    int Resync(uint32_t shutter, uint32_t gain, uint32_t frame_counter);
+
+    std::vector<ExposureStep> steps;
+    int bank_step[HDR_BANKS];
+    int prev_bank_step[HDR_BANKS];
+
+    // bank of frame k is (k - bank_origin) % HDR_BANKS and the step due
+    // is (k - step_origin) % N, valid once synced
+    bool synced;
+    uint32_t bank_origin;
+    uint32_t step_origin;
+    uint32_t last_frame_counter;
+};
+
+}
+
+#endif // PANGOLIN_EXPOSURE_SCHEDULE_H
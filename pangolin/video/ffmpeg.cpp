@@ -27,6 +27,12 @@
 
 #include "ffmpeg.h"
 
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+
+#include <boost/bind.hpp>
+
 namespace pangolin
 {
 
@@ -119,13 +125,20 @@ std::string FfmpegFmtToString(const PixelFormat fmt)
 
 #undef TEST_PIX_FMT_RETURN
 
-FfmpegVideo::FfmpegVideo(const std::string filename, const std::string strfmtout, const std::string codec_hint, bool dump_info, int user_video_stream)
-    :pFormatCtx(0)
+FfmpegVideo::FfmpegVideo(const std::string filename, const std::string strfmtout, const std::string codec_hint, bool dump_info, int user_video_stream, int decode_ahead, int codec_threads)
+    :pFormatCtx(0), end_of_stream(false), ring_head(0), ring_count(0), decoding(false), decoder_active(false)
 {
-    InitUrl(filename, strfmtout, codec_hint, dump_info, user_video_stream);
+    InitUrl(filename, strfmtout, codec_hint, dump_info, user_video_stream, codec_threads);
+
+    ring.resize(std::max(0, decode_ahead));
+    for(size_t i=0; i < ring.size(); ++i) {
+        ring[i].resize(numBytesOut);
+    }
+
+    Start();
 }
 
-void FfmpegVideo::InitUrl(const std::string url, const std::string strfmtout, const std::string codec_hint, bool dump_info, int user_video_stream)
+void FfmpegVideo::InitUrl(const std::string url, const std::string strfmtout, const std::string codec_hint, bool dump_info, int user_video_stream, int codec_threads)
 {
     if( url.find('*') != url.npos )
         throw VideoException("Wildcards not supported. Please use ffmpegs printf style formatting for image sequences. e.g. img-000000%04d.ppm");
@@ -204,6 +217,18 @@ void FfmpegVideo::InitUrl(const std::string url, const std::string strfmtout, co
     if(pVidCodec==0)
         throw VideoException("Codec not found");
 
+    // Frame threading decodes consecutive frames in parallel at the cost of
+    // a frame of latency per thread, so live streams only split slices
+    if( codec_threads <= 0 ) {
+        codec_threads = std::max(1u, boost::thread::hardware_concurrency());
+    }
+#ifdef FF_THREAD_FRAME
+    pVidCodecCtx->thread_count = codec_threads;
+    pVidCodecCtx->thread_type = codec_hint.empty() ? (FF_THREAD_FRAME | FF_THREAD_SLICE) : FF_THREAD_SLICE;
+#else
+    avcodec_thread_init(pVidCodecCtx, codec_threads);
+#endif
+
     // Open video codec
 #if LIBAVCODEC_VERSION_MAJOR > 52
     if(avcodec_open2(pVidCodecCtx, pVidCodec,0)<0)
@@ -218,10 +243,7 @@ void FfmpegVideo::InitUrl(const std::string url, const std::string strfmtout, co
 
     // Allocate video frame
     pFrame=avcodec_alloc_frame();
-
-    // Allocate an AVFrame structure
-    pFrameOut=avcodec_alloc_frame();
-    if(pFrameOut==0)
+    if(pFrame==0)
         throw VideoException("Couldn't allocate frame");
 
     fmtout = FfmpegFmtFromString(strfmtout);
@@ -232,14 +254,9 @@ void FfmpegVideo::InitUrl(const std::string url, const std::string strfmtout, co
     const int w = pVidCodecCtx->width;
     const int h = pVidCodecCtx->height;
 
-    // Determine required buffer size and allocate buffer
+    // Determine required buffer size, frames are converted in place
     numBytesOut=avpicture_get_size(fmtout, w, h);
 
-    buffer= new uint8_t[numBytesOut];
-
-    // Assign appropriate parts of buffer to image planes in pFrameRGB
-    avpicture_fill((AVPicture *)pFrameOut, buffer, fmtout, w, h);
-
     // Allocate SWS for converting pixel formats
     img_convert_ctx = sws_getContext(w, h,
                     pVidCodecCtx->pix_fmt,
@@ -252,9 +269,8 @@ void FfmpegVideo::InitUrl(const std::string url, const std::string strfmtout, co
 
 FfmpegVideo::~FfmpegVideo()
 {
-    // Free the RGB image
-	delete[] buffer;
-    av_free(pFrameOut);
+    // Join decode thread before the codec is closed
+    Stop();
 
     // Free the YUV frame
     av_free(pFrame);
@@ -297,79 +313,274 @@ std::string FfmpegVideo::PixFormat() const
 
 void FfmpegVideo::Start()
 {
+    if( ring.empty() || decoding ) return;
+
+    // thread may have exited at end of stream
+    if( decode_thread.joinable() ) {
+        decode_thread.join();
+    }
+
+    decoding = true;
+    decoder_active = true;
+    decode_thread = boost::thread(boost::ref(*this));
 }
 
 void FfmpegVideo::Stop()
 {
+    {
+        boost::lock_guard<boost::mutex> lock(mutex);
+        decoding = false;
+    }
+    not_full.notify_all();
+
+    if( decode_thread.joinable() ) {
+        decode_thread.join();
+    }
 }
 
-bool FfmpegVideo::GrabNext(unsigned char* image, bool /*wait*/)
+bool FfmpegVideo::DecodeFrame()
 {
     int gotFrame = 0;
 
-    while(!gotFrame && av_read_frame(pFormatCtx, &packet)>=0)
+    while(!gotFrame && !end_of_stream)
     {
-        // Is this a packet from the video stream?
-        if(packet.stream_index==videoStream)
+        if(av_read_frame(pFormatCtx, &packet)>=0)
         {
-            // Decode video frame
-            avcodec_decode_video2(pVidCodecCtx, pFrame, &gotFrame, &packet);
+            // Is this a packet from the video stream?
+            if(packet.stream_index==videoStream)
+            {
+                // Decode video frame
+                avcodec_decode_video2(pVidCodecCtx, pFrame, &gotFrame, &packet);
+            }
+
+            // Free the packet that was allocated by av_read_frame
+            av_free_packet(&packet);
+        }else{
+            // Drain frames still held by the (frame threaded) decoder
+            AVPacket flush;
+            av_init_packet(&flush);
+            flush.data = NULL;
+            flush.size = 0;
+            avcodec_decode_video2(pVidCodecCtx, pFrame, &gotFrame, &flush);
+            end_of_stream = !gotFrame;
         }
+    }
 
-        // Did we get a video frame?
-        if(gotFrame) {
-            sws_scale(img_convert_ctx, pFrame->data, pFrame->linesize, 0, pVidCodecCtx->height, pFrameOut->data, pFrameOut->linesize);
-            memcpy(image,pFrameOut->data[0],numBytesOut);
+    return gotFrame;
+}
+
+void FfmpegVideo::ConvertFrame(uint8_t* image)
+{
+    AVPicture out;
+    avpicture_fill(&out, image, fmtout, pVidCodecCtx->width, pVidCodecCtx->height);
+    sws_scale(img_convert_ctx, pFrame->data, pFrame->linesize, 0, pVidCodecCtx->height, out.data, out.linesize);
+}
+
+void FfmpegVideo::TakeFrame(boost::unique_lock<boost::mutex>& lock, unsigned char* image)
+{
+    // the decoder never writes the head slot, so copy without the lock
+    const uint8_t* frame = &ring[ring_head][0];
+    lock.unlock();
+    memcpy(image, frame, numBytesOut);
+    lock.lock();
+
+    ring_head = (ring_head + 1) % ring.size();
+    --ring_count;
+    not_full.notify_one();
+}
+
+void FfmpegVideo::operator()()
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+
+    while( decoding )
+    {
+        if( ring_count == ring.size() ) {
+            not_full.wait(lock);
+            continue;
         }
 
-        // Free the packet that was allocated by av_read_frame
-        av_free_packet(&packet);
+        // slot after the last filled one isn't visible to the consumer
+        uint8_t* slot = &ring[(ring_head + ring_count) % ring.size()][0];
+
+        lock.unlock();
+        const bool gotFrame = DecodeFrame();
+        if(gotFrame) ConvertFrame(slot);
+        lock.lock();
+
+        if(!gotFrame) break;
+
+        ++ring_count;
+        not_empty.notify_one();
     }
 
-    return gotFrame;
+    decoder_active = false;
+    not_empty.notify_all();
+}
+
+bool FfmpegVideo::GrabNext(unsigned char* image, bool wait)
+{
+    boost::unique_lock<boost::mutex> lock(mutex);
+
+    while( ring_count == 0 ) {
+        if( !decoder_active ) {
+            // Stopped or no decode ahead: decode on this thread
+            lock.unlock();
+            if( !DecodeFrame() ) return false;
+            ConvertFrame(image);
+            return true;
+        }
+        if( !wait ) return false;
+        not_empty.wait(lock);
+    }
+
+    TakeFrame(lock, image);
+    return true;
 }
 
 bool FfmpegVideo::GrabNewest(unsigned char *image, bool wait)
 {
-    return GrabNext(image,wait);
+    boost::unique_lock<boost::mutex> lock(mutex);
+
+    while( ring_count == 0 ) {
+        if( !decoder_active ) {
+            lock.unlock();
+            return GrabNext(image, wait);
+        }
+        if( !wait ) return false;
+        not_empty.wait(lock);
+    }
+
+    // Skip all but the most recently decoded frame
+    ring_head = (ring_head + ring_count - 1) % ring.size();
+    ring_count = 1;
+
+    TakeFrame(lock, image);
+    return true;
+}
+
+FfmpegMethod FfmpegMethodFromString(const std::string& method)
+{
+    const std::string lmethod = boost::algorithm::to_lower_copy(method);
+    if( lmethod == "fast_bilinear" ) return FFMPEG_FAST_BILINEAR;
+    if( lmethod == "bilinear" )      return FFMPEG_BILINEAR;
+    if( lmethod == "bicubic" )       return FFMPEG_BICUBIC;
+    if( lmethod == "x" )             return FFMPEG_X;
+    if( lmethod == "point" )         return FFMPEG_POINT;
+    if( lmethod == "area" )          return FFMPEG_AREA;
+    if( lmethod == "bicublin" )      return FFMPEG_BICUBLIN;
+    if( lmethod == "gauss" )         return FFMPEG_GAUSS;
+    if( lmethod == "sinc" )          return FFMPEG_SINC;
+    if( lmethod == "lanczos" )       return FFMPEG_LANCZOS;
+    if( lmethod == "spline" )        return FFMPEG_SPLINE;
+    throw VideoException("Unknown scaling method", method);
 }
 
-FfmpegConverter::FfmpegConverter(VideoInterface* videoin, const std::string pixelfmtout, FfmpegMethod method )
-	:videoin(videoin)
+static unsigned GreatestCommonDivisor(unsigned a, unsigned b)
 {
-	if( !videoin )
-		throw VideoException("Source video interface not specified");
+    while( b ) {
+        const unsigned t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+//! Offset the image planes of pic by row lines of fmt, leaving any palette
+static void OffsetPlanes(const AVPicture& pic, PixelFormat fmt, unsigned row, uint8_t* data[4])
+{
+    const AVPixFmtDescriptor& desc = av_pix_fmt_descriptors[fmt];
+    for( int p = 0; p < 4; ++p ) {
+        data[p] = pic.data[p];
+        if( !data[p] || ((desc.flags & PIX_FMT_PAL) && p == 1) ) continue;
+        const unsigned prow = (p == 1 || p == 2) ? (row >> desc.log2_chroma_h) : row;
+        data[p] += prow * pic.linesize[p];
+    }
+}
 
-	w = videoin->Width();
-	h = videoin->Height();
-	fmtsrc = FfmpegFmtFromString(videoin->PixFormat());
-	fmtdst = FfmpegFmtFromString(pixelfmtout);
+FfmpegConverter::FfmpegConverter(VideoInterface* videoin, const std::string pixelfmtout, FfmpegMethod method,
+                                 unsigned width, unsigned height, unsigned threads )
+    :videoin(videoin), pool(method == FFMPEG_POINT ? threads : 1)
+{
+    if( !videoin )
+        throw VideoException("Source video interface not specified");
 
-	img_convert_ctx = sws_getContext(
-		w, h, fmtsrc,
-		w, h, fmtdst,
-		method, NULL, NULL, NULL
-	);
-	if(!img_convert_ctx)
-		throw VideoException("Could not create SwScale context for pixel conversion");
+    w = videoin->Width();
+    h = videoin->Height();
+    wout = width ? width : w;
+    hout = height ? height : h;
+    fmtsrc = FfmpegFmtFromString(videoin->PixFormat());
+    fmtdst = FfmpegFmtFromString(pixelfmtout);
 
     numbytessrc=avpicture_get_size(fmtsrc, w, h);
-    numbytesdst=avpicture_get_size(fmtdst, w, h);
+    numbytesdst=avpicture_get_size(fmtdst, wout, hout);
+    passthrough = fmtsrc == fmtdst && wout == w && hout == h;
+
+    bufsrc = 0;
+    avsrc = 0;
+    if( passthrough ) return;
+
     bufsrc  = new uint8_t[numbytessrc];
-    bufdst  = new uint8_t[numbytesdst];
     avsrc = avcodec_alloc_frame();
-    avdst = avcodec_alloc_frame();
     avpicture_fill((AVPicture*)avsrc,bufsrc,fmtsrc,w,h);
-    avpicture_fill((AVPicture*)avdst,bufdst,fmtdst,w,h);
+
+    PlanBands(method);
+
+    // SwsContext holds per call state, so each band gets its own
+    for( size_t b = 0; b+1 < src_rows.size(); ++b ) {
+        SwsContext* ctx = sws_getContext(
+            w, src_rows[b+1] - src_rows[b], fmtsrc,
+            wout, dst_rows[b+1] - dst_rows[b], fmtdst,
+            method, NULL, NULL, NULL
+        );
+        if(!ctx) {
+            for( size_t i = 0; i < contexts.size(); ++i ) sws_freeContext(contexts[i]);
+            delete[] bufsrc;
+            av_free(avsrc);
+            throw VideoException("Could not create SwScale context for pixel conversion");
+        }
+        contexts.push_back(ctx);
+    }
 }
 
 FfmpegConverter::~FfmpegConverter()
 {
-    sws_freeContext(img_convert_ctx);
+    for( size_t i = 0; i < contexts.size(); ++i )
+        sws_freeContext(contexts[i]);
     delete[] bufsrc;
-    av_free(avsrc);
-    delete[] bufdst;
-    av_free(avdst);
+    if(avsrc) av_free(avsrc);
+}
+
+void FfmpegConverter::PlanBands(FfmpegMethod method)
+{
+    src_rows.assign(1, 0);
+    dst_rows.assign(1, 0);
+
+    unsigned units = 1;
+    unsigned su = h;
+    unsigned du = hout;
+
+    if( method == FFMPEG_POINT && pool.Threads() > 1 ) {
+        // Band edges must fall on whole rows of both images, and on whole
+        // rows of any subsampled chroma
+        const unsigned g = GreatestCommonDivisor(h, hout);
+        const unsigned cs = 1u << av_pix_fmt_descriptors[fmtsrc].log2_chroma_h;
+        const unsigned cd = 1u << av_pix_fmt_descriptors[fmtdst].log2_chroma_h;
+        unsigned k = 1;
+        while( ((k*h/g) % cs) || ((k*hout/g) % cd) ) ++k;
+        if( k <= g ) {
+            units = g / k;
+            su = k * h / g;
+            du = k * hout / g;
+        }
+    }
+
+    const unsigned bands = std::max(1u, std::min(units, pool.Threads() * 4));
+    for( unsigned b = 1; b <= bands; ++b ) {
+        const unsigned u = (b == bands) ? units : (units * b) / bands;
+        src_rows.push_back(b == bands ? h : u * su);
+        dst_rows.push_back(b == bands ? hout : u * du);
+    }
 }
 
 void FfmpegConverter::Start()
@@ -384,12 +595,12 @@ void FfmpegConverter::Stop()
 
 unsigned FfmpegConverter::Width() const
 {
-    return w;
+    return wout;
 }
 
 unsigned FfmpegConverter::Height() const
 {
-    return h;
+    return hout;
 }
 
 size_t FfmpegConverter::SizeBytes() const
@@ -402,16 +613,35 @@ std::string FfmpegConverter::PixFormat() const
     return FfmpegFmtToString(fmtdst);
 }
 
+void FfmpegConverter::ScaleBand(unsigned band)
+{
+    uint8_t* src[4];
+    uint8_t* dst[4];
+    OffsetPlanes(*(AVPicture*)avsrc, fmtsrc, src_rows[band], src);
+    OffsetPlanes(avdst, fmtdst, dst_rows[band], dst);
+
+    sws_scale(
+        contexts[band],
+        src, avsrc->linesize, 0, src_rows[band+1] - src_rows[band],
+        dst, avdst.linesize
+    );
+}
+
+void FfmpegConverter::Convert(unsigned char* image)
+{
+    // Scale straight into the caller's image
+    avpicture_fill(&avdst, image, fmtdst, wout, hout);
+    pool.Run(contexts.size(), boost::bind(&FfmpegConverter::ScaleBand, this, _1));
+}
+
 bool FfmpegConverter::GrabNext( unsigned char* image, bool wait )
 {
+    if( passthrough )
+        return videoin->GrabNext(image, wait);
+
     if( videoin->GrabNext(avsrc->data[0],wait) )
     {
-        sws_scale(
-            img_convert_ctx,
-            avsrc->data, avsrc->linesize, 0, h,
-            avdst->data, avdst->linesize
-        );
-        memcpy(image,avdst->data[0],numbytesdst);
+        Convert(image);
         return true;
     }
     return false;
@@ -419,18 +649,247 @@ bool FfmpegConverter::GrabNext( unsigned char* image, bool wait )
 
 bool FfmpegConverter::GrabNewest( unsigned char* image, bool wait )
 {
+    if( passthrough )
+        return videoin->GrabNewest(image, wait);
+
     if( videoin->GrabNewest(avsrc->data[0],wait) )
     {
+        Convert(image);
+        return true;
+    }
+    return false;
+}
+
+FfmpegVideoOutput::FfmpegVideoOutput(const std::string& filename, const std::map<std::string,std::string>& params)
+    : filename(filename), params(params), oc(0), stream(0), codec_ctx(0), img_convert_ctx(0),
+      avsrc(0), avenc(0), bufenc(0), w(0), h(0), frames(0), header_written(false)
+{
+    av_register_all();
+
+    AVOutputFormat* fmt = av_guess_format(NULL, filename.c_str(), NULL);
+    if(!fmt)
+        throw VideoException("Could not deduce output container from file extension", filename);
+
+    oc = avformat_alloc_context();
+    if(!oc)
+        throw VideoException("Could not allocate output context");
+    oc->oformat = fmt;
+    snprintf(oc->filename, sizeof(oc->filename), "%s", filename.c_str());
+}
+
+FfmpegVideoOutput::~FfmpegVideoOutput()
+{
+    try {
+        if(header_written) {
+            // Encoders with b-frames or lookahead hold on to frames
+            if(codec_ctx->codec->capabilities & CODEC_CAP_DELAY) {
+                while( EncodeFrame(0) ) {}
+            }
+            av_write_trailer(oc);
+        }
+    }catch(const VideoException& e) {
+        std::cerr << e.what() << std::endl;
+    }
+
+    if(codec_ctx && codec_ctx->codec) avcodec_close(codec_ctx);
+    if(img_convert_ctx) sws_freeContext(img_convert_ctx);
+    delete[] bufenc;
+    av_free(avenc);
+    av_free(avsrc);
+
+    if(oc) {
+        if(!(oc->oformat->flags & AVFMT_NOFILE) && oc->pb) avio_close(oc->pb);
+        avformat_free_context(oc);
+    }
+}
+
+std::string FfmpegVideoOutput::Param(const std::string& key, const std::string& default_value) const
+{
+    std::map<std::string,std::string>::const_iterator i = params.find(key);
+    return i != params.end() ? i->second : default_value;
+}
+
+AVCodec* FfmpegVideoOutput::FindEncoder() const
+{
+    const std::string name = Param("codec", "");
+    if(name.empty()) {
+        return avcodec_find_encoder(oc->oformat->video_codec);
+    }
+
+    AVCodec* codec = avcodec_find_encoder_by_name(name.c_str());
+    if(!codec) {
+        // Codec named by format rather than encoder (e.g. h264 -> libx264)
+        AVCodec* decoder = avcodec_find_decoder_by_name(name.c_str());
+        if(decoder) codec = avcodec_find_encoder(decoder->id);
+    }
+    return codec;
+}
+
+void FfmpegVideoOutput::SetStream(unsigned width, unsigned height, std::string pix_fmt, double fps)
+{
+    if(stream)
+        throw VideoException("Stream already set");
+
+    w = width;
+    h = height;
+
+    fmtsrc = FfmpegFmtFromString(pix_fmt);
+    if(fmtsrc == PIX_FMT_NONE)
+        throw VideoException("Input format not recognised", pix_fmt);
+
+    // fps param overrides rate given by the caller
+    if(params.find("fps") != params.end()) {
+        std::istringstream(Param("fps", "0")) >> fps;
+    }
+    if(fps <= 0) fps = 30;
+
+    AVCodec* codec = FindEncoder();
+    if(!codec)
+        throw VideoException("Encoder not found", Param("codec", oc->oformat->name));
+
+#if (LIBAVFORMAT_VERSION_MAJOR >= 54)
+    stream = avformat_new_stream(oc, codec);
+#else
+    stream = av_new_stream(oc, 0);
+#endif
+    if(!stream)
+        throw VideoException("Could not allocate stream");
+
+    codec_ctx = stream->codec;
+    codec_ctx->codec_id = codec->id;
+    codec_ctx->codec_type = AVMEDIA_TYPE_VIDEO;
+    codec_ctx->width = w;
+    codec_ctx->height = h;
+    codec_ctx->time_base = av_d2q(1.0 / fps, 65535);
+    stream->time_base = codec_ctx->time_base;
+
+    int gop = 12;
+    std::istringstream(Param("gop", "12")) >> gop;
+    codec_ctx->gop_size = gop;
+
+    int bitrate_kbit = 0;
+    std::istringstream(Param("bitrate", "0")) >> bitrate_kbit;
+    if(bitrate_kbit > 0) codec_ctx->bit_rate = bitrate_kbit * 1000;
+
+    // Prefer YUV420P (most widely decodable) when the encoder supports it
+    codec_ctx->pix_fmt = PIX_FMT_YUV420P;
+    if(params.find("fmt") != params.end()) {
+        codec_ctx->pix_fmt = FfmpegFmtFromString(Param("fmt", ""));
+    }else if(codec->pix_fmts) {
+        const PixelFormat* f = codec->pix_fmts;
+        while(*f != PIX_FMT_NONE && *f != PIX_FMT_YUV420P) ++f;
+        if(*f == PIX_FMT_NONE) codec_ctx->pix_fmt = codec->pix_fmts[0];
+    }
+    if(codec_ctx->pix_fmt == PIX_FMT_NONE)
+        throw VideoException("Encoder format not recognised", Param("fmt", ""));
+
+    if(oc->oformat->flags & AVFMT_GLOBALHEADER)
+        codec_ctx->flags |= CODEC_FLAG_GLOBAL_HEADER;
+
+    // Private encoder options (e.g. libx264 crf / preset)
+#if LIBAVCODEC_VERSION_MAJOR > 52
+    AVDictionary* opts = 0;
+    if(params.find("crf") != params.end())    av_dict_set(&opts, "crf", Param("crf","").c_str(), 0);
+    if(params.find("preset") != params.end()) av_dict_set(&opts, "preset", Param("preset","").c_str(), 0);
+    const int open_err = avcodec_open2(codec_ctx, codec, &opts);
+    av_dict_free(&opts);
+    if(open_err < 0)
+#else
+    if(avcodec_open(codec_ctx, codec) < 0)
+#endif
+        throw VideoException("Could not open encoder", codec->name);
+
+    // Frame in encoder format, converted from caller's buffer when formats differ
+    avsrc = avcodec_alloc_frame();
+    avenc = avcodec_alloc_frame();
+    if(!avsrc || !avenc)
+        throw VideoException("Couldn't allocate frame");
+
+    if(fmtsrc != codec_ctx->pix_fmt) {
+        bufenc = new uint8_t[avpicture_get_size(codec_ctx->pix_fmt, w, h)];
+        avpicture_fill((AVPicture*)avenc, bufenc, codec_ctx->pix_fmt, w, h);
+        img_convert_ctx = sws_getContext(
+            w, h, fmtsrc,
+            w, h, codec_ctx->pix_fmt,
+            FFMPEG_BICUBIC, NULL, NULL, NULL
+        );
+        if(!img_convert_ctx)
+            throw VideoException("Could not create SwScale context for pixel conversion");
+    }
+
+    outbuf.resize(std::max(w * h * 4, (unsigned)FF_MIN_BUFFER_SIZE));
+
+    if(!(oc->oformat->flags & AVFMT_NOFILE)) {
+        if(avio_open(&oc->pb, filename.c_str(), AVIO_FLAG_WRITE) < 0)
+            throw VideoException("Could not open output file", filename);
+    }
+
+#if (LIBAVFORMAT_VERSION_MAJOR >= 54)
+    if(avformat_write_header(oc, NULL) < 0)
+#else
+    if(av_write_header(oc) < 0)
+#endif
+        throw VideoException("Could not write container header", filename);
+    header_written = true;
+}
+
+int FfmpegVideoOutput::WriteFrame(const unsigned char* image)
+{
+    if(!header_written)
+        throw VideoException("Stream must be set before writing frames");
+
+    avpicture_fill((AVPicture*)avsrc, (uint8_t*)image, fmtsrc, w, h);
+
+    AVFrame* frame = avsrc;
+    if(img_convert_ctx) {
         sws_scale(
             img_convert_ctx,
             avsrc->data, avsrc->linesize, 0, h,
-            avdst->data, avdst->linesize
+            avenc->data, avenc->linesize
         );
-        memcpy(image,avdst->data[0],numbytesdst);
-        return true;
+        frame = avenc;
     }
-    return false;
+
+    frame->pts = frames;
+    EncodeFrame(frame);
+    return frames++;
 }
 
+bool FfmpegVideoOutput::EncodeFrame(AVFrame* frame)
+{
+    AVPacket pkt;
+    av_init_packet(&pkt);
+
+#if LIBAVCODEC_VERSION_MAJOR >= 54
+    pkt.data = &outbuf[0];
+    pkt.size = outbuf.size();
+    int got_packet = 0;
+    if(avcodec_encode_video2(codec_ctx, &pkt, frame, &got_packet) < 0)
+        throw VideoException("Error encoding frame");
+    if(!got_packet)
+        return false;
+#else
+    const int size = avcodec_encode_video(codec_ctx, &outbuf[0], outbuf.size(), frame);
+    if(size < 0)
+        throw VideoException("Error encoding frame");
+    if(size == 0)
+        return false;
+    pkt.data = &outbuf[0];
+    pkt.size = size;
+    pkt.pts = codec_ctx->coded_frame->pts;
+    if(codec_ctx->coded_frame->key_frame)
+        pkt.flags |= AV_PKT_FLAG_KEY;
+#endif
+
+    if(pkt.pts != (int64_t)AV_NOPTS_VALUE)
+        pkt.pts = av_rescale_q(pkt.pts, codec_ctx->time_base, stream->time_base);
+    if(pkt.dts != (int64_t)AV_NOPTS_VALUE)
+        pkt.dts = av_rescale_q(pkt.dts, codec_ctx->time_base, stream->time_base);
+    pkt.stream_index = stream->index;
+
+    if(av_interleaved_write_frame(oc, &pkt) < 0)
+        throw VideoException("Error writing frame", filename);
+    return true;
 }
 
+}
@@ -30,6 +30,13 @@
 
 #include <pangolin/pangolin.h>
 #include <pangolin/video.h>
+#include <pangolin/video_output.h>
+#include <pangolin/video/band_pool.h>
+
+#include <map>
+#include <vector>
+
+#include <boost/thread.hpp>
 
 extern "C"
 {
@@ -48,10 +55,18 @@ extern "C"
 namespace pangolin
 {
 
+//! Decodes video files and streams with libavcodec, using frame and slice
+//! threaded decoding where the codec supports it.
+//!
+//! With decode_ahead > 0 a decode thread keeps a ring of that many frames
+//! converted to fmtout. GrabNext() returns them in order, waiting for the
+//! decoder if wait is set, and GrabNewest() skips to the most recently
+//! decoded frame. While stopped, frames are decoded on the caller's thread.
 class FfmpegVideo : public VideoInterface
 {
 public:
-    FfmpegVideo(const std::string filename, const std::string fmtout = "RGB24", const std::string codec_hint = "", bool dump_info = false, int user_video_stream = -1);
+    //! codec_threads = 0 uses one per core
+    FfmpegVideo(const std::string filename, const std::string fmtout = "RGB24", const std::string codec_hint = "", bool dump_info = false, int user_video_stream = -1, int decode_ahead = 4, int codec_threads = 0);
     ~FfmpegVideo();
 
     //! Implement VideoSource::Start()
@@ -72,8 +87,20 @@ public:
 
     bool GrabNewest( unsigned char* image, bool wait = true );
 
+    //! Decode ahead thread body
+    void operator()();
+
 protected:
-    void InitUrl(const std::string filename, const std::string fmtout = "RGB24", const std::string codec_hint = "", bool dump_info = false , int user_video_stream = -1);
+    void InitUrl(const std::string filename, const std::string fmtout = "RGB24", const std::string codec_hint = "", bool dump_info = false , int user_video_stream = -1, int codec_threads = 0);
+
+    //! Decode next frame of video stream into pFrame, false at end of stream
+    bool DecodeFrame();
+
+    //! Convert pFrame to fmtout in image
+    void ConvertFrame(uint8_t* image);
+
+    //! Copy frame at head of ring to image and release its slot
+    void TakeFrame(boost::unique_lock<boost::mutex>& lock, unsigned char* image);
 
     SwsContext      *img_convert_ctx;
     AVFormatContext *pFormatCtx;
@@ -84,11 +111,22 @@ protected:
     AVCodec         *pVidCodec;
     AVCodec         *pAudCodec;
     AVFrame         *pFrame;
-	AVFrame         *pFrameOut;
     AVPacket        packet;
     int             numBytesOut;
-    uint8_t         *buffer;
     PixelFormat     fmtout;
+    bool            end_of_stream;
+
+    // ring of decoded frames, ring_count from ring_head
+    std::vector<std::vector<uint8_t> > ring;
+    size_t          ring_head;
+    size_t          ring_count;
+    bool            decoding;       // decode thread requested to run
+    bool            decoder_active; // decode thread has not yet exited
+
+    boost::mutex    mutex;
+    boost::condition_variable not_empty;
+    boost::condition_variable not_full;
+    boost::thread   decode_thread;
 };
 
 enum FfmpegMethod
@@ -106,10 +144,22 @@ enum FfmpegMethod
     FFMPEG_SPLINE        =0x400
 };
 
+//! "point", "bilinear", "bicubic", "area", ... as FfmpegMethod
+FfmpegMethod FfmpegMethodFromString(const std::string& method);
+
+//! Converts the pixel format and optionally the size of a video. Frames are
+//! scaled straight into the caller's image, or grabbed straight into it
+//! when the format and size are unchanged.
+//!
+//! With FFMPEG_POINT the image is cut into bands of rows scaled in parallel
+//! on a BandPool. Filtering methods read rows across band boundaries so are
+//! scaled in one pass.
 class FfmpegConverter : public VideoInterface
 {
 public:
-    FfmpegConverter(VideoInterface* videoin, const std::string pixelfmtout = "RGB24", FfmpegMethod method = FFMPEG_POINT);
+    //! width, height of 0 keep the size of videoin, threads = 0 uses one per core
+    FfmpegConverter(VideoInterface* videoin, const std::string pixelfmtout = "RGB24", FfmpegMethod method = FFMPEG_POINT,
+                    unsigned width = 0, unsigned height = 0, unsigned threads = 0);
     ~FfmpegConverter();
 
     void Start();
@@ -123,18 +173,70 @@ public:
     bool GrabNewest( unsigned char* image, bool wait = true );
 
 protected:
+    //! Split rows into bands which map to whole rows of source and destination
+    void PlanBands(FfmpegMethod method);
+
+    void Convert(unsigned char* image);
+    void ScaleBand(unsigned band);
+
     VideoInterface* videoin;
-    SwsContext *img_convert_ctx;
+
+    // per band scaling contexts, band b takes source rows [src_rows[b], src_rows[b+1])
+    // to destination rows [dst_rows[b], dst_rows[b+1])
+    std::vector<SwsContext*> contexts;
+    std::vector<unsigned> src_rows;
+    std::vector<unsigned> dst_rows;
+    BandPool        pool;
 
     PixelFormat     fmtsrc;
     PixelFormat     fmtdst;
     AVFrame*        avsrc;
-    AVFrame*        avdst;
+    AVPicture       avdst;
     uint8_t*        bufsrc;
-    uint8_t*        bufdst;
     int             numbytessrc;
     int             numbytesdst;
     unsigned        w,h;
+    unsigned        wout,hout;
+    bool            passthrough;
+};
+
+//! Encodes frames in process with libavcodec. Container is deduced from
+//! the filename extension. Parameters (see video_output.h): codec, fps,
+//! bitrate (kbit/s), crf, preset, gop and fmt (encoder pixel format).
+class FfmpegVideoOutput : public VideoOutputInterface
+{
+public:
+    FfmpegVideoOutput(const std::string& filename, const std::map<std::string,std::string>& params);
+
+    //! Flushes frames delayed by the encoder and finalises the file
+    ~FfmpegVideoOutput();
+
+    void SetStream(unsigned w, unsigned h, std::string pix_fmt, double fps);
+    int WriteFrame(const unsigned char* image);
+    using VideoOutputInterface::WriteFrame;
+
+protected:
+    std::string Param(const std::string& key, const std::string& default_value) const;
+    AVCodec* FindEncoder() const;
+
+    //! Encode frame (NULL to flush) and write any packet produced
+    bool EncodeFrame(AVFrame* frame);
+
+    std::string filename;
+    std::map<std::string,std::string> params;
+
+    AVFormatContext *oc;
+    AVStream        *stream;
+    AVCodecContext  *codec_ctx;
+    SwsContext      *img_convert_ctx;
+    PixelFormat     fmtsrc;
+    AVFrame         *avsrc;
+    AVFrame         *avenc;
+    uint8_t         *bufenc;
+    std::vector<uint8_t> outbuf;
+    unsigned        w,h;
+    int             frames;
+    bool            header_written;
 };
 
 }
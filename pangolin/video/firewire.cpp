@@ -32,6 +32,9 @@
 
     #include "firewire.h"
     #include "image.h"
+    #include "pixel_convert.h"
+    #include <boost/bind.hpp>
+    #include <boost/algorithm/string/case_conv.hpp>
 
     using namespace std;
 
@@ -100,6 +103,7 @@
     //-----------------------------------------------------------------------
     dc1394_get_image_size_from_video_mode(camera, video_mode, &width, &height);
 
+    UpdateFrameFormat();
     Start();
     }
 
@@ -263,6 +267,7 @@
     if( err != DC1394_SUCCESS )
         throw VideoException("[DC1394 ERROR]: Could not setup camera - check settings");
 
+    UpdateFrameFormat();
     Start();
 
     }
@@ -274,17 +279,21 @@
     {
         case DC1394_COLOR_CODING_RGB8 :    return "RGB24";
         case DC1394_COLOR_CODING_MONO8 :   return "GRAY8";
+        // IIDC transmits 16 bit data most significant byte first
+        case DC1394_COLOR_CODING_MONO16 :  return "GRAY16BE";
+        case DC1394_COLOR_CODING_RGB16 :   return "RGB48BE";
 
-    //        case DC1394_COLOR_CODING_MONO16 :  return "GRAY16LE";
-    //        case DC1394_COLOR_CODING_RGB16 :   return "RGB48LE";
     //        case DC1394_COLOR_CODING_MONO16S : return "GRAY16BE";
     //        case DC1394_COLOR_CODING_RGB16S :  return "RGB48BE";
 
-    //        case DC1394_COLOR_CODING_YUV411 :  return "YUV411P";
-    //        case DC1394_COLOR_CODING_YUV422 :  return "YUV422P";
+        // packed, chroma first, see ConvertYuv
+        case DC1394_COLOR_CODING_YUV411 :  return "UYYVYY411";
+        case DC1394_COLOR_CODING_YUV422 :  return "UYVY422";
     //        case DC1394_COLOR_CODING_YUV444 :  return "YUV444P";
-    //        case DC1394_COLOR_CODING_RAW8 :    return "RAW8";
-    //        case DC1394_COLOR_CODING_RAW16 :   return "RAW16";
+        // without the colour filter RAW8 / RAW16 are reported as RGGB,
+        // see FirewireVideo::PixFormat()
+        case DC1394_COLOR_CODING_RAW8 :    return "BAYER_RGGB8";
+        case DC1394_COLOR_CODING_RAW16 :   return "BAYER_RGGB16BE";
         default:
             throw VideoException("[DC1394 ERROR]: Unknown colour coding");
     }
@@ -294,18 +303,22 @@
     {
     if(     !coding.compare("RGB24"))    return DC1394_COLOR_CODING_RGB8;
     else if(!coding.compare("GRAY8"))    return DC1394_COLOR_CODING_MONO8;
+    else if(!coding.compare("GRAY16BE")) return DC1394_COLOR_CODING_MONO16;
+    else if(!coding.compare("RGB48BE"))  return DC1394_COLOR_CODING_RGB16;
 
-    //    else if(!coding.compare("GRAY16LE")) return DC1394_COLOR_CODING_MONO16;
-    //    else if(!coding.compare("RGB48LE"))  return DC1394_COLOR_CODING_RGB16;
     //    else if(!coding.compare("GRAY16BE")) return DC1394_COLOR_CODING_MONO16S;
     //    else if(!coding.compare("RGB48BE"))  return DC1394_COLOR_CODING_RGB16S;
 
     
-    //    else if(!coding.compare("YUV411P"))  return DC1394_COLOR_CODING_YUV411;
-    //    else if(!coding.compare("YUV422P"))  return DC1394_COLOR_CODING_YUV422;
+    else if(!coding.compare("UYYVYY411")) return DC1394_COLOR_CODING_YUV411;
+    else if(!coding.compare("UYVY422"))  return DC1394_COLOR_CODING_YUV422;
     //    else if(!coding.compare("YUV444P"))  return DC1394_COLOR_CODING_YUV444;
-    //    else if(!coding.compare("RAW8"))     return DC1394_COLOR_CODING_RAW8;
-    //    else if(!coding.compare("RAW16"))    return DC1394_COLOR_CODING_RAW16;
+    BayerPattern pattern;
+    int bits;
+    bool big_endian;
+    if( BayerFormatFromString(coding, pattern, bits, big_endian) ) {
+        return bits == 8 ? DC1394_COLOR_CODING_RAW8 : DC1394_COLOR_CODING_RAW16;
+    }
     throw VideoException("Unknown colour coding");
     }
 
@@ -394,6 +407,7 @@
 
     FirewireVideo::~FirewireVideo()
     {
+        StopEncoderPool();
         Stop();
         
         if(shutter_lookup_table) delete shutter_lookup_table;
@@ -411,9 +425,58 @@
     dc1394color_coding_t color_coding;
     dc1394_video_get_mode(camera,&video_mode);
     dc1394_get_color_coding_from_video_mode(camera,video_mode,&color_coding);
+
+    // raw sensor data, laid out according to the camera's colour filter
+    if( color_coding == DC1394_COLOR_CODING_RAW8 || color_coding == DC1394_COLOR_CODING_RAW16 )
+    {
+        dc1394color_filter_t filter = DC1394_COLOR_FILTER_RGGB;
+        if( video_mode >= DC1394_VIDEO_MODE_FORMAT7_0 ) {
+            dc1394_format7_get_color_filter(camera, video_mode, &filter);
+        }
+
+        BayerPattern pattern = BAYER_RGGB;
+        switch(filter)
+        {
+            case DC1394_COLOR_FILTER_GBRG : pattern = BAYER_GBRG; break;
+            case DC1394_COLOR_FILTER_GRBG : pattern = BAYER_GRBG; break;
+            case DC1394_COLOR_FILTER_BGGR : pattern = BAYER_BGGR; break;
+            default: break;
+        }
+        // IIDC transmits 16 bit data most significant byte first
+        return BayerFormatToString(pattern, color_coding == DC1394_COLOR_CODING_RAW8 ? 8 : 16, true);
+    }
+
     return Dc1394ColorCodingToString(color_coding);
     }
 
+    void FirewireVideo::UpdateFrameFormat()
+    {
+    frame_format = PixFormat();
+    sample_bits = FormatBitDepth(frame_format);
+
+    // 16 bit modes may carry fewer significant bits (msb aligned)
+    uint32_t depth = 0;
+    if( sample_bits == 16 && dc1394_video_get_data_depth(camera, &depth) == DC1394_SUCCESS
+        && depth > 8 && depth < 16 ) {
+        sample_bits = depth;
+    }
+
+    if( sample_bits > 8 ) {
+        cout << "[INFO]: " << frame_format << " frames with " << sample_bits << " significant bits" << endl;
+    }
+    }
+
+    float FirewireVideo::GetFramerate() const
+    {
+        dc1394framerate_t framerate;
+        float fps;
+        if( dc1394_video_get_framerate(camera, &framerate) != DC1394_SUCCESS
+            || dc1394_framerate_as_float(framerate, &fps) != DC1394_SUCCESS ) {
+            return 30;
+        }
+        return fps;
+    }
+
     size_t FirewireVideo::SizeBytes() const
     {
     return (Width() * Height() * VideoFormatFromString(PixFormat()).bpp) / 8;
@@ -539,6 +602,10 @@
     if (!d)
         throw VideoException("[DC1394 ERROR]: Failed to get 1394 bus");
     shutter_lookup_table = 0;
+    feature_refresh = 1.0;
+    exif_valid = false;
+    schedule_running = false;
+    RefreshFeatures();
     init_camera(guid.guid,dma_buffers,iso_speed,video_mode,framerate);
     }
 
@@ -556,6 +623,10 @@
     if (!d)
         throw VideoException("[DC1394 ERROR]: Failed to get 1394 bus");
     shutter_lookup_table = 0;
+    feature_refresh = 1.0;
+    exif_valid = false;
+    schedule_running = false;
+    RefreshFeatures();
     init_format7_camera(guid.guid,dma_buffers,iso_speed,video_mode,framerate,width,height,left,top, reset_at_boot);
     }
 
@@ -585,6 +656,10 @@
 
         dc1394_camera_free_list (list);
         shutter_lookup_table = 0;
+        feature_refresh = 1.0;
+        exif_valid = false;
+        schedule_running = false;
+        RefreshFeatures();
         init_camera(guid,dma_buffers,iso_speed,video_mode,framerate);
 
     }
@@ -617,6 +692,10 @@
 
     dc1394_camera_free_list (list);
     shutter_lookup_table = 0;
+    feature_refresh = 1.0;
+    exif_valid = false;
+    schedule_running = false;
+    RefreshFeatures();
     init_format7_camera(guid,dma_buffers,iso_speed,video_mode,framerate,width,height,left,top, reset_at_boot);
 
     }
@@ -741,32 +820,187 @@
         DC1394_FEATURE_CAPTURE_QUALITY
     };
         
+    /*-----------------------------------------------------------------------
+     *  FEATURE STATE CACHE
+     *-----------------------------------------------------------------------*/
+        
+    FeatureState& FirewireVideo::CachedFeature(dc1394feature_t feature) const {
+        return feature_state[feature - DC1394_FEATURE_MIN];
+    }
+        
+    bool FirewireVideo::CacheFresh(const FeatureState& state) const {
+        
+        // only we change manual features
+        if (state.mode == DC1394_FEATURE_MODE_MANUAL) return true;
+        
+        // camera may have changed auto features since they were read
+        if (feature_refresh < 0) return true;
+        return TimeDiff_s(state.read_time, TimeNow()) < feature_refresh;
+    }
+        
+    void FirewireVideo::InvalidateAutoFeatures() {
+        for (int i = 0; i < DC1394_FEATURE_NUM; i++) {
+            FeatureState& state = feature_state[i];
+            if (state.mode != DC1394_FEATURE_MODE_MANUAL) {
+                state.value_valid = false;
+                state.quant_valid = false;
+                state.wb_valid = false;
+            }
+        }
+    }
+        
+    void FirewireVideo::SetFeatureRefresh(double seconds){
+        feature_refresh = seconds;
+    }
+        
+    void FirewireVideo::RefreshFeatures(){
+        for (int i = 0; i < DC1394_FEATURE_NUM; i++) {
+            FeatureState& state = feature_state[i];
+            state.power = -1;
+            state.mode = -1;
+            state.absolute = -1;
+            state.modes_valid = false;
+            state.value_valid = false;
+            state.written_valid = false;
+            state.quant_valid = false;
+            state.wb_valid = false;
+        }
+    }
+        
+    void FirewireVideo::WriteFeaturePower(dc1394feature_t feature, bool on){
+        
+        FeatureState& state = CachedFeature(feature);
+        const int pwr = on ? DC1394_ON : DC1394_OFF;
+        if (state.power == pwr) return;
+        
+        err = dc1394_feature_set_power(camera, feature, on ? DC1394_ON : DC1394_OFF);
+        if (err != DC1394_SUCCESS) {
+            state.power = -1;
+            throw VideoException(on ? "[DC1394 ERROR]: Could not turn on " : "[DC1394 ERROR]: Could not turn off ", dc1394_feature_get_string(feature));
+        }
+        state.power = pwr;
+    }
+        
+    void FirewireVideo::WriteFeatureMode(dc1394feature_t feature, dc1394feature_mode_t mode){
+        
+        FeatureState& state = CachedFeature(feature);
+        if (state.mode == mode) return;
+        
+        err = dc1394_feature_set_mode(camera, feature, mode);
+        if (err != DC1394_SUCCESS) {
+            state.mode = -1;
+            throw VideoException("[DC1394 ERROR]: Could not set mode for ", dc1394_feature_get_string(feature));
+        }
+        state.mode = mode;
+        
+        // values now owned by camera (auto) or stale
+        state.value_valid = false;
+        state.written_valid = false;
+        state.quant_valid = false;
+        state.wb_valid = false;
+    }
+        
+    void FirewireVideo::WriteFeatureAbsolute(dc1394feature_t feature, bool on){
+        
+        FeatureState& state = CachedFeature(feature);
+        const int abs = on ? DC1394_ON : DC1394_OFF;
+        if (state.absolute == abs) return;
+        
+        err = dc1394_feature_set_absolute_control(camera, feature, on ? DC1394_ON : DC1394_OFF);
+        if (err != DC1394_SUCCESS) {
+            state.absolute = -1;
+            throw VideoException("[DC1394 ERROR]: Could not set absolute control for ", dc1394_feature_get_string(feature));
+        }
+        state.absolute = abs;
+    }
+        
+    void FirewireVideo::WriteFeatureAbsValue(dc1394feature_t feature, float value){
+        
+        FeatureState& state = CachedFeature(feature);
+        if (state.written_valid && state.written == value) return;
+        
+        err = dc1394_feature_set_absolute_value(camera, feature, value);
+        if (err != DC1394_SUCCESS) {
+            state.written_valid = false;
+            throw VideoException("[DC1394 ERROR]: Could set absolute value for ", dc1394_feature_get_string(feature));
+        }
+        
+        // camera rounds to its own step, read back lazily
+        state.written_valid = true;
+        state.written = value;
+        state.value_valid = false;
+        state.quant_valid = false;
+        
+        InvalidateAutoFeatures();
+    }
+        
+    void FirewireVideo::WriteFeatureQuant(dc1394feature_t feature, uint32_t value){
+        
+        FeatureState& state = CachedFeature(feature);
+        
+        // in auto mode the camera may move the value, so trust the cache
+        // only while it is fresh
+        const bool changed = !(state.quant_valid && state.quant == value);
+        if (!changed && CacheFresh(state)) return;
+        
+        err = dc1394_feature_set_value(camera, feature, value);
+        if (err != DC1394_SUCCESS) {
+            state.quant_valid = false;
+            throw VideoException("[DC1394 ERROR]: Could set quantised value for ", dc1394_feature_get_string(feature));
+        }
+        
+        state.quant_valid = true;
+        state.quant = value;
+        state.read_time = TimeNow();
+        state.value_valid = false;
+        state.written_valid = false;
+        
+        // rewriting the same value leaves auto features where they were
+        if (changed) InvalidateAutoFeatures();
+    }
+        
     void FirewireVideo::SetAllFeaturesAuto()
     {
                 
-    dc1394feature_modes_t modes;
-        
     for (int i = 0; i <= 22; i++){
         
         if(feature[i] == DC1394_FEATURE_TRIGGER || feature[i] == DC1394_FEATURE_TRIGGER_DELAY ){
-            dc1394_feature_set_power(camera, DC1394_FEATURE_TRIGGER, DC1394_OFF);       // these tend to break things so i've left them alone
-            dc1394_feature_set_power(camera, DC1394_FEATURE_TRIGGER_DELAY, DC1394_OFF); // these tend to break things so i've left them alone
+            if(CachedFeature(DC1394_FEATURE_TRIGGER).power != DC1394_OFF){
+                dc1394_feature_set_power(camera, DC1394_FEATURE_TRIGGER, DC1394_OFF);       // these tend to break things so i've left them alone
+                dc1394_feature_set_power(camera, DC1394_FEATURE_TRIGGER_DELAY, DC1394_OFF); // these tend to break things so i've left them alone
+                CachedFeature(DC1394_FEATURE_TRIGGER).power = DC1394_OFF;
+                CachedFeature(DC1394_FEATURE_TRIGGER_DELAY).power = DC1394_OFF;
+            }
             break;
         }
         
-        if( dc1394_feature_get_modes(camera, feature[i], &modes) != DC1394_SUCCESS){
-            throw VideoException("[DC1394 ERROR]: Could not get modes for feature ", dc1394_feature_get_string(feature[i]));
-        }
+        FeatureState& state = CachedFeature(feature[i]);
         
+        if( !state.modes_valid ){
+            if( dc1394_feature_get_modes(camera, feature[i], &state.modes) != DC1394_SUCCESS){
+                throw VideoException("[DC1394 ERROR]: Could not get modes for feature ", dc1394_feature_get_string(feature[i]));
+            }
+            state.modes_valid = true;
+        }
   
-        if (modes.modes[1] == DC1394_FEATURE_MODE_AUTO){
+        if (state.modes.modes[1] == DC1394_FEATURE_MODE_AUTO){
             
-            if( dc1394_feature_set_power(camera, feature[i], DC1394_ON) != DC1394_SUCCESS) {
-                break;
+            if( state.power != DC1394_ON ){
+                if( dc1394_feature_set_power(camera, feature[i], DC1394_ON) != DC1394_SUCCESS) {
+                    break;
+                }
+                state.power = DC1394_ON;
             }
             
-            if( dc1394_feature_set_mode(camera, feature[i], DC1394_FEATURE_MODE_AUTO) != DC1394_SUCCESS){
-                break;
+            if( state.mode != DC1394_FEATURE_MODE_AUTO ){
+                if( dc1394_feature_set_mode(camera, feature[i], DC1394_FEATURE_MODE_AUTO) != DC1394_SUCCESS){
+                    break;
+                }
+                state.mode = DC1394_FEATURE_MODE_AUTO;
+                state.value_valid = false;
+                state.written_valid = false;
+                state.quant_valid = false;
+                state.wb_valid = false;
             }
             
         }
@@ -780,29 +1014,45 @@
         
     void FirewireVideo::SetAllFeaturesManual(){
        
-        dc1394feature_modes_t modes;
-
         for (int i = 0; i <= 22; i++){
             
             if(feature[i] == DC1394_FEATURE_TRIGGER || feature[i] == DC1394_FEATURE_TRIGGER_DELAY ){
-                dc1394_feature_set_power(camera, DC1394_FEATURE_TRIGGER, DC1394_OFF);       // these tend to break things so i've left them alone
-                dc1394_feature_set_power(camera, DC1394_FEATURE_TRIGGER_DELAY, DC1394_OFF); // these tend to break things so i've left them alone
+                if(CachedFeature(DC1394_FEATURE_TRIGGER).power != DC1394_OFF){
+                    dc1394_feature_set_power(camera, DC1394_FEATURE_TRIGGER, DC1394_OFF);       // these tend to break things so i've left them alone
+                    dc1394_feature_set_power(camera, DC1394_FEATURE_TRIGGER_DELAY, DC1394_OFF); // these tend to break things so i've left them alone
+                    CachedFeature(DC1394_FEATURE_TRIGGER).power = DC1394_OFF;
+                    CachedFeature(DC1394_FEATURE_TRIGGER_DELAY).power = DC1394_OFF;
+                }
                 break;
             }
             
-            if (dc1394_feature_get_modes(camera, feature[i], &modes) != DC1394_SUCCESS) {
-                break;
+            FeatureState& state = CachedFeature(feature[i]);
+            
+            if( !state.modes_valid ){
+                if (dc1394_feature_get_modes(camera, feature[i], &state.modes) != DC1394_SUCCESS) {
+                    break;
+                }
+                state.modes_valid = true;
             }
             
         
-            if (modes.modes[0] == DC1394_FEATURE_MODE_MANUAL){
+            if (state.modes.modes[0] == DC1394_FEATURE_MODE_MANUAL){
                 
-                if (dc1394_feature_set_power(camera, feature[i], DC1394_ON) != DC1394_SUCCESS) {
-                    break;
+                if( state.power != DC1394_ON ){
+                    if (dc1394_feature_set_power(camera, feature[i], DC1394_ON) != DC1394_SUCCESS) {
+                        break;
+                    }
+                    state.power = DC1394_ON;
                 }
                 
-                if (dc1394_feature_set_mode(camera, feature[i], DC1394_FEATURE_MODE_MANUAL) != DC1394_SUCCESS) {
-                    break;
+                if( state.mode != DC1394_FEATURE_MODE_MANUAL ){
+                    if (dc1394_feature_set_mode(camera, feature[i], DC1394_FEATURE_MODE_MANUAL) != DC1394_SUCCESS) {
+                        break;
+                    }
+                    state.mode = DC1394_FEATURE_MODE_MANUAL;
+                    state.value_valid = false;
+                    state.quant_valid = false;
+                    state.wb_valid = false;
                 }
                 
             }
@@ -813,100 +1063,62 @@
         
     void FirewireVideo::SetFeatureAuto(dc1394feature_t feature){
         
-        err = dc1394_feature_set_power(camera, feature, DC1394_ON);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not turn on ", dc1394_feature_get_string(feature));
-        }
-        
-        err = dc1394_feature_set_mode(camera, feature, DC1394_FEATURE_MODE_AUTO);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not set auto mode for ", dc1394_feature_get_string(feature));
-        }
+        WriteFeaturePower(feature, true);
+        WriteFeatureMode(feature, DC1394_FEATURE_MODE_AUTO);
         
     }
 
     void FirewireVideo::SetFeatureManual(dc1394feature_t feature){
         
-        err = dc1394_feature_set_power(camera, feature, DC1394_ON);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not turn on ", dc1394_feature_get_string(feature));
-        }
-        
-        err = dc1394_feature_set_mode(camera, feature, DC1394_FEATURE_MODE_MANUAL);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not set manual mode for ", dc1394_feature_get_string(feature));
-        }
+        WriteFeaturePower(feature, true);
+        WriteFeatureMode(feature, DC1394_FEATURE_MODE_MANUAL);
         
     }
 
     void FirewireVideo::SetFeatureOn(dc1394feature_t feature){
         
-        err = dc1394_feature_set_power(camera, feature, DC1394_ON);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not turn on ", dc1394_feature_get_string(feature));
-        }
+        WriteFeaturePower(feature, true);
         
     }
 
     void FirewireVideo::SetFeatureOff(dc1394feature_t feature){
         
-        err = dc1394_feature_set_power(camera, feature, DC1394_OFF);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not turn off ", dc1394_feature_get_string(feature));
-        }
+        WriteFeaturePower(feature, false);
         
     }
 
     void FirewireVideo::SetFeatureValue(dc1394feature_t feature, float value){
         
-        SetFeatureOn(feature);
-        
-        err = dc1394_feature_set_mode(camera, feature, DC1394_FEATURE_MODE_MANUAL);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not set manual mode for ", dc1394_feature_get_string(feature));
-        }
-        
-        err = dc1394_feature_set_absolute_control(camera, feature, DC1394_ON);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not turn absolute mode off for ", dc1394_feature_get_string(feature));
-        }
-             
-        err = dc1394_feature_set_absolute_value(camera, feature, value);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could set absolute value for ", dc1394_feature_get_string(feature));
-        }
+        WriteFeaturePower(feature, true);
+        WriteFeatureMode(feature, DC1394_FEATURE_MODE_MANUAL);
+        WriteFeatureAbsolute(feature, true);
+        WriteFeatureAbsValue(feature, value);
         
     }
 
     void FirewireVideo::SetFeatureQuant(dc1394feature_t feature, int value){
         
-        err = dc1394_feature_set_mode(camera, feature, DC1394_FEATURE_MODE_MANUAL);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not set manual mode for ", dc1394_feature_get_string(feature));
-        }
-        
-        err = dc1394_feature_set_absolute_control(camera, feature, DC1394_OFF);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not turn absolute mode off for ", dc1394_feature_get_string(feature));
-        }
-        
-        err = dc1394_feature_set_value(camera, feature, value);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could set quantised value for ", dc1394_feature_get_string(feature));
-        }
+        WriteFeatureMode(feature, DC1394_FEATURE_MODE_MANUAL);
+        WriteFeatureAbsolute(feature, false);
+        WriteFeatureQuant(feature, value);
         
     }
 
     bool FirewireVideo::GetFeaturePower(dc1394feature_t feature){
         
-        dc1394switch_t pwr;
+        FeatureState& state = CachedFeature(feature);
         
-        err = dc1394_feature_get_power(camera, feature, &pwr);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could check if power on/off for feature ", dc1394_feature_get_string(feature));
+        if (state.power == -1) {
+            dc1394switch_t pwr;
+            
+            err = dc1394_feature_get_power(camera, feature, &pwr);
+            if (err != DC1394_SUCCESS) {
+                throw VideoException("[DC1394 ERROR]: Could check if power on/off for feature ", dc1394_feature_get_string(feature));
+            }
+            state.power = pwr;
         }
         
-        if(pwr == 1){
+        if(state.power == 1){
             return true;
         }
         return false;
@@ -914,14 +1126,20 @@
         
     int FirewireVideo::GetFeatureMode(dc1394feature_t feature) const{
         
-        dc1394feature_mode_t mode;
+        FeatureState& state = CachedFeature(feature);
         
-        err =  dc1394_feature_get_mode(camera, feature, &mode);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not check mode of feature ", dc1394_feature_get_string(feature));
+        // one push auto reverts to manual by itself
+        if (state.mode == -1 || state.mode == DC1394_FEATURE_MODE_ONE_PUSH_AUTO) {
+            dc1394feature_mode_t mode;
+            
+            err =  dc1394_feature_get_mode(camera, feature, &mode);
+            if (err != DC1394_SUCCESS) {
+                throw VideoException("[DC1394 ERROR]: Could not check mode of feature ", dc1394_feature_get_string(feature));
+            }
+            state.mode = mode;
         }
         
-        if (mode == 737){
+        if (state.mode == 737){
             return 0; // auto mode
         } 
         
@@ -930,27 +1148,37 @@
             
     float FirewireVideo::GetFeatureValue(dc1394feature_t feature) const {
        
-        float value;
+        FeatureState& state = CachedFeature(feature);
         
-        err = dc1394_feature_get_absolute_value(camera, feature, &value);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could set absolute value for ", dc1394_feature_get_string(feature));
+        if (!state.value_valid || !CacheFresh(state)) {
+            err = dc1394_feature_get_absolute_value(camera, feature, &state.value);
+            if (err != DC1394_SUCCESS) {
+                state.value_valid = false;
+                throw VideoException("[DC1394 ERROR]: Could set absolute value for ", dc1394_feature_get_string(feature));
+            }
+            state.value_valid = true;
+            state.read_time = TimeNow();
         }
 
-        return value;
+        return state.value;
         
     }
 
     int FirewireVideo::GetFeatureQuant(dc1394feature_t feature) const {
         
-        uint32_t value;
+        FeatureState& state = CachedFeature(feature);
         
-        err = dc1394_feature_get_value(camera, feature, &value);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not get quantised value for ", dc1394_feature_get_string(feature));
+        if (!state.quant_valid || !CacheFresh(state)) {
+            err = dc1394_feature_get_value(camera, feature, &state.quant);
+            if (err != DC1394_SUCCESS) {
+                state.quant_valid = false;
+                throw VideoException("[DC1394 ERROR]: Could not get quantised value for ", dc1394_feature_get_string(feature));
+            }
+            state.quant_valid = true;
+            state.read_time = TimeNow();
         }
         
-        return value;
+        return state.quant;
         
     }
 
@@ -1005,6 +1233,22 @@
         return min;
         
     }
+
+    void FirewireVideo::SetShutterQuant(int shutter) {
+        SetFeatureQuant(DC1394_FEATURE_SHUTTER, shutter);
+    }
+
+    void FirewireVideo::SetGainQuant(int gain) {
+        SetFeatureQuant(DC1394_FEATURE_GAIN, gain);
+    }
+
+    int FirewireVideo::GetShutterQuant() {
+        return GetFeatureQuant(DC1394_FEATURE_SHUTTER);
+    }
+
+    int FirewireVideo::GetGainQuant() {
+        return GetFeatureQuant(DC1394_FEATURE_GAIN);
+    }
                                            
     /*-----------------------------------------------------------------------
      *  WHITE BALANCE
@@ -1012,112 +1256,91 @@
         
     void FirewireVideo::SetSingleAutoWhiteBalance(){
 
+        FeatureState& state = CachedFeature(DC1394_FEATURE_WHITE_BALANCE);
+        
         err = dc1394_feature_set_mode(camera, DC1394_FEATURE_WHITE_BALANCE, DC1394_FEATURE_MODE_ONE_PUSH_AUTO);
         if (err != DC1394_SUCCESS) {
+            state.mode = -1;
             throw VideoException("[DC1394 ERROR]: Could not set manual white balance mode");
         }
+        state.mode = DC1394_FEATURE_MODE_ONE_PUSH_AUTO;
+        state.wb_valid = false;
     }
     
         
     void FirewireVideo::SetWhiteBalance(unsigned int Blue_U_val, unsigned int Red_V_val){
 
-        err = dc1394_feature_set_mode(camera, DC1394_FEATURE_WHITE_BALANCE, DC1394_FEATURE_MODE_MANUAL);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not set manual white balance mode");
-        }
+        FeatureState& state = CachedFeature(DC1394_FEATURE_WHITE_BALANCE);
+        
+        WriteFeatureMode(DC1394_FEATURE_WHITE_BALANCE, DC1394_FEATURE_MODE_MANUAL);
+        
+        if (state.wb_valid && state.wb_u_b == Blue_U_val && state.wb_v_r == Red_V_val) return;
 
         err = dc1394_feature_whitebalance_set_value(camera, Blue_U_val, Red_V_val);
         if (err != DC1394_SUCCESS) {
+            state.wb_valid = false;
             throw VideoException("[DC1394 ERROR]: Could not set white balance value");
         }
+        state.wb_valid = true;
+        state.wb_u_b = Blue_U_val;
+        state.wb_v_r = Red_V_val;
+        state.read_time = TimeNow();
 
     }
 
     void FirewireVideo::GetWhiteBalance(unsigned int *Blue_U_val, unsigned int *Red_V_val) {
 
-    err = dc1394_feature_whitebalance_get_value(camera,Blue_U_val, Red_V_val );
-    if( err != DC1394_SUCCESS )
-        throw VideoException("[DC1394 ERROR]: Failed to read white balance");
+    FeatureState& state = CachedFeature(DC1394_FEATURE_WHITE_BALANCE);
+    
+    if (!state.wb_valid || !CacheFresh(state)) {
+        err = dc1394_feature_whitebalance_get_value(camera, &state.wb_u_b, &state.wb_v_r );
+        if( err != DC1394_SUCCESS ) {
+            state.wb_valid = false;
+            throw VideoException("[DC1394 ERROR]: Failed to read white balance");
+        }
+        state.wb_valid = true;
+        state.read_time = TimeNow();
+    }
+    
+    *Blue_U_val = state.wb_u_b;
+    *Red_V_val = state.wb_v_r;
     }    
     
         
     int FirewireVideo::GetWhiteBalanceBlueU()
     {
-        uint32_t Blue_U_val, Red_V_val;
-        
-        err = dc1394_feature_whitebalance_get_value( camera, &Blue_U_val, &Red_V_val );
-        if( err != DC1394_SUCCESS )
-            throw VideoException("[DC1394 ERROR]: Failed to read white balance");
-
+        unsigned int Blue_U_val, Red_V_val;
+        GetWhiteBalance(&Blue_U_val, &Red_V_val);
         return Blue_U_val;
     }
         
     int FirewireVideo::GetWhiteBalanceRedV()
     {
-        uint32_t Blue_U_val, Red_V_val;
-        
-        err = dc1394_feature_whitebalance_get_value( camera, &Blue_U_val, &Red_V_val );
-        if( err != DC1394_SUCCESS )
-            throw VideoException("[DC1394 ERROR]: Failed to read white balance");
-        
+        unsigned int Blue_U_val, Red_V_val;
+        GetWhiteBalance(&Blue_U_val, &Red_V_val);
         return Red_V_val;
     }
 
     void FirewireVideo::ResetBrightness()
     {
-        err = dc1394_feature_set_power(camera, DC1394_FEATURE_BRIGHTNESS, DC1394_ON);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not set brightness feature on");
-        }
-        
-        err = dc1394_feature_set_absolute_control(camera, DC1394_FEATURE_BRIGHTNESS, DC1394_OFF);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not set absolute control for brightness off");
-        }
-        
-        err = dc1394_feature_set_value(camera, DC1394_FEATURE_BRIGHTNESS, 0);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not set absolute gamma value to 0");
-        }
-        
+        WriteFeaturePower(DC1394_FEATURE_BRIGHTNESS, true);
+        WriteFeatureAbsolute(DC1394_FEATURE_BRIGHTNESS, false);
+        WriteFeatureQuant(DC1394_FEATURE_BRIGHTNESS, 0);
     } 
     
     void FirewireVideo::ResetGamma()
     {
-        err = dc1394_feature_set_power(camera, DC1394_FEATURE_GAMMA, DC1394_ON);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not set gamma feature on");
-        }
-        
-        err = dc1394_feature_set_absolute_control(camera, DC1394_FEATURE_GAMMA, DC1394_ON);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not set absolute control for gamma");
-        }
-        
-        err = dc1394_feature_set_absolute_value(camera, DC1394_FEATURE_GAMMA, 1.0);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not set absolute gamma value to 1.0");
-        }
-        
+        WriteFeaturePower(DC1394_FEATURE_GAMMA, true);
+        WriteFeatureAbsolute(DC1394_FEATURE_GAMMA, true);
+        WriteFeatureAbsValue(DC1394_FEATURE_GAMMA, 1.0);
     } 
 
     void FirewireVideo::ResetHue()
     {
-        err = dc1394_feature_set_power(camera, DC1394_FEATURE_HUE, DC1394_ON);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not set hue feature on");
-        }
-        
-        err = dc1394_feature_set_absolute_control(camera, DC1394_FEATURE_HUE, DC1394_OFF);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not set absolute control for hue off");
-        }
-        
-        err = dc1394_feature_set_value(camera, DC1394_FEATURE_HUE, 2048);
-        if (err != DC1394_SUCCESS) {
-            throw VideoException("[DC1394 ERROR]: Could not set absolute hue value to 2048 i.e. 0");
-        }
-        
+        // 2048 i.e. 0
+        WriteFeaturePower(DC1394_FEATURE_HUE, true);
+        WriteFeatureAbsolute(DC1394_FEATURE_HUE, false);
+        WriteFeatureQuant(DC1394_FEATURE_HUE, 2048);
     } 
         
     /*-----------------------------------------------------------------------
@@ -1197,6 +1420,9 @@
             hdr_register = false;
             // reset shutter flags
             SetHDRShutterFlags(0,0,0,0); 
+
+            boost::mutex::scoped_lock lock(bracket_mutex);
+            schedule_running = false;
         }
         
         err = dc1394_set_control_register(camera, 0x1800, hdr_flags);
@@ -1238,6 +1464,9 @@
             throw VideoException("[DC1394 ERROR]: Could not set hdr shutter3 flags");
         }
         //cout << "[HDR]: Shutter 3 set to: " << shut3 << endl;
+        
+        boost::mutex::scoped_lock lock(bracket_mutex);
+        bracket_assembler.SetBanks(shut0, shut1, shut2, shut3);
     }
 
     void FirewireVideo::GetHDRShutterFlags(uint32_t &shut0, 
@@ -1304,6 +1533,56 @@
         */
     }
 
+    void FirewireVideo::SetHDRBank(int bank, uint32_t shutter, uint32_t gain)
+    {
+        if (bank < 0 || bank >= HDR_BANKS) {
+            throw VideoException("[DC1394 ERROR]: Invalid hdr bank");
+        }
+        if (dc1394_set_control_register(camera, IIDC_REG_HDR_SHUTTER[bank], 0x8000000 | shutter) != DC1394_SUCCESS) {
+            throw VideoException("[DC1394 ERROR]: Could not set hdr bank shutter flags");
+        }
+        if (dc1394_set_control_register(camera, IIDC_REG_HDR_GAIN[bank], 0x8000000 | gain) != DC1394_SUCCESS) {
+            throw VideoException("[DC1394 ERROR]: Could not set hdr bank gain flags");
+        }
+        
+        boost::mutex::scoped_lock lock(bracket_mutex);
+        bracket_assembler.SetBank(bank, shutter);
+    }
+        
+    void FirewireVideo::StartExposureSchedule(const ExposureSchedule& schedule)
+    {
+        ExposureStep b[HDR_BANKS];
+        for (int i = 0; i < HDR_BANKS; i++) {
+            b[i] = schedule.Bank(i);
+        }
+        
+        SetHDRGainFlags(b[0].gain, b[1].gain, b[2].gain, b[3].gain);
+        SetHDRShutterFlags(b[0].shutter, b[1].shutter, b[2].shutter, b[3].shutter);
+        
+        {
+            boost::mutex::scoped_lock lock(bracket_mutex);
+            exposure_schedule = schedule;
+            schedule_running = true;
+        }
+        
+        SetHDRRegister(true);
+    }
+        
+    int FirewireVideo::ReadExposureStep(unsigned char* image, std::vector<BankWrite>& writes)
+    {
+        const uint32_t shutter = ReadMetaWord(image, META_SHUTTER);
+        const uint32_t gain = ReadMetaWord(image, META_GAIN);
+        
+        boost::mutex::scoped_lock lock(bracket_mutex);
+        writes.clear();
+        if (!schedule_running) return -1;
+        
+        if (meta_data_flags & META_FRAME_COUNTER) {
+            return exposure_schedule.OnFrame(shutter, gain, ReadMetaWord(image, META_FRAME_COUNTER), writes);
+        }
+        return exposure_schedule.OnFrame(shutter, gain, writes);
+    }
+        
     void FirewireVideo::ReadMetaData( unsigned char *image, MetaData *metaData ) {
         
     uint8_t* data = (uint8_t*)image;
@@ -1367,6 +1646,27 @@
 
     }
 
+    void FirewireVideo::ReadFrameInfo( unsigned char *image, int step, int stream, PvnFrameInfo& info ) {
+        
+        MetaData meta;
+        memset(&meta, 0, sizeof(meta));
+        ReadMetaData(image, &meta);
+        
+        info = PvnFrameInfo();
+        info.stream = stream;
+        info.schedule_step = step;
+        info.meta_flags = meta.flags;
+        info.timestamp = meta.timestamp;
+        info.frame_count = meta.frame_count;
+        info.shutter_quant = meta.shutterQuant;
+        info.gain = meta.gain;
+        info.shutter_abs = meta.shutterAbs;
+        info.brightness = meta.brightness;
+        info.auto_exposure = meta.auto_exposure;
+        info.whitebalance_u_b = meta.whitebalance_u_b;
+        info.whitebalance_v_r = meta.whitebalance_v_r;
+    }
+
     float FirewireVideo::ReadShutter( unsigned char *image ) {
         
         uint8_t* data = (uint8_t*)image;
@@ -1391,6 +1691,53 @@
         return ret;
     }
    
+    uint32_t FirewireVideo::ReadMetaWord( unsigned char *image, uint32_t flag ){
+        
+        if( !(meta_data_flags & flag) ) return 0;
+        
+        // words are stored in flag order, so offset is number of enabled flags below
+        int offset = 0;
+        for (uint32_t f = 1; f < flag; f <<= 1) {
+            if(meta_data_flags & f) offset++;
+        }
+        
+        uint8_t* data = (uint8_t*)image + 4*offset;
+        return data[3] + (data[2] << 8) + (data[1] << 16) + (data[0] << 24);
+    }
+        
+    int FirewireVideo::ReadHDRExposure( unsigned char *image ){
+        boost::mutex::scoped_lock lock(bracket_mutex);
+        return bracket_assembler.Exposure(ReadMetaWord(image, META_SHUTTER));
+    }
+        
+    bool FirewireVideo::AddHDRFrame( unsigned char *image, int frame_number ){
+        
+        if( !(meta_data_flags & META_SHUTTER) || !(meta_data_flags & META_FRAME_COUNTER) ){
+            throw VideoException("[DC1394 ERROR]: Shutter and frame counter meta data required for HDR brackets");
+        }
+        
+        boost::mutex::scoped_lock lock(bracket_mutex);
+        HDRBracket bracket;
+        if( bracket_assembler.Push(ReadMetaWord(image, META_SHUTTER),
+                                   ReadMetaWord(image, META_FRAME_COUNTER),
+                                   frame_number, bracket) ){
+            hdr_brackets.push_back(bracket);
+            return true;
+        }
+        return false;
+    }
+        
+    void FirewireVideo::ResetHDRBrackets(){
+        boost::mutex::scoped_lock lock(bracket_mutex);
+        bracket_assembler.Reset();
+        hdr_brackets.clear();
+    }
+        
+    std::vector<HDRBracket> FirewireVideo::GetHDRBrackets(){
+        boost::mutex::scoped_lock lock(bracket_mutex);
+        return hdr_brackets;
+    }
+   
     uint32_t FirewireVideo::ReadTimeStamp( unsigned char *image ){
         
         uint8_t* data = (uint8_t*)image;
@@ -1552,6 +1899,111 @@
         
     }
 
+    // Shutter settle detection. Register writes take up to 3 frames to reach
+    // the sensor, and a capture thread may hold frames exposed before them.
+    // A stable run must outlast the auto exposure loop stepping once.
+    const int SETTLE_SKIP_FRAMES = 3;
+    const int SETTLE_STABLE_FRAMES = 4;
+    const int SETTLE_MAX_FRAMES = 30;
+
+    uint32_t FirewireVideo::WaitForShutterSettle(VideoInterface& source, unsigned char* image,
+                                                 int stable_frames, int skip_frames, int max_frames)
+    {
+        if( !(meta_data_flags & META_SHUTTER) ){
+            throw VideoException("[DC1394 ERROR]: Shutter meta data required for settle detection");
+        }
+        
+        uint32_t shutter = 0;
+        int stable = 0;
+        
+        for( int frames = 0; frames < max_frames; frames++ ){
+            
+            // a failed grab counts too, so a stopped source can't hang us
+            if( !source.GrabNewest(image, true) ) continue;
+            
+            if( skip_frames > 0 ){
+                skip_frames--;
+                continue;
+            }
+            
+            const uint32_t s = ReadMetaWord(image, META_SHUTTER) & 0xfff;
+            stable = (stable > 0 && s == shutter) ? stable + 1 : 1;
+            shutter = s;
+            
+            if( stable >= stable_frames ) return shutter;
+        }
+        
+        cout << "[HDR]: Shutter did not settle within " << max_frames << " frames" << endl;
+        return shutter;
+    }
+        
+    bool FirewireVideo::ComputeBracketShutters(uint32_t base_shutter, const float ev[], int n, uint32_t shutter[])
+    {
+        if( shutter_abs_map.empty() ) return false;
+        
+        // +1 EV doubles exposure time
+        const float base = GetShutterMapAbs(base_shutter);
+        const float longest = shutter_quant_map.rbegin()->first;
+        
+        for (int i = 0; i < n; i++){
+            const float t = base * pow(2.0f, ev[i]);
+            shutter[i] = t >= longest ? shutter_quant_map.rbegin()->second : GetShutterMapQuant(t);
+        }
+        return true;
+    }
+        
+    void FirewireVideo::CalibrateBracket(VideoInterface& source, unsigned char* image, const float ev[], int n, uint32_t shutter[])
+    {
+        // source may still hold frames exposed before auto shutter was enabled
+        const uint32_t base = WaitForShutterSettle(source, image, SETTLE_STABLE_FRAMES, SETTLE_SKIP_FRAMES, SETTLE_MAX_FRAMES);
+        
+        if( !ComputeBracketShutters(base, ev, n, shutter) ){
+            
+            // no shutter map, let auto exposure find each shutter
+            const float EV = GetFeatureValue(DC1394_FEATURE_EXPOSURE);
+            for (int i = 0; i < n; i++){
+                SetFeatureValue(DC1394_FEATURE_EXPOSURE, EV + ev[i]);
+                shutter[i] = WaitForShutterSettle(source, image, SETTLE_STABLE_FRAMES, SETTLE_SKIP_FRAMES, 2*SETTLE_MAX_FRAMES);
+            }
+            SetFeatureValue(DC1394_FEATURE_EXPOSURE, EV);
+        }
+        
+        for (int i = 0; i < n; i++){
+            cout << "> " << ev[i] << " EV: shutter " << shutter[i] << endl;
+        }
+    }
+        
+    dc1394video_frame_t* FirewireVideo::GrabOneShotSettled(int expected_shutter)
+    {
+        const int max_tries = 10;
+        uint32_t last = 0xffffffff;
+        dc1394video_frame_t *frame = NULL;
+        
+        for (int tries = 0; tries < max_tries; tries++){
+            
+            if(dc1394_video_set_one_shot( camera, DC1394_ON ) != DC1394_SUCCESS)
+                throw VideoException("[DC1394 ERROR]: Could not set one shot mode");
+            
+            if(dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_WAIT, &frame) != DC1394_SUCCESS)
+                throw VideoException("[DC1394 ERROR]: Could not dequeue frame");
+            
+            if( !frame || !(meta_data_flags & META_SHUTTER) ) return frame;
+            
+            // exposed with requested shutter, or auto exposure stable between shots
+            const uint32_t s = ReadMetaWord(frame->image, META_SHUTTER) & 0xfff;
+            if( expected_shutter >= 0 ? s == (uint32_t)expected_shutter : s == last ) return frame;
+            last = s;
+            
+            if( tries == max_tries-1 ) break;
+            
+            if(dc1394_capture_enqueue(camera, frame) != DC1394_SUCCESS)
+                throw VideoException("[DC1394 ERROR]: Could not enqueue frame");
+        }
+        
+        cout << "[INFO]: Shutter did not settle after " << max_tries << " one-shot frames" << endl;
+        return frame;
+    }
+        
     void FirewireVideo::CaptureHDRFrame(unsigned char* image, int n, uint32_t shutter[])
     {
  
@@ -1564,16 +2016,15 @@
         // discard images from DMA buffer
         FlushDMABuffer();
         
-        // embed to hdr register shutter values (abs->quant)
-        SetHDRShutterFlags(
-                           shutter[0],
-                           shutter[0],
-                           shutter[1],
-                           shutter[2]
-                           );
-    
-        // turn hdr register on
-        SetHDRRegister(true);
+        // one schedule step per frame at current gain
+        const uint32_t gain = GetFeatureQuant(DC1394_FEATURE_GAIN);
+        std::vector<ExposureStep> steps;
+        for (int i = 0; i < n; i++) {
+            steps.push_back(ExposureStep(shutter[i], gain));
+        }
+        
+        // program hdr banks and turn hdr register on
+        StartExposureSchedule(ExposureSchedule(steps));
         
         // enable multi-shot mode
         SetMultiShotOn(n);
@@ -1596,18 +2047,46 @@
         
         boost::thread_group thread_group;
 
+        // deeper formats are merged from 16 bit ppm, which carries no exif,
+        // through an hdrgen script of exposures read from the frames
+        const bool high_precision = sample_bits > 8;
+        string merge_input = "pfsinme ./hdr-image/jpeg/*1.jpeg ./hdr-image/jpeg/*2.jpeg";
+        string calibrate_bits;
+        FILE* hdrgen = NULL;
+        if( high_precision ){
+            mkdir("hdr-image", 0755);
+            hdrgen = fopen("./hdr-image/image.hdrgen", "w");
+            if( !hdrgen )
+                throw VideoException("[HDR]: Could not create hdrgen script");
+            merge_input = "pfsinhdrgen ./hdr-image/image.hdrgen";
+            stringstream bits;
+            bits << " -b " << sample_bits;
+            calibrate_bits = bits.str();
+        }
+
         // save each frame to jpeg and return frames to dma to requeue the buffer
         for(int i = 0; i < n; i++){
             if(frame[i]){
 
+                // first frame is left out, as by the jpeg merge
+                if( hdrgen && i > 0 ){
+                    MetaData metaData;
+                    ReadMetaData(frame[i]->image, &metaData);
+                    char *padded = PadNumber(i);
+                    WriteHDRGEN(hdrgen, (string("./hdr-image/ppm/image") + padded + ".ppm").c_str(), ExposureTime(metaData));
+                    delete[] padded;
+                }
+
                 // add to thread group
-                thread_group.create_thread(boost::bind(&FirewireVideo::SaveFile, this, i, *frame[i], "hdr-image", true)); 
+                thread_group.create_thread(boost::bind(&FirewireVideo::SaveFile, this, i, *frame[i], "hdr-image", !high_precision)); 
                 
                 if(dc1394_capture_enqueue(camera, frame[i]) != DC1394_SUCCESS)
                     throw VideoException("[DC1394 ERROR]: Could not enqueue frame");
             }
         }
     
+        if( hdrgen ) fclose(hdrgen);
+
         cout << "[HDR]: Generating HDR frame" << endl;
 
         char time_stamp[32];
@@ -1640,20 +2119,20 @@
 
             // don't create radiance map
             //                    && rm -rf ./hdr-image/jpeg 
-            sprintf(command, "pfsinme ./hdr-image/jpeg/*1.jpeg ./hdr-image/jpeg/*2.jpeg\
-                    | pfshdrcalibrate -f ./config/camera.response \
+            sprintf(command, "%s\
+                    | pfshdrcalibrate%s -f ./config/camera.response \
                     | pfstmo_%s | pfsoutimgmagick -q 100 ./hdr-image/%s \
                     && echo '[HDR]: HDR frame generated: ./hdr-image/%s'", 
-                    tmo, output, output);
+                    merge_input.c_str(), calibrate_bits.c_str(), tmo, output, output);
             } else {
                 // && rm -rf ./hdr-image/jpeg 
-                sprintf(command, "pfsinme ./hdr-image/jpeg/*1.jpeg ./hdr-image/jpeg/*2.jpeg\
-                        | pfshdrcalibrate -f ./config/camera.response \
+                sprintf(command, "%s\
+                        | pfshdrcalibrate%s -f ./config/camera.response \
                         | pfsoutrgbe ./hdr-image/%s.rgbe \
                         && pfsinrgbe ./hdr-image/%s.rgbe \
                         | pfstmo_%s | pfsoutimgmagick -q 100 ./hdr-image/%s \
                         && echo '[HDR]: HDR frame generated: ./hdr-image/%s'", 
-                        time_stamp, time_stamp, tmo, output, output);
+                        merge_input.c_str(), calibrate_bits.c_str(), time_stamp, time_stamp, tmo, output, output);
             }
             
         }
@@ -1663,21 +2142,21 @@
 
                 // don't create radiance map
                 //                        && rm -rf ./hdr-image/jpeg 
-                sprintf(command, "pfsinme ./hdr-image/jpeg/*1.jpeg ./hdr-image/jpeg/*2.jpeg\
-                        | pfshdrcalibrate -f ./config/camera.response \
+                sprintf(command, "%s\
+                        | pfshdrcalibrate%s -f ./config/camera.response \
                         | pfstmo_%s | pfsoutimgmagick -q 100 ./hdr-image/%s \
                         && echo '[HDR]: HDR frame generated: ./hdr-image/%s'", 
-                        tmo, output, output);
+                        merge_input.c_str(), calibrate_bits.c_str(), tmo, output, output);
             }
             else {
                 //                        && rm -rf ./hdr-image/jpeg 
-                sprintf(command, "pfsinme ./hdr-image/jpeg/*1.jpeg ./hdr-image/jpeg/*2.jpeg\
-                        | pfshdrcalibrate -f ./config/camera.response \
+                sprintf(command, "%s\
+                        | pfshdrcalibrate%s -f ./config/camera.response \
                         | pfsoutexr ./hdr-image/%s.exr \
                         && pfsinexr ./hdr-image/%s.exr \
                         | pfstmo_%s | pfsoutimgmagick -q 100 ./hdr-image/%s \
                         && echo '[HDR]: HDR frame generated: ./hdr-image/%s'", 
-                        time_stamp, time_stamp, tmo, output, output);
+                        merge_input.c_str(), calibrate_bits.c_str(), time_stamp, time_stamp, tmo, output, output);
             }
                     
             
@@ -1692,7 +2171,6 @@
             ){
             char filename[256];
             char convert_filename[256];
-            char delete_command[256];
             
             sprintf(filename, "./hdr-image/%s", output);
             
@@ -1703,9 +2181,7 @@
                     );
             
             CopyFormatToFormat(filename, convert_filename);
-            
-            sprintf(delete_command, "rm -rf %s", filename);
-            system(delete_command);
+            remove(filename);
             
             cout << "[SAVE]: " << GetConfigValue("NORMAL_IMAGE_FORMAT").c_str() << " image saved to " << convert_filename << endl;
         }
@@ -1736,30 +2212,48 @@
             
             // create directories
             mkdir("single-frames", 0755);
-            mkdir("single-frames/jpeg/", 0755);
             
             // get time stamp
             GetTimeStamp(date_time);
+            
+            std::vector<unsigned char> rgb;
+            unsigned char* pixels = SaveBuffer(frame->image, frame->size[0], frame->size[1], rgb);
+
+            // configured png or tiff is written directly in place of jpeg
+            const ImageFileFormat direct_format = NormalImageFormat();
+            if( direct_format != IMAGE_FILE_UNKNOWN && direct_format != IMAGE_FILE_JPEG ){
+                const string format = GetConfigValue("NORMAL_IMAGE_FORMAT");
+                char direct_dir[256];
+                
+                sprintf(direct_dir, "./single-frames/%s", format.c_str());
+                mkdir(direct_dir, 0755);
+                sprintf(filename, "./single-frames/%s/%s.%s", format.c_str(), date_time, format.c_str());
+                
+                if( CreateImageFile(direct_format, pixels, frame->size[0], frame->size[1], filename) ){
+                    cout << "[SAVE]: " << format << " image saved to " << filename << endl;
+                }
+                return;
+            }
+            
+            mkdir("single-frames/jpeg/", 0755);
             // create filename
             sprintf(filename, "./single-frames/jpeg/%s%s", date_time, ".jpeg");
             
-            CreateJPEG(frame->image, frame->size[0], frame->size[1], filename);
+            ExifBuilder exif;
             ReadMetaData(frame->image, &metaData);
+            BuildExif(metaData, exif);
             
-            // write exif data from image meta data if abs table exists, else get from camera
-            !shutter_abs_map.empty() 
-            ? WriteExifDataFromImageMetaData(&metaData, filename)
-            : WriteExifData(this, filename);
+            CreateJPEG(pixels, frame->size[0], frame->size[1], filename, &exif.Build());
            
+            // formats without a direct writer are converted through image magick
             if (
                 CheckConfigLoaded() 
-                && strcmp(GetConfigValue("NORMAL_IMAGE_FORMAT").c_str(), "jpeg")
+                && direct_format == IMAGE_FILE_UNKNOWN
                 && strcmp(GetConfigValue("NORMAL_IMAGE_FORMAT").c_str(), "ppm")
                 ){
                 
                 char convert_dir[256];
                 char convert_filename[256];
-                char delete_command[256];
                 
                 sprintf(convert_dir, "./single-frames/%s", GetConfigValue("NORMAL_IMAGE_FORMAT").c_str());
                 mkdir(convert_dir, 0755);
@@ -1771,9 +2265,7 @@
                         );
                 
                 CopyFormatToFormat(filename, convert_filename);
-                
-                sprintf(delete_command, "rm -rf %s", filename);
-                system(delete_command);
+                remove(filename);
                 
                 cout << "[SAVE]: " << GetConfigValue("NORMAL_IMAGE_FORMAT").c_str() << " image saved to " << convert_filename << endl;
             }
@@ -1791,16 +2283,50 @@
                                  const char* folder, 
                                  bool jpeg
                                  )
+    {
+        return SaveImage(frame_number, frame.image, frame.size[0], frame.size[1], folder, jpeg);
+    }
+
+    bool FirewireVideo::SaveImage(
+                                 int frame_number,
+                                 unsigned char* image,
+                                 unsigned w, unsigned h,
+                                 const char* folder,
+                                 bool jpeg
+                                 )
     {
         char filename[128];
         char dir[128];
-        MetaData metaData;
 
         // create top directory
         mkdir(folder, 0755);
         
         char *padded_frame_number = PadNumber(frame_number);
 
+        // ppm of deeper formats keeps the full sample precision for the merge
+        const bool ppm16 = !jpeg && sample_bits > 8;
+
+        // meta data is read from the raw image, pixels from the converted one
+        std::vector<unsigned char> rgb;
+        unsigned char* pixels = ppm16 ? image : SaveBuffer(image, w, h, rgb);
+
+        // configured png or tiff is written directly in place of jpeg/ppm
+        const ImageFileFormat direct_format = NormalImageFormat();
+        if( !ppm16 && direct_format != IMAGE_FILE_UNKNOWN && direct_format != IMAGE_FILE_JPEG ){
+            
+            const string format = GetConfigValue("NORMAL_IMAGE_FORMAT");
+            sprintf(dir, "%s/%s", folder, format.c_str());
+            mkdir(dir, 0755);
+            
+            sprintf(filename, "./%s/%s/%s%s.%s", folder, format.c_str(), "image", padded_frame_number, format.c_str());
+            delete[] padded_frame_number;
+            
+            if( jpeg_pool ){
+                return jpeg_pool->Encode(pixels, w, h, filename, NULL, JpegWrittenCallback(), direct_format);
+            }
+            return CreateImageFile(direct_format, pixels, w, h, filename);
+        }
+
         // save to jpeg or ppm
         if( jpeg ){  
             
@@ -1809,15 +2335,22 @@
             mkdir(dir, 0755);
             
             sprintf(filename, "./%s/jpeg/%s%s%s", folder, "image", padded_frame_number, ".jpeg");
-           
-            CreateJPEG(frame.image, frame.size[0], frame.size[1], filename);
-            ReadMetaData(frame.image, &metaData);
+            delete[] padded_frame_number;
 
-            // write exif data from image meta data if abs table exists, else from camera
-            !shutter_abs_map.empty() 
-            ? WriteExifDataFromImageMetaData(&metaData, filename)
-            : WriteExifData(this, filename);
+            // exif is written with the jpeg, avoiding a second pass over the file
+            MetaData metaData;
+            ExifBuilder exif;
+            ReadMetaData(image, &metaData);
+            BuildExif(metaData, exif);
+
+            if( jpeg_pool ){
+                // any conversion follows on the worker once written
+                return jpeg_pool->Encode(pixels, w, h, filename, &exif.Build(),
+                                         boost::bind(&FirewireVideo::FinishImage, this, _1,
+                                                     string(folder), frame_number));
+            }
 
+            CreateJPEG(pixels, w, h, filename, &exif.Build());
         } 
         else{   
             
@@ -1827,40 +2360,173 @@
             
             // create path for ppm
             sprintf(filename, "./%s/ppm/%s%s%s", folder, "image", padded_frame_number, ".ppm");
+            delete[] padded_frame_number;
             
-            CreatePPM(frame.image, frame.size[0], frame.size[1], filename);
+            if( ppm16 ){
+                std::vector<uint16_t> rgb48((size_t)w * h * 3);
+                ConvertToRGB48(image, w, h, frame_format, &rgb48[0], SaveDemosaicMethod());
+                CreatePPM16(&rgb48[0], w, h, filename);
+            }else{
+                CreatePPM(pixels, w, h, filename);
+            }
             // cout << "[SAVE]: PPM image saved to " << filename << endl;
             
         }
+
+        FinishImage(filename, folder, frame_number);
+        return true;
+    }
+
+    unsigned char* FirewireVideo::SaveBuffer(unsigned char* image, unsigned w, unsigned h, std::vector<unsigned char>& rgb)
+    {
+        if( !frame_format.compare("RGB24") ) {
+            return image;
+        }
+
+        rgb.resize((size_t)w * h * 3);
+        ConvertToRGB24(image, w, h, frame_format, &rgb[0], SaveDemosaicMethod());
+        return &rgb[0];
+    }
+
+    DemosaicMethod FirewireVideo::SaveDemosaicMethod()
+    {
+        if( CheckConfigLoaded() && !GetConfigValue("DEMOSAIC_METHOD").empty() ) {
+            return DemosaicMethodFromString(GetConfigValue("DEMOSAIC_METHOD"));
+        }
+        return DEMOSAIC_MHC;
+    }
+
+    float FirewireVideo::ExposureTime(const MetaData& metaData) const
+    {
+        return !shutter_abs_map.empty()
+             ? metaData.shutterAbs
+             : GetFeatureValue(DC1394_FEATURE_SHUTTER);
+    }
+
+    void FirewireVideo::WriteHDRGEN(FILE* hdrgen, const char* path, float exposure)
+    {
+        // aperture and iso as written to the exif of jpeg frames
+        fprintf(hdrgen, "%s %f %2.2f %d 0\n", path, 1/exposure, 7.0/5.0, 100);
+    }
+
+    void FirewireVideo::BuildExif(const MetaData& metaData, ExifBuilder& exif) const
+    {
+        exif.SetMake(GetCameraVendor());
+        exif.SetModel(GetCameraModel());
+        exif.SetFNumber(7, 5); // hard coded -- change to config file later
+        exif.SetColorSpace(1); // sRGB
+
+        // exposure from image meta data if abs table exists, else from camera
+        exif.SetExposureTime(ExposureTime(metaData));
+
+        // camera settings from the snapshot when registers are owned by
+        // another thread, as the feature cache isn't safe to read here
+        {
+            boost::mutex::scoped_lock lock(exif_mutex);
+            if( exif_valid ){
+                exif.SetExposureBias(exif_exposure_bias);
+                exif.SetWhiteBalance(exif_white_balance);
+            }else{
+                exif.SetExposureBias(GetFeatureValue(DC1394_FEATURE_EXPOSURE));
+                exif.SetWhiteBalance(GetFeatureMode(DC1394_FEATURE_WHITE_BALANCE));
+            }
+        }
+
+        if( meta_data_flags & META_GAIN ){
+            exif.SetGainControl(metaData.gain > 0 ? 1 : 0);
+        }
+    }
+
+    void FirewireVideo::RefreshExifSettings()
+    {
+        const float exposure_bias = GetFeatureValue(DC1394_FEATURE_EXPOSURE);
+        const int white_balance = GetFeatureMode(DC1394_FEATURE_WHITE_BALANCE);
+
+        boost::mutex::scoped_lock lock(exif_mutex);
+        exif_exposure_bias = exposure_bias;
+        exif_white_balance = white_balance;
+        exif_valid = true;
+    }
+
+    void FirewireVideo::FinishImage(
+                                 const std::string& filename,
+                                 std::string folder,
+                                 int frame_number
+                                 )
+    {
+        // formats without a direct writer are converted through image magick
         if (
             CheckConfigLoaded() 
-            && strcmp(GetConfigValue("NORMAL_IMAGE_FORMAT").c_str(), "jpeg")
+            && NormalImageFormat() == IMAGE_FILE_UNKNOWN
             && strcmp(GetConfigValue("NORMAL_IMAGE_FORMAT").c_str(), "ppm")
             ){
             
             char convert_dir[256];
             char convert_filename[256];
-            char delete_command[256];
+            char *padded_frame_number = PadNumber(frame_number);
                
-            sprintf(convert_dir, "%s/%s", folder, GetConfigValue("NORMAL_IMAGE_FORMAT").c_str());
+            sprintf(convert_dir, "%s/%s", folder.c_str(), GetConfigValue("NORMAL_IMAGE_FORMAT").c_str());
             mkdir(convert_dir, 0755);
             
-            sprintf(convert_filename, "./%s/%s/%s%s.%s", folder, 
+            sprintf(convert_filename, "./%s/%s/%s%s.%s", folder.c_str(), 
                     GetConfigValue("NORMAL_IMAGE_FORMAT").c_str(), 
                     "image", 
                     padded_frame_number,
                     GetConfigValue("NORMAL_IMAGE_FORMAT").c_str()
                     );
+            delete[] padded_frame_number;
 
-            CopyFormatToFormat(filename, convert_filename);
-         
-            sprintf(delete_command, "rm -rf %s", filename);
-            system(delete_command);
+            CopyFormatToFormat(filename.c_str(), convert_filename);
+            remove(filename.c_str());
         }
+    }
 
-        return true;
+    ImageFileFormat FirewireVideo::NormalImageFormat()
+    {
+        if( !CheckConfigLoaded() ) return IMAGE_FILE_UNKNOWN;
+        
+        return ImageFileFormatFromString(
+                                         GetConfigValue("NORMAL_IMAGE_FORMAT"),
+                                         GetConfigValue("NORMAL_TIFF_COMPRESSION") == "lzw"
+                                         );
+    }
+
+    void FirewireVideo::StartEncoderPool(int workers, size_t queue_size, JpegQueuePolicy policy)
+    {
+        StopEncoderPool();
+        jpeg_pool.reset(new JpegEncoderPool(workers, queue_size, policy));
     }
+
+    void FirewireVideo::StopEncoderPool()
+    {
+        if( jpeg_pool ){
+            jpeg_pool->Stop();
+            cout << "[SAVE]: " << jpeg_pool->FramesEncoded() << " images encoded, "
+                 << jpeg_pool->FramesDropped() << " dropped, "
+                 << jpeg_pool->FramesFailed() << " failed" << endl;
+            jpeg_pool.reset();
+        }
+    }
+        
+    string FirewireVideo::GetVideoOutputUri(const string& folder, const string& name, bool hdr, float fps)
+    {
+        // defaults match the formats previously produced by convert/mencoder
+        string format = hdr ? "avi" : "mpeg";
+        string codec;
         
+        if (CheckConfigLoaded()){
+            format = GetConfigValue(hdr ? "HDR_VIDEO_FORMAT" : "NORMAL_VIDEO_FORMAT");
+            codec = GetConfigValue(hdr ? "HDR_VIDEO_CODEC" : "NORMAL_VIDEO_CODEC");
+        }
+        
+        stringstream uri;
+        uri << "ffmpeg:[fps=" << fps;
+        if( !codec.empty() ) uri << ",codec=" << codec;
+        uri << "]//./" << folder << "/" << name << "." << boost::algorithm::to_lower_copy(format);
+        
+        return uri.str();
+    }
+
     void FirewireVideo::SaveVideo(){
         
         cout << "[VIDEO]: Processing video" << endl;
@@ -1902,7 +2568,7 @@
 
     }
         
-    void FirewireVideo::SaveHDRVideo(int frame_number){
+    void FirewireVideo::SaveHDRVideo(std::vector<HDRBracket> brackets){
         
         // temp directories for jpeg intermediate outputs
         mkdir("./hdr-video/temp-jpeg/", 0755);
@@ -1910,6 +2576,7 @@
         char time_stamp[64];
         char convert_command[1024];
         char video_command[1024];
+        char temp_filename[256];
         char *tmo;
         string format;
         
@@ -1922,37 +2589,88 @@
             format = "avi";
         }
         
-        int j = 0;
+        GetTimeStamp(time_stamp);
+        
+        // encode tone mapped frames in process as they are produced
+        VideoOutput output;
+        unsigned char* tonemapped = NULL;
+        try {
+            output.Open(GetVideoOutputUri("hdr-video", string(time_stamp) + "-" + tmo, true, 15));
+            output.SetStream(width, height, "RGB24", 15);
+            tonemapped = new unsigned char[width * height * 3];
+        } catch (VideoException& e) {
+            cout << "[HDR]: " << e.what() << " - using external encoder" << endl;
+            output.Reset();
+        }
         
-        for ( int i = 0 ; i < frame_number-1 ; i++){
+        for ( size_t j = 0 ; j < brackets.size() ; j++){
            
             cout << "[HDR]: Processing frame " << j << endl;
             
-            stringstream ps, ps2, ps_j;
+            // input exposures of bracket, deeper formats are saved as 16 bit
+            // ppm without exif so exposures are passed by hdrgen script
+            string inputs;
+            if( sample_bits > 8 ){
+                FILE* hdrgen = fopen("./hdr-video/bracket.hdrgen", "w");
+                if( !hdrgen ){
+                    cout << "[HDR]: Unable to write bracket script" << endl;
+                    continue;
+                }
+                for ( unsigned int k = 0 ; k < brackets[j].size ; k++){
+                    char *padded = PadNumber(brackets[j].index[k]);
+                    const float exposure = !shutter_abs_map.empty()
+                        ? GetShutterMapAbs(brackets[j].shutter[k])
+                        : GetFeatureValue(DC1394_FEATURE_SHUTTER);
+                    WriteHDRGEN(hdrgen, (string("./hdr-video/ppm/image") + padded + ".ppm").c_str(), exposure);
+                    delete[] padded;
+                }
+                fclose(hdrgen);
+            } else {
+                for ( unsigned int k = 0 ; k < brackets[j].size ; k++){
+                    char *padded = PadNumber(brackets[j].index[k]);
+                    inputs += string("./hdr-video/jpeg/image") + padded + ".jpeg ";
+                    delete[] padded;
+                }
+            }
+            const string merge_input = sample_bits > 8
+                ? string("pfsinhdrgen ./hdr-video/bracket.hdrgen")
+                : "pfsinme " + inputs;
+            stringstream calibrate_bits;
+            if( sample_bits > 8 ) calibrate_bits << " -b " << sample_bits;
             
-            // padded file numbers
-            char *pf = PadNumber(i);
-            char *pf2 = PadNumber(i+1);
-            char *pf_j = PadNumber(j);
+            char *padded_frame_number = PadNumber(j);
+            sprintf(temp_filename, "./hdr-video/temp-jpeg/image%s.jpeg", padded_frame_number);
+            delete[] padded_frame_number;
             
-            sprintf(convert_command, "pfsinme ./hdr-video/jpeg/image%s.jpeg ./hdr-video/jpeg/image%s.jpeg \
-                    | pfshdrcalibrate -f ./config/camera.response \
-                    | pfstmo_%s | pfsoutimgmagick -q 100 ./hdr-video/temp-jpeg/image%s.jpeg",
-                    pf, pf2, tmo, pf_j);
+            sprintf(convert_command, "%s \
+                    | pfshdrcalibrate%s -f ./config/camera.response \
+                    | pfstmo_%s | pfsoutimgmagick -q 100 %s",
+                    merge_input.c_str(), calibrate_bits.str().c_str(), tmo, temp_filename);
             
-            // convert pair of frames to exr
+            // convert bracket of frames to tone mapped jpeg
             system(convert_command);
             
-            i++; // increment by 2 - jump over next frame
-            j++; // increment by 1 - final file name
+            if( output.IsOpen() ){
+                if( LoadJPEG(tonemapped, temp_filename) ){
+                    output.WriteFrame(tonemapped);
+                }
+                remove(temp_filename);
+            }
         }
         
-        cout << "[HDR]: Processing HDR video" << endl;
-        
-        GetTimeStamp(time_stamp);
-                
-        if(!format.compare("avi") || !format.compare("AVI") ){
+        if( output.IsOpen() ){
+            
+            // finishes encoding
+            output.Reset();
+            delete[] tonemapped;
+            rmdir("./hdr-video/temp-jpeg/");
+            cout << "[HDR]: HDR Video saved to ./hdr-video/" << time_stamp << "-" << tmo
+                 << "." << boost::algorithm::to_lower_copy(format) << endl;
+            
+        } else if(!format.compare("avi") || !format.compare("AVI") ){
 
+            cout << "[HDR]: Processing HDR video" << endl;
+            
             // create command string: convert video, remove files and then echo completedy
             sprintf(video_command, "mencoder \"mf://./hdr-video/temp-jpeg/image*.jpeg\" -mf fps=15:type=jpg  -o /dev/null -ovc xvid -xvidencopts pass=1:bitrate=2160000 \
                                     && mencoder \"mf://./hdr-video/temp-jpeg/image*.jpeg\" -mf fps=15:type=jpg -o ./hdr-video/%s-%s.avi -ovc xvid -xvidencopts pass=2:bitrate=2160000 \
@@ -1964,6 +2682,8 @@
             
         } else {
                    
+            cout << "[HDR]: Processing HDR video" << endl;
+            
             sprintf(video_command, "convert -q 100 ./hdr-video/temp-jpeg/image*.jpeg ./hdr-video/%s-%s.mpeg \
                     rm -rf ./hdr-video/temp-jpeg/  \
                     && echo '[HDR]: HDR Video saved to ./hdr-video/%s-%s.mpeg' ", 
@@ -1979,13 +2699,9 @@
         
     }
        
-    dc1394video_frame_t* FirewireVideo::ConvertToRGB(dc1394video_frame_t *original_frame)
-    {       
-        dc1394video_frame_t *new_frame = new dc1394video_frame_t();
-        new_frame->color_coding=DC1394_COLOR_CODING_RGB8;
-        dc1394_convert_frames(original_frame, new_frame);
-        
-        return new_frame;
+    void FirewireVideo::ConvertToRGB(const dc1394video_frame_t* frame, unsigned char* rgb)
+    {
+        ConvertToRGB24(frame->image, frame->size[0], frame->size[1], frame_format, rgb, SaveDemosaicMethod());
     }
          
     /*-----------------------------------------------------------------------
@@ -1994,47 +2710,27 @@
     
     float FirewireVideo::AEC(unsigned char *image, float st, bool under_over){
         
-        // image details
-        int colours = 3;
-        int points_skip = GetMetaOffset();
-        int num_pixels = (width * height) - (points_skip / colours);
-
-        // variables 
-        int start = 0, finish = 0, pixel_intensity = 0;
-        float C_multiplier = 1, count = 0;
+        // embedded meta data occupies a quadlet per enabled field
+        const size_t meta_bytes = 4 * GetMetaOffset();
         
-        // loop start/stop pixels
-        int i = points_skip - 1; // starting pixel
-        int stop = (width * height * colours) - colours; // stopping point in matrix
-
-        //Over/Under Specific Criteria:
-        if( under_over ){
-            start = 0;    
-            finish = 127; // finish = (bit_depth / 2 ) - 1
-
-        } else {
-            start = 128;  // start = (bit_depth + 1) / 2
-            finish = 255; // finish = bit_depth - 1
-        }
+        // luma histogram over the camera's full output range, so deeper
+        // formats are judged on their real precision rather than top 8 bits
+        vector<unsigned> hist(256, 0);
+        const size_t num_pixels = LumaHistogram(image, width, height, frame_format, meta_bytes, hist);
         
-        // loop through entire image matrix and count each intensity
-        while( i < stop ){
-            
-            // get luminance value for each RGB triplet
-            // Y = R * 0.299 + G * 0.587 + B * 0.144
-            pixel_intensity = 
-              ( (int) image[++i] * 0.299 ) 
-            + ( (int) image[++i] * 0.587 )
-            + ( (int) image[++i] * 0.114 );
-            
-            // count if in half of histogram
-            if( (pixel_intensity >= start) && (pixel_intensity <= finish) ){
-                count++;
-            }
-
+        float C_multiplier = 1;
+        
+        // Over/Under Specific Criteria:
+        // under counts the lower half of the histogram, over the upper half
+        const int start = under_over ? 0 : 128;
+        const int finish = under_over ? 128 : 256;
+        
+        size_t count = 0;
+        for( int b = start; b < finish; ++b ){
+            count += hist[b];
         }
-
-        float percent_in_half = (float) count / (float) (num_pixels);
+        
+        float percent_in_half = num_pixels ? (float) count / (float) num_pixels : 0.0f;
         
         // based on config values
         if(CheckConfigLoaded()){
@@ -2180,27 +2876,67 @@
         double i = -2;
         int j = 0;
         
-        while (EV + i <= exposure_max){
+        // with a shutter map, step shutter directly from settled auto exposure
+        // at fixed gain rather than waiting for auto exposure at each step
+        const bool use_map = !shutter_abs_map.empty();
+        uint32_t base_shutter = 0;
+        uint32_t last_shutter = 0;
+        
+        if(use_map){
+            std::vector<unsigned char> buffer(SizeBytes());
+            Start();
+            base_shutter = WaitForShutterSettle(*this, &buffer[0], SETTLE_STABLE_FRAMES, SETTLE_SKIP_FRAMES, SETTLE_MAX_FRAMES);
+            FlushDMABuffer();
+            SetFeatureQuant(DC1394_FEATURE_GAIN, GetFeatureQuant(DC1394_FEATURE_GAIN));
+        }
+        
+        while (true){
 
-            cout << "[RESPONSE FUNCTION]: " << j << " @ " << EV+i << " EV" << endl;
-            SetFeatureValue(DC1394_FEATURE_EXPOSURE, EV + i);
-            sleep(1);
+            int expected_shutter = -1;
             
-            // set one shot mode
-            if(dc1394_video_set_one_shot( camera, DC1394_ON ) != DC1394_SUCCESS)
-                throw VideoException("[DC1394 ERROR]: Could not set one shot mode");
+            if(use_map){
+                const float ev = i;
+                uint32_t shutter;
+                ComputeBracketShutters(base_shutter, &ev, 1, &shutter);
+                if( j > 0 && shutter == last_shutter ){
+                    if( shutter == (uint32_t)shutter_quant_map.rbegin()->second ) break; // reached longest shutter
+                    i += 0.25; // same quantised shutter as last step
+                    continue;
+                }
+                last_shutter = shutter;
+                expected_shutter = shutter;
+                cout << "[RESPONSE FUNCTION]: " << j << " @ " << i << " EV (shutter " << shutter << ")" << endl;
+                SetFeatureQuant(DC1394_FEATURE_SHUTTER, shutter);
+            }else{
+                if( EV + i > exposure_max ) break;
+                cout << "[RESPONSE FUNCTION]: " << j << " @ " << EV+i << " EV" << endl;
+                SetFeatureValue(DC1394_FEATURE_EXPOSURE, EV + i);
+            }
             
-            // dequeue frame
-            if(dc1394_capture_dequeue(camera, DC1394_CAPTURE_POLICY_WAIT, &frame) != DC1394_SUCCESS)
-                throw VideoException("[DC1394 ERROR]: Could not dequeue frame");
+            // one shot frame exposed with new settings
+            frame = GrabOneShotSettled(expected_shutter);
             
             if ( frame ) {
                 
-                // save to jpeg with exif data
-                SaveFile(j, *frame, "response-function", true);
-                
-                // append line to hdrgen script for response function
-                JpegToHDRGEN("response-function", file, j);
+                if( sample_bits > 8 ){
+                    
+                    // save to 16 bit ppm, exposure from the frame meta data
+                    SaveFile(j, *frame, "response-function", false);
+                    
+                    MetaData metaData;
+                    ReadMetaData(frame->image, &metaData);
+                    char *padded = PadNumber(j);
+                    WriteHDRGEN(file, (string("./response-function/ppm/image") + padded + ".ppm").c_str(), ExposureTime(metaData));
+                    delete[] padded;
+                    
+                } else {
+                    
+                    // save to jpeg with exif data
+                    SaveFile(j, *frame, "response-function", true);
+                    
+                    // append line to hdrgen script for response function
+                    JpegToHDRGEN("response-function", file, j);
+                }
                 
             }
             // enque frame
@@ -2210,6 +2946,8 @@
             i += 0.25;
             j++;
         }
+        
+        SetAllFeaturesAuto();
              
         //close hdrgen file
         cout << "[RESPONSE FUNCTION]: Closing hdrgen script file" << endl;
@@ -2220,22 +2958,27 @@
         
         string calibration = config.find("HDR_RESPONSE_CALIBRATION")->second;
         
+        // response has a row per input level, 2^bits for deeper formats
+        stringstream calibrate;
+        calibrate << "pfsinhdrgen camera.hdrgen | pfshdrcalibrate";
+        if( sample_bits > 8 ) calibrate << " -b " << sample_bits;
+        
         // set attributes from config or if not loaded, to defaults
         // don't thread because HDR Capture uses output and will call this function
         if(!calibration.compare("mitsunaga") || !calibration.compare("MITSUNAGA") ){
-            system("pfsinhdrgen camera.hdrgen | pfshdrcalibrate -c mitsunaga -s ./config/camera.response > /dev/null 2>&1");
+            system((calibrate.str() + " -c mitsunaga -s ./config/camera.response > /dev/null 2>&1").c_str());
             cout << "[RESPONSE FUNCTION]: Camera Response Function file generated using Mitsunaga calibration technique" << endl;
         } else if (!calibration.compare("linear") || !calibration.compare("LINEAR")){
-            system("pfsinhdrgen camera.hdrgen | pfshdrcalibrate -r linear -s ./config/camera.response > /dev/null 2>&1");
+            system((calibrate.str() + " -r linear -s ./config/camera.response > /dev/null 2>&1").c_str());
             cout << "[RESPONSE FUNCTION]: Linear camera response function generated." << endl;
         } else if (!calibration.compare("gamma") || !calibration.compare("GAMMA")){
-            system("pfsinhdrgen camera.hdrgen | pfshdrcalibrate -r gamma -s ./config/camera.response > /dev/null 2>&1");
+            system((calibrate.str() + " -r gamma -s ./config/camera.response > /dev/null 2>&1").c_str());
             cout << "[RESPONSE FUNCTION]: Gamma camera response function generated." << endl;
         } else if (!calibration.compare("log") || !calibration.compare("LOG")){
-            system("pfsinhdrgen camera.hdrgen | pfshdrcalibrate -r log -s ./config/camera.response > /dev/null 2>&1");
+            system((calibrate.str() + " -r log -s ./config/camera.response > /dev/null 2>&1").c_str());
             cout << "[RESPONSE FUNCTION]: Log camera response function generated." << endl;
         } else {
-            system("pfsinhdrgen camera.hdrgen | pfshdrcalibrate -s ./config/camera.response > /dev/null 2>&1");
+            system((calibrate.str() + " -s ./config/camera.response > /dev/null 2>&1").c_str());
             cout << "[RESPONSE FUNCTION]: Camera Response Function file generated using Robertson calibration technique" << endl;
         }
         
@@ -2251,7 +2994,17 @@
     bool FirewireVideo::CheckResponseFunction(){
         
         ifstream file("./config/camera.response");
-        return file;
+        if( !file ) return false;
+        
+        // a response recorded at a different bit depth is stale
+        const int levels = 1 << (sample_bits > 8 ? sample_bits : 8);
+        string line;
+        while( getline(file, line) ){
+            if( line.compare(0, 8, "# rows: ") == 0 ){
+                if( atoi(line.c_str() + 8) != levels ) return false;
+            }
+        }
+        return true;
 
     }
     
@@ -2284,6 +3037,10 @@
             // NORMAL
             config.insert( pair<string,string>( "NORMAL_IMAGE_FORMAT", pt.get<string>("NORMAL.image_format") ) );
             config.insert( pair<string,string>( "NORMAL_VIDEO_FORMAT", pt.get<string>("NORMAL.video_format") ) );
+            config.insert( pair<string,string>( "NORMAL_TIFF_COMPRESSION", pt.get<string>("NORMAL.tiff_compression", "none") ) );
+            config.insert( pair<string,string>( "NORMAL_VIDEO_CODEC", pt.get<string>("NORMAL.video_codec", "") ) );
+            config.insert( pair<string,string>( "DEMOSAIC_METHOD", pt.get<string>("NORMAL.demosaic_method", "") ) );
+            config.insert( pair<string,string>( "HDR_VIDEO_CODEC", pt.get<string>("HDR.video_codec", "") ) );
             
             // HDR
             config.insert( pair<string,string>( "HDR_RADIANCE_FORMAT", pt.get<string>("HDR.radiance_format") ) );
@@ -2315,7 +3072,8 @@
     }
         
     string FirewireVideo::GetConfigValue(string attribute){ 
-        return config.find(attribute)->second;
+        map<string,string>::const_iterator i = config.find(attribute);
+        return i != config.end() ? i->second : string();
     }
         
     void FirewireVideo::SetConfigValue(string attribute, string value){        
@@ -2350,8 +3108,9 @@
         string pad = ps.str();
         pad.insert(pad.begin(), 6 - pad.size(), '0');
         
-        char *padded_frame_number = new char[pad.size()];
+        char *padded_frame_number = new char[pad.size()+1];
         copy(pad.begin(),pad.end(),padded_frame_number);
+        padded_frame_number[pad.size()] = '\0';
         
         return padded_frame_number;
         
@@ -40,10 +40,21 @@
     #include <sys/stat.h>
     #include <time.h>
     #include <map>
+    #include <vector>
 
     #include <pangolin/pangolin.h>
     #include <pangolin/video.h>
+    #include <pangolin/video_output.h>
+    #include <pangolin/video/pvn_video.h>
     #include <pangolin/timer.h>
+    #include <pangolin/video/iidc.h>
+    #include <pangolin/video/bracket_assembler.h>
+    #include <pangolin/video/exposure_schedule.h>
+    #include <pangolin/video/hdr_camera.h>
+    #include <pangolin/video/jpeg_encoder.h>
+    #include <pangolin/video/exif.h>
+    #include <pangolin/video/image_formats.h>
+    #include <pangolin/video/demosaic.h>
 
 
     #include <dc1394/dc1394.h>
@@ -51,6 +62,8 @@
     #include <jpeglib.h>
 
     #include <boost/thread/thread.hpp>
+    #include <boost/thread/mutex.hpp>
+    #include <boost/scoped_ptr.hpp>
     #include <boost/property_tree/ptree.hpp>
     #include <boost/property_tree/ini_parser.hpp>
 
@@ -118,23 +131,26 @@
         }
     };
 
-    typedef enum {
-    META_TIMESTAMP = 1,
-    META_GAIN = 2,
-    META_SHUTTER = 4,
-    META_BRIGHTNESS = 8,
-    META_EXPOSURE = 16,
-    META_WHITE_BALANCE = 32,
-    META_FRAME_COUNTER = 64,
-    META_STROBE = 128,
-    META_GPIO_PIN_STATE = 256,
-    META_ROI_POSITION = 512,
-    META_ALL = 1023,
-    META_ABS = 32678, 
-    META_ALL_AND_ABS = 33791,
-    } meta_flags;
+    // cached camera feature registers, -1 = unknown
+    struct FeatureState
+    {
+        int power;
+        int mode;
+        int absolute;
+        bool modes_valid;
+        dc1394feature_modes_t modes;
+        bool value_valid;   // absolute value read back from camera
+        float value;
+        bool written_valid; // last absolute value written
+        float written;
+        bool quant_valid;
+        uint32_t quant;
+        bool wb_valid;
+        uint32_t wb_u_b, wb_v_r;
+        basetime read_time;
+    };
    
-    class FirewireVideo : public VideoInterface
+    class FirewireVideo : public VideoInterface, public HDRCameraInterface
     {
     public:
     const static int MAX_FR = -1;
@@ -198,6 +214,16 @@
      */
      std::string PixFormat() const;
 
+    /* frame rate of current video mode
+     @return frames per second, 30 if not known (e.g. format7)
+     */
+    float GetFramerate() const;
+
+    /* significant bits per sample of the current video mode (8, 12, 16)
+     @return bits
+     */
+    int SampleBits() const { return sample_bits; }
+
     /*Implement VideoSource::Start()
     @exception dc1394 error
      */
@@ -313,12 +339,43 @@
      @excepion dc1394 error
      */
     void GetHDRGainFlags(uint32_t &gain0, uint32_t &gain1, uint32_t &gain2, uint32_t &gain3); 
+
+    /* set shutter and gain of a single HDR bank
+     @param hdr bank (0-3)
+     @param quantised shutter
+     @param quantised gain
+     @excepion dc1394 error
+     */
+    void SetHDRBank(int bank, uint32_t shutter, uint32_t gain);
+
+    /* program HDR banks with exposure schedule and enable HDR register
+     @param schedule
+     @excepion dc1394 error
+     */
+    void StartExposureSchedule(const ExposureSchedule& schedule);
+
+    /* identify exposure schedule step of frame from embedded shutter, gain
+       and frame counter
+     @param image buffer
+     @param bank writes needed by rolling schedules (by reference)
+     @return schedule step, -1 if unknown or HDR mode off
+     */
+    int ReadExposureStep(unsigned char* image, std::vector<BankWrite>& writes);
+
         
     /* read the meta data from an image according to meta flags
      @param image buffer
      @param metadata (by reference)
      */
     void ReadMetaData( unsigned char *image, MetaData *metaData );
+
+    /* fill PVN frame record from meta data embedded in image
+     @param image buffer
+     @param exposure schedule step of image, -1 if unknown
+     @param stream to record image to
+     @param frame record (by reference)
+     */
+    void ReadFrameInfo( unsigned char *image, int step, int stream, PvnFrameInfo& info );
     
     /* return time stamp from image data
      @param image buffer
@@ -331,6 +388,37 @@
      @return abs shutter time
      */
     float ReadShutter( unsigned char *image );
+
+    /* read single meta data word from image data
+     @param image buffer
+     @param meta data flag of word to read (e.g. META_SHUTTER)
+     @return word, 0 if flag not enabled
+     */
+    uint32_t ReadMetaWord( unsigned char *image, uint32_t flag );
+
+    /* position of image within the HDR bracket, from its embedded shutter
+     @param image buffer
+     @return exposure index (0 = first bank), -1 if shutter matches no bank
+     */
+    int ReadHDRExposure( unsigned char *image );
+
+    /* add recorded frame to HDR bracket assembly using embedded shutter and
+       frame counter. Dropped frames discard the partial bracket.
+     @param image buffer
+     @param frame number image was saved as
+     @return true if frame completed a bracket
+     @exception dc1394 error if shutter/frame counter meta data not enabled
+     */
+    bool AddHDRFrame( unsigned char *image, int frame_number );
+
+    /* clear assembled HDR brackets (e.g. at start of recording)
+     */
+    void ResetHDRBrackets();
+
+    /* get HDR brackets assembled since last reset
+     @return brackets
+     */
+    std::vector<HDRBracket> GetHDRBrackets();
         
     /* create lookup table to convert quantised shutter values to absolute values
      */
@@ -499,6 +587,15 @@
      @exception dc1394 error
      */    
     int GetFeatureQuant(dc1394feature_t feature) const;
+
+    /**
+     shutter and gain quantised values (HDRCameraInterface)
+     @exception dc1394 error
+     */
+    void SetShutterQuant(int shutter);
+    void SetGainQuant(int gain);
+    int GetShutterQuant();
+    int GetGainQuant();
     
 
     /**
@@ -551,6 +648,18 @@
      */
     void ResetHue();
 
+    /**
+     set how often values of features in auto mode are re-read from the camera.
+     Manual features are always served from cache as only we change them.
+     @param seconds (0 = always re-read, negative = never)
+     */
+    void SetFeatureRefresh(double seconds);
+
+    /**
+     discard cached feature state, next access reads from camera
+     */
+    void RefreshFeatures();
+
     /*-----------------------------------------------------------------------
      *  WHITE BALANCE CONTROLS
      *-----------------------------------------------------------------------*/
@@ -689,6 +798,42 @@
      @exception dc1394 error or exiv error
      */ 
     void CaptureHDRFrame(unsigned char* image, int n, uint32_t shutter[]);
+
+    /**
+     grab newest frames from source until their embedded shutter is stable.
+     Limits are in frames so that the wait follows the camera frame rate.
+     @param video source delivering this camera's frames (e.g. this or a VideoCaptureThread)
+     @param image buffer
+     @param number of consecutive frames which must report same shutter
+     @param frames to ignore first (register write latency)
+     @param frames to grab before giving up, including those skipped
+     @return settled quantised shutter
+     @exception dc1394 error if shutter meta data not enabled
+     */
+    uint32_t WaitForShutterSettle(VideoInterface& source, unsigned char* image,
+                                  int stable_frames, int skip_frames, int max_frames);
+
+    /**
+     compute quantised shutters for EV offsets from base shutter using shutter map
+     @param base quantised shutter
+     @param EV offsets
+     @param number of offsets
+     @param quantised shutter array (output)
+     @return false if shutter maps have not been created
+     */
+    bool ComputeBracketShutters(uint32_t base_shutter, const float ev[], int n, uint32_t shutter[]);
+
+    /**
+     calibrate HDR bracket around current auto exposure. Computed from the shutter
+     map where available, otherwise steps exposure and waits for shutter to settle.
+     @param video source delivering this camera's frames
+     @param image buffer
+     @param EV offsets
+     @param number of offsets
+     @param quantised shutter array (output)
+     @exception dc1394 error
+     */
+    void CalibrateBracket(VideoInterface& source, unsigned char* image, const float ev[], int n, uint32_t shutter[]);
          
     /**
      grab and save indidivdual frame with time stamp
@@ -711,6 +856,105 @@
                     bool jpeg = true            // true = jpeg, false = ppm
                 );
 
+    /**
+     save image buffer to ppm or jpeg (e.g. frame taken from a VideoCaptureThread)
+     @param frame number
+     @param image buffer (including embedded meta data)
+     @param image width
+     @param image height
+     @param folder name
+     @param jpeg?
+     @exception exiv error
+     */
+    bool SaveImage(
+                    int frame_number,
+                    unsigned char* image,
+                    unsigned w, unsigned h,
+                    const char* folder,
+                    bool jpeg = true
+                );
+
+    /**
+     image to write for a frame as RGB24: raw bayer frames are demosaiced
+     (DEMOSAIC_METHOD = bilinear | mhc in the config, default mhc) so that
+     brackets reach the HDR merge at full colour resolution, gray and deeper
+     formats are expanded or reduced to 8 bits
+     @param image buffer
+     @param image width
+     @param image height
+     @param storage for demosaiced image
+     @return image or demosaiced image
+     */
+    unsigned char* SaveBuffer(unsigned char* image, unsigned w, unsigned h, std::vector<unsigned char>& rgb);
+
+    /**
+     demosaic method for saved frames
+     @return DEMOSAIC_METHOD from config, default mhc
+     */
+    DemosaicMethod SaveDemosaicMethod();
+
+    /**
+     exposure time of a frame in seconds
+     @param meta data read from image
+     @return absolute shutter from meta data, or current shutter value
+     @exception dc1394 error
+     */
+    float ExposureTime(const MetaData& metaData) const;
+
+    /**
+     append a line for a frame to an hdrgen script
+     @param hdrgen script
+     @param path of frame
+     @param exposure time in seconds
+     */
+    static void WriteHDRGEN(FILE* hdrgen, const char* path, float exposure);
+
+    /**
+     fill exif tags from image meta data and camera settings
+     @param meta data read from image
+     @param exif builder
+     @exception dc1394 error
+     */
+    void BuildExif(const MetaData& metaData, ExifBuilder& exif) const;
+
+    /**
+     snapshot the exposure and white balance written to exif. Once taken,
+     BuildExif uses the snapshot instead of reading camera features, so
+     images can be saved on threads other than the one writing registers.
+     Call from the thread that owns the registers (see FirewireControlQueue).
+     @exception dc1394 error
+     */
+    void RefreshExifSettings();
+
+    /**
+     encode jpeg images passed to SaveImage on a pool of worker threads.
+     SaveImage then returns once the image is queued, or false if dropped.
+     @param number of worker threads
+     @param maximum number of images waiting to be encoded
+     @param block or drop images when queue is full
+     */
+    void StartEncoderPool(
+                    int workers,
+                    size_t queue_size = 32,
+                    JpegQueuePolicy policy = JPEG_QUEUE_BLOCK
+                );
+
+    /**
+     write images queued for encoding and return to encoding in SaveImage
+     */
+    void StopEncoderPool();
+
+    /**
+     video output uri for recording to folder/name, with container and
+     codec from config (NORMAL/HDR video_format and video_codec)
+     @param folder name
+     @param file name without extension
+     @param hdr video or not
+     @param frames per second
+     @return uri for VideoOutput
+     */
+    std::string GetVideoOutputUri(const std::string& folder, const std::string& name, bool hdr, float fps);
+
     /**
      save normal video
      @exception dc1394 error
@@ -719,18 +963,18 @@
 
     /**
      save HDR video
-     @param frame number
+     @param brackets of recorded frames (see AddHDRFrame)
      @exception dc1394 error
      */  
-    void SaveHDRVideo(int frame_number);
+    void SaveHDRVideo(std::vector<HDRBracket> brackets);
         
     /**
-     convert dc1394 frame to RGB from YUV
+     convert dc1394 frame of the current mode (YUV, bayer, ...) to RGB24
      @param dc1394 frame
-     @return new converted dc1394 frame
-     @exception dc1394 error
+     @param storage for width x height RGB24 image
+     @exception VideoException for formats without conversion
      */  
-    dc1394video_frame_t* ConvertToRGB(dc1394video_frame_t *original_frame);
+    void ConvertToRGB(const dc1394video_frame_t* frame, unsigned char* rgb);
     
     
     /*-----------------------------------------------------------------------
@@ -844,7 +1088,7 @@
     /**
      get loaded configuration file attribute value
      @param attribute string
-     @return attribute string
+     @return attribute string, empty if not loaded
      */ 
     std::string GetConfigValue(std::string attribute);  
         
@@ -870,6 +1114,20 @@
         
     protected:
 
+    dc1394video_frame_t* GrabOneShotSettled(int expected_shutter);
+
+    void FinishImage(const std::string& filename, std::string folder, int frame_number);
+    ImageFileFormat NormalImageFormat();
+
+    FeatureState& CachedFeature(dc1394feature_t feature) const;
+    bool CacheFresh(const FeatureState& state) const;
+    void InvalidateAutoFeatures();
+    void WriteFeaturePower(dc1394feature_t feature, bool on);
+    void WriteFeatureMode(dc1394feature_t feature, dc1394feature_mode_t mode);
+    void WriteFeatureAbsolute(dc1394feature_t feature, bool on);
+    void WriteFeatureAbsValue(dc1394feature_t feature, float value);
+    void WriteFeatureQuant(dc1394feature_t feature, uint32_t value);
+
     void init_camera(
     uint64_t guid, int dma_frames,
     dc1394speed_t iso_speed,
@@ -886,6 +1144,9 @@
       uint32_t left, uint32_t top, bool reset_at_boot
     );
 
+    // cache pixel format and sample depth once the mode is set
+    void UpdateFrameFormat();
+
     static int nearest_value(int value, int step, int min, int max);
     static double bus_period_from_iso_speed(dc1394speed_t iso_speed);
         
@@ -893,10 +1154,14 @@
     dc1394camera_t *camera;
     unsigned width, height, top, left;
     dc1394featureset_t features;
+    mutable FeatureState feature_state[DC1394_FEATURE_NUM];
+    double feature_refresh;
     dc1394_t * d;
     dc1394camera_list_t * list;
     mutable dc1394error_t err;
     dc1394video_mode_t video_mode;
+    std::string frame_format;
+    int sample_bits;
         
     uint32_t meta_data_flags;
     bool hdr_register; // 1 = on
@@ -905,6 +1170,22 @@
 
     std::map<int,float> shutter_abs_map;
     std::map<float,int> shutter_quant_map; 
+
+    // guards brackets and schedule, which are updated by register writes
+    // and read by consumers on other threads
+    boost::mutex bracket_mutex;
+    BracketAssembler bracket_assembler;
+    std::vector<HDRBracket> hdr_brackets;
+    ExposureSchedule exposure_schedule;
+    bool schedule_running;
+
+    boost::scoped_ptr<JpegEncoderPool> jpeg_pool;
+
+    // camera settings for exif, see RefreshExifSettings
+    mutable boost::mutex exif_mutex;
+    bool exif_valid;
+    float exif_exposure_bias;
+    int exif_white_balance;
         
     std::map<std::string, std::string> config;
       
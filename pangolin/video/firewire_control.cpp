@@ -0,0 +1,324 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "firewire_control.h"
+
+using namespace std;
+
+namespace pangolin
+{
+
+FirewireControlQueue::FirewireControlQueue(FirewireVideo& video)
+    : video(video), running(false), busy(false), executed(0), coalesced(0)
+{
+}
+
+FirewireControlQueue::~FirewireControlQueue()
+{
+    Stop();
+}
+
+void FirewireControlQueue::Start()
+{
+    if(running) return;
+
+    // control thread isn't running yet, so the cache is safe to read here
+    video.RefreshExifSettings();
+
+    running = true;
+    control_thread = boost::thread(boost::ref(*this));
+}
+
+void FirewireControlQueue::Stop()
+{
+    {
+        boost::mutex::scoped_lock lock(queue_mutex);
+        if(!running) return;
+        running = false;
+    }
+    cond_pending.notify_all();
+    control_thread.join();
+}
+
+void FirewireControlQueue::Flush()
+{
+    boost::mutex::scoped_lock lock(queue_mutex);
+    while( !pending.empty() || busy ) {
+        cond_idle.wait(lock);
+    }
+}
+
+int FirewireControlQueue::CoalesceKey(const ControlCommand& cmd)
+{
+    switch(cmd.type) {
+    case CONTROL_FEATURE_VALUE:
+    case CONTROL_FEATURE_QUANT:
+    case CONTROL_FEATURE_AUTO:
+        // each fully determines the feature, so last one wins
+        return cmd.feature;
+    case CONTROL_HDR_BANK:
+        return -100 - (int)cmd.args[0];
+    default:
+        return -1 - (int)cmd.type;
+    }
+}
+
+ControlFuture FirewireControlQueue::Post(ControlCommand& cmd)
+{
+    boost::shared_ptr<boost::promise<bool> > promise(new boost::promise<bool>());
+    ControlFuture future(promise->get_future());
+
+    {
+        boost::mutex::scoped_lock lock(queue_mutex);
+        const int key = CoalesceKey(cmd);
+        std::map<int, std::list<ControlCommand>::iterator>::iterator it = pending_index.find(key);
+
+        if( it != pending_index.end() ) {
+            // drop the pending write and queue this one at the tail, so it
+            // still follows writes to other registers posted in between.
+            // Its promises complete with this write.
+            cmd.promises.swap(it->second->promises);
+            pending.erase(it->second);
+            ++coalesced;
+        }
+        cmd.promises.push_back(promise);
+        pending_index[key] = pending.insert(pending.end(), cmd);
+    }
+    cond_pending.notify_one();
+
+    return future;
+}
+
+void FirewireControlQueue::Execute(const ControlCommand& cmd)
+{
+    switch(cmd.type) {
+    case CONTROL_FEATURE_VALUE:
+        video.SetFeatureValue(cmd.feature, cmd.value);
+        break;
+    case CONTROL_FEATURE_QUANT:
+        video.SetFeatureQuant(cmd.feature, cmd.args[0]);
+        break;
+    case CONTROL_FEATURE_AUTO:
+        video.SetFeatureAuto(cmd.feature);
+        break;
+    case CONTROL_WHITE_BALANCE:
+        video.SetWhiteBalance(cmd.args[0], cmd.args[1]);
+        break;
+    case CONTROL_HDR_SHUTTER:
+        video.SetHDRShutterFlags(cmd.args[0], cmd.args[1], cmd.args[2], cmd.args[3]);
+        break;
+    case CONTROL_HDR_GAIN:
+        video.SetHDRGainFlags(cmd.args[0], cmd.args[1], cmd.args[2], cmd.args[3]);
+        break;
+    case CONTROL_HDR_BANK:
+        video.SetHDRBank(cmd.args[0], cmd.args[1], cmd.args[2]);
+        break;
+    case CONTROL_HDR_REGISTER:
+        video.SetHDRRegister(cmd.args[0] != 0);
+        break;
+    case CONTROL_META_FLAGS:
+        video.SetMetaDataFlags(cmd.args[0]);
+        break;
+    case CONTROL_EXIF_SETTINGS:
+        video.RefreshExifSettings();
+        break;
+    case CONTROL_EXPOSURE_SCHEDULE:
+        video.StartExposureSchedule(ExposureSchedule(cmd.steps));
+        break;
+    }
+
+    // keep exif in step with writes to the settings it records
+    const bool feature_cmd = cmd.type == CONTROL_FEATURE_VALUE || cmd.type == CONTROL_FEATURE_QUANT || cmd.type == CONTROL_FEATURE_AUTO;
+    if( cmd.type == CONTROL_WHITE_BALANCE ||
+        (feature_cmd && (cmd.feature == DC1394_FEATURE_EXPOSURE || cmd.feature == DC1394_FEATURE_WHITE_BALANCE)) )
+    {
+        video.RefreshExifSettings();
+    }
+}
+
+void FirewireControlQueue::operator()()
+{
+    while(true) {
+        ControlCommand cmd;
+
+        {
+            boost::mutex::scoped_lock lock(queue_mutex);
+            while( pending.empty() && running ) {
+                cond_pending.wait(lock);
+            }
+            if( pending.empty() ) break;
+
+            cmd = pending.front();
+            pending_index.erase(CoalesceKey(cmd));
+            pending.pop_front();
+            busy = true;
+        }
+
+        try {
+            {
+                boost::mutex::scoped_lock bus_lock(bus_mutex);
+                Execute(cmd);
+            }
+            for(size_t i=0; i < cmd.promises.size(); ++i) {
+                cmd.promises[i]->set_value(true);
+            }
+        }catch(std::exception& e) {
+            cerr << "[CONTROL ERROR]: " << e.what() << endl;
+            for(size_t i=0; i < cmd.promises.size(); ++i) {
+                cmd.promises[i]->set_exception(boost::current_exception());
+            }
+        }
+
+        {
+            boost::mutex::scoped_lock lock(queue_mutex);
+            busy = false;
+            ++executed;
+        }
+        cond_idle.notify_all();
+    }
+}
+
+ControlFuture FirewireControlQueue::SetFeatureValue(dc1394feature_t feature, float value)
+{
+    ControlCommand cmd;
+    cmd.type = CONTROL_FEATURE_VALUE;
+    cmd.feature = feature;
+    cmd.value = value;
+    return Post(cmd);
+}
+
+ControlFuture FirewireControlQueue::SetFeatureQuant(dc1394feature_t feature, int value)
+{
+    ControlCommand cmd;
+    cmd.type = CONTROL_FEATURE_QUANT;
+    cmd.feature = feature;
+    cmd.args[0] = value;
+    return Post(cmd);
+}
+
+ControlFuture FirewireControlQueue::SetFeatureAuto(dc1394feature_t feature)
+{
+    ControlCommand cmd;
+    cmd.type = CONTROL_FEATURE_AUTO;
+    cmd.feature = feature;
+    return Post(cmd);
+}
+
+ControlFuture FirewireControlQueue::SetWhiteBalance(unsigned int u_b_value, unsigned int v_r_value)
+{
+    ControlCommand cmd;
+    cmd.type = CONTROL_WHITE_BALANCE;
+    cmd.args[0] = u_b_value;
+    cmd.args[1] = v_r_value;
+    return Post(cmd);
+}
+
+ControlFuture FirewireControlQueue::SetHDRShutterFlags(uint32_t shut0, uint32_t shut1, uint32_t shut2, uint32_t shut3)
+{
+    ControlCommand cmd;
+    cmd.type = CONTROL_HDR_SHUTTER;
+    cmd.args[0] = shut0;
+    cmd.args[1] = shut1;
+    cmd.args[2] = shut2;
+    cmd.args[3] = shut3;
+    return Post(cmd);
+}
+
+ControlFuture FirewireControlQueue::SetHDRGainFlags(uint32_t gain0, uint32_t gain1, uint32_t gain2, uint32_t gain3)
+{
+    ControlCommand cmd;
+    cmd.type = CONTROL_HDR_GAIN;
+    cmd.args[0] = gain0;
+    cmd.args[1] = gain1;
+    cmd.args[2] = gain2;
+    cmd.args[3] = gain3;
+    return Post(cmd);
+}
+
+ControlFuture FirewireControlQueue::SetHDRBank(int bank, uint32_t shutter, uint32_t gain)
+{
+    ControlCommand cmd;
+    cmd.type = CONTROL_HDR_BANK;
+    cmd.args[0] = bank;
+    cmd.args[1] = shutter;
+    cmd.args[2] = gain;
+    return Post(cmd);
+}
+
+int FirewireControlQueue::ScheduleFrame(unsigned char* image)
+{
+    std::vector<BankWrite> writes;
+    const int step = video.ReadExposureStep(image, writes);
+    if(!writes.empty()) {
+        // bank rewrites belong to the schedule being replaced
+        ControlCommand schedule_cmd;
+        schedule_cmd.type = CONTROL_EXPOSURE_SCHEDULE;
+        bool schedule_pending;
+        {
+            boost::mutex::scoped_lock lock(queue_mutex);
+            schedule_pending = pending_index.find(CoalesceKey(schedule_cmd)) != pending_index.end();
+        }
+        for(size_t i=0; !schedule_pending && i < writes.size(); ++i) {
+            SetHDRBank(writes[i].bank, writes[i].step.shutter, writes[i].step.gain);
+        }
+    }
+    return step;
+}
+
+ControlFuture FirewireControlQueue::StartExposureSchedule(const ExposureSchedule& schedule)
+{
+    ControlCommand cmd;
+    cmd.type = CONTROL_EXPOSURE_SCHEDULE;
+    cmd.steps = schedule.Steps();
+    return Post(cmd);
+}
+
+ControlFuture FirewireControlQueue::SetHDRRegister(bool power)
+{
+    ControlCommand cmd;
+    cmd.type = CONTROL_HDR_REGISTER;
+    cmd.args[0] = power ? 1 : 0;
+    return Post(cmd);
+}
+
+ControlFuture FirewireControlQueue::SetMetaDataFlags(int flags)
+{
+    ControlCommand cmd;
+    cmd.type = CONTROL_META_FLAGS;
+    cmd.args[0] = flags;
+    return Post(cmd);
+}
+
+ControlFuture FirewireControlQueue::RefreshExifSettings()
+{
+    ControlCommand cmd;
+    cmd.type = CONTROL_EXIF_SETTINGS;
+    return Post(cmd);
+}
+
+}
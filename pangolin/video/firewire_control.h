@@ -0,0 +1,157 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PANGOLIN_FIREWIRE_CONTROL_H
+#define PANGOLIN_FIREWIRE_CONTROL_H
+
+#include <pangolin/video/firewire.h>
+
+#include <list>
+#include <map>
+#include <vector>
+
+#include <boost/thread.hpp>
+#include <boost/thread/future.hpp>
+#include <boost/shared_ptr.hpp>
+
+namespace pangolin
+{
+
+//! Completes with true once the command has been written to the camera,
+//! or holds the VideoException thrown by the write.
+typedef boost::shared_future<bool> ControlFuture;
+
+enum ControlCommandType
+{
+    CONTROL_FEATURE_VALUE,
+    CONTROL_FEATURE_QUANT,
+    CONTROL_FEATURE_AUTO,
+    CONTROL_WHITE_BALANCE,
+    CONTROL_HDR_SHUTTER,
+    CONTROL_HDR_GAIN,
+    CONTROL_HDR_BANK,
+    CONTROL_HDR_REGISTER,
+    CONTROL_META_FLAGS,
+    CONTROL_EXIF_SETTINGS,
+    CONTROL_EXPOSURE_SCHEDULE
+};
+
+struct ControlCommand
+{
+    ControlCommandType type;
+    dc1394feature_t feature;
+    float value;
+    uint32_t args[4];
+    std::vector<ExposureStep> steps;
+    std::vector<boost::shared_ptr<boost::promise<bool> > > promises;
+};
+
+//! Performs FirewireVideo register writes on a dedicated thread so that
+//! callers (AEC, UI) never wait on the bus. A write to a register which
+//! already has a write pending replaces it and moves to the back of the
+//! queue, so only the last value is sent and order across registers
+//! holds. Callers needing confirmation can wait on the returned future,
+//! others can ignore it.
+//!
+//! Direct calls into the FirewireVideo from other threads must hold
+//! BusMutex() while the queue is running. Settings written to exif are
+//! snapshotted by the queue (FirewireVideo::RefreshExifSettings) so that
+//! images can be saved without either.
+class FirewireControlQueue
+{
+public:
+    FirewireControlQueue(FirewireVideo& video);
+    ~FirewireControlQueue();
+
+    //! Start the control thread
+    void Start();
+
+    //! Complete outstanding commands and stop the control thread
+    void Stop();
+
+    //! Block until all commands posted so far have been written
+    void Flush();
+
+    ControlFuture SetFeatureValue(dc1394feature_t feature, float value);
+    ControlFuture SetFeatureQuant(dc1394feature_t feature, int value);
+    ControlFuture SetFeatureAuto(dc1394feature_t feature);
+    ControlFuture SetWhiteBalance(unsigned int u_b_value, unsigned int v_r_value);
+    ControlFuture SetHDRShutterFlags(uint32_t shut0, uint32_t shut1, uint32_t shut2, uint32_t shut3);
+    ControlFuture SetHDRGainFlags(uint32_t gain0, uint32_t gain1, uint32_t gain2, uint32_t gain3);
+    ControlFuture SetHDRBank(int bank, uint32_t shutter, uint32_t gain);
+    ControlFuture SetHDRRegister(bool power);
+    ControlFuture SetMetaDataFlags(int flags);
+
+    //! Program banks for schedule and enable HDR mode (see
+    //! FirewireVideo::StartExposureSchedule). Frames are identified against
+    //! the new schedule once it has been written.
+    ControlFuture StartExposureSchedule(const ExposureSchedule& schedule);
+
+    //! Re-read the exif settings snapshot, e.g. as auto exposure drifts.
+    //! Writes to exposure or white balance refresh it automatically.
+    ControlFuture RefreshExifSettings();
+
+    boost::mutex& BusMutex() { return bus_mutex; }
+
+    unsigned long CommandsExecuted() const { return executed; }
+    unsigned long CommandsCoalesced() const { return coalesced; }
+
+    //! Identify exposure schedule step of frame (see HDRCameraInterface::ScheduleFrame),
+    //! posting any bank rewrites for rolling schedules. Call on the capture
+    //! thread for every frame, in order (see VideoCaptureThread::SetFrameHandler).
+    //! Rewrites are skipped while a new schedule is pending.
+    int ScheduleFrame(unsigned char* image);
+
+    void operator()();
+
+protected:
+    ControlFuture Post(ControlCommand& cmd);
+    void Execute(const ControlCommand& cmd);
+    static int CoalesceKey(const ControlCommand& cmd);
+
+    FirewireVideo& video;
+
+    std::list<ControlCommand> pending;
+    std::map<int, std::list<ControlCommand>::iterator> pending_index;
+
+    boost::mutex queue_mutex;
+    boost::condition_variable cond_pending;
+    boost::condition_variable cond_idle;
+    boost::mutex bus_mutex;
+
+    bool running;
+    bool busy;
+    unsigned long executed;
+    unsigned long coalesced;
+
+    boost::thread control_thread;
+};
+
+}
+
+#endif // PANGOLIN_FIREWIRE_CONTROL_H
@@ -0,0 +1,124 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "frame_pacer.h"
+
+#include <pangolin/platform.h>
+
+#include <cerrno>
+#include <ctime>
+
+#ifdef _UNIX_
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+namespace pangolin
+{
+
+FramePacer::FramePacer(double speed, double spin_s, double max_lag_s)
+    : speed(speed > 0 ? speed : 1.0), spin_ns((int64_t)(spin_s * 1E9)),
+      max_lag_ns((int64_t)(max_lag_s * 1E9)), anchored(false), anchor_ns(0), anchor_media_us(0)
+{
+}
+
+void FramePacer::SetSpeed(double new_speed)
+{
+    if( new_speed > 0 ) {
+        speed = new_speed;
+        Reset();
+    }
+}
+
+void FramePacer::Reset()
+{
+    anchored = false;
+}
+
+int64_t FramePacer::Now_ns()
+{
+#ifdef _LINUX_
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#else
+    timeval tv;
+    gettimeofday(&tv, 0);
+    return (int64_t)tv.tv_sec * 1000000000 + (int64_t)tv.tv_usec * 1000;
+#endif
+}
+
+void FramePacer::SleepUntil(int64_t deadline_ns)
+{
+    // sleep until just before deadline, wake up latency is made up by spinning
+    const int64_t wake_ns = deadline_ns - spin_ns;
+
+#ifdef _LINUX_
+    if( wake_ns > Now_ns() ) {
+        timespec ts;
+        ts.tv_sec = wake_ns / 1000000000;
+        ts.tv_nsec = wake_ns % 1000000000;
+        while( clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0) == EINTR ) {}
+    }
+#else
+    const int64_t sleep_ns = wake_ns - Now_ns();
+    if( sleep_ns > 0 ) {
+        usleep(sleep_ns / 1000);
+    }
+#endif
+
+    while( Now_ns() < deadline_ns ) {}
+}
+
+void FramePacer::WaitForFrame(int64_t media_time_us)
+{
+    const int64_t now = Now_ns();
+
+    if( !anchored ) {
+        anchored = true;
+        anchor_ns = now;
+        anchor_media_us = media_time_us;
+        return;
+    }
+
+    int64_t media_us = media_time_us - anchor_media_us;
+    if( media_us < 0 ) media_us = -media_us;
+
+    const int64_t deadline = anchor_ns + (int64_t)(media_us * 1000 / speed);
+
+    if( now - deadline > max_lag_ns ) {
+        // too far behind to catch up, continue from here
+        anchor_ns = now;
+        anchor_media_us = media_time_us;
+        return;
+    }
+
+    SleepUntil(deadline);
+}
+
+}
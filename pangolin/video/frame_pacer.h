@@ -0,0 +1,78 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PANGOLIN_FRAME_PACER_H
+#define PANGOLIN_FRAME_PACER_H
+
+#include <stdint.h>
+
+namespace pangolin
+{
+
+//! Paces playback of recorded frames against a monotonic clock.
+//!
+//! Frame deadlines are measured from an anchor (the first frame after a
+//! reset) rather than from the previous frame, so oversleeping on one
+//! frame doesn't push back all following ones. Waits sleep until just
+//! before the deadline and spin for the remainder. If playback falls
+//! more than max_lag behind, the anchor is moved up to the current frame
+//! rather than racing to catch up.
+class FramePacer
+{
+public:
+    FramePacer(double speed = 1.0, double spin_s = 0.0005, double max_lag_s = 0.25);
+
+    //! Playback speed factor, 2 = twice as fast. Takes effect from next frame.
+    void SetSpeed(double speed);
+    double Speed() const { return speed; }
+
+    //! Start new timeline from next frame (e.g. after seeking)
+    void Reset();
+
+    //! Block until frame with media time (recorded time, in any direction
+    //! since the last reset) is due.
+    void WaitForFrame(int64_t media_time_us);
+
+    //! Current monotonic time
+    static int64_t Now_ns();
+
+protected:
+    void SleepUntil(int64_t deadline_ns);
+
+    double speed;
+    int64_t spin_ns;
+    int64_t max_lag_ns;
+
+    bool anchored;
+    int64_t anchor_ns;
+    int64_t anchor_media_us;
+};
+
+}
+
+#endif // PANGOLIN_FRAME_PACER_H
@@ -0,0 +1,91 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PANGOLIN_HDR_CAMERA_H
+#define PANGOLIN_HDR_CAMERA_H
+
+#include <stdint.h>
+#include <vector>
+
+#include <pangolin/video/exposure_schedule.h>
+
+namespace pangolin
+{
+
+//! Exposure and HDR bank control common to FirewireVideo and SimVideo, so
+//! bracketing, exposure schedules and AEC can be driven without a FireWire
+//! bus. Shutter and gain are quantised register values.
+class HDRCameraInterface
+{
+public:
+    virtual ~HDRCameraInterface() {}
+
+    virtual void SetMetaDataFlags(int flags) = 0;
+
+    virtual void SetShutterQuant(int shutter) = 0;
+    virtual void SetGainQuant(int gain) = 0;
+    virtual int GetShutterQuant() = 0;
+    virtual int GetGainQuant() = 0;
+
+    //! Enable or disable cycling exposure through the HDR banks
+    virtual void SetHDRRegister(bool power) = 0;
+    virtual void SetHDRShutterFlags(uint32_t shut0, uint32_t shut1, uint32_t shut2, uint32_t shut3) = 0;
+    virtual void SetHDRGainFlags(uint32_t gain0, uint32_t gain1, uint32_t gain2, uint32_t gain3) = 0;
+    virtual void SetHDRBank(int bank, uint32_t shutter, uint32_t gain) = 0;
+
+    //! Meta data word embedded in image, 0 if flag not enabled
+    virtual uint32_t ReadMetaWord(unsigned char* image, uint32_t flag) = 0;
+
+    //! Position of image within the HDR bracket, -1 if it matches no bank
+    virtual int ReadHDRExposure(unsigned char* image) = 0;
+
+    //! Program banks with schedule and enable HDR mode
+    virtual void StartExposureSchedule(const ExposureSchedule& schedule) = 0;
+
+    //! Identify schedule step of image from its embedded shutter, gain and
+    //! frame counter (see ExposureSchedule::OnFrame). Returns -1 while no
+    //! schedule is running.
+    virtual int ReadExposureStep(unsigned char* image, std::vector<BankWrite>& writes) = 0;
+
+    //! Identify schedule step of image and write any banks a rolling
+    //! schedule needs. Call on the capture thread for every frame, in
+    //! order. Returns step, -1 if unknown.
+    int ScheduleFrame(unsigned char* image)
+    {
+        std::vector<BankWrite> writes;
+        const int step = ReadExposureStep(image, writes);
+        for(size_t i=0; i < writes.size(); ++i) {
+            SetHDRBank(writes[i].bank, writes[i].step.shutter, writes[i].step.gain);
+        }
+        return step;
+    }
+};
+
+}
+
+#endif // PANGOLIN_HDR_CAMERA_H
@@ -0,0 +1,69 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PANGOLIN_IIDC_H
+#define PANGOLIN_IIDC_H
+
+#include <stdint.h>
+
+namespace pangolin
+{
+
+// Embedded image meta data flags (Point Grey FRAME_INFO register). Each
+// enabled flag occupies one big-endian 32 bit word at the start of the
+// image, in flag order.
+typedef enum {
+META_TIMESTAMP = 1,
+META_GAIN = 2,
+META_SHUTTER = 4,
+META_BRIGHTNESS = 8,
+META_EXPOSURE = 16,
+META_WHITE_BALANCE = 32,
+META_FRAME_COUNTER = 64,
+META_STROBE = 128,
+META_GPIO_PIN_STATE = 256,
+META_ROI_POSITION = 512,
+META_ALL = 1023,
+META_ABS = 32678, 
+META_ALL_AND_ABS = 33791,
+} meta_flags;
+
+// Control register offsets
+const uint64_t IIDC_REG_SHUTTER    = 0x81c;
+const uint64_t IIDC_REG_GAIN       = 0x820;
+const uint64_t IIDC_REG_META_FLAGS = 0x12f8;
+const uint64_t IIDC_REG_HDR_CTRL   = 0x1800;
+const uint64_t IIDC_REG_HDR_SHUTTER[4] = { 0x1820, 0x1840, 0x1860, 0x1880 };
+const uint64_t IIDC_REG_HDR_GAIN[4]    = { 0x1824, 0x1844, 0x1864, 0x1884 };
+
+// HDR_CTRL value with HDR mode enabled
+const uint32_t IIDC_HDR_ON = 0x82000000;
+
+}
+
+#endif // PANGOLIN_IIDC_H
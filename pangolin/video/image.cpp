@@ -54,52 +54,11 @@ namespace pangolin
         
     }
     
-    bool CreateJPEG(unsigned char* image, int width, int height, const char* filename)
+    bool CreateJPEG(unsigned char* image, int width, int height, const char* filename,
+                    const std::vector<unsigned char>* app1)
     {            
-    
-        // this is a pointer to one row of image data
-        JSAMPROW row_pointer[1];
-        FILE *imagefile = fopen( filename, "wb" );
-
-        struct jpeg_compress_struct cinfo;
-        struct jpeg_error_mgr jerr;
-             
-        if ( !imagefile ) {
-            printf("[IMAGE ERROR]: Error opening output jpeg file %s\n!", filename );
-            return false;
-        }
-        
-        cinfo.err = jpeg_std_error( &jerr );
-        jpeg_create_compress(&cinfo);
-        jpeg_stdio_dest(&cinfo, imagefile);
-        
-        // Setting the parameters of the output file here 
-        cinfo.image_width = width;  
-        cinfo.image_height = height;
-        cinfo.input_components = 3;
-        cinfo.in_color_space = JCS_RGB;
-        
-        // default compression parameters
-        jpeg_set_defaults( &cinfo );
-        
-        // set quality to 100%
-        jpeg_set_quality ( &cinfo, 100, TRUE);
-        
-        // Now do the compression
-        jpeg_start_compress( &cinfo, TRUE );
-        
-        // like reading a file, this time write one row at a time
-        while( cinfo.next_scanline < cinfo.image_height )
-        {
-            row_pointer[0] = &image[ cinfo.next_scanline * cinfo.image_width *  cinfo.input_components];
-            jpeg_write_scanlines( &cinfo, row_pointer, 1 );
-        }
-        // similar to read file, clean up after we're done compressing 
-        jpeg_finish_compress( &cinfo );
-        jpeg_destroy_compress( &cinfo );
-        fclose( imagefile );
-        
-        return true;
+        JpegCompressor compressor(100);
+        return compressor.Write(image, width, height, filename, app1);
     }
     
     bool LoadJPEG(unsigned char* image_buffer, const char* filename){
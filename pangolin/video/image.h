@@ -73,9 +73,11 @@ namespace pangolin
      @param image width
      @param image height
      @param image output file path
+     @param optional APP1 (exif) payload, see ExifBuilder
      @returns bool flag
      */
-    bool CreateJPEG(unsigned char* image, int width, int height, const char* filename);
+    bool CreateJPEG(unsigned char* image, int width, int height, const char* filename,
+                    const std::vector<unsigned char>* app1 = NULL);
     
     /**
      load jpeg in to image buffer
@@ -0,0 +1,359 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/video/image_formats.h>
+#include <pangolin/config.h>
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <iostream>
+#include <vector>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+using namespace std;
+
+namespace pangolin
+{
+    ImageFileFormat ImageFileFormatFromString(const std::string& format, bool lzw)
+    {
+        if( format == "jpeg" || format == "jpg" ) return IMAGE_FILE_JPEG;
+        if( format == "png" ) return IMAGE_FILE_PNG;
+        if( format == "tiff" || format == "tif" ) return lzw ? IMAGE_FILE_TIFF_LZW : IMAGE_FILE_TIFF;
+        return IMAGE_FILE_UNKNOWN;
+    }
+
+    /*-----------------------------------------------------------------------
+     *  PNG
+     *-----------------------------------------------------------------------*/
+
+#ifdef HAVE_ZLIB
+    static void PutBE32(unsigned char* p, uint32_t v)
+    {
+        p[0] = v >> 24; p[1] = v >> 16; p[2] = v >> 8; p[3] = v;
+    }
+
+    static bool WritePNGChunk(FILE* file, const char* type, const unsigned char* data, uint32_t size)
+    {
+        unsigned char header[8];
+        unsigned char crc_bytes[4];
+
+        PutBE32(header, size);
+        memcpy(header+4, type, 4);
+
+        uLong crc = crc32(0L, Z_NULL, 0);
+        crc = crc32(crc, header+4, 4);
+        if(size) crc = crc32(crc, data, size);
+        PutBE32(crc_bytes, crc);
+
+        return fwrite(header, 1, 8, file) == 8
+            && (!size || fwrite(data, 1, size, file) == size)
+            && fwrite(crc_bytes, 1, 4, file) == 4;
+    }
+#endif
+
+    bool CreatePNG(const unsigned char* image, int width, int height, const char* filename, int level)
+    {
+#ifdef HAVE_ZLIB
+        static const unsigned char signature[8] = {137, 'P', 'N', 'G', '\r', '\n', 26, '\n'};
+        const size_t pitch = width * 3;
+
+        FILE* file = fopen(filename, "wb");
+        if( !file ){
+            cout << "[IMAGE ERROR]: Error opening output png file " << filename << endl;
+            return false;
+        }
+
+        // 8 bit RGB, no interlace
+        unsigned char ihdr[13];
+        PutBE32(ihdr, width);
+        PutBE32(ihdr+4, height);
+        ihdr[8] = 8; ihdr[9] = 2; ihdr[10] = 0; ihdr[11] = 0; ihdr[12] = 0;
+
+        bool ok = fwrite(signature, 1, 8, file) == 8 && WritePNGChunk(file, "IHDR", ihdr, 13);
+
+        z_stream zs;
+        memset(&zs, 0, sizeof(zs));
+        if( deflateInit(&zs, level) != Z_OK ){
+            fclose(file);
+            return false;
+        }
+
+        // 'Sub' filter costs little and helps deflate considerably on camera images
+        std::vector<unsigned char> row(pitch + 1);
+        std::vector<unsigned char> out(1 << 16);
+        row[0] = 1;
+
+        for( int y = 0; ok && y <= height; ++y ){
+            const bool last = (y == height);
+            if( !last ){
+                const unsigned char* src = image + y * pitch;
+                memcpy(&row[1], src, pitch < 3 ? pitch : 3);
+                for( size_t i = 3; i < pitch; ++i ){
+                    row[1+i] = src[i] - src[i-3];
+                }
+                zs.next_in = &row[0];
+                zs.avail_in = row.size();
+            }
+
+            int ret;
+            do {
+                zs.next_out = &out[0];
+                zs.avail_out = out.size();
+                ret = deflate(&zs, last ? Z_FINISH : Z_NO_FLUSH);
+                const uint32_t have = out.size() - zs.avail_out;
+                if( have ) ok = ok && WritePNGChunk(file, "IDAT", &out[0], have);
+            } while( ok && (zs.avail_out == 0 || (last && ret != Z_STREAM_END)) );
+        }
+
+        deflateEnd(&zs);
+        ok = ok && WritePNGChunk(file, "IEND", NULL, 0);
+        fclose(file);
+
+        if( !ok ) cout << "[IMAGE ERROR]: Error writing png file " << filename << endl;
+        return ok;
+#else
+        cout << "[IMAGE ERROR]: png support requires zlib" << endl;
+        return false;
+#endif
+    }
+
+    /*-----------------------------------------------------------------------
+     *  TIFF
+     *-----------------------------------------------------------------------*/
+
+    // LZW as specified by TIFF 6.0 (and written by libtiff): MSB first codes
+    // from 9 to 12 bits, with the table cleared before it fills.
+    class TiffLzwEncoder
+    {
+    public:
+        void Encode(const unsigned char* in, size_t size, std::vector<unsigned char>& out)
+        {
+            this->out = &out;
+            acc = 0;
+            nbits = 0;
+            Reset();
+            Put(CODE_CLEAR);
+
+            if( size ){
+                int prefix = in[0];
+                for( size_t i = 1; i < size; ++i ){
+                    const int key = (prefix << 8) | in[i];
+                    int h = key % HASH_SIZE;
+                    while( keys[h] != -1 && keys[h] != key ) {
+                        if( ++h == HASH_SIZE ) h = 0;
+                    }
+                    if( keys[h] == key ){
+                        prefix = codes[h];
+                        continue;
+                    }
+
+                    Put(prefix);
+                    prefix = in[i];
+                    keys[h] = key;
+                    codes[h] = next_code;
+                    AddCode();
+                }
+                Put(prefix);
+                // decoder adds an entry for the final code too
+                AddCode();
+            }
+
+            Put(CODE_EOI);
+            if( nbits ) out.push_back((acc << (8 - nbits)) & 0xff);
+        }
+
+    protected:
+        static const int CODE_CLEAR = 256;
+        static const int CODE_EOI = 257;
+        static const int CODE_FIRST = 258;
+        static const int CODE_MAX = 4096;
+        static const int HASH_SIZE = 9973; // prime, under half full
+
+        void Reset()
+        {
+            for( int i = 0; i < HASH_SIZE; ++i ) keys[i] = -1;
+            next_code = CODE_FIRST;
+            width = 9;
+        }
+
+        void AddCode()
+        {
+            if( ++next_code == CODE_MAX - 1 ){
+                // table full
+                Put(CODE_CLEAR);
+                Reset();
+            }else if( next_code > (1 << width) - 1 ){
+                ++width;
+            }
+        }
+
+        void Put(int code)
+        {
+            acc = (acc << width) | code;
+            nbits += width;
+            while( nbits >= 8 ){
+                nbits -= 8;
+                out->push_back((acc >> nbits) & 0xff);
+            }
+            acc &= (1u << nbits) - 1;
+        }
+
+        std::vector<unsigned char>* out;
+        uint32_t acc;
+        int nbits;
+        int width;
+        int next_code;
+        int keys[HASH_SIZE];
+        short codes[HASH_SIZE];
+    };
+
+    static void PutLE16(std::vector<unsigned char>& b, size_t pos, uint16_t v)
+    {
+        b[pos] = v & 0xff; b[pos+1] = v >> 8;
+    }
+
+    static void PutLE32(std::vector<unsigned char>& b, size_t pos, uint32_t v)
+    {
+        for( int i = 0; i < 4; ++i ) b[pos+i] = (v >> (8*i)) & 0xff;
+    }
+
+    bool CreateTIFF(const unsigned char* image, int width, int height, const char* filename, bool lzw)
+    {
+        const size_t image_size = (size_t)width * height * 3;
+
+        std::vector<unsigned char> compressed;
+        if( lzw ){
+            compressed.reserve(image_size / 2);
+            TiffLzwEncoder* encoder = new TiffLzwEncoder();
+            encoder->Encode(image, image_size, compressed);
+            delete encoder;
+        }
+        const unsigned char* strip = lzw ? &compressed[0] : image;
+        const uint32_t strip_size = lzw ? compressed.size() : image_size;
+
+        // little endian header, single IFD followed by its values, then the single strip
+        const int entries = 13;
+        const size_t ifd_offset = 8;
+        const size_t bps_offset = ifd_offset + 2 + entries * 12 + 4;
+        const size_t xres_offset = bps_offset + 6;
+        const size_t yres_offset = xres_offset + 8;
+        const size_t strip_offset = yres_offset + 8;
+
+        std::vector<unsigned char> header(strip_offset, 0);
+        header[0] = 'I'; header[1] = 'I';
+        PutLE16(header, 2, 42);
+        PutLE32(header, 4, ifd_offset);
+        PutLE16(header, ifd_offset, entries);
+
+        size_t pos = ifd_offset + 2;
+        struct { uint16_t tag, type; uint32_t count, value; } ifd[entries] = {
+            {256, 4, 1, (uint32_t)width},       // ImageWidth
+            {257, 4, 1, (uint32_t)height},      // ImageLength
+            {258, 3, 3, bps_offset},            // BitsPerSample
+            {259, 3, 1, lzw ? 5u : 1u},         // Compression
+            {262, 3, 1, 2},                     // PhotometricInterpretation = RGB
+            {273, 4, 1, strip_offset},          // StripOffsets
+            {277, 3, 1, 3},                     // SamplesPerPixel
+            {278, 4, 1, (uint32_t)height},      // RowsPerStrip
+            {279, 4, 1, strip_size},            // StripByteCounts
+            {282, 5, 1, xres_offset},           // XResolution
+            {283, 5, 1, yres_offset},           // YResolution
+            {284, 3, 1, 1},                     // PlanarConfiguration = contiguous
+            {296, 3, 1, 2}                      // ResolutionUnit = inch
+        };
+        for( int i = 0; i < entries; ++i, pos += 12 ){
+            PutLE16(header, pos, ifd[i].tag);
+            PutLE16(header, pos+2, ifd[i].type);
+            PutLE32(header, pos+4, ifd[i].count);
+            // short values are left justified
+            if( ifd[i].type == 3 && ifd[i].count == 1 ) PutLE16(header, pos+8, ifd[i].value);
+            else PutLE32(header, pos+8, ifd[i].value);
+        }
+
+        for( int i = 0; i < 3; ++i ) PutLE16(header, bps_offset + 2*i, 8);
+        PutLE32(header, xres_offset, 72); PutLE32(header, xres_offset+4, 1);
+        PutLE32(header, yres_offset, 72); PutLE32(header, yres_offset+4, 1);
+
+        FILE* file = fopen(filename, "wb");
+        if( !file ){
+            cout << "[IMAGE ERROR]: Error opening output tiff file " << filename << endl;
+            return false;
+        }
+
+        const bool ok = fwrite(&header[0], 1, header.size(), file) == header.size()
+                     && fwrite(strip, 1, strip_size, file) == strip_size;
+        fclose(file);
+
+        if( !ok ) cout << "[IMAGE ERROR]: Error writing tiff file " << filename << endl;
+        return ok;
+    }
+
+    bool CreatePPM16(const uint16_t* image, int width, int height, const char* filename)
+    {
+        FILE* file = fopen(filename, "wb");
+        if( !file ){
+            cout << "[IMAGE ERROR]: Error opening output ppm file " << filename << endl;
+            return false;
+        }
+
+        // samples are big endian for maxval above 255
+        const size_t pitch = (size_t)width * 3;
+        vector<unsigned char> row(pitch * 2);
+        bool ok = fprintf(file, "P6\n%d %d\n65535\n", width, height) > 0;
+        for( int y = 0; ok && y < height; ++y ){
+            const uint16_t* src = image + y * pitch;
+            for( size_t i = 0; i < pitch; ++i ){
+                row[2*i] = (unsigned char)(src[i] >> 8);
+                row[2*i+1] = (unsigned char)src[i];
+            }
+            ok = fwrite(&row[0], 1, row.size(), file) == row.size();
+        }
+        fclose(file);
+
+        if( !ok ) cout << "[IMAGE ERROR]: Error writing ppm file " << filename << endl;
+        return ok;
+    }
+
+    bool CreateImageFile(ImageFileFormat format, const unsigned char* image, int width, int height, const char* filename)
+    {
+        switch( format ){
+        case IMAGE_FILE_PNG:
+            return CreatePNG(image, width, height, filename);
+        case IMAGE_FILE_TIFF:
+            return CreateTIFF(image, width, height, filename, false);
+        case IMAGE_FILE_TIFF_LZW:
+            return CreateTIFF(image, width, height, filename, true);
+        default:
+            return false;
+        }
+    }
+}
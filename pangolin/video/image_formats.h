@@ -0,0 +1,105 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+/** @brief Direct writers for PNG and TIFF files from RGB8 image buffers
+
+ These write the configured image format in a single encode, rather than
+ converting a saved JPEG through ImageMagick. 16 bit PPM keeps frames of
+ deeper formats at full precision for the HDR merge.
+ */
+
+#ifndef PANGOLIN_IMAGE_FORMATS_H
+#define PANGOLIN_IMAGE_FORMATS_H
+
+#include <string>
+#include <stdint.h>
+
+namespace pangolin
+{
+    enum ImageFileFormat
+    {
+        IMAGE_FILE_UNKNOWN,
+        IMAGE_FILE_JPEG,
+        IMAGE_FILE_PNG,
+        IMAGE_FILE_TIFF,     // uncompressed
+        IMAGE_FILE_TIFF_LZW
+    };
+
+    /**
+     format from config name (jpeg, jpg, png, tiff, tif)
+     @param format name
+     @param use lzw compression for tiff
+     @returns format, IMAGE_FILE_UNKNOWN if not supported directly
+     */
+    ImageFileFormat ImageFileFormatFromString(const std::string& format, bool lzw = false);
+
+    /**
+     create png from RGB8 image buffer
+     @param image buffer
+     @param image width
+     @param image height
+     @param image output file path
+     @param zlib compression level (1 = fastest, 9 = smallest)
+     @returns bool flag
+     */
+    bool CreatePNG(const unsigned char* image, int width, int height, const char* filename, int level = 1);
+
+    /**
+     create tiff from RGB8 image buffer
+     @param image buffer
+     @param image width
+     @param image height
+     @param image output file path
+     @param lzw compress or not
+     @returns bool flag
+     */
+    bool CreateTIFF(const unsigned char* image, int width, int height, const char* filename, bool lzw = false);
+
+    /**
+     create 16 bit ppm from RGB16 image buffer (host endian)
+     @param image buffer
+     @param image width
+     @param image height
+     @param image output file path
+     @returns bool flag
+     */
+    bool CreatePPM16(const uint16_t* image, int width, int height, const char* filename);
+
+    /**
+     create png or tiff from RGB8 image buffer
+     @param format
+     @param image buffer
+     @param image width
+     @param image height
+     @param image output file path
+     @returns bool flag, false if format is not png or tiff
+     */
+    bool CreateImageFile(ImageFileFormat format, const unsigned char* image, int width, int height, const char* filename);
+}
+
+#endif
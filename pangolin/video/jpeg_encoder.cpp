@@ -0,0 +1,249 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include <pangolin/video/jpeg_encoder.h>
+
+#include <string.h>
+#include <iostream>
+#include <exception>
+
+using namespace std;
+
+namespace pangolin
+{
+
+JpegCompressor::JpegCompressor(int quality)
+    : quality(quality)
+{
+    cinfo.err = jpeg_std_error(&jerr);
+    jpeg_create_compress(&cinfo);
+}
+
+JpegCompressor::~JpegCompressor()
+{
+    jpeg_destroy_compress(&cinfo);
+}
+
+void JpegCompressor::SetQuality(int quality)
+{
+    this->quality = quality;
+}
+
+bool JpegCompressor::Write(const unsigned char* image, int width, int height, const char* filename,
+                           const std::vector<unsigned char>* app1)
+{
+    FILE* imagefile = fopen(filename, "wb");
+    if(!imagefile) {
+        cout << "[IMAGE ERROR]: Error opening output jpeg file " << filename << endl;
+        return false;
+    }
+
+    // destination manager is allocated once and retargeted per file
+    jpeg_stdio_dest(&cinfo, imagefile);
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = 3;
+    cinfo.in_color_space = JCS_RGB;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+
+    // EXIF files carry APP1 in place of the JFIF APP0 marker
+    const bool exif = app1 && !app1->empty();
+    cinfo.write_JFIF_header = exif ? FALSE : TRUE;
+
+    jpeg_start_compress(&cinfo, TRUE);
+
+    if(exif) {
+        jpeg_write_marker(&cinfo, JPEG_APP0 + 1, &(*app1)[0], app1->size());
+    }
+
+    const size_t pitch = width * 3;
+    JSAMPROW row_pointer[1];
+    while(cinfo.next_scanline < cinfo.image_height) {
+        row_pointer[0] = const_cast<unsigned char*>(image + cinfo.next_scanline * pitch);
+        jpeg_write_scanlines(&cinfo, row_pointer, 1);
+    }
+
+    jpeg_finish_compress(&cinfo);
+    fclose(imagefile);
+    return true;
+}
+
+JpegEncoderPool::JpegEncoderPool(int num_workers, size_t queue_size, JpegQueuePolicy policy, int quality)
+    : queue_size(queue_size > 0 ? queue_size : 1), policy(policy), quality(quality),
+      running(true), reserved(0), busy(0), encoded(0), dropped(0), failed(0)
+{
+    if(num_workers < 1) num_workers = 1;
+
+    // enough buffers for a full queue plus one in each worker
+    for(size_t i = 0; i < this->queue_size + num_workers; ++i) {
+        jobs.push_back(new Job());
+        free_jobs.push_back(jobs.back());
+    }
+
+    for(int i = 0; i < num_workers; ++i) {
+        workers.create_thread(boost::ref(*this));
+    }
+}
+
+JpegEncoderPool::~JpegEncoderPool()
+{
+    Stop();
+    for(size_t i = 0; i < jobs.size(); ++i) {
+        delete jobs[i];
+    }
+}
+
+JpegEncoderPool::Job* JpegEncoderPool::Acquire()
+{
+    Job* job = free_jobs.back();
+    free_jobs.pop_back();
+    return job;
+}
+
+bool JpegEncoderPool::Encode(const unsigned char* image, int width, int height,
+                             const std::string& filename,
+                             const std::vector<unsigned char>* app1,
+                             JpegWrittenCallback written,
+                             ImageFileFormat format)
+{
+    Job* job;
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        while(running && reserved >= queue_size) {
+            if(policy == JPEG_QUEUE_DROP) {
+                ++dropped;
+                return false;
+            }
+            not_full.wait(lock);
+        }
+        if(!running) {
+            ++dropped;
+            return false;
+        }
+        ++reserved;
+        job = Acquire();
+    }
+
+    // copy outside of lock so that workers are not held up
+    job->image.resize((size_t)width * height * 3);
+    memcpy(&job->image[0], image, job->image.size());
+    job->width = width;
+    job->height = height;
+    job->format = format;
+    job->filename = filename;
+    if(app1) {
+        job->app1 = *app1;
+    }else{
+        job->app1.clear();
+    }
+    job->written = written;
+
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        queue.push_back(job);
+    }
+    not_empty.notify_one();
+    return true;
+}
+
+void JpegEncoderPool::Wait()
+{
+    boost::mutex::scoped_lock lock(mutex);
+    while(reserved > 0 || busy > 0) {
+        idle.wait(lock);
+    }
+}
+
+void JpegEncoderPool::Stop()
+{
+    {
+        boost::mutex::scoped_lock lock(mutex);
+        if(!running) return;
+        running = false;
+    }
+    not_empty.notify_all();
+    not_full.notify_all();
+    workers.join_all();
+}
+
+size_t JpegEncoderPool::Pending() const
+{
+    boost::mutex::scoped_lock lock(mutex);
+    return reserved + busy;
+}
+
+void JpegEncoderPool::operator()()
+{
+    JpegCompressor compressor(quality);
+
+    while(true) {
+        Job* job;
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            // keep going until queue is drained, even once stopped
+            while(queue.empty() && (running || reserved > 0)) {
+                not_empty.wait(lock);
+            }
+            if(queue.empty()) {
+                return;
+            }
+            job = queue.front();
+            queue.pop_front();
+            --reserved;
+            ++busy;
+        }
+        not_full.notify_one();
+
+        bool ok = job->format == IMAGE_FILE_JPEG
+                ? compressor.Write(&job->image[0], job->width, job->height, job->filename.c_str(), &job->app1)
+                : CreateImageFile(job->format, &job->image[0], job->width, job->height, job->filename.c_str());
+        if(ok && job->written) {
+            try {
+                job->written(job->filename);
+            }catch(const std::exception& e) {
+                cout << "[SAVE ERROR]: " << e.what() << endl;
+                ok = false;
+            }
+        }
+        job->written = JpegWrittenCallback();
+
+        {
+            boost::mutex::scoped_lock lock(mutex);
+            ok ? ++encoded : ++failed;
+            free_jobs.push_back(job);
+            --busy;
+            if(reserved == 0 && busy == 0) {
+                idle.notify_all();
+            }
+        }
+    }
+}
+
+}
@@ -0,0 +1,157 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PANGOLIN_JPEG_ENCODER_H
+#define PANGOLIN_JPEG_ENCODER_H
+
+#include <stdio.h>
+#include <deque>
+#include <string>
+#include <vector>
+
+#include <jpeglib.h>
+
+#include <pangolin/video/image_formats.h>
+
+#include <boost/function.hpp>
+#include <boost/thread.hpp>
+
+namespace pangolin
+{
+
+//! Behaviour of JpegEncoderPool::Encode when the queue is full
+enum JpegQueuePolicy
+{
+    JPEG_QUEUE_BLOCK, // wait for a worker to free a slot
+    JPEG_QUEUE_DROP   // reject the frame immediately
+};
+
+//! Called on the worker thread once filename has been written
+typedef boost::function<void (const std::string&)> JpegWrittenCallback;
+
+//! Reusable libjpeg compressor for RGB8 images. The compress struct, and
+//! with it libjpeg's working memory, is kept between images.
+class JpegCompressor
+{
+public:
+    JpegCompressor(int quality = 100);
+    ~JpegCompressor();
+
+    void SetQuality(int quality);
+
+    //! Write image, with optional APP1 (EXIF) marker payload (see
+    //! ExifBuilder). Returns false if the file could not be opened
+    bool Write(const unsigned char* image, int width, int height, const char* filename,
+               const std::vector<unsigned char>* app1 = NULL);
+
+protected:
+    JpegCompressor(const JpegCompressor&);
+    JpegCompressor& operator=(const JpegCompressor&);
+
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr jerr;
+    int quality;
+};
+
+//! Encodes frames to JPEG (or PNG / TIFF) files on a pool of worker
+//! threads so that recording is not limited by the speed of one core.
+//! Frames are copied into recycled buffers on submission, and each worker
+//! owns a JpegCompressor.
+class JpegEncoderPool
+{
+public:
+    JpegEncoderPool(int workers, size_t queue_size = 32,
+                    JpegQueuePolicy policy = JPEG_QUEUE_BLOCK, int quality = 100);
+
+    //! Finishes queued frames before returning
+    ~JpegEncoderPool();
+
+    //! Queue a copy of image (and APP1 payload) to be written to filename,
+    //! with optional callback once written. Returns false if the frame
+    //! was dropped.
+    bool Encode(const unsigned char* image, int width, int height,
+                const std::string& filename,
+                const std::vector<unsigned char>* app1 = NULL,
+                JpegWrittenCallback written = JpegWrittenCallback(),
+                ImageFileFormat format = IMAGE_FILE_JPEG);
+
+    //! Block until all queued frames have been written
+    void Wait();
+
+    //! Write queued frames and stop workers. No frames are accepted after.
+    void Stop();
+
+    size_t Pending() const;
+    unsigned long FramesEncoded() const { return encoded; }
+    unsigned long FramesDropped() const { return dropped; }
+    unsigned long FramesFailed() const { return failed; }
+
+    //! Worker body
+    void operator()();
+
+protected:
+    struct Job
+    {
+        std::vector<unsigned char> image;
+        std::vector<unsigned char> app1;
+        int width, height;
+        ImageFileFormat format;
+        std::string filename;
+        JpegWrittenCallback written;
+    };
+
+    JpegEncoderPool(const JpegEncoderPool&);
+    JpegEncoderPool& operator=(const JpegEncoderPool&);
+
+    Job* Acquire();
+
+    size_t queue_size;
+    JpegQueuePolicy policy;
+    int quality;
+
+    bool running;
+    size_t reserved; // slots queued or being filled
+    int busy;        // workers encoding
+    std::deque<Job*> queue;
+    std::vector<Job*> jobs;
+    std::vector<Job*> free_jobs;
+
+    mutable boost::mutex mutex;
+    boost::condition_variable not_empty;
+    boost::condition_variable not_full;
+    boost::condition_variable idle;
+    boost::thread_group workers;
+
+    unsigned long encoded;
+    unsigned long dropped;
+    unsigned long failed;
+};
+
+}
+
+#endif // PANGOLIN_JPEG_ENCODER_H
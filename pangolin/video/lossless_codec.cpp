@@ -0,0 +1,361 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "lossless_codec.h"
+
+#include <cstring>
+#include <stdint.h>
+
+namespace pangolin
+{
+
+namespace
+{
+
+const int BLOCK = 32;
+const int K_BITS = 3;
+const int K_MAX = 7;
+
+// quotients of this size or more escape to raw value
+const int ESCAPE = 12;
+
+struct CodecHeader
+{
+    uint32_t row_bytes;
+    uint32_t rows;
+    uint32_t stride;
+};
+
+inline unsigned char Predict(unsigned char a, unsigned char b, unsigned char c)
+{
+    const unsigned char mx = a > b ? a : b;
+    const unsigned char mn = a > b ? b : a;
+    const unsigned char mid = a + b - c;
+    return c >= mx ? mn : (c <= mn ? mx : mid);
+}
+
+// residual modulo 256 as signed, then interleaved 0,-1,1,-2,...
+inline unsigned char ZigZag(unsigned char r)
+{
+    return (unsigned char)((r << 1) ^ -(r >> 7));
+}
+
+inline unsigned char UnZigZag(unsigned char z)
+{
+    return (z >> 1) ^ -(z & 1);
+}
+
+// predicted residuals of row y, prev is row above (NULL for first row)
+inline void Residuals(const unsigned char* row, const unsigned char* prev,
+                      size_t row_bytes, size_t stride, unsigned char* res)
+{
+    if( !prev ) {
+        for(size_t x=0; x < stride && x < row_bytes; ++x)
+            res[x] = ZigZag(row[x]);
+        for(size_t x=stride; x < row_bytes; ++x)
+            res[x] = ZigZag(row[x] - row[x-stride]);
+    }else{
+        for(size_t x=0; x < stride && x < row_bytes; ++x)
+            res[x] = ZigZag(row[x] - prev[x]);
+        for(size_t x=stride; x < row_bytes; ++x)
+            res[x] = ZigZag(row[x] - Predict(row[x-stride], prev[x], prev[x-stride]));
+    }
+}
+
+// Rice code of each residual for each parameter, including escapes
+struct RiceCodes
+{
+    RiceCodes()
+    {
+        for(int k=0; k <= K_MAX; ++k) {
+            for(int r=0; r < 256; ++r) {
+                const unsigned q = r >> k;
+                if( q < (unsigned)ESCAPE ) {
+                    // q ones, terminating zero, then k bits of remainder
+                    code[k][r] = ((1u << q) - 1) | ((r & ((1u << k) - 1)) << (q + 1));
+                    length[k][r] = q + 1 + k;
+                }else{
+                    code[k][r] = ((1u << ESCAPE) - 1) | (r << ESCAPE);
+                    length[k][r] = ESCAPE + 8;
+                }
+            }
+        }
+    }
+
+    uint32_t code[K_MAX+1][256];
+    unsigned char length[K_MAX+1][256];
+};
+
+const RiceCodes rice_codes;
+
+// inverse of Residuals
+inline void Reconstruct(unsigned char* row, const unsigned char* prev,
+                        size_t row_bytes, size_t stride, const unsigned char* res)
+{
+    if( !prev ) {
+        for(size_t x=0; x < stride && x < row_bytes; ++x)
+            row[x] = UnZigZag(res[x]);
+        for(size_t x=stride; x < row_bytes; ++x)
+            row[x] = row[x-stride] + UnZigZag(res[x]);
+    }else{
+        for(size_t x=0; x < stride && x < row_bytes; ++x)
+            row[x] = prev[x] + UnZigZag(res[x]);
+        for(size_t x=stride; x < row_bytes; ++x)
+            row[x] = Predict(row[x-stride], prev[x], prev[x-stride]) + UnZigZag(res[x]);
+    }
+}
+
+// Reconstruct for common strides, keeping neighbours in registers rather
+// than reloading values just written
+template<int S>
+inline void Reconstruct(unsigned char* row, const unsigned char* prev,
+                        size_t row_bytes, const unsigned char* res)
+{
+    if( !prev || row_bytes < 2*S ) {
+        Reconstruct(row, prev, row_bytes, S, res);
+        return;
+    }
+
+    unsigned char left[S], up_left[S];
+    for(int c=0; c < S; ++c) {
+        left[c] = row[c] = prev[c] + UnZigZag(res[c]);
+        up_left[c] = prev[c];
+    }
+
+    size_t x = S;
+    for(; x + S <= row_bytes; x += S) {
+        for(int c=0; c < S; ++c) {
+            const unsigned char up = prev[x+c];
+            left[c] = row[x+c] = Predict(left[c], up, up_left[c]) + UnZigZag(res[x+c]);
+            up_left[c] = up;
+        }
+    }
+
+    for(; x < row_bytes; ++x)
+        row[x] = Predict(row[x-S], prev[x], prev[x-S]) + UnZigZag(res[x]);
+}
+
+class BitWriter
+{
+public:
+    BitWriter(unsigned char* out) : out(out), pos(0), acc(0), bits(0) {}
+
+    // n <= 56. Always stores 8 bytes and advances by whole bytes, so output
+    // needs 8 bytes of slack.
+    inline void Put(uint32_t value, int n)
+    {
+        acc |= (uint64_t)value << bits;
+        bits += n;
+        memcpy(out + pos, &acc, 8);
+        const int bytes = bits >> 3;
+        pos += bytes;
+        acc = bytes < 8 ? acc >> (bytes << 3) : 0;
+        bits &= 7;
+    }
+
+    size_t Flush()
+    {
+        return pos + (bits ? 1 : 0);
+    }
+
+protected:
+    unsigned char* out;
+    size_t pos;
+    uint64_t acc;
+    int bits;
+};
+
+class BitReader
+{
+public:
+    BitReader(const unsigned char* in, size_t size)
+        : in(in), size(size), pos(0), acc(0), bits(0) {}
+
+    inline void Refill()
+    {
+        if( pos + 8 <= size ) {
+            // whole bytes that fit in accumulator in one load
+            uint64_t word;
+            memcpy(&word, in + pos, 8);
+            acc |= word << bits;
+            const int n = (63 - bits) >> 3;
+            pos += n;
+            bits += n << 3;
+            return;
+        }
+        while( bits <= 56 ) {
+            const uint64_t byte = pos < size ? in[pos] : 0;
+            acc |= byte << bits;
+            ++pos;
+            bits += 8;
+        }
+    }
+
+    inline uint32_t Get(int n)
+    {
+        if( bits < n ) Refill();
+        const uint32_t v = (uint32_t)(acc & ((1ull << n) - 1));
+        acc >>= n;
+        bits -= n;
+        return v;
+    }
+
+    // Rice coded value with parameter k, or escaped raw value
+    inline unsigned char Rice(int k)
+    {
+        if( bits < ESCAPE + 8 ) Refill();
+        const uint64_t zeros = ~acc;
+        const int q = zeros ? __builtin_ctzll(zeros) : 64;
+        if( q < ESCAPE ) {
+            const int n = q + 1 + k;
+            const unsigned char v = (q << k) | ((acc >> (q + 1)) & ((1u << k) - 1));
+            acc >>= n;
+            bits -= n;
+            return v;
+        }else{
+            const unsigned char v = (unsigned char)(acc >> ESCAPE);
+            acc >>= ESCAPE + 8;
+            bits -= ESCAPE + 8;
+            return v;
+        }
+    }
+
+    bool Overrun() const { return pos > size + 8; }
+
+protected:
+    const unsigned char* in;
+    size_t size;
+    size_t pos;
+    uint64_t acc;
+    int bits;
+};
+
+}
+
+size_t LosslessCompress(const unsigned char* image, size_t row_bytes, size_t rows,
+                        size_t stride, std::vector<unsigned char>& out)
+{
+    const size_t image_bytes = row_bytes * rows;
+    if( !image_bytes || !stride )
+        return 0;
+
+    // worst case is every value escaping, plus block parameters
+    const size_t bound = sizeof(CodecHeader) + image_bytes * (ESCAPE + 8 + 7) / 8
+                       + (image_bytes / BLOCK + rows + 1) + 16;
+    if( out.size() < bound )
+        out.resize(bound);
+
+    CodecHeader header;
+    header.row_bytes = row_bytes;
+    header.rows = rows;
+    header.stride = stride;
+    memcpy(&out[0], &header, sizeof(header));
+
+    std::vector<unsigned char> res(row_bytes);
+    BitWriter writer(&out[sizeof(header)]);
+
+    for(size_t y=0; y < rows; ++y)
+    {
+        const unsigned char* row = image + y * row_bytes;
+        Residuals(row, y ? row - row_bytes : 0, row_bytes, stride, &res[0]);
+
+        for(size_t b=0; b < row_bytes; b += BLOCK)
+        {
+            const size_t n = (row_bytes - b) < (size_t)BLOCK ? row_bytes - b : BLOCK;
+            const unsigned char* r = &res[b];
+
+            // Rice parameter is log2 of mean residual
+            unsigned sum = 0;
+            for(size_t i=0; i < n; ++i) sum += r[i];
+            const unsigned mean = sum / n;
+            int k = mean ? 31 - __builtin_clz(mean) : 0;
+            if( k > K_MAX ) k = K_MAX;
+
+            writer.Put(k, K_BITS);
+
+            const uint32_t* code = rice_codes.code[k];
+            const unsigned char* length = rice_codes.length[k];
+            for(size_t i=0; i < n; ++i) {
+                writer.Put(code[r[i]], length[r[i]]);
+            }
+        }
+    }
+
+    const size_t size = sizeof(header) + writer.Flush();
+    return size < image_bytes ? size : 0;
+}
+
+bool LosslessDecompress(const unsigned char* data, size_t size,
+                        unsigned char* image, size_t image_bytes)
+{
+    CodecHeader header;
+    if( size < sizeof(header) )
+        return false;
+
+    memcpy(&header, data, sizeof(header));
+
+    const size_t row_bytes = header.row_bytes;
+    const size_t rows = header.rows;
+    const size_t stride = header.stride;
+    if( row_bytes * rows != image_bytes || !stride )
+        return false;
+
+    std::vector<unsigned char> res(row_bytes);
+    BitReader reader(data + sizeof(header), size - sizeof(header));
+
+    for(size_t y=0; y < rows; ++y)
+    {
+        for(size_t b=0; b < row_bytes; b += BLOCK)
+        {
+            const size_t n = (row_bytes - b) < (size_t)BLOCK ? row_bytes - b : BLOCK;
+            const int k = reader.Get(K_BITS);
+
+            for(size_t i=0; i < n; ++i) {
+                res[b+i] = reader.Rice(k);
+            }
+        }
+
+        if( reader.Overrun() )
+            return false;
+
+        unsigned char* row = image + y * row_bytes;
+        const unsigned char* prev = y ? row - row_bytes : 0;
+
+        switch( stride ) {
+        case 1: Reconstruct<1>(row, prev, row_bytes, &res[0]); break;
+        case 2: Reconstruct<2>(row, prev, row_bytes, &res[0]); break;
+        case 3: Reconstruct<3>(row, prev, row_bytes, &res[0]); break;
+        case 4: Reconstruct<4>(row, prev, row_bytes, &res[0]); break;
+        default: Reconstruct(row, prev, row_bytes, stride, &res[0]);
+        }
+    }
+
+    return true;
+}
+
+}
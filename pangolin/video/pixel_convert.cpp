@@ -0,0 +1,365 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "pixel_convert.h"
+#include "yuv_convert.h"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace pangolin
+{
+
+namespace
+{
+
+enum PixelLayout
+{
+    LAYOUT_GRAY8,
+    LAYOUT_GRAY12P,
+    LAYOUT_GRAY16LE,
+    LAYOUT_GRAY16BE,
+    LAYOUT_RGB24,
+    LAYOUT_BGR24,
+    LAYOUT_RGB48LE,
+    LAYOUT_RGB48BE,
+    LAYOUT_BAYER,
+    LAYOUT_YUV
+};
+
+// ITU-R BT.601 luma weights in 1/65536 (summing to 65536)
+const uint32_t LUMA_R = 19595;
+const uint32_t LUMA_G = 38470;
+const uint32_t LUMA_B = 7471;
+
+inline bool IsBigEndianHost()
+{
+    const uint16_t one = 1;
+    return *(const unsigned char*)&one == 0;
+}
+
+PixelLayout LayoutFromString(const std::string& format)
+{
+    if( !format.compare("GRAY8") )    return LAYOUT_GRAY8;
+    if( !format.compare("GRAY12P") )  return LAYOUT_GRAY12P;
+    if( !format.compare("GRAY16LE") ) return LAYOUT_GRAY16LE;
+    if( !format.compare("GRAY16BE") ) return LAYOUT_GRAY16BE;
+    if( !format.compare("RGB24") )    return LAYOUT_RGB24;
+    if( !format.compare("BGR24") )    return LAYOUT_BGR24;
+    if( !format.compare("RGB48LE") )  return LAYOUT_RGB48LE;
+    if( !format.compare("RGB48BE") )  return LAYOUT_RGB48BE;
+    if( IsBayerFormat(format) )       return LAYOUT_BAYER;
+    if( IsYuvFormat(format) )         return LAYOUT_YUV;
+    throw VideoException("Pixel format cannot be converted", format);
+}
+
+int Channels(PixelLayout layout)
+{
+    return layout >= LAYOUT_RGB24 && layout <= LAYOUT_RGB48BE ? 3 : 1;
+}
+
+int BitsPerPixel(PixelLayout layout, const std::string& format)
+{
+    switch(layout)
+    {
+        case LAYOUT_GRAY8:    return 8;
+        case LAYOUT_GRAY12P:  return 12;
+        case LAYOUT_RGB24:
+        case LAYOUT_BGR24:    return 24;
+        case LAYOUT_RGB48LE:
+        case LAYOUT_RGB48BE:  return 48;
+        case LAYOUT_BAYER:    return FormatBitDepth(format);
+        case LAYOUT_YUV:      return VideoFormatFromString(format).bpp;
+        default:              return 16;
+    }
+}
+
+inline void Widen8(const unsigned char* src, size_t n, uint16_t* dst)
+{
+    for(size_t i=0; i < n; ++i) dst[i] = (uint16_t)(src[i] * 257);
+}
+
+inline void Copy16(const unsigned char* src, size_t n, bool big_endian, uint16_t* dst)
+{
+    if( big_endian != IsBigEndianHost() ) {
+        const uint16_t* s = (const uint16_t*)src;
+        for(size_t i=0; i < n; ++i) dst[i] = (uint16_t)((s[i] << 8) | (s[i] >> 8));
+    }else{
+        memcpy(dst, src, n * sizeof(uint16_t));
+    }
+}
+
+// Convert row of w pixels of non bayer layout to RGB48. samples is
+// scratch for w * 3 values, rows of gray are widened there first.
+void RowToRGB48(const unsigned char* src, PixelLayout layout, unsigned w,
+                uint16_t* samples, uint16_t* rgb)
+{
+    const size_t n = (size_t)w * Channels(layout);
+    uint16_t* dst = Channels(layout) == 3 ? rgb : samples;
+
+    switch(layout)
+    {
+        case LAYOUT_GRAY8:
+        case LAYOUT_RGB24:
+        case LAYOUT_BGR24:    Widen8(src, n, dst); break;
+        case LAYOUT_GRAY12P:  Unpack12(src, n, dst); break;
+        case LAYOUT_GRAY16LE:
+        case LAYOUT_RGB48LE:  Copy16(src, n, false, dst); break;
+        case LAYOUT_GRAY16BE:
+        case LAYOUT_RGB48BE:  Copy16(src, n, true, dst); break;
+        default:              break;
+    }
+
+    if( Channels(layout) == 1 ) {
+        for(unsigned x=0; x < w; ++x) {
+            rgb[3*x+0] = rgb[3*x+1] = rgb[3*x+2] = samples[x];
+        }
+    }else if( layout == LAYOUT_BGR24 ) {
+        for(unsigned x=0; x < w; ++x) {
+            const uint16_t b = rgb[3*x];
+            rgb[3*x] = rgb[3*x+2];
+            rgb[3*x+2] = b;
+        }
+    }
+}
+
+// Luma of full scale samples, scaled by 256/257 so that samples widened
+// from 8 bit fall in the same bin as luma computed on the 8 bit values.
+inline unsigned Luma(uint32_t r, uint32_t g, uint32_t b)
+{
+    const uint32_t y = (LUMA_R * r + LUMA_G * g + LUMA_B * b) >> 16;
+    return y - (y >> 8);
+}
+
+}
+
+int FormatBitDepth(const std::string& format)
+{
+    BayerPattern pattern;
+    int bits;
+    bool big_endian;
+    if( BayerFormatFromString(format, pattern, bits, big_endian) ) {
+        return bits;
+    }
+
+    const VideoPixelFormat fmt = VideoFormatFromString(format);
+    if( !format.compare("GRAY12P") ) return 12;
+    return fmt.channel_bits[0] > 8 ? 16 : 8;
+}
+
+void Unpack12(const unsigned char* src, size_t samples, uint16_t* dst)
+{
+    const size_t pairs = samples / 2;
+    size_t i = 0;
+
+#ifdef __SSE2__
+    // 4 pairs (12 bytes) per 16 byte load, while the load stays in bounds
+    const __m128i lo24 = _mm_set_epi32(0, 0xffffff, 0, 0xffffff);
+    const __m128i hi24 = _mm_set_epi32(0xffffff, 0, 0xffffff, 0);
+    const __m128i m8  = _mm_set1_epi32(0xff);
+    const __m128i m4  = _mm_set1_epi32(0xf);
+    const __m128i m12 = _mm_set1_epi32(0xfff);
+    for(; 3*i + 16 <= 3*pairs; i += 4) {
+        const __m128i x = _mm_loadu_si128((const __m128i*)(src + 3*i));
+
+        // 64 bit halves hold pairs 0,1 and 2,3. Move the second pair of
+        // each half up a byte so every 32 bit lane is b0 | b1<<8 | b2<<16.
+        const __m128i q = _mm_unpacklo_epi64(x, _mm_srli_si128(x, 6));
+        const __m128i z = _mm_or_si128(_mm_and_si128(q, lo24),
+                                       _mm_and_si128(_mm_slli_epi64(q, 8), hi24));
+
+        const __m128i p0 = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(z, m8), 4),
+                                        _mm_and_si128(_mm_srli_epi32(z, 8), m4));
+        const __m128i p1 = _mm_and_si128(_mm_srli_epi32(z, 12), m12);
+
+        // even 16 bit lanes P0, odd lanes P1, top bits replicated as below
+        const __m128i p = _mm_or_si128(p0, _mm_slli_epi32(p1, 16));
+        _mm_storeu_si128((__m128i*)(dst + 2*i),
+                         _mm_or_si128(_mm_slli_epi16(p, 4), _mm_srli_epi16(p, 8)));
+    }
+#endif // __SSE2__
+
+    for(; i < pairs; ++i) {
+        const uint32_t b0 = src[3*i+0];
+        const uint32_t b1 = src[3*i+1];
+        const uint32_t b2 = src[3*i+2];
+        const uint32_t p0 = (b0 << 4) | (b1 & 0xf);
+        const uint32_t p1 = (b2 << 4) | (b1 >> 4);
+        // replicate top bits so that 4095 maps to 65535
+        dst[2*i+0] = (uint16_t)((p0 << 4) | (p0 >> 8));
+        dst[2*i+1] = (uint16_t)((p1 << 4) | (p1 >> 8));
+    }
+}
+
+void ConvertToRGB24(const unsigned char* image, unsigned w, unsigned h,
+                    const std::string& format, unsigned char* rgb,
+                    DemosaicMethod method)
+{
+    const PixelLayout layout = LayoutFromString(format);
+    const size_t pixels = (size_t)w * h;
+
+    switch(layout)
+    {
+        case LAYOUT_RGB24:
+            memcpy(rgb, image, pixels * 3);
+            return;
+        case LAYOUT_BGR24:
+            for(size_t i=0; i < pixels; ++i) {
+                rgb[3*i+0] = image[3*i+2];
+                rgb[3*i+1] = image[3*i+1];
+                rgb[3*i+2] = image[3*i+0];
+            }
+            return;
+        case LAYOUT_GRAY8:
+            for(size_t i=0; i < pixels; ++i) {
+                rgb[3*i+0] = rgb[3*i+1] = rgb[3*i+2] = image[i];
+            }
+            return;
+        case LAYOUT_BAYER:
+            Demosaic(image, w, h, format, rgb, "RGB24", method);
+            return;
+        case LAYOUT_YUV:
+            ConvertYuv(image, w, h, format, rgb, "RGB24");
+            return;
+        default:
+            break;
+    }
+
+    const size_t row_bytes = (size_t)w * BitsPerPixel(layout, format) / 8;
+    vector<uint16_t> samples(w), rgb48((size_t)w * 3);
+    for(unsigned y=0; y < h; ++y) {
+        RowToRGB48(image + y * row_bytes, layout, w, &samples[0], &rgb48[0]);
+        unsigned char* out = rgb + (size_t)y * w * 3;
+        for(size_t i=0; i < rgb48.size(); ++i) out[i] = (unsigned char)(rgb48[i] >> 8);
+    }
+}
+
+void ConvertToRGB48(const unsigned char* image, unsigned w, unsigned h,
+                    const std::string& format, uint16_t* rgb,
+                    DemosaicMethod method)
+{
+    const PixelLayout layout = LayoutFromString(format);
+
+    if( layout == LAYOUT_YUV ) {
+        vector<unsigned char> rgb24((size_t)w * h * 3);
+        ConvertYuv(image, w, h, format, &rgb24[0], "RGB24");
+        Widen8(&rgb24[0], rgb24.size(), rgb);
+        return;
+    }
+
+    if( layout == LAYOUT_BAYER ) {
+        if( FormatBitDepth(format) > 8 ) {
+            Demosaic(image, w, h, format, (unsigned char*)rgb, "RGB48LE", method);
+        }else{
+            vector<unsigned char> rgb24((size_t)w * h * 3);
+            Demosaic(image, w, h, format, &rgb24[0], "RGB24", method);
+            Widen8(&rgb24[0], rgb24.size(), rgb);
+        }
+        return;
+    }
+
+    const size_t row_bytes = (size_t)w * BitsPerPixel(layout, format) / 8;
+    vector<uint16_t> samples(w);
+    for(unsigned y=0; y < h; ++y) {
+        RowToRGB48(image + y * row_bytes, layout, w, &samples[0], rgb + (size_t)y * w * 3);
+    }
+}
+
+size_t LumaHistogram(const unsigned char* image, unsigned w, unsigned h,
+                     const std::string& format, size_t skip_bytes,
+                     std::vector<unsigned>& hist)
+{
+    const PixelLayout layout = LayoutFromString(format);
+    const int bpp = BitsPerPixel(layout, format);
+    const size_t skip_pixels = (skip_bytes * 8 + bpp - 1) / bpp;
+
+    if( layout == LAYOUT_YUV ) {
+        vector<unsigned char> rgb24((size_t)w * h * 3);
+        ConvertYuv(image, w, h, format, &rgb24[0], "RGB24");
+        return LumaHistogram(&rgb24[0], w, h, "RGB24", skip_pixels * 3, hist);
+    }
+
+    int shift = 16;
+    while( shift > 0 && ((size_t)1 << (16 - shift)) < hist.size() ) --shift;
+    if( hist.empty() || ((size_t)1 << (16 - shift)) != hist.size() ) {
+        throw VideoException("Histogram size must be a power of two up to 65536");
+    }
+    std::fill(hist.begin(), hist.end(), 0);
+
+    size_t count = 0;
+
+    if( layout == LAYOUT_BAYER ) {
+        BayerPattern pattern;
+        int bits;
+        bool big_endian;
+        BayerFormatFromString(format, pattern, bits, big_endian);
+
+        // offsets within the 2x2 cell of red and blue, greens are the others
+        const int r = pattern == BAYER_RGGB ? 0 : (pattern == BAYER_GRBG ? 1 : (pattern == BAYER_GBRG ? 2 : 3));
+        const int b = 3 - r;
+
+        vector<uint16_t> rows(2 * (size_t)w);
+        for(unsigned y=0; y + 1 < h; y += 2) {
+            const unsigned char* row = image + (size_t)y * w * bits / 8;
+            if( bits == 8 ) {
+                Widen8(row, rows.size(), &rows[0]);
+            }else{
+                Copy16(row, rows.size(), big_endian, &rows[0]);
+            }
+            for(unsigned x=0; x + 1 < w; x += 2) {
+                if( (size_t)y * w + x < skip_pixels ) continue;
+                const uint32_t cell[4] = { rows[x], rows[x+1], rows[w+x], rows[w+x+1] };
+                const uint32_t g = (cell[0] + cell[1] + cell[2] + cell[3] - cell[r] - cell[b]) / 2;
+                ++hist[Luma(cell[r], g, cell[b]) >> shift];
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    const size_t row_bytes = (size_t)w * bpp / 8;
+    vector<uint16_t> samples(w), rgb((size_t)w * 3);
+    for(unsigned y=0; y < h; ++y) {
+        RowToRGB48(image + y * row_bytes, layout, w, &samples[0], &rgb[0]);
+        const size_t row_start = (size_t)y * w;
+        const unsigned x0 = row_start >= skip_pixels ? 0 : (unsigned)std::min<size_t>(w, skip_pixels - row_start);
+        for(unsigned x=x0; x < w; ++x) {
+            ++hist[Luma(rgb[3*x], rgb[3*x+1], rgb[3*x+2]) >> shift];
+        }
+        count += w - x0;
+    }
+    return count;
+}
+
+}
@@ -0,0 +1,78 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PANGOLIN_PIXEL_CONVERT_H
+#define PANGOLIN_PIXEL_CONVERT_H
+
+#include <pangolin/video/demosaic.h>
+
+#include <stdint.h>
+#include <vector>
+
+namespace pangolin
+{
+
+//! Conversion of captured pixel formats for saving, merging and exposure
+//! control at the precision of the sensor.
+//!
+//! Deep formats are GRAY12P (two 12 bit samples in three bytes, laid out
+//! P0[11:4], P1[3:0]<<4 | P0[3:0], P1[11:4] as IIDC cameras pack them),
+//! GRAY16LE/BE, RGB48LE/BE and 16 bit bayer. 16 bit samples are taken to be
+//! most significant bit aligned, so full scale is 65535 whatever the depth
+//! of the sensor.
+
+//! Bits per sample carried by format: 8, 12 or 16
+int FormatBitDepth(const std::string& format);
+
+//! Unpack GRAY12P samples (an even number) to 16 bit, full scale 65535
+void Unpack12(const unsigned char* src, size_t samples, uint16_t* dst);
+
+//! Convert w x h image of format to interleaved RGB24. Bayer formats are
+//! demosaiced, packed YUV converted by ConvertYuv and deeper formats keep
+//! their most significant byte.
+void ConvertToRGB24(const unsigned char* image, unsigned w, unsigned h,
+                    const std::string& format, unsigned char* rgb,
+                    DemosaicMethod method = DEMOSAIC_MHC);
+
+//! Convert w x h image of format to interleaved host endian RGB48,
+//! full scale 65535. 8 bit formats are scaled by 257.
+void ConvertToRGB48(const unsigned char* image, unsigned w, unsigned h,
+                    const std::string& format, uint16_t* rgb,
+                    DemosaicMethod method = DEMOSAIC_MHC);
+
+//! Histogram of luma (0.299 R + 0.587 G + 0.114 B) over the full scale of
+//! format, in hist.size() equal bins (which should be a power of two).
+//! Pixels in the first skip_bytes of the image (embedded meta data) are
+//! excluded. Bayer images are binned per 2x2 cell. Returns pixels binned.
+size_t LumaHistogram(const unsigned char* image, unsigned w, unsigned h,
+                     const std::string& format, size_t skip_bytes,
+                     std::vector<unsigned>& hist);
+
+}
+
+#endif // PANGOLIN_PIXEL_CONVERT_H
@@ -26,16 +26,38 @@
  */
 
 #include "pvn_video.h"
+#include "lossless_codec.h"
 
 #include <iostream>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+
+#include <boost/static_assert.hpp>
+
+#ifdef _UNIX_
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 using namespace std;
 
 namespace pangolin
 {
 
-PvnVideo::PvnVideo(const char* filename, bool realtime )
-    : realtime(realtime), last_frame(TimeNow())
+// on disk layout must not depend on compiler padding
+BOOST_STATIC_ASSERT(sizeof(PvnFrameInfo) == 56);
+BOOST_STATIC_ASSERT(sizeof(PvnFileHeader) == 24);
+BOOST_STATIC_ASSERT(sizeof(PvnStreamHeader) == 72);
+BOOST_STATIC_ASSERT(sizeof(PvnRecordHeader) == 64);
+BOOST_STATIC_ASSERT(sizeof(PvnIndexEntry) == 24);
+BOOST_STATIC_ASSERT(sizeof(PvnFileFooter) == 24);
+
+PvnVideo::PvnVideo(const char* filename, bool realtime, const std::string& stream )
+    : frames(0), version(1), framerate(0), stream(0), next_record(0), position(0), current(-1),
+      map(0), map_size(0), prefetch(8), realtime(realtime), play_direction(1)
 {
     file.open(filename, ios::binary );
 
@@ -43,35 +65,337 @@ PvnVideo::PvnVideo(const char* filename, bool realtime )
         throw VideoException("Cannot open file - does not exist or bad permissions.");
 
     ReadFileHeader();
+    SelectStream(stream);
+    MapFile(filename);
 }
 
 PvnVideo::~PvnVideo()
 {
+#ifdef _UNIX_
+    if(map) munmap(map, map_size);
+#endif
+}
+
+void PvnVideo::MapFile(const char* filename)
+{
+#ifdef _UNIX_
+    const int fd = open(filename, O_RDONLY);
+    if( fd < 0 ) return;
+
+    struct stat st;
+    if( fstat(fd, &st) == 0 && st.st_size > 0 && (uint64_t)st.st_size <= (size_t)-1 )
+    {
+        void* addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if( addr != MAP_FAILED ) {
+            map = (unsigned char*)addr;
+            map_size = st.st_size;
+            // readahead is driven by Prefetch in the direction of travel,
+            // so faults from random access shouldn't pull in neighbours
+            madvise(map, map_size, MADV_RANDOM);
+        }
+    }
 
+    // mapping holds its own reference to the file
+    close(fd);
+#endif
+    // otherwise frames are read through file
 }
 
 void PvnVideo::ReadFileHeader()
+{
+    char magic[sizeof(PVN_MAGIC)];
+    file.read(magic, sizeof(magic));
+    file.clear();
+    file.seekg(0, ios::beg);
+
+    if( !memcmp(magic, PVN_MAGIC, sizeof(PVN_MAGIC)) ) {
+        ReadFileHeaderV2();
+    }else{
+        ReadFileHeaderV1();
+    }
+}
+
+void PvnVideo::ReadFileHeaderV1()
 {
     string sfmt;
-    float framerate;
+    float v1_framerate;
 
     VideoStream strm0;
     file >> sfmt;
     file >> strm0.w;
     file >> strm0.h;
-    file >> framerate;
+    file >> v1_framerate;
     file.get();
 
     if(file.bad() || !(strm0.w >0 && strm0.h >0) )
         throw VideoException("Unable to read video header");
 
+    strm0.name = "main";
     strm0.fmt = VideoFormatFromString(sfmt);
     strm0.frame_size_bytes = (strm0.w * strm0.h * strm0.fmt.bpp) / 8;
-    frame_interval = TimeFromSeconds( 1.0 / framerate);
+    framerate = v1_framerate;
+    version = 1;
 
     stream_info.push_back(strm0);
+
+    // frames are back to back, so index is implicit
+    const streamoff data_start = file.tellg();
+    file.seekg(0, ios::end);
+    const streamoff file_size = file.tellg();
+
+    const size_t num_frames = strm0.frame_size_bytes ?
+        (size_t)((file_size - data_start) / strm0.frame_size_bytes) : 0;
+
+    index.resize(num_frames);
+    for(size_t i=0; i < num_frames; ++i) {
+        index[i].offset = data_start + i * strm0.frame_size_bytes;
+        index[i].host_time_us = 0;
+        index[i].stream = 0;
+        index[i].schedule_step = -1;
+    }
+}
+
+void PvnVideo::ReadFileHeaderV2()
+{
+    PvnFileHeader header;
+    file.read((char*)&header, sizeof(header));
+
+    if( !file.good() || header.version != 2 || header.num_streams == 0 )
+        throw VideoException("Unable to read video header");
+
+    version = header.version;
+    framerate = header.framerate;
+
+    for(uint32_t i=0; i < header.num_streams; ++i) {
+        PvnStreamHeader sh;
+        file.read((char*)&sh, sizeof(sh));
+        if( !file.good() || !(sh.w > 0 && sh.h > 0) )
+            throw VideoException("Unable to read video stream header");
+
+        sh.name[PVN_NAME_LEN-1] = '\0';
+        sh.fmt[PVN_NAME_LEN-1] = '\0';
+
+        VideoStream strm;
+        strm.name = sh.name;
+        strm.w = sh.w;
+        strm.h = sh.h;
+        strm.fmt = VideoFormatFromString(sh.fmt);
+        strm.frame_size_bytes = (strm.w * strm.h * strm.fmt.bpp) / 8;
+        stream_info.push_back(strm);
+    }
+
+    const streamoff data_start = file.tellg();
+    file.seekg(0, ios::end);
+    const streamoff file_size = file.tellg();
+
+    if( !ReadIndex(data_start, file_size) ) {
+        cout << "[VIDEO]: PVN file has no index, scanning frames" << endl;
+        ScanIndex(data_start, file_size);
+    }
+}
+
+bool PvnVideo::ReadIndex(std::streamoff data_start, std::streamoff file_size)
+{
+    if( file_size < data_start + (streamoff)sizeof(PvnFileFooter) )
+        return false;
+
+    PvnFileFooter footer;
+    file.clear();
+    file.seekg(file_size - (streamoff)sizeof(footer), ios::beg);
+    file.read((char*)&footer, sizeof(footer));
+
+    if( !file.good() || memcmp(footer.magic, PVN_INDEX_MAGIC, sizeof(PVN_INDEX_MAGIC)) )
+        return false;
+
+    const uint64_t index_bytes = footer.num_entries * sizeof(PvnIndexEntry);
+    if( footer.index_offset < (uint64_t)data_start ||
+        footer.index_offset + index_bytes + sizeof(footer) != (uint64_t)file_size )
+        return false;
+
+    index.resize(footer.num_entries);
+    if( footer.num_entries ) {
+        file.seekg(footer.index_offset, ios::beg);
+        file.read((char*)&index[0], index_bytes);
+        if( !file.good() ) {
+            index.clear();
+            return false;
+        }
+    }
+
+    return true;
 }
 
+void PvnVideo::ScanIndex(std::streamoff data_start, std::streamoff file_size)
+{
+    index.clear();
+
+    streamoff offset = data_start;
+    while( offset + (streamoff)sizeof(PvnRecordHeader) <= file_size )
+    {
+        PvnRecordHeader rec;
+        file.clear();
+        file.seekg(offset, ios::beg);
+        file.read((char*)&rec, sizeof(rec));
+
+        // stop at truncated or corrupt record
+        if( !file.good() ||
+            (rec.magic != PVN_RECORD_MAGIC && rec.magic != PVN_RECORD_MAGIC_LOSSLESS) ||
+            rec.info.stream >= stream_info.size() ||
+            (rec.magic == PVN_RECORD_MAGIC && rec.size_bytes != stream_info[rec.info.stream].frame_size_bytes) ||
+            rec.size_bytes > stream_info[rec.info.stream].frame_size_bytes ||
+            offset + (streamoff)(sizeof(rec) + rec.size_bytes) > file_size )
+            break;
+
+        PvnIndexEntry entry;
+        entry.offset = offset;
+        entry.host_time_us = rec.info.host_time_us;
+        entry.stream = rec.info.stream;
+        entry.schedule_step = rec.info.schedule_step;
+        index.push_back(entry);
+
+        offset += sizeof(rec) + rec.size_bytes;
+    }
+}
+
+void PvnVideo::SelectStream(const std::string& name)
+{
+    stream = 0;
+
+    if( !name.empty() ) {
+        size_t i = 0;
+        while( i < stream_info.size() && stream_info[i].name != name ) ++i;
+
+        if( i == stream_info.size() ) {
+            char* end;
+            i = strtoul(name.c_str(), &end, 10);
+            if( *end != '\0' || i >= stream_info.size() )
+                throw VideoException("Unknown PVN stream", name);
+        }
+        stream = i;
+    }
+
+    stream_records.clear();
+    for(size_t i=0; i < index.size(); ++i)
+        if( index[i].stream == stream ) stream_records.push_back(i);
+
+    frames = stream_records.size();
+    position = 0;
+    current = -1;
+}
+
+const unsigned char* PvnVideo::ReadRecord(size_t record, PvnFrameInfo& info)
+{
+    const PvnIndexEntry& entry = index[record];
+    const size_t frame_bytes = stream_info[entry.stream].frame_size_bytes;
+
+    size_t data_offset = entry.offset;
+    size_t data_bytes = frame_bytes;
+    bool compressed = false;
+
+    if( version == 1 ) {
+        info = PvnFrameInfo();
+    }else{
+        PvnRecordHeader rec;
+        if( map ) {
+            if( entry.offset + sizeof(rec) > map_size )
+                return 0;
+            memcpy(&rec, map + entry.offset, sizeof(rec));
+        }else{
+            file.clear();
+            file.seekg(entry.offset, ios::beg);
+            file.read((char*)&rec, sizeof(rec));
+            if( !file.good() )
+                return 0;
+        }
+
+        compressed = (rec.magic == PVN_RECORD_MAGIC_LOSSLESS);
+        if( !(rec.magic == PVN_RECORD_MAGIC && rec.size_bytes == frame_bytes) &&
+            !(compressed && rec.size_bytes <= frame_bytes) )
+            return 0;
+        if( rec.info.stream != entry.stream )
+            return 0;
+
+        info = rec.info;
+        data_offset += sizeof(rec);
+        data_bytes = rec.size_bytes;
+    }
+
+    const unsigned char* data;
+
+    if( map ) {
+        if( data_offset + data_bytes > map_size )
+            return 0;
+        data = map + data_offset;
+    }else{
+        std::vector<unsigned char>& buffer = compressed ? packed : scratch;
+        buffer.resize(data_bytes);
+        file.clear();
+        file.seekg(data_offset, ios::beg);
+        file.read((char*)&buffer[0], data_bytes);
+        if( !file.good() )
+            return 0;
+        data = &buffer[0];
+    }
+
+    if( compressed ) {
+        scratch.resize(frame_bytes);
+        if( !LosslessDecompress(data, data_bytes, &scratch[0], frame_bytes) )
+            return 0;
+        data = &scratch[0];
+    }
+
+    return data;
+}
+
+void PvnVideo::Prefetch(int frame, int direction)
+{
+#ifdef _UNIX_
+    if( !map || prefetch <= 0 )
+        return;
+
+    const int first = std::max(0, std::min(frame + direction, frame + direction * prefetch));
+    const int last = std::min(frames - 1, std::max(frame + direction, frame + direction * prefetch));
+    if( first > last )
+        return;
+
+    const PvnIndexEntry& end = index[stream_records[last]];
+    const size_t header_bytes = (version == 1) ? 0 : sizeof(PvnRecordHeader);
+    const size_t page = sysconf(_SC_PAGESIZE);
+    const size_t begin = index[stream_records[first]].offset & ~(page-1);
+    const size_t finish = std::min(map_size, (size_t)end.offset + header_bytes + stream_info[end.stream].frame_size_bytes);
+
+    madvise(map + begin, finish - begin, MADV_WILLNEED);
+#endif
+}
+
+const unsigned char* PvnVideo::Step(int frame, int direction)
+{
+    if( frame < 0 || frame >= frames )
+        return 0;
+
+    const unsigned char* data = ReadRecord(stream_records[frame], frame_info);
+    if( !data )
+        return 0;
+
+    position = frame + 1;
+    current = frame;
+    Prefetch(frame, direction);
+
+    if( realtime ) {
+        if( direction != play_direction ) {
+            play_direction = direction;
+            pacer.Reset();
+        }
+
+        // recorded host times give true spacing of frames, otherwise
+        // frames are spaced by header rate
+        const int64_t media_time_us = frame_info.host_time_us ? frame_info.host_time_us :
+            (int64_t)(frame * 1E6 / (framerate > 0 ? framerate : 30.0));
+        pacer.WaitForFrame(media_time_us);
+    }
+
+    return data;
+}
 
 void PvnVideo::Start()
 {
@@ -83,36 +407,89 @@ void PvnVideo::Stop()
 
 unsigned PvnVideo::Width() const
 {
-    return stream_info[0].w;
+    return stream_info[stream].w;
 }
 
 unsigned PvnVideo::Height() const
 {
-    return stream_info[0].h;
+    return stream_info[stream].h;
 }
 
 size_t PvnVideo::SizeBytes() const
 {
-    return stream_info[0].frame_size_bytes;
+    return stream_info[stream].frame_size_bytes;
 }
 
 std::string PvnVideo::PixFormat() const
 {
-    return stream_info[0].fmt.format;
+    return stream_info[stream].fmt.format;
+}
+
+const unsigned char* PvnVideo::NextFrame()
+{
+    return Step(position, 1);
+}
+
+const unsigned char* PvnVideo::PrevFrame()
+{
+    // frame before the last one returned, or before the cursor after Seek
+    return Step((current >= 0 ? current : position) - 1, -1);
+}
+
+const unsigned char* PvnVideo::Frame( int frame, PvnFrameInfo* info )
+{
+    if( frame < 0 || frame >= frames )
+        return 0;
+
+    PvnFrameInfo frame_record;
+    return ReadRecord(stream_records[frame], info ? *info : frame_record);
+}
+
+bool PvnVideo::Seek( int frame )
+{
+    if( frame < 0 || frame > frames )
+        return false;
+
+    position = frame;
+    current = -1;
+    frame_info = PvnFrameInfo();
+    pacer.Reset();
+    Prefetch(frame - 1, 1);
+    return true;
+}
+
+bool PvnVideo::GrabNextRecord( unsigned char* image, PvnFrameInfo& info )
+{
+    if( next_record >= index.size() )
+        return false;
+
+    const size_t frame_bytes = stream_info[index[next_record].stream].frame_size_bytes;
+    const unsigned char* data = ReadRecord(next_record++, info);
+    if( !data )
+        return false;
+
+    memcpy(image, data, frame_bytes);
+    return true;
 }
 
 bool PvnVideo::GrabNext( unsigned char* image, bool /*wait*/ )
 {
-    file.read((char*)image,stream_info[0].frame_size_bytes);
+    const unsigned char* data = NextFrame();
+    if( !data )
+        return false;
 
-    const basetime next_frame = TimeAdd(last_frame, frame_interval);
+    memcpy(image, data, SizeBytes());
+    return true;
+}
 
-    if( realtime ) {
-        WaitUntil(next_frame);
-    }
+bool PvnVideo::GrabPrev( unsigned char* image )
+{
+    const unsigned char* data = PrevFrame();
+    if( !data )
+        return false;
 
-    last_frame = TimeNow();
-    return file.good();
+    memcpy(image, data, SizeBytes());
+    return true;
 }
 
 bool PvnVideo::GrabNewest( unsigned char* image, bool wait )
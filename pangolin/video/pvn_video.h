@@ -30,8 +30,23 @@
 
 #include <pangolin/pangolin.h>
 #include <pangolin/video.h>
-#include <pangolin/timer.h>
+#include <pangolin/video/frame_pacer.h>
 #include "fstream"
+#include <stdint.h>
+
+// PVN v1 files are a text header (format, width, height, framerate, one per
+// line) followed by raw frames of a single stream.
+//
+// PVN v2 files are binary, values in host byte order:
+//  PvnFileHeader
+//  PvnStreamHeader * num_streams
+//  { PvnRecordHeader, frame data } * frames
+//    (frame data raw, or compressed for PVN_RECORD_MAGIC_LOSSLESS records)
+//  PvnIndexEntry * frames
+//  PvnFileFooter
+//
+// The trailing index is written when recording finishes. Files without one
+// (e.g. interrupted recordings) are indexed by scanning the records.
 
 namespace pangolin
 {
@@ -44,10 +59,78 @@ struct VideoStream
     size_t frame_size_bytes;
 };
 
+//! Per frame record of PVN v2 files. Camera fields are those embedded in the
+//! frame by the camera (see FirewireVideo::MetaData), valid according to meta_flags.
+struct PvnFrameInfo
+{
+    PvnFrameInfo()
+        : host_time_us(0), stream(0), schedule_step(-1), meta_flags(0),
+          timestamp(0), frame_count(0), shutter_quant(0), gain(0), shutter_abs(0),
+          brightness(0), auto_exposure(0), whitebalance_u_b(0), whitebalance_v_r(0)
+    {}
+
+    int64_t  host_time_us;      // host time frame was recorded, 0 if unknown
+    uint32_t stream;            // index into file streams
+    int32_t  schedule_step;     // exposure schedule step, -1 if unknown
+    uint32_t meta_flags;
+    uint32_t timestamp, frame_count;
+    uint32_t shutter_quant, gain;
+    float    shutter_abs;
+    uint32_t brightness, auto_exposure;
+    uint32_t whitebalance_u_b, whitebalance_v_r;
+};
+
+const char PVN_MAGIC[8] = {'P','V','N','_','F','I','L','E'};
+const char PVN_INDEX_MAGIC[8] = {'P','V','N','I','N','D','E','X'};
+const uint32_t PVN_RECORD_MAGIC = 0x464e5650; // "PVNF"
+const uint32_t PVN_RECORD_MAGIC_LOSSLESS = 0x4c4e5650; // "PVNL", see lossless_codec.h
+const int PVN_NAME_LEN = 32;
+
+struct PvnFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t num_streams;
+    double framerate;       // nominal, 0 if unknown
+};
+
+struct PvnStreamHeader
+{
+    char name[PVN_NAME_LEN];
+    char fmt[PVN_NAME_LEN];
+    uint32_t w, h;
+};
+
+struct PvnRecordHeader
+{
+    uint32_t magic;
+    uint32_t size_bytes;
+    PvnFrameInfo info;
+};
+
+struct PvnIndexEntry
+{
+    uint64_t offset;        // file offset of frame data (v2: of its record header)
+    int64_t host_time_us;
+    uint32_t stream;
+    int32_t schedule_step;
+};
+
+struct PvnFileFooter
+{
+    uint64_t index_offset;
+    uint64_t num_entries;
+    char magic[8];
+};
+
+//! Random access reader for PVN files. Where possible the file is memory
+//! mapped so frames can be used in place without copying.
 class PvnVideo : public VideoInterface
 {
 public:
-    PvnVideo(const char* filename, bool realtime = false);
+    //! Open v1 or v2 PVN file. For multiple stream files, stream selects
+    //! the stream to grab by name or number (default first).
+    PvnVideo(const char* filename, bool realtime = false, const std::string& stream = "");
     ~PvnVideo();
 
     // Implement VideoInterface
@@ -60,17 +143,79 @@ public:
     bool GrabNext( unsigned char* image, bool wait = true );
     bool GrabNewest( unsigned char* image, bool wait = true );
 
+    //! Copy frame preceding the last grabbed one, for stepping backwards
+    bool GrabPrev( unsigned char* image );
+
+    //! Return next / preceding frame in place, NULL at end of stream. Valid
+    //! until the next call unless the file is memory mapped and the frame
+    //! uncompressed, in which case it is valid for the lifetime of this object.
+    const unsigned char* NextFrame();
+    const unsigned char* PrevFrame();
+
+    //! Frame of selected stream in place, without moving position
+    const unsigned char* Frame( int frame, PvnFrameInfo* info = 0 );
+
+    //! Set frame of selected stream returned by next NextFrame/GrabNext.
+    //! The next PrevFrame/GrabPrev returns the frame before it.
+    bool Seek( int frame );
+    int Position() const { return position; }
+    int Frames() const { return frames; }
+
+    //! Realtime playback speed factor (2 = twice as fast)
+    void SetPlaybackSpeed( double speed ) { pacer.SetSpeed(speed); }
+
+    //! Number of frames ahead of the direction of travel to read ahead (0 = off)
+    void SetPrefetch( int frames ) { prefetch = frames; }
+
+    //! Read next frame of any stream, image must hold the largest stream
+    bool GrabNextRecord( unsigned char* image, PvnFrameInfo& info );
+
+    //! Record of last grabbed frame
+    const PvnFrameInfo& FrameInfo() const { return frame_info; }
+
+    const std::vector<VideoStream>& Streams() const { return stream_info; }
+    const std::vector<PvnIndexEntry>& Index() const { return index; }
+    int Version() const { return version; }
+    double Framerate() const { return framerate; }
+    bool Mapped() const { return map != 0; }
+
 protected:
     int frames;
     std::ifstream file;
     std::vector<VideoStream> stream_info;
 
+    int version;
+    double framerate;
+    size_t stream;
+    std::vector<PvnIndexEntry> index;
+    std::vector<size_t> stream_records;
+    size_t next_record;
+    int position;
+    // frame last returned by NextFrame/PrevFrame, -1 after Seek
+    int current;
+    PvnFrameInfo frame_info;
+
+    // memory mapped file, 0 if reading through file
+    unsigned char* map;
+    size_t map_size;
+    std::vector<unsigned char> scratch;
+    std::vector<unsigned char> packed;
+    int prefetch;
 
     bool realtime;
-    pangolin::basetime frame_interval;
-    pangolin::basetime last_frame;
+    FramePacer pacer;
+    int play_direction;
 
     void ReadFileHeader();
+    void ReadFileHeaderV1();
+    void ReadFileHeaderV2();
+    bool ReadIndex(std::streamoff data_start, std::streamoff file_size);
+    void ScanIndex(std::streamoff data_start, std::streamoff file_size);
+    void SelectStream(const std::string& stream);
+    void MapFile(const char* filename);
+    void Prefetch(int frame, int direction);
+    const unsigned char* ReadRecord(size_t record, PvnFrameInfo& info);
+    const unsigned char* Step(int frame, int direction);
 };
 
 }
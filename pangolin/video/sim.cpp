@@ -0,0 +1,518 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "sim.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <boost/thread/thread.hpp>
+
+using namespace std;
+
+namespace pangolin
+{
+
+// range of log2 sensor irradiance mapped by the response curve
+const float SIM_LOG_MIN = -16.0f;
+const float SIM_LOG_MAX = 0.0f;
+const int SIM_LUT_SIZE = 4096;
+const float SIM_GAMMA = 2.2f;
+
+// scales radiance x shutter(s) x gain so that radiance 1 at 10ms is mid grey
+const float SIM_EXPOSURE_SCALE = 18.0f;
+
+// frames the simulated DMA ring can hold before the oldest are dropped
+const unsigned long SIM_DMA_FRAMES = 10;
+
+SimVideo::SimVideo(unsigned width, unsigned height, float fps, int latency,
+                   const std::string& radiance, float noise )
+    : width(width), height(height), noise(noise), latency(latency),
+      running(false), realtime(fps > 0),
+      frame_counter(0), hdr_bank(0), noise_state(12345), schedule_running(false)
+{
+    interval_s = realtime ? 1.0 / fps : 0;
+    frame_interval = TimeFromSeconds(interval_s);
+
+    if(radiance.empty()) {
+        SyntheticRadiance();
+    }else{
+        LoadRadiance(radiance);
+    }
+
+    // camera response: 8 bit gamma curve over log2 irradiance
+    response_lut.resize(SIM_LUT_SIZE);
+    for(int i=0; i < SIM_LUT_SIZE; ++i) {
+        const float l = SIM_LOG_MIN + (SIM_LOG_MAX - SIM_LOG_MIN) * i / (SIM_LUT_SIZE-1);
+        const float v = 255.0f * pow(pow(2.0f, l), 1.0f / SIM_GAMMA);
+        response_lut[i] = (unsigned char)(v > 255.0f ? 255 : v + 0.5f);
+    }
+
+    // power on defaults
+    active[IIDC_REG_SHUTTER] = written[IIDC_REG_SHUTTER] = 500;
+    active[IIDC_REG_GAIN] = written[IIDC_REG_GAIN] = 0;
+}
+
+SimVideo::~SimVideo()
+{
+}
+
+unsigned SimVideo::Width() const
+{
+    return width;
+}
+
+unsigned SimVideo::Height() const
+{
+    return height;
+}
+
+size_t SimVideo::SizeBytes() const
+{
+    return width * height * 3;
+}
+
+std::string SimVideo::PixFormat() const
+{
+    return "RGB24";
+}
+
+void SimVideo::Start()
+{
+    running = true;
+    if(realtime) next_frame = TimeNow();
+}
+
+void SimVideo::Stop()
+{
+    running = false;
+}
+
+void SimVideo::SyntheticRadiance()
+{
+    // horizontal ramp over 5 decades, vertical colour bands
+    log_radiance.resize(1);
+    std::vector<float>& lr = log_radiance[0];
+    lr.resize(width*height*3);
+
+    for(unsigned y=0; y < height; ++y) {
+        const int band = (4 * y) / height;
+        for(unsigned x=0; x < width; ++x) {
+            const float l = log2(0.01f) + (float)x / width * log2(100000.0f);
+            float* p = &lr[3*(y*width + x)];
+            p[0] = l + (band == 1 ? 0.0f : -1.0f);
+            p[1] = l + (band == 2 ? 0.0f : -1.0f);
+            p[2] = l + (band == 3 ? 0.0f : -1.0f);
+        }
+    }
+}
+
+static bool LoadPFM(const std::string& filename, unsigned& w, unsigned& h, std::vector<float>& log_rad)
+{
+    ifstream f(filename.c_str(), ios::in | ios::binary);
+    if(!f.is_open()) return false;
+
+    string type;
+    float scale;
+    f >> type >> w >> h >> scale;
+    f.get();
+
+    const int channels = (type == "PF") ? 3 : 1;
+    if( !f.good() || (type != "PF" && type != "Pf") ) {
+        throw VideoException("Not a PFM file", filename);
+    }
+
+    std::vector<float> data(w*h*channels);
+    f.read((char*)&data[0], data.size() * sizeof(float));
+    if(!f.good()) {
+        throw VideoException("Truncated PFM file", filename);
+    }
+
+    // scale < 0 is little endian
+    const uint32_t one = 1;
+    const bool host_little = *(const unsigned char*)&one == 1;
+    if( (scale < 0) != host_little ) {
+        for(size_t i=0; i < data.size(); ++i) {
+            unsigned char* b = (unsigned char*)&data[i];
+            std::swap(b[0],b[3]);
+            std::swap(b[1],b[2]);
+        }
+    }
+
+    // rows stored bottom to top
+    log_rad.resize(w*h*3);
+    for(unsigned y=0; y < h; ++y) {
+        const float* src = &data[(h-1-y)*w*channels];
+        float* dst = &log_rad[y*w*3];
+        for(unsigned x=0; x < w; ++x) {
+            for(int c=0; c < 3; ++c) {
+                const float e = src[x*channels + (channels == 3 ? c : 0)];
+                dst[3*x+c] = log2(e > 1E-10f ? e : 1E-10f);
+            }
+        }
+    }
+    return true;
+}
+
+void SimVideo::LoadRadiance( const std::string& radiance )
+{
+    if(radiance.find('%') == std::string::npos) {
+        log_radiance.resize(1);
+        if( !LoadPFM(radiance, width, height, log_radiance[0]) ) {
+            throw VideoException("Unable to open radiance file", radiance);
+        }
+        return;
+    }
+
+    // numbered sequence, starting at 0 or 1
+    char filename[1024];
+    for(int i=0; ; ++i) {
+        snprintf(filename, sizeof(filename), radiance.c_str(), i);
+        unsigned w, h;
+        std::vector<float> lr;
+        if( !LoadPFM(filename, w, h, lr) ) {
+            if(i == 0) continue;
+            break;
+        }
+        if(!log_radiance.empty() && (w != width || h != height) ) {
+            throw VideoException("Radiance sequence frames differ in size", filename);
+        }
+        width = w;
+        height = h;
+        log_radiance.push_back(lr);
+    }
+
+    if(log_radiance.empty()) {
+        throw VideoException("Unable to open radiance sequence", radiance);
+    }
+}
+
+void SimVideo::SetControlRegister( uint64_t offset, uint32_t value )
+{
+    boost::mutex::scoped_lock lock(register_mutex);
+    written[offset] = value;
+
+    PendingWrite w;
+    w.frame = frame_counter + latency;
+    w.offset = offset;
+    w.value = value;
+    pending.push_back(w);
+}
+
+uint32_t SimVideo::GetControlRegister( uint64_t offset )
+{
+    boost::mutex::scoped_lock lock(register_mutex);
+    return written[offset];
+}
+
+void SimVideo::SetMetaDataFlags( int flags )
+{
+    SetControlRegister(IIDC_REG_META_FLAGS, 0x80000000 | flags);
+}
+
+void SimVideo::SetHDRRegister( bool power )
+{
+    SetControlRegister(IIDC_REG_HDR_CTRL, power ? IIDC_HDR_ON : 0x80000000);
+
+    if(!power) {
+        boost::mutex::scoped_lock lock(bracket_mutex);
+        schedule_running = false;
+    }
+}
+
+void SimVideo::SetHDRShutterFlags( uint32_t shut0, uint32_t shut1, uint32_t shut2, uint32_t shut3 )
+{
+    SetControlRegister(IIDC_REG_HDR_SHUTTER[0], shut0);
+    SetControlRegister(IIDC_REG_HDR_SHUTTER[1], shut1);
+    SetControlRegister(IIDC_REG_HDR_SHUTTER[2], shut2);
+    SetControlRegister(IIDC_REG_HDR_SHUTTER[3], shut3);
+
+    boost::mutex::scoped_lock lock(bracket_mutex);
+    bracket_assembler.SetBanks(shut0, shut1, shut2, shut3);
+}
+
+void SimVideo::SetHDRGainFlags( uint32_t gain0, uint32_t gain1, uint32_t gain2, uint32_t gain3 )
+{
+    SetControlRegister(IIDC_REG_HDR_GAIN[0], gain0);
+    SetControlRegister(IIDC_REG_HDR_GAIN[1], gain1);
+    SetControlRegister(IIDC_REG_HDR_GAIN[2], gain2);
+    SetControlRegister(IIDC_REG_HDR_GAIN[3], gain3);
+}
+
+void SimVideo::SetHDRBank( int bank, uint32_t shutter, uint32_t gain )
+{
+    if(bank < 0 || bank >= HDR_BANKS) {
+        throw VideoException("Invalid hdr bank");
+    }
+    SetControlRegister(IIDC_REG_HDR_SHUTTER[bank], shutter);
+    SetControlRegister(IIDC_REG_HDR_GAIN[bank], gain);
+
+    boost::mutex::scoped_lock lock(bracket_mutex);
+    bracket_assembler.SetBank(bank, shutter);
+}
+
+void SimVideo::StartExposureSchedule( const ExposureSchedule& schedule )
+{
+    ExposureStep b[HDR_BANKS];
+    for(int i=0; i < HDR_BANKS; ++i) {
+        b[i] = schedule.Bank(i);
+    }
+
+    SetHDRGainFlags(b[0].gain, b[1].gain, b[2].gain, b[3].gain);
+    SetHDRShutterFlags(b[0].shutter, b[1].shutter, b[2].shutter, b[3].shutter);
+
+    {
+        boost::mutex::scoped_lock lock(bracket_mutex);
+        exposure_schedule = schedule;
+        schedule_running = true;
+    }
+
+    SetHDRRegister(true);
+}
+
+uint32_t SimVideo::ReadMetaWord( unsigned char* image, uint32_t flag )
+{
+    const uint32_t meta = GetControlRegister(IIDC_REG_META_FLAGS) & META_ALL;
+    if( !(meta & flag) ) return 0;
+
+    // words are stored in flag order, as written by Render
+    int offset = 0;
+    for(uint32_t f = 1; f < flag; f <<= 1) {
+        if(meta & f) offset++;
+    }
+
+    const unsigned char* p = image + 4*offset;
+    return (p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+int SimVideo::ReadHDRExposure( unsigned char* image )
+{
+    const uint32_t shutter = ReadMetaWord(image, META_SHUTTER);
+    boost::mutex::scoped_lock lock(bracket_mutex);
+    return bracket_assembler.Exposure(shutter);
+}
+
+int SimVideo::ReadExposureStep( unsigned char* image, std::vector<BankWrite>& writes )
+{
+    const uint32_t shutter = ReadMetaWord(image, META_SHUTTER);
+    const uint32_t gain = ReadMetaWord(image, META_GAIN);
+    const bool has_counter = (GetControlRegister(IIDC_REG_META_FLAGS) & META_FRAME_COUNTER) != 0;
+    const uint32_t counter = ReadMetaWord(image, META_FRAME_COUNTER);
+
+    boost::mutex::scoped_lock lock(bracket_mutex);
+    writes.clear();
+    if(!schedule_running) return -1;
+
+    return has_counter ? exposure_schedule.OnFrame(shutter, gain, counter, writes)
+                       : exposure_schedule.OnFrame(shutter, gain, writes);
+}
+
+void SimVideo::SetShutterQuant( int shutter )
+{
+    SetControlRegister(IIDC_REG_SHUTTER, std::min(std::max(shutter,0),GetShutterQuantMax()) );
+}
+
+void SimVideo::SetGainQuant( int gain )
+{
+    SetControlRegister(IIDC_REG_GAIN, std::min(std::max(gain,0),GetGainQuantMax()) );
+}
+
+int SimVideo::GetShutterQuant()
+{
+    return GetControlRegister(IIDC_REG_SHUTTER) & 0xfff;
+}
+
+int SimVideo::GetGainQuant()
+{
+    return GetControlRegister(IIDC_REG_GAIN) & 0xfff;
+}
+
+float SimVideo::ShutterAbs( int shutter ) const
+{
+    // 20us per step, as Flea2 at 30fps
+    return (shutter + 1) * 2E-5f;
+}
+
+float SimVideo::GainLinear( int gain ) const
+{
+    // 0 - 24dB
+    return pow(10.0f, (gain * 24.0f / GetGainQuantMax()) / 20.0f);
+}
+
+void SimVideo::ApplyPending( bool flush )
+{
+    while( !pending.empty() && (flush || pending.front().frame <= frame_counter) ) {
+        active[pending.front().offset] = pending.front().value;
+        pending.pop_front();
+    }
+}
+
+void SimVideo::Advance( unsigned long frames )
+{
+    boost::mutex::scoped_lock lock(register_mutex);
+    for(unsigned long i=0; i < frames; ++i) {
+        ApplyPending(false);
+        if( (active[IIDC_REG_HDR_CTRL] & IIDC_HDR_ON) == IIDC_HDR_ON ) ++hdr_bank;
+        ++frame_counter;
+    }
+}
+
+static inline void PutWord(unsigned char*& p, uint32_t v)
+{
+    p[0] = (v >> 24) & 0xff;
+    p[1] = (v >> 16) & 0xff;
+    p[2] = (v >> 8) & 0xff;
+    p[3] = v & 0xff;
+    p += 4;
+}
+
+void SimVideo::Render( unsigned char* image )
+{
+    uint32_t shutter, gain, meta;
+    unsigned long frame;
+
+    {
+        boost::mutex::scoped_lock lock(register_mutex);
+        ApplyPending(false);
+
+        if( (active[IIDC_REG_HDR_CTRL] & IIDC_HDR_ON) == IIDC_HDR_ON ) {
+            const unsigned int bank = hdr_bank++ % 4;
+            shutter = active[IIDC_REG_HDR_SHUTTER[bank]] & 0xfff;
+            gain = active[IIDC_REG_HDR_GAIN[bank]] & 0xfff;
+        }else{
+            shutter = active[IIDC_REG_SHUTTER] & 0xfff;
+            gain = active[IIDC_REG_GAIN] & 0xfff;
+        }
+        meta = active[IIDC_REG_META_FLAGS] & META_ALL;
+        frame = frame_counter++;
+    }
+
+    // expose through response curve
+    const float log_k = log2(ShutterAbs(shutter) * GainLinear(gain) * SIM_EXPOSURE_SCALE);
+    const float lut_scale = (SIM_LUT_SIZE-1) / (SIM_LOG_MAX - SIM_LOG_MIN);
+    const float lut_offset = (log_k - SIM_LOG_MIN) * lut_scale;
+    const std::vector<float>& lr = log_radiance[frame % log_radiance.size()];
+    const size_t n = lr.size();
+
+    for(size_t i=0; i < n; ++i) {
+        const float fi = lr[i] * lut_scale + lut_offset;
+        const int idx = fi <= 0 ? 0 : (fi >= SIM_LUT_SIZE-1 ? SIM_LUT_SIZE-1 : (int)fi);
+        int v = response_lut[idx];
+        if(noise > 0) {
+            noise_state = noise_state * 1664525u + 1013904223u;
+            v += (int)(noise * ((int)(noise_state >> 24) - 128) / 128.0f);
+            v = v < 0 ? 0 : (v > 255 ? 255 : v);
+        }
+        image[i] = (unsigned char)v;
+    }
+
+    // embed meta data in place of first pixels
+    const double t = frame * interval_s;
+    unsigned char* p = image;
+    if(meta & META_TIMESTAMP) {
+        // IIDC cycle time: 7 bit seconds, 13 bit cycle count, 12 bit offset
+        const uint32_t sec = (uint32_t)t;
+        const uint32_t cycle = (uint32_t)((t - sec) * 8000);
+        PutWord(p, ((sec & 0x7f) << 25) | ((cycle & 0x1fff) << 12));
+    }
+    if(meta & META_GAIN)            PutWord(p, gain);
+    if(meta & META_SHUTTER)         PutWord(p, shutter);
+    if(meta & META_BRIGHTNESS)      PutWord(p, 0);
+    if(meta & META_EXPOSURE)        PutWord(p, 0);
+    if(meta & META_WHITE_BALANCE)   PutWord(p, 0);
+    if(meta & META_FRAME_COUNTER)   PutWord(p, (uint32_t)frame);
+    if(meta & META_STROBE)          PutWord(p, 0);
+    if(meta & META_GPIO_PIN_STATE)  PutWord(p, 0);
+    if(meta & META_ROI_POSITION)    PutWord(p, 0);
+}
+
+bool SimVideo::GrabNext( unsigned char* image, bool wait )
+{
+    if(!running) return false;
+
+    if(realtime) {
+        double ahead_s = TimeDiff_s(TimeNow(), next_frame);
+
+        if(ahead_s > 0) {
+            if(!wait) return false;
+            boost::this_thread::sleep(boost::posix_time::microseconds((long)(ahead_s * 1E6)));
+        }else if( -ahead_s > SIM_DMA_FRAMES * interval_s ) {
+            // consumer too slow - oldest frames overwritten in DMA ring
+            const unsigned long lost = (unsigned long)(-ahead_s / interval_s) - SIM_DMA_FRAMES;
+            Advance(lost);
+            next_frame = TimeAdd(next_frame, TimeFromSeconds(lost * interval_s));
+        }
+        next_frame = TimeAdd(next_frame, frame_interval);
+    }
+
+    Render(image);
+    return true;
+}
+
+bool SimVideo::GrabNewest( unsigned char* image, bool wait )
+{
+    if(!running) return false;
+
+    if(realtime) {
+        // skip all frames exposed since last grab
+        const double behind_s = TimeDiff_s(next_frame, TimeNow());
+        if(behind_s >= interval_s) {
+            const unsigned long skip = (unsigned long)(behind_s / interval_s);
+            Advance(skip);
+            next_frame = TimeAdd(next_frame, TimeFromSeconds(skip * interval_s));
+        }
+    }
+
+    return GrabNext(image, wait);
+}
+
+bool SimVideo::GrabOneShot( unsigned char* image )
+{
+    {
+        // camera idle between shots, so all writes have settled
+        boost::mutex::scoped_lock lock(register_mutex);
+        ApplyPending(true);
+    }
+    Render(image);
+    return true;
+}
+
+bool SimVideo::GrabMultiShot( int num_frames, unsigned char* images )
+{
+    {
+        boost::mutex::scoped_lock lock(register_mutex);
+        ApplyPending(true);
+    }
+    for(int i=0; i < num_frames; ++i) {
+        Render(images + i * SizeBytes());
+    }
+    return true;
+}
+
+}
@@ -0,0 +1,161 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PANGOLIN_SIM_H
+#define PANGOLIN_SIM_H
+
+#include <pangolin/pangolin.h>
+#include <pangolin/video.h>
+#include <pangolin/timer.h>
+#include <pangolin/video/iidc.h>
+#include <pangolin/video/hdr_camera.h>
+#include <pangolin/video/bracket_assembler.h>
+
+#include <deque>
+#include <map>
+#include <vector>
+
+#include <boost/thread/mutex.hpp>
+
+namespace pangolin
+{
+
+//! Simulated IIDC camera. Renders RGB24 frames from a linear radiance
+//! image (or sequence) through a camera response curve, honouring
+//! shutter, gain and HDR bank register writes with a configurable latency
+//! of whole frames. Meta data is embedded in the first image words using
+//! the same layout as FirewireVideo::ReadMetaData expects, so the HDR and
+//! AEC paths can be exercised without a FireWire bus. Bracketing and
+//! exposure schedules are driven through HDRCameraInterface, as on
+//! FirewireVideo.
+class SimVideo : public VideoInterface, public HDRCameraInterface
+{
+public:
+    //! radiance is a PFM file, a printf pattern for a numbered PFM sequence
+    //! (e.g. "scene%03d.pfm") or empty for a synthetic high dynamic range
+    //! test pattern of width x height.
+    SimVideo(unsigned width, unsigned height, float fps = 30, int latency = 2,
+             const std::string& radiance = "", float noise = 0 );
+    ~SimVideo();
+
+    // Implement VideoInterface
+    unsigned Width() const;
+    unsigned Height() const;
+    size_t SizeBytes() const;
+    std::string PixFormat() const;
+    void Start();
+    void Stop();
+    bool GrabNext( unsigned char* image, bool wait = true );
+    bool GrabNewest( unsigned char* image, bool wait = true );
+
+    //! Capture single frame with settings applied (as dc1394 one-shot)
+    bool GrabOneShot( unsigned char* image );
+
+    //! Capture num_frames consecutive frames into images (as dc1394 multi-shot)
+    bool GrabMultiShot( int num_frames, unsigned char* images );
+
+    //! Write control register. Takes effect after 'latency' frames.
+    void SetControlRegister( uint64_t offset, uint32_t value );
+
+    //! Read control register (last written value)
+    uint32_t GetControlRegister( uint64_t offset );
+
+    // Implement HDRCameraInterface
+    void SetMetaDataFlags( int flags );
+    void SetShutterQuant( int shutter );
+    void SetGainQuant( int gain );
+    int GetShutterQuant();
+    int GetGainQuant();
+    void SetHDRRegister( bool power );
+    void SetHDRShutterFlags( uint32_t shut0, uint32_t shut1, uint32_t shut2, uint32_t shut3 );
+    void SetHDRGainFlags( uint32_t gain0, uint32_t gain1, uint32_t gain2, uint32_t gain3 );
+    void SetHDRBank( int bank, uint32_t shutter, uint32_t gain );
+    uint32_t ReadMetaWord( unsigned char* image, uint32_t flag );
+    int ReadHDRExposure( unsigned char* image );
+    void StartExposureSchedule( const ExposureSchedule& schedule );
+    int ReadExposureStep( unsigned char* image, std::vector<BankWrite>& writes );
+
+    int GetShutterQuantMax() const { return 4095; }
+    int GetGainQuantMax() const { return 680; }
+
+    //! Absolute shutter time (s) of quantised shutter value
+    float ShutterAbs( int shutter ) const;
+
+    //! Linear gain of quantised gain value
+    float GainLinear( int gain ) const;
+
+    //! Number of frames exposed by the sensor so far
+    unsigned long FrameCount() const { return frame_counter; }
+
+protected:
+    struct PendingWrite
+    {
+        unsigned long frame;
+        uint64_t offset;
+        uint32_t value;
+    };
+
+    void LoadRadiance( const std::string& radiance );
+    void SyntheticRadiance();
+    void ApplyPending( bool flush );
+    void Advance( unsigned long frames );
+    void Render( unsigned char* image );
+
+    unsigned width, height;
+    float noise;
+    int latency;
+
+    bool running;
+    bool realtime;
+    double interval_s;
+    basetime frame_interval;
+    basetime next_frame;
+
+    // log2 radiance per pixel channel, one entry per frame of sequence
+    std::vector<std::vector<float> > log_radiance;
+    std::vector<unsigned char> response_lut;
+
+    boost::mutex register_mutex;
+    std::map<uint64_t,uint32_t> written;
+    std::map<uint64_t,uint32_t> active;
+    std::deque<PendingWrite> pending;
+
+    unsigned long frame_counter;
+    unsigned int hdr_bank;
+    uint32_t noise_state;
+
+    // frame identification, by consumer as on FirewireVideo
+    boost::mutex bracket_mutex;
+    BracketAssembler bracket_assembler;
+    ExposureSchedule exposure_schedule;
+    bool schedule_running;
+};
+
+}
+
+#endif // PANGOLIN_SIM_H
@@ -28,6 +28,7 @@
 
 #include "v4l.h"
 
+#include <algorithm>
 #include <iostream>
 #include <stdio.h>
 #include <stdlib.h>
@@ -59,11 +60,13 @@ namespace pangolin
         return r;
     }
 
-    V4lVideo::V4lVideo(const char* dev_name, io_method io)
-        : io(io), fd(-1), buffers(0), n_buffers(0), running(false)
+    V4lVideo::V4lVideo(const char* dev_name, io_method io, bool export_dmabuf)
+        : io(io), fd(-1), buffers(0), n_buffers(0), running(false), skipped(0)
     {
         open_device(dev_name);
         init_device(dev_name,640,480,30);
+        if (export_dmabuf)
+            export_buffers();
         Start();
     }
 
@@ -100,6 +103,79 @@ namespace pangolin
     }
 
     bool V4lVideo::GrabNext( unsigned char* image, bool wait )
+    {
+        V4lFrame frame = GetNext(wait);
+        if(!frame.isValid())
+            return false;
+
+        memcpy(image, frame.Image(), std::min(frame.SizeBytes(), image_size));
+        PutFrame(frame);
+        return true;
+    }
+
+    bool V4lVideo::GrabNewest( unsigned char* image, bool wait )
+    {
+        V4lFrame frame = GetNewest(wait);
+        if(!frame.isValid())
+            return false;
+
+        memcpy(image, frame.Image(), std::min(frame.SizeBytes(), image_size));
+        PutFrame(frame);
+        return true;
+    }
+
+    V4lFrame V4lVideo::GetNext(bool wait)
+    {
+        V4lFrame frame;
+
+        for (;;) {
+            if (!WaitForFrame(wait))
+                break;
+
+            if (DequeueFrame(frame) || !wait)
+                break;
+
+            /* EAGAIN - continue select loop. */
+        }
+        return frame;
+    }
+
+    V4lFrame V4lVideo::GetNewest(bool wait)
+    {
+        /* read() always returns the frame in progress. */
+        if (io == IO_METHOD_READ)
+            return GetNext(wait);
+
+        V4lFrame frame;
+
+        if (DequeueFrame(frame)) {
+            /* Drain the queue, bounded in case the driver refills as fast
+               as we requeue. */
+            V4lFrame next;
+            unsigned drained = 0;
+            for (unsigned int i = 0; i < n_buffers && DequeueFrame(next); ++i) {
+                PutFrame(frame);
+                frame = next;
+                ++drained;
+            }
+            frame.skipped = drained;
+            skipped += drained;
+        } else if (wait) {
+            frame = GetNext(true);
+        }
+
+        return frame;
+    }
+
+    void V4lVideo::PutFrame(V4lFrame& frame)
+    {
+        if (frame.image && io != IO_METHOD_READ)
+            QueueBuffer(frame.index);
+
+        frame = V4lFrame();
+    }
+
+    bool V4lVideo::WaitForFrame(bool wait)
     {
         for (;;) {
             fd_set fds;
@@ -110,7 +186,7 @@ namespace pangolin
             FD_SET (fd, &fds);
 
             /* Timeout. */
-            tv.tv_sec = 2;
+            tv.tv_sec = wait ? 2 : 0;
             tv.tv_usec = 0;
 
             r = select (fd + 1, &fds, NULL, NULL, &tv);
@@ -123,24 +199,17 @@ namespace pangolin
             }
 
             if (0 == r) {
+                if (!wait)
+                    return false;
+
                 throw VideoException("select Timeout", strerror(errno));
             }
 
-            if (ReadFrame(image))
-                break;
-
-            /* EAGAIN - continue select loop. */
+            return true;
         }
-        return true;
-    }
-
-    bool V4lVideo::GrabNewest( unsigned char* image, bool wait )
-    {
-        // TODO: Implement
-        return GrabNext(image,wait);
     }
 
-    int V4lVideo::ReadFrame(unsigned char* image)
+    bool V4lVideo::DequeueFrame(V4lFrame& frame)
     {
         struct v4l2_buffer buf;
         unsigned int i;
@@ -150,7 +219,7 @@ namespace pangolin
             if (-1 == read (fd, buffers[0].start, buffers[0].length)) {
                 switch (errno) {
                 case EAGAIN:
-                    return 0;
+                    return false;
 
                 case EIO:
                     /* Could ignore EIO, see spec. */
@@ -162,53 +231,24 @@ namespace pangolin
                 }
             }
 
-//            process_image(buffers[0].start);
-            memcpy(image,buffers[0].start,buffers[0].length);
-
-            break;
+            frame.image = (unsigned char*)buffers[0].start;
+            frame.bytes = buffers[0].length;
+            frame.index = 0;
+            frame.sequence = 0;
+            frame.dmabuf = -1;
+            return true;
 
         case IO_METHOD_MMAP:
-            CLEAR (buf);
-
-            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            buf.memory = V4L2_MEMORY_MMAP;
-
-            if (-1 == xioctl (fd, VIDIOC_DQBUF, &buf)) {
-                switch (errno) {
-                case EAGAIN:
-                    return 0;
-
-                case EIO:
-                    /* Could ignore EIO, see spec. */
-
-                    /* fall through */
-
-                default:
-                    throw VideoException("VIDIOC_DQBUF", strerror(errno));
-                }
-            }
-
-            assert (buf.index < n_buffers);
-
-//            process_image (buffers[buf.index].start);
-            memcpy(image,buffers[buf.index].start,buffers[buf.index].length);
-
-
-            if (-1 == xioctl (fd, VIDIOC_QBUF, &buf))
-                throw VideoException("VIDIOC_QBUF", strerror(errno));
-
-            break;
-
         case IO_METHOD_USERPTR:
             CLEAR (buf);
 
             buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            buf.memory = V4L2_MEMORY_USERPTR;
+            buf.memory = (io == IO_METHOD_MMAP) ? V4L2_MEMORY_MMAP : V4L2_MEMORY_USERPTR;
 
             if (-1 == xioctl (fd, VIDIOC_DQBUF, &buf)) {
                 switch (errno) {
                 case EAGAIN:
-                    return 0;
+                    return false;
 
                 case EIO:
                     /* Could ignore EIO, see spec. */
@@ -220,24 +260,54 @@ namespace pangolin
                 }
             }
 
-            for (i = 0; i < n_buffers; ++i)
-                if (buf.m.userptr == (unsigned long) buffers[i].start
-                    && buf.length == buffers[i].length)
-                    break;
+            if (io == IO_METHOD_USERPTR) {
+                for (i = 0; i < n_buffers; ++i)
+                    if (buf.m.userptr == (unsigned long) buffers[i].start
+                        && buf.length == buffers[i].length)
+                        break;
+            } else {
+                i = buf.index;
+            }
 
             assert (i < n_buffers);
+            buffers[i].queued = false;
+
+            frame.image = (unsigned char*)buffers[i].start;
+            frame.bytes = buf.bytesused ? buf.bytesused : buffers[i].length;
+            frame.index = i;
+            frame.sequence = buf.sequence;
+            frame.dmabuf = buffers[i].dmabuf;
+            return true;
+        }
 
-//            process_image ((void *) buf.m.userptr);
-            memcpy(image,(void *)buf.m.userptr,buf.length);
+        return false;
+    }
+
+    void V4lVideo::QueueBuffer(unsigned index)
+    {
+        struct v4l2_buffer buf;
 
+        // Start() queues every buffer again
+        if (!running || buffers[index].queued)
+            return;
 
-            if (-1 == xioctl (fd, VIDIOC_QBUF, &buf))
-                throw VideoException("VIDIOC_QBUF", strerror(errno));
+        CLEAR (buf);
 
-            break;
+        buf.type        = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        buf.index       = index;
+
+        if (io == IO_METHOD_MMAP) {
+            buf.memory      = V4L2_MEMORY_MMAP;
+        } else {
+            buf.memory      = V4L2_MEMORY_USERPTR;
+            buf.m.userptr   = (unsigned long) buffers[index].start;
+            buf.length      = buffers[index].length;
         }
 
-        return 1;
+        if (-1 == xioctl (fd, VIDIOC_QBUF, &buf))
+            throw VideoException("VIDIOC_QBUF", strerror(errno));
+
+        buffers[index].queued = true;
     }
 
     void V4lVideo::Stop()
@@ -256,6 +326,10 @@ namespace pangolin
             if (-1 == xioctl (fd, VIDIOC_STREAMOFF, &type))
                 throw VideoException("VIDIOC_STREAMOFF", strerror(errno));
 
+            /* STREAMOFF returns every buffer, including any still lent out. */
+            for (unsigned int i = 0; i < n_buffers; ++i)
+                buffers[i].queued = false;
+
             break;
         }
 
@@ -284,6 +358,8 @@ namespace pangolin
 
                 if (-1 == xioctl (fd, VIDIOC_QBUF, &buf))
                     throw VideoException("VIDIOC_QBUF", strerror(errno));
+
+                buffers[i].queued = true;
             }
 
             type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -307,6 +383,8 @@ namespace pangolin
 
                 if (-1 == xioctl (fd, VIDIOC_QBUF, &buf))
                     throw VideoException("VIDIOC_QBUF", strerror(errno));
+
+                buffers[i].queued = true;
             }
 
             type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
@@ -330,9 +408,12 @@ namespace pangolin
             break;
 
         case IO_METHOD_MMAP:
-            for (i = 0; i < n_buffers; ++i)
+            for (i = 0; i < n_buffers; ++i) {
+                if (buffers[i].dmabuf != -1)
+                    close (buffers[i].dmabuf);
                 if (-1 == munmap (buffers[i].start, buffers[i].length))
                     throw VideoException ("munmap");
+            }
             break;
 
         case IO_METHOD_USERPTR:
@@ -354,6 +435,7 @@ namespace pangolin
 
         buffers[0].length = buffer_size;
         buffers[0].start = malloc (buffer_size);
+        buffers[0].dmabuf = -1;
 
         if (!buffers[0].start) {
             throw VideoException("Out of memory\n");
@@ -401,6 +483,7 @@ namespace pangolin
                 throw VideoException ("VIDIOC_QUERYBUF", strerror(errno));
 
             buffers[n_buffers].length = buf.length;
+            buffers[n_buffers].dmabuf = -1;
             buffers[n_buffers].start =
                     mmap (NULL /* start anywhere */,
                           buf.length,
@@ -413,6 +496,31 @@ namespace pangolin
         }
     }
 
+    void V4lVideo::export_buffers()
+    {
+        if (io != IO_METHOD_MMAP)
+            throw VideoException("DMABUF export requires memory mapped i/o");
+
+#ifdef VIDIOC_EXPBUF
+        for (unsigned int i = 0; i < n_buffers; ++i) {
+            struct v4l2_exportbuffer expbuf;
+
+            CLEAR (expbuf);
+
+            expbuf.type     = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            expbuf.index    = i;
+            expbuf.flags    = O_RDONLY | O_CLOEXEC;
+
+            if (-1 == xioctl (fd, VIDIOC_EXPBUF, &expbuf))
+                throw VideoException ("VIDIOC_EXPBUF", strerror(errno));
+
+            buffers[i].dmabuf = expbuf.fd;
+        }
+#else
+        throw VideoException("DMABUF export not supported by these kernel headers");
+#endif
+    }
+
     void V4lVideo::init_userp(const char* dev_name, unsigned int buffer_size)
     {
         struct v4l2_requestbuffers req;
@@ -443,6 +551,7 @@ namespace pangolin
 
         for (n_buffers = 0; n_buffers < 4; ++n_buffers) {
             buffers[n_buffers].length = buffer_size;
+            buffers[n_buffers].dmabuf = -1;
             buffers[n_buffers].start = memalign (/* boundary */ page_size,
                                                                 buffer_size);
 
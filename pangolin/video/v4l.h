@@ -46,12 +46,45 @@ typedef enum {
 struct buffer {
     void*  start;
     size_t length;
+    int    dmabuf;  // exported DMABUF file descriptor, or -1
+    bool   queued;  // held by the driver
+};
+
+//! Capture buffer lent out by V4lVideo::GetNext(), to be handed back with
+//! V4lVideo::PutFrame()
+class V4lFrame
+{
+friend class V4lVideo;
+public:
+    V4lFrame() : image(0), bytes(0), index(0), sequence(0), skipped(0), dmabuf(-1) {}
+
+    bool isValid() { return image; }
+    unsigned char* Image() { return image; }
+    size_t SizeBytes() const { return bytes; }
+    unsigned Sequence() const { return sequence; }
+
+    //! Older frames discarded by GetNewest() to reach this one
+    unsigned Skipped() const { return skipped; }
+
+    //! DMABUF file descriptor of the buffer, if exported, else -1.
+    //! Owned by V4lVideo.
+    int DmaBuf() const { return dmabuf; }
+
+protected:
+    unsigned char* image;
+    size_t bytes;
+    unsigned index;
+    unsigned sequence;
+    unsigned skipped;
+    int dmabuf;
 };
 
 class V4lVideo : public VideoInterface
 {
 public:
-    V4lVideo(const char* dev_name, io_method io = IO_METHOD_MMAP);
+    //! export_dmabuf exports each MMAP buffer as a DMABUF (VIDIOC_EXPBUF)
+    //! for sharing with other devices
+    V4lVideo(const char* dev_name, io_method io = IO_METHOD_MMAP, bool export_dmabuf = false);
     ~V4lVideo();
 
     //! Implement VideoSource::Start()
@@ -72,9 +105,42 @@ public:
 
     bool GrabNewest( unsigned char* image, bool wait = true );
 
+    /**
+     Lend the next captured buffer without copying. The driver can't fill
+     it again until it is returned with PutFrame(). With IO_METHOD_READ
+     there is a single buffer, so only one frame may be held at a time.
+     Frames still held at Stop() are invalidated.
+     @param wait flag
+     @return frame, invalid if wait is false and none is ready
+     */
+    V4lFrame GetNext(bool wait = true);
+
+    /**
+     Lend the newest captured buffer, returning any older ready buffers
+     to the driver. Waits for the next frame if none is ready.
+     @param wait flag
+     @return frame, invalid if wait is false and none is ready
+     */
+    V4lFrame GetNewest(bool wait = true);
+
+    /**
+     Return a frame from GetNext() to the driver
+     @param frame, invalid on return
+     */
+    void PutFrame(V4lFrame& frame);
+
+    //! Total frames discarded by GrabNewest() / GetNewest()
+    unsigned long FramesSkipped() const { return skipped; }
+
 protected:
-    int ReadFrame(unsigned char* image);
-    void Mainloop();
+    //! Wait up to 2s for a buffer to be ready, or not at all if !wait
+    bool WaitForFrame(bool wait);
+
+    //! Dequeue a filled buffer, false if none is ready
+    bool DequeueFrame(V4lFrame& frame);
+
+    void QueueBuffer(unsigned index);
+    void export_buffers();
 
     void init_read(unsigned int buffer_size);
     void init_mmap(const char* dev_name);
@@ -96,6 +162,7 @@ protected:
     unsigned height;
     float fps;
     size_t image_size;
+    unsigned long skipped;
 };
 
 }
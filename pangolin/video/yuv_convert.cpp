@@ -0,0 +1,512 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "yuv_convert.h"
+
+#include <stdint.h>
+#include <algorithm>
+#include <cstring>
+
+#include <boost/bind.hpp>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+namespace pangolin
+{
+
+namespace
+{
+
+enum YuvLayout
+{
+    YUV_YUYV422,
+    YUV_UYVY422,
+    YUV_UYYVYY411
+};
+
+enum OutLayout
+{
+    OUT_RGB24,
+    OUT_BGR24,
+    OUT_GRAY8
+};
+
+const char* YuvNames[] = { "YUYV422", "UYVY422", "UYYVYY411" };
+const char* OutNames[] = { "RGB24", "BGR24", "GRAY8" };
+
+int FindName(const char* names[], int n, const std::string& format)
+{
+    for(int i=0; i < n; ++i) {
+        if( !format.compare(names[i]) ) return i;
+    }
+    return -1;
+}
+
+YuvLayout YuvLayoutFromString(const std::string& format)
+{
+    const int i = FindName(YuvNames, 3, format);
+    if( i < 0 ) {
+        throw VideoException("Not a packed YUV format", format);
+    }
+    return (YuvLayout)i;
+}
+
+OutLayout OutLayoutFromString(const std::string& format)
+{
+    const int i = FindName(OutNames, 3, format);
+    if( i < 0 ) {
+        throw VideoException("YUV conversion: unsupported output format", format);
+    }
+    return (OutLayout)i;
+}
+
+// Luma samples sharing a chroma pair
+inline int Phases(YuvLayout layout)
+{
+    return layout == YUV_UYYVYY411 ? 4 : 2;
+}
+
+inline size_t YuvRowBytes(YuvLayout layout, unsigned w)
+{
+    return layout == YUV_UYYVYY411 ? (size_t)w * 3 / 2 : (size_t)w * 2;
+}
+
+inline size_t OutRowBytes(OutLayout layout, unsigned w)
+{
+    return layout == OUT_GRAY8 ? (size_t)w : (size_t)w * 3;
+}
+
+void CheckWidth(YuvLayout layout, unsigned w)
+{
+    if( w % Phases(layout) ) {
+        throw VideoException("YUV conversion: width must be a multiple of the chroma subsampling");
+    }
+}
+
+inline bool IsBigEndianHost()
+{
+    const uint16_t one = 1;
+    return *(const unsigned char*)&one == 0;
+}
+
+// Fixed point BT.601 for video range samples, in 1/8192, with U' = U-128
+// and V' = V-128:
+//   R = 1.164383 (Y-16) + 1.596027 V'
+//   G = 1.164383 (Y-16) - 0.391762 U' - 0.812968 V'
+//   B = 1.164383 (Y-16) + 2.017232 U'
+// Coefficients fit 16 bits so SSE2 can form each sum of two products in
+// 32 bits with one multiply-add. Results are within 1 of the rounded
+// floating point conversion.
+const int FIX_BITS = 13;
+const int32_t FIX_HALF = 1 << (FIX_BITS - 1);
+const int16_t K_Y  = 9539;
+const int16_t K_RV = 13075;
+const int16_t K_GU = 3209;
+const int16_t K_GV = 6660;
+const int16_t K_BU = 16525;
+
+// Planes of one row. y[p][k] is luma phase p of chroma group k, and px[p]
+// the converted pixels of that phase. The chroma terms cr, cg and cb are
+// only filled for groups left to the scalar loops.
+struct Planes
+{
+    int16_t* y[4];
+    int16_t* u;
+    int16_t* v;
+    int32_t* cr;
+    int32_t* cg;
+    int32_t* cb;
+    uint32_t* px[4];
+    int groups;
+};
+
+// Groups of a row converted by the SSE2 kernel, the rest by scalar loops
+inline int VectorGroups(int groups)
+{
+#ifdef __SSE2__
+    return groups & ~7;
+#else
+    (void)groups;
+    return 0;
+#endif
+}
+
+void Split(const unsigned char* src, YuvLayout layout, const Planes& p)
+{
+    int16_t *y0 = p.y[0], *y1 = p.y[1], *y2 = p.y[2], *y3 = p.y[3];
+    int16_t *u = p.u, *v = p.v;
+    const int count = p.groups;
+
+    switch(layout)
+    {
+        case YUV_YUYV422:
+            for(int k=0; k < count; ++k) {
+                y0[k] = src[4*k+0];
+                u[k]  = src[4*k+1];
+                y1[k] = src[4*k+2];
+                v[k]  = src[4*k+3];
+            }
+            break;
+        case YUV_UYVY422:
+            for(int k=0; k < count; ++k) {
+                u[k]  = src[4*k+0];
+                y0[k] = src[4*k+1];
+                v[k]  = src[4*k+2];
+                y1[k] = src[4*k+3];
+            }
+            break;
+        case YUV_UYYVYY411:
+            for(int k=0; k < count; ++k) {
+                u[k]  = src[6*k+0];
+                y0[k] = src[6*k+1];
+                y1[k] = src[6*k+2];
+                v[k]  = src[6*k+3];
+                y2[k] = src[6*k+4];
+                y3[k] = src[6*k+5];
+            }
+            break;
+    }
+}
+
+// Chroma contributions of groups from first on, with the rounding of the
+// final shift folded in. One plane per loop, as for the demosaic kernels.
+void Chroma(const Planes& p, int first)
+{
+    const int16_t *u = p.u, *v = p.v;
+    int32_t *cr = p.cr, *cg = p.cg, *cb = p.cb;
+    const int count = p.groups;
+
+    for(int k=first; k < count; ++k) cr[k] = K_RV * (v[k] - 128) + FIX_HALF;
+    for(int k=first; k < count; ++k) cg[k] = FIX_HALF - K_GU * (u[k] - 128) - K_GV * (v[k] - 128);
+    for(int k=first; k < count; ++k) cb[k] = K_BU * (u[k] - 128) + FIX_HALF;
+}
+
+inline uint32_t Clamp8(int32_t v)
+{
+    return v < 0 ? 0 : (v > 255 ? 255 : v);
+}
+
+// Pixels of one luma phase from group first on as 32 bit words, colour c
+// at bit shift[c]
+void Pixels(const int16_t* y, const Planes& p, const int shift[3], uint32_t* out, int first)
+{
+    const int32_t *cr = p.cr, *cg = p.cg, *cb = p.cb;
+    const int rs = shift[0], gs = shift[1], bs = shift[2];
+    const int count = p.groups;
+
+    for(int k=first; k < count; ++k) {
+        const int32_t yy = K_Y * (y[k] - 16);
+        const int32_t r = (yy + cr[k]) >> FIX_BITS;
+        const int32_t g = (yy + cg[k]) >> FIX_BITS;
+        const int32_t b = (yy + cb[k]) >> FIX_BITS;
+        out[k] = (Clamp8(r) << rs) | (Clamp8(g) << gs) | (Clamp8(b) << bs);
+    }
+}
+
+#ifdef __SSE2__
+// Sum of products a0 * k0 + a1 * k1 in each 32 bit lane of 8 samples,
+// rounded and shifted back to 16 bits
+inline __m128i Dot(__m128i a0, __m128i a1, __m128i k, __m128i half)
+{
+    const __m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(a0, a1), k), half);
+    const __m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(a0, a1), k), half);
+    return _mm_packs_epi32(_mm_srai_epi32(lo, FIX_BITS), _mm_srai_epi32(hi, FIX_BITS));
+}
+
+inline __m128i Coeffs(int16_t k0, int16_t k1)
+{
+    return _mm_set_epi16(k1, k0, k1, k0, k1, k0, k1, k0);
+}
+
+// Pixels of all phases for the first VectorGroups groups, 8 at a time. The
+// x86 hosts SSE2 runs on are little endian, so only the order of red and
+// blue varies.
+void PixelsSSE2(const Planes& p, int phases, bool bgr)
+{
+    const __m128i half = _mm_set1_epi32(FIX_HALF);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i k_r = Coeffs(K_Y, K_RV);
+    const __m128i k_g = Coeffs(K_Y, -K_GU);
+    const __m128i k_b = Coeffs(K_Y, K_BU);
+    const __m128i k_gv = Coeffs(-K_GV, 0);
+    const __m128i c128 = _mm_set1_epi16(128);
+    const __m128i c16 = _mm_set1_epi16(16);
+    const int count = VectorGroups(p.groups);
+
+    for(int k=0; k < count; k += 8) {
+        const __m128i u = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(p.u + k)), c128);
+        const __m128i v = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(p.v + k)), c128);
+
+        // V' term of green, shared by all phases (before rounding)
+        const __m128i gv_lo = _mm_madd_epi16(_mm_unpacklo_epi16(v, zero), k_gv);
+        const __m128i gv_hi = _mm_madd_epi16(_mm_unpackhi_epi16(v, zero), k_gv);
+
+        for(int i=0; i < phases; ++i) {
+            const __m128i y = _mm_sub_epi16(_mm_loadu_si128((const __m128i*)(p.y[i] + k)), c16);
+
+            const __m128i r = Dot(y, v, k_r, half);
+            const __m128i b = Dot(y, u, k_b, half);
+            const __m128i g_lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(y, u), k_g), _mm_add_epi32(gv_lo, half));
+            const __m128i g_hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(y, u), k_g), _mm_add_epi32(gv_hi, half));
+            const __m128i g = _mm_packs_epi32(_mm_srai_epi32(g_lo, FIX_BITS), _mm_srai_epi32(g_hi, FIX_BITS));
+
+            // saturate to bytes and interleave into pixel words
+            const __m128i first = _mm_packus_epi16(bgr ? b : r, zero);
+            const __m128i third = _mm_packus_epi16(bgr ? r : b, zero);
+            const __m128i fg = _mm_unpacklo_epi8(first, _mm_packus_epi16(g, zero));
+            const __m128i tz = _mm_unpacklo_epi8(third, zero);
+            _mm_storeu_si128((__m128i*)(p.px[i] + k), _mm_unpacklo_epi16(fg, tz));
+            _mm_storeu_si128((__m128i*)(p.px[i] + k + 4), _mm_unpackhi_epi16(fg, tz));
+        }
+    }
+}
+#endif // __SSE2__
+
+// Write phase planes as packed 24 bit pixels. Each pixel is stored as a
+// whole word whose spare byte the next pixel overwrites, so only the last
+// pixel of the row is written bytewise.
+void Store(const Planes& p, int phases, unsigned char* out)
+{
+    const int last = p.groups - 1;
+    for(int k=0; k < last; ++k) {
+        for(int i=0; i < phases; ++i) {
+            memcpy(out + 3 * (phases * k + i), p.px[i] + k, 4);
+        }
+    }
+
+    unsigned char* tail = out + 3 * phases * last;
+    for(int i=0; i < phases - 1; ++i) {
+        memcpy(tail + 3 * i, p.px[i] + last, 4);
+    }
+    memcpy(tail + 3 * (phases - 1), p.px[phases-1] + last, 3);
+}
+
+// GRAY8 is the luma plane as is
+void Gray(const unsigned char* src, YuvLayout layout, unsigned w, unsigned char* out)
+{
+    switch(layout)
+    {
+        case YUV_YUYV422:
+            for(unsigned x=0; x < w; ++x) out[x] = src[2*x];
+            break;
+        case YUV_UYVY422:
+            for(unsigned x=0; x < w; ++x) out[x] = src[2*x+1];
+            break;
+        case YUV_UYYVYY411:
+            for(unsigned k=0; k < w / 4; ++k) {
+                out[4*k+0] = src[6*k+1];
+                out[4*k+1] = src[6*k+2];
+                out[4*k+2] = src[6*k+4];
+                out[4*k+3] = src[6*k+5];
+            }
+            break;
+    }
+}
+
+void ConvertRows(const unsigned char* src, YuvLayout layout, OutLayout out_layout,
+                 unsigned w, unsigned rows, unsigned char* dst)
+{
+    if( w == 0 || rows == 0 ) return;
+
+    const size_t src_stride = YuvRowBytes(layout, w);
+    const size_t dst_stride = OutRowBytes(out_layout, w);
+
+    if( out_layout == OUT_GRAY8 ) {
+        for(unsigned y=0; y < rows; ++y) {
+            Gray(src + y * src_stride, layout, w, dst + y * dst_stride);
+        }
+        return;
+    }
+
+    const int phases = Phases(layout);
+    const int groups = w / phases;
+
+    vector<int16_t> samples((size_t)(phases + 2) * groups);
+    vector<int32_t> chroma((size_t)3 * groups);
+    vector<uint32_t> pixels((size_t)phases * groups);
+
+    Planes p;
+    p.groups = groups;
+    for(int i=0; i < 4; ++i) {
+        p.y[i] = i < phases ? &samples[(size_t)i * groups] : 0;
+        p.px[i] = i < phases ? &pixels[(size_t)i * groups] : 0;
+    }
+    p.u   = &samples[(size_t)(phases + 0) * groups];
+    p.v   = &samples[(size_t)(phases + 1) * groups];
+    p.cr  = &chroma[0];
+    p.cg  = &chroma[(size_t)groups];
+    p.cb  = &chroma[(size_t)2 * groups];
+
+    // place colours so that a pixel word is in byte order in memory
+    const bool big_endian = IsBigEndianHost();
+    int shift[3];
+    for(int c=0; c < 3; ++c) shift[c] = big_endian ? 24 - 8 * c : 8 * c;
+    if( out_layout == OUT_BGR24 ) std::swap(shift[0], shift[2]);
+
+    const int first = VectorGroups(groups);
+
+    for(unsigned y=0; y < rows; ++y) {
+        Split(src + y * src_stride, layout, p);
+#ifdef __SSE2__
+        PixelsSSE2(p, phases, out_layout == OUT_BGR24);
+#endif
+        Chroma(p, first);
+        for(int i=0; i < phases; ++i) {
+            Pixels(p.y[i], p, shift, p.px[i], first);
+        }
+        Store(p, phases, dst + y * dst_stride);
+    }
+}
+
+}
+
+bool IsYuvFormat(const std::string& format)
+{
+    return FindName(YuvNames, 3, format) >= 0;
+}
+
+bool IsYuvOutputFormat(const std::string& format)
+{
+    return FindName(OutNames, 3, format) >= 0;
+}
+
+void ConvertYuv(const unsigned char* yuv, unsigned w, unsigned h,
+                const std::string& yuv_format, unsigned char* out,
+                const std::string& out_format)
+{
+    const YuvLayout layout = YuvLayoutFromString(yuv_format);
+    const OutLayout out_layout = OutLayoutFromString(out_format);
+    CheckWidth(layout, w);
+    ConvertRows(yuv, layout, out_layout, w, h, out);
+}
+
+YuvConverter::YuvConverter(unsigned threads)
+    : pool(threads), yuv(0), out(0), w(0), h(0), yuv_layout(0), out_layout(0), bands(0)
+{
+}
+
+void YuvConverter::Convert(const unsigned char* yuv, unsigned w, unsigned h,
+                           const std::string& yuv_format, unsigned char* out,
+                           const std::string& out_format)
+{
+    const YuvLayout layout = YuvLayoutFromString(yuv_format);
+    const OutLayout olayout = OutLayoutFromString(out_format);
+    CheckWidth(layout, w);
+
+    this->yuv = yuv;
+    this->out = out;
+    this->w = w;
+    this->h = h;
+    yuv_layout = layout;
+    out_layout = olayout;
+    bands = std::min(h, pool.Threads() * 4);
+
+    pool.Run(bands, boost::bind(&YuvConverter::ConvertBand, this, _1));
+}
+
+void YuvConverter::ConvertBand(unsigned band)
+{
+    const YuvLayout layout = (YuvLayout)yuv_layout;
+    const OutLayout olayout = (OutLayout)out_layout;
+    const unsigned y0 = (unsigned)((size_t)h * band / bands);
+    const unsigned y1 = (unsigned)((size_t)h * (band + 1) / bands);
+    ConvertRows(yuv + y0 * YuvRowBytes(layout, w), layout, olayout, w, y1 - y0,
+                out + y0 * OutRowBytes(olayout, w));
+}
+
+YuvVideo::YuvVideo(VideoInterface* src, const std::string& out_format, unsigned threads)
+    : src(src), yuv_format(src->PixFormat()), out_format(out_format), converter(threads)
+{
+    if( !IsYuvFormat(yuv_format) ) {
+        throw VideoException("YUV conversion: source is not packed YUV", yuv_format);
+    }
+    if( !IsYuvOutputFormat(out_format) ) {
+        throw VideoException("YUV conversion: unsupported output format", out_format);
+    }
+
+    yuv.resize(src->SizeBytes());
+}
+
+YuvVideo::~YuvVideo()
+{
+    delete src;
+}
+
+unsigned YuvVideo::Width() const
+{
+    return src->Width();
+}
+
+unsigned YuvVideo::Height() const
+{
+    return src->Height();
+}
+
+size_t YuvVideo::SizeBytes() const
+{
+    return (size_t)Width() * Height() * VideoFormatFromString(out_format).bpp / 8;
+}
+
+std::string YuvVideo::PixFormat() const
+{
+    return out_format;
+}
+
+void YuvVideo::Start()
+{
+    src->Start();
+}
+
+void YuvVideo::Stop()
+{
+    src->Stop();
+}
+
+bool YuvVideo::GrabNext( unsigned char* image, bool wait )
+{
+    if( src->GrabNext(&yuv[0], wait) ) {
+        converter.Convert(&yuv[0], Width(), Height(), yuv_format, image, out_format);
+        return true;
+    }
+    return false;
+}
+
+bool YuvVideo::GrabNewest( unsigned char* image, bool wait )
+{
+    if( src->GrabNewest(&yuv[0], wait) ) {
+        converter.Convert(&yuv[0], Width(), Height(), yuv_format, image, out_format);
+        return true;
+    }
+    return false;
+}
+
+}
@@ -0,0 +1,245 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "video_capture_thread.h"
+
+#include <cstring>
+
+using namespace std;
+
+namespace pangolin
+{
+
+VideoCaptureThread::VideoCaptureThread(VideoInterface* src, unsigned int num_buffers, bool own_src)
+    : src(src), own_src(own_src), size_bytes(0), num_buffers(num_buffers),
+      slots(0), scratch(0), producer_slot(0), filled(num_buffers), empty(num_buffers),
+      running(false), frames_captured(0), frames_dropped(0), started(false)
+{
+    if( !src )
+        throw VideoException("Source video interface not specified");
+
+    if( num_buffers < 2 )
+        throw VideoException("VideoCaptureThread requires at least 2 buffers");
+
+    size_bytes = src->SizeBytes();
+
+    slots = new FrameSlot[num_buffers];
+    for(unsigned int i=0; i < num_buffers; ++i) {
+        slots[i].image = new unsigned char[size_bytes];
+        empty.push(&slots[i]);
+    }
+    scratch = new unsigned char[size_bytes];
+}
+
+VideoCaptureThread::~VideoCaptureThread()
+{
+    Stop();
+
+    for(unsigned int i=0; i < num_buffers; ++i) {
+        delete[] slots[i].image;
+    }
+    delete[] slots;
+    delete[] scratch;
+
+    if(own_src) delete src;
+}
+
+void VideoCaptureThread::SetFrameHandler(const FrameHandler& handler)
+{
+    if( started )
+        throw VideoException("Frame handler must be set while capture is stopped");
+
+    frame_handler = handler;
+}
+
+unsigned VideoCaptureThread::Width() const
+{
+    return src->Width();
+}
+
+unsigned VideoCaptureThread::Height() const
+{
+    return src->Height();
+}
+
+size_t VideoCaptureThread::SizeBytes() const
+{
+    return size_bytes;
+}
+
+std::string VideoCaptureThread::PixFormat() const
+{
+    return src->PixFormat();
+}
+
+void VideoCaptureThread::Start()
+{
+    if( started )
+        return;
+
+    src->Start();
+    started = true;
+    running = true;
+    capture_thread = boost::thread(boost::ref(*this));
+}
+
+void VideoCaptureThread::Stop()
+{
+    running = false;
+
+    if( capture_thread.joinable() ) {
+        capture_thread.join();
+    }
+
+    // wake any consumer still waiting on a frame
+    cond_filled.notify_all();
+
+    if( started ) {
+        src->Stop();
+        started = false;
+    }
+
+    Drain();
+}
+
+void VideoCaptureThread::Drain()
+{
+    // Only called with capture thread joined, so both queue ends are ours
+    if( producer_slot ) {
+        empty.push(producer_slot);
+        producer_slot = 0;
+    }
+
+    FrameSlot* slot;
+    while( filled.pop(slot) ) {
+        empty.push(slot);
+    }
+}
+
+VideoCaptureThread::FrameSlot* VideoCaptureThread::PopFilled(bool wait)
+{
+    FrameSlot* slot = 0;
+
+    if( filled.pop(slot) )
+        return slot;
+
+    if( !wait )
+        return 0;
+
+    boost::unique_lock<boost::mutex> lock(wait_mutex);
+    while( !filled.pop(slot) ) {
+        if( !running )
+            return 0;
+        cond_filled.wait(lock);
+    }
+    return slot;
+}
+
+void VideoCaptureThread::Release(FrameSlot* slot)
+{
+    // never fails - only num_buffers slots exist
+    empty.push(slot);
+}
+
+bool VideoCaptureThread::GrabNext( unsigned char* image, bool wait )
+{
+    FrameSlot* slot = PopFilled(wait);
+    if( !slot )
+        return false;
+
+    memcpy(image, slot->image, size_bytes);
+    last_info = slot->info;
+    Release(slot);
+    return true;
+}
+
+bool VideoCaptureThread::GrabNewest( unsigned char* image, bool wait )
+{
+    FrameSlot* slot = PopFilled(wait);
+    if( !slot )
+        return false;
+
+    unsigned long skipped = 0;
+    FrameSlot* newer;
+    while( filled.pop(newer) ) {
+        Release(slot);
+        slot = newer;
+        ++skipped;
+    }
+
+    memcpy(image, slot->image, size_bytes);
+    last_info = slot->info;
+    last_info.skipped = skipped;
+    Release(slot);
+    return true;
+}
+
+void VideoCaptureThread::operator()()
+{
+    FrameSlot* slot = 0;
+
+    try {
+        while( running )
+        {
+            if( !slot && !empty.pop(slot) ) {
+                // Consumer is holding every buffer. Keep the source draining
+                // so that its own (e.g. DMA) ring doesn't overflow.
+                if( src->GrabNext(scratch, true) ) {
+                    if( frame_handler ) frame_handler(scratch);
+                    ++frames_captured;
+                    ++frames_dropped;
+                }
+                continue;
+            }
+
+            if( src->GrabNext(slot->image, true) ) {
+                slot->info.sequence = frames_captured++;
+                slot->info.host_time = TimeNow();
+                slot->info.skipped = 0;
+                slot->info.tag = frame_handler ? frame_handler(slot->image) : -1;
+                filled.push(slot);
+                slot = 0;
+
+                // Don't notify between a waiting consumer's test and its wait
+                { boost::lock_guard<boost::mutex> lock(wait_mutex); }
+                cond_filled.notify_one();
+            }else{
+                // e.g. end of file - don't spin
+                boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+            }
+        }
+    }catch(std::exception& e) {
+        cerr << "[CAPTURE ERROR]: " << e.what() << endl;
+        running = false;
+        cond_filled.notify_all();
+    }
+
+    producer_slot = slot;
+}
+
+}
@@ -0,0 +1,174 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PANGOLIN_VIDEO_CAPTURE_THREAD_H
+#define PANGOLIN_VIDEO_CAPTURE_THREAD_H
+
+#include <pangolin/pangolin.h>
+#include <pangolin/video.h>
+#include <pangolin/timer.h>
+
+#include <boost/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/atomic.hpp>
+#include <boost/lockfree/spsc_queue.hpp>
+#include <boost/function.hpp>
+
+namespace pangolin
+{
+
+//! Information about the most recently grabbed frame
+struct CaptureFrameInfo
+{
+    CaptureFrameInfo() : sequence(0), skipped(0), tag(-1) {}
+
+    //! Index of frame as counted by the capture thread
+    unsigned long sequence;
+
+    //! Host time at which the frame left the source
+    basetime host_time;
+
+    //! Number of frames discarded by GrabNewest() to reach this one
+    unsigned long skipped;
+
+    //! Value returned by the frame handler for this frame, -1 if none
+    int tag;
+};
+
+//! Runs VideoInterface::GrabNext() on its own thread so that capture rate
+//! is independent of the consumer (render loop, UI, saving).
+//!
+//! Frames are copied into a fixed pool of buffers and handed to the consumer
+//! through a bounded lock-free single-producer / single-consumer queue.
+//! Buffers are returned to the producer through a second queue, so no
+//! allocation or locking takes place on the capture path.
+//!
+//! GrabNext() returns every captured frame in order (every-frame mode).
+//! GrabNewest() discards everything but the most recent frame (latest-frame mode).
+//! If the consumer falls so far behind that the pool is exhausted, the
+//! capture thread keeps draining the source and counts the frames as dropped.
+//!
+//! Exactly one thread may act as consumer.
+class VideoCaptureThread : public VideoInterface
+{
+public:
+    VideoCaptureThread(VideoInterface* src, unsigned int num_buffers = 8, bool own_src = false);
+    ~VideoCaptureThread();
+
+    //! Called on the capture thread with every frame taken from the source,
+    //! including those later dropped, e.g. to track an exposure schedule.
+    typedef boost::function<int(unsigned char* image)> FrameHandler;
+
+    //! Set handler whose result is kept in CaptureFrameInfo::tag. Must be
+    //! called while stopped.
+    void SetFrameHandler(const FrameHandler& handler);
+
+    // Implement VideoInterface
+    unsigned Width() const;
+    unsigned Height() const;
+    size_t SizeBytes() const;
+    std::string PixFormat() const;
+
+    //! Start source and capture thread
+    void Start();
+
+    //! Join capture thread and stop source. Any queued frames are discarded.
+    //! Source may then be used directly (e.g. for one-shot capture) until Start()
+    void Stop();
+
+    //! Copy the oldest queued frame (every-frame mode)
+    bool GrabNext( unsigned char* image, bool wait = true );
+
+    //! Copy the newest queued frame, discarding older ones (latest-frame mode)
+    bool GrabNewest( unsigned char* image, bool wait = true );
+
+    //! Information about frame last returned by GrabNext() / GrabNewest()
+    const CaptureFrameInfo& LastFrameInfo() const { return last_info; }
+
+    //! Total frames taken from the source
+    unsigned long FramesCaptured() const { return frames_captured; }
+
+    //! Frames lost because the consumer did not return buffers in time
+    unsigned long FramesDropped() const { return frames_dropped; }
+
+    bool IsRunning() const { return running; }
+
+    VideoInterface* Source() { return src; }
+
+    //! Capture thread body
+    void operator()();
+
+protected:
+    struct FrameSlot
+    {
+        unsigned char* image;
+        CaptureFrameInfo info;
+    };
+
+    FrameSlot* PopFilled(bool wait);
+    void Release(FrameSlot* slot);
+    void Drain();
+
+    VideoInterface* src;
+    bool own_src;
+    size_t size_bytes;
+
+    unsigned int num_buffers;
+    FrameSlot* slots;
+    unsigned char* scratch;
+
+    // slot held by capture thread when it was last joined
+    FrameSlot* producer_slot;
+
+    // producer -> consumer
+    boost::lockfree::spsc_queue<FrameSlot*> filled;
+    // consumer -> producer
+    boost::lockfree::spsc_queue<FrameSlot*> empty;
+
+    boost::atomic<bool> running;
+    boost::atomic<unsigned long> frames_captured;
+    boost::atomic<unsigned long> frames_dropped;
+
+    // source started by us (consumer side only)
+    bool started;
+
+    FrameHandler frame_handler;
+
+    CaptureFrameInfo last_info;
+
+    // only used to put a waiting consumer to sleep, never held while copying
+    boost::mutex wait_mutex;
+    boost::condition_variable cond_filled;
+
+    boost::thread capture_thread;
+};
+
+}
+
+#endif // PANGOLIN_VIDEO_CAPTURE_THREAD_H
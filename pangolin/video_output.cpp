@@ -0,0 +1,197 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#include "video_output.h"
+#include "video_recorder.h"
+
+#ifdef HAVE_FFMPEG
+#include "video/ffmpeg.h"
+#endif
+
+#include <sstream>
+
+#include <boost/algorithm/string/predicate.hpp>
+
+using namespace std;
+
+namespace pangolin
+{
+
+//! Adapts VideoRecorder, which needs the stream format on construction
+class PvnVideoOutput : public VideoOutputInterface
+{
+public:
+    PvnVideoOutput(const std::string& filename, unsigned int buffer_size_bytes,
+                   const ThreadedFileOptions& file_options, int compress_workers)
+        : filename(filename), buffer_size_bytes(buffer_size_bytes), file_options(file_options),
+          compress_workers(compress_workers), recorder(0)
+    {
+    }
+
+    ~PvnVideoOutput()
+    {
+        delete recorder;
+    }
+
+    void SetStream(unsigned w, unsigned h, std::string pix_fmt, double fps)
+    {
+        if(recorder) throw VideoException("Stream already set");
+        try {
+            recorder = new VideoRecorder(filename, w, h, pix_fmt, buffer_size_bytes, fps, file_options);
+            if(compress_workers > 0) recorder->StartCompression(compress_workers);
+        } catch (VideoRecorderException& e) {
+            throw VideoException(e.what());
+        }
+    }
+
+    int WriteFrame(const unsigned char* image)
+    {
+        if(!recorder) throw VideoException("Stream must be set before writing frames");
+        try {
+            return recorder->RecordFrame((void*)image);
+        } catch (VideoRecorderException& e) {
+            throw VideoException(e.what());
+        }
+    }
+
+    int WriteFrame(const unsigned char* image, const PvnFrameInfo& info)
+    {
+        if(!recorder) throw VideoException("Stream must be set before writing frames");
+        try {
+            return recorder->RecordFrame((void*)image, info);
+        } catch (VideoRecorderException& e) {
+            throw VideoException(e.what());
+        }
+    }
+
+protected:
+    std::string filename;
+    unsigned int buffer_size_bytes;
+    ThreadedFileOptions file_options;
+    int compress_workers;
+    VideoRecorder* recorder;
+};
+
+VideoOutputInterface* OpenVideoOutput(std::string str_uri)
+{
+    VideoOutputInterface* output = 0;
+
+    Uri uri = ParseUri(str_uri);
+
+    if(!uri.scheme.compare("pvn") || (!uri.scheme.compare("file") && boost::algorithm::ends_with(uri.url,"pvn")) )
+    {
+        unsigned int buffer_mb = 100;
+        if(uri.params.find("buffer")!=uri.params.end()){
+            std::istringstream iss(uri.params["buffer"]);
+            iss >> buffer_mb;
+        }
+        ThreadedFileOptions file_options;
+        if(uri.params.find("direct")!=uri.params.end()){
+            std::istringstream iss(uri.params["direct"]);
+            iss >> file_options.direct;
+        }
+        if(uri.params.find("prealloc")!=uri.params.end()){
+            std::istringstream iss(uri.params["prealloc"]);
+            iss >> file_options.preallocate_bytes;
+            file_options.preallocate_bytes *= 1024*1024;
+        }
+        if(uri.params.find("sync")!=uri.params.end()){
+            std::istringstream iss(uri.params["sync"]);
+            iss >> file_options.sync_bytes;
+            file_options.sync_bytes *= 1024*1024;
+        }
+        int compress_workers = 0;
+        if(uri.params.find("compress")!=uri.params.end()){
+            std::istringstream iss(uri.params["compress"]);
+            iss >> compress_workers;
+        }
+        output = new PvnVideoOutput(uri.url, buffer_mb*1024*1024, file_options, compress_workers);
+    }else
+#ifdef HAVE_FFMPEG
+    if(!uri.scheme.compare("ffmpeg") || !uri.scheme.compare("file") )
+    {
+        output = new FfmpegVideoOutput(uri.url, uri.params);
+    }else
+#endif
+    {
+        throw VideoException("Unable to open video output URI", str_uri);
+    }
+
+    return output;
+}
+
+VideoOutput::VideoOutput()
+    : uri(""), output(0)
+{
+}
+
+VideoOutput::VideoOutput(std::string uri)
+    : output(0)
+{
+    Open(uri);
+}
+
+VideoOutput::~VideoOutput()
+{
+    Reset();
+}
+
+void VideoOutput::Open(std::string uri)
+{
+    Reset();
+    this->uri = uri;
+    output = OpenVideoOutput(uri);
+}
+
+void VideoOutput::Reset()
+{
+    if(output) {
+        delete output;
+        output = 0;
+    }
+}
+
+void VideoOutput::SetStream(unsigned w, unsigned h, std::string pix_fmt, double fps)
+{
+    if(!output) throw VideoException("No video output open");
+    output->SetStream(w, h, pix_fmt, fps);
+}
+
+int VideoOutput::WriteFrame(const unsigned char* image)
+{
+    if(!output) throw VideoException("No video output open");
+    return output->WriteFrame(image);
+}
+
+int VideoOutput::WriteFrame(const unsigned char* image, const PvnFrameInfo& info)
+{
+    if(!output) throw VideoException("No video output open");
+    return output->WriteFrame(image, info);
+}
+
+}
@@ -0,0 +1,103 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef PANGOLIN_VIDEO_OUTPUT_H
+#define PANGOLIN_VIDEO_OUTPUT_H
+
+#include <pangolin/pangolin.h>
+#include <pangolin/video.h>
+#include <pangolin/video/pvn_video.h>
+
+// Video output URI's mirror those of OpenVideo:
+//  scheme:[param1=value1,param2=value2,...]//filename
+//
+// scheme = pvn | ffmpeg | file
+//
+// pvn - write raw frames to PVN file format (pangolin video)
+//  e.g. "pvn:[buffer=100]///home/user/video/movie.pvn" (buffer in MB)
+//  e.g. "pvn:[direct=1,prealloc=512,sync=64]//./video/movie.pvn" (O_DIRECT writes,
+//       reserve disk 512MB at a time, fdatasync every 64MB)
+//  e.g. "pvn:[compress=2]//./video/movie.pvn" (lossless compression on 2 threads)
+//
+// ffmpeg - encode frames in process using libavcodec. Container is chosen
+//          from the file extension, codec defaults to that of the container.
+//  e.g. "ffmpeg:[codec=h264,crf=18,fps=30]///home/user/video/movie.mp4"
+//  e.g. "ffmpeg:[codec=mpeg4,bitrate=8000,gop=15]//./video/movie.avi" (bitrate in kbit/s)
+//
+// file - pvn for .pvn files, otherwise ffmpeg
+//  e.g. "file://./video/movie.pvn"
+
+namespace pangolin
+{
+    //! Interface to video recording destinations
+    struct VideoOutputInterface
+    {
+        virtual ~VideoOutputInterface() {}
+
+        //! Describe frames which will follow. Must be called once, before
+        //! the first WriteFrame
+        virtual void SetStream(unsigned w, unsigned h, std::string pix_fmt, double fps) = 0;
+
+        //! Write frame in the format given to SetStream, returning its index
+        virtual int WriteFrame(const unsigned char* image) = 0;
+
+        //! Write frame along with its per frame record. Destinations which
+        //! cannot store the record ignore it.
+        virtual int WriteFrame(const unsigned char* image, const PvnFrameInfo& info)
+        {
+            return WriteFrame(image);
+        }
+    };
+
+    struct VideoOutput : public VideoOutputInterface
+    {
+        VideoOutput();
+        VideoOutput(std::string uri);
+        ~VideoOutput();
+
+        void Open(std::string uri);
+
+        //! Finish and close any open output
+        void Reset();
+
+        bool IsOpen() const { return output != 0; }
+
+        void SetStream(unsigned w, unsigned h, std::string pix_fmt, double fps);
+        int WriteFrame(const unsigned char* image);
+        int WriteFrame(const unsigned char* image, const PvnFrameInfo& info);
+
+    protected:
+        std::string uri;
+        VideoOutputInterface* output;
+    };
+
+    //! Open Video Output Interface from string specification (as described in this files header)
+    VideoOutputInterface* OpenVideoOutput(std::string uri);
+}
+
+#endif // PANGOLIN_VIDEO_OUTPUT_H
@@ -26,6 +26,14 @@
  */
 
 #include "video_recorder.h"
+#include "timer.h"
+
+#include <cstring>
+#include <algorithm>
+
+#include <boost/bind.hpp>
+
+#include "video/lossless_codec.h"
 
 using namespace std;
 
@@ -35,29 +43,104 @@ namespace pangolin
 VideoRecorder::VideoRecorder(
     const std::string& filename,
     int stream0_width, int stream0_height, std::string stream0_fmt,
-    unsigned int buffer_size_bytes
-    ) : frames(0), buffer(filename, buffer_size_bytes), writer(&buffer)
+    unsigned int buffer_size_bytes, double framerate,
+    const ThreadedFileOptions& file_options
+    ) : frames(0), framerate(framerate), bytes_written(0),
+        buffer(filename, buffer_size_bytes, file_options), writer(&buffer),
+        next_seq(0), next_write(0), compress_stop(false)
+{
+    if( !buffer.Error().empty() )
+        throw VideoRecorderException("Unable to open file " + filename, buffer.Error());
+
+    AddStream("main", stream0_width, stream0_height, stream0_fmt);
+    WriteFileHeader();
+}
+
+VideoRecorder::VideoRecorder(
+    const std::string& filename,
+    const std::vector<VideoStream>& streams,
+    double framerate, unsigned int buffer_size_bytes,
+    const ThreadedFileOptions& file_options
+    ) : frames(0), framerate(framerate), bytes_written(0),
+        buffer(filename, buffer_size_bytes, file_options), writer(&buffer),
+        next_seq(0), next_write(0), compress_stop(false)
 {
-    VideoStream strm0;
-    strm0.name = "main";
-    strm0.w = stream0_width;
-    strm0.h = stream0_height;
-    strm0.fmt = VideoFormatFromString(stream0_fmt);
-    strm0.frame_size_bytes = (strm0.w * strm0.h * strm0.fmt.bpp) / 8;
-
-    stream_info.push_back(strm0);
+    if( !buffer.Error().empty() )
+        throw VideoRecorderException("Unable to open file " + filename, buffer.Error());
+
+    if( streams.empty() )
+        throw VideoRecorderException("No streams specified");
+
+    for(size_t i=0; i < streams.size(); ++i)
+        AddStream(streams[i].name, streams[i].w, streams[i].h, streams[i].fmt.format);
+
+    WriteFileHeader();
 }
 
 VideoRecorder::~VideoRecorder()
 {
+    StopCompression();
+
+    try {
+        WriteIndex();
+    } catch (VideoRecorderException& e) {
+        std::cerr << "[VIDEO]: " << e.what() << std::endl;
+    }
+}
+
+void VideoRecorder::AddStream(const std::string& name, int width, int height, const std::string& fmt)
+{
+    if( name.size() >= (size_t)PVN_NAME_LEN || fmt.size() >= (size_t)PVN_NAME_LEN )
+        throw VideoRecorderException("Stream name or format too long", name);
+
+    VideoStream strm;
+    strm.name = name;
+    strm.w = width;
+    strm.h = height;
+    strm.fmt = VideoFormatFromString(fmt);
+    strm.frame_size_bytes = (strm.w * strm.h * strm.fmt.bpp) / 8;
+
+    stream_info.push_back(strm);
+}
+
+void VideoRecorder::Write(const void* data, size_t bytes)
+{
+    writer.write((const char*)data, bytes);
+    if( !writer.good() )
+        throw VideoRecorderException("Unable to write to file", buffer.Error());
+    bytes_written += bytes;
 }
 
 void VideoRecorder::WriteFileHeader()
 {
-    writer << stream_info[0].fmt.format << "\n";
-    writer << stream_info[0].w  << "\n";
-    writer << stream_info[0].h  << "\n";
-    writer << "30.0\n";
+    PvnFileHeader header;
+    memcpy(header.magic, PVN_MAGIC, sizeof(PVN_MAGIC));
+    header.version = 2;
+    header.num_streams = stream_info.size();
+    header.framerate = framerate;
+    Write(&header, sizeof(header));
+
+    for(size_t i=0; i < stream_info.size(); ++i) {
+        PvnStreamHeader sh;
+        memset(&sh, 0, sizeof(sh));
+        strncpy(sh.name, stream_info[i].name.c_str(), PVN_NAME_LEN-1);
+        strncpy(sh.fmt, stream_info[i].fmt.format.c_str(), PVN_NAME_LEN-1);
+        sh.w = stream_info[i].w;
+        sh.h = stream_info[i].h;
+        Write(&sh, sizeof(sh));
+    }
+}
+
+void VideoRecorder::WriteIndex()
+{
+    PvnFileFooter footer;
+    footer.index_offset = bytes_written;
+    footer.num_entries = index.size();
+    memcpy(footer.magic, PVN_INDEX_MAGIC, sizeof(PVN_INDEX_MAGIC));
+
+    if( !index.empty() )
+        Write(&index[0], index.size() * sizeof(PvnIndexEntry));
+    Write(&footer, sizeof(footer));
 }
 
 int VideoRecorder::RecordFrame(void* img)
@@ -65,14 +148,159 @@ int VideoRecorder::RecordFrame(void* img)
     if( stream_info.size() != 1 )
         throw VideoRecorderException("Incorrect number of frames specified");
 
-    if(frames==0)
-        WriteFileHeader();
+    return RecordFrame(img, PvnFrameInfo());
+}
+
+int VideoRecorder::RecordFrame(void* img, const PvnFrameInfo& info)
+{
+    if( info.stream >= stream_info.size() )
+        throw VideoRecorderException("Invalid stream specified");
+
+    PvnFrameInfo record = info;
+    if( !record.host_time_us ) {
+        const basetime now = TimeNow();
+        record.host_time_us = (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+    }
+
+    const size_t frame_size_bytes = stream_info[info.stream].frame_size_bytes;
 
-    const VideoStream& strm = stream_info[0];
+    if( jobs.empty() ) {
+        WriteRecord(img, frame_size_bytes, PVN_RECORD_MAGIC, record);
+        return frames++;
+    }
 
-    writer.write((char*)img,strm.frame_size_bytes);
+    CompressJob* job;
+    {
+        boost::unique_lock<boost::mutex> lock(compress_mutex);
+        while( free_jobs.empty() && write_error.empty() )
+            cond_free.wait(lock);
+
+        if( !write_error.empty() )
+            throw VideoRecorderException("Unable to write to file", write_error);
+
+        job = free_jobs.back();
+        free_jobs.pop_back();
+    }
+
+    job->seq = next_seq++;
+    job->info = record;
+    job->frame.assign((unsigned char*)img, (unsigned char*)img + frame_size_bytes);
+
+    {
+        boost::unique_lock<boost::mutex> lock(compress_mutex);
+        compress_queue.push_back(job);
+    }
+    cond_queued.notify_one();
 
     return frames++;
 }
 
+void VideoRecorder::WriteRecord(const void* img, size_t size_bytes, uint32_t magic, const PvnFrameInfo& info)
+{
+    PvnRecordHeader rec;
+    rec.magic = magic;
+    rec.size_bytes = size_bytes;
+    rec.info = info;
+
+    PvnIndexEntry entry;
+    entry.offset = bytes_written;
+    entry.host_time_us = info.host_time_us;
+    entry.stream = info.stream;
+    entry.schedule_step = info.schedule_step;
+    index.push_back(entry);
+
+    Write(&rec, sizeof(rec));
+    Write(img, size_bytes);
+}
+
+void VideoRecorder::StartCompression(int workers, int queue_frames)
+{
+    StopCompression();
+
+    compress_stop = false;
+    for(int i=0; i < std::max(1, queue_frames); ++i) {
+        jobs.push_back(new CompressJob());
+        free_jobs.push_back(jobs.back());
+    }
+
+    for(int i=0; i < std::max(1, workers); ++i) {
+        compress_workers.create_thread(boost::bind(&VideoRecorder::CompressWorker, this));
+    }
+}
+
+void VideoRecorder::StopCompression()
+{
+    if( jobs.empty() )
+        return;
+
+    {
+        boost::unique_lock<boost::mutex> lock(compress_mutex);
+        compress_stop = true;
+    }
+    cond_queued.notify_all();
+    compress_workers.join_all();
+
+    for(size_t i=0; i < jobs.size(); ++i)
+        delete jobs[i];
+    jobs.clear();
+    free_jobs.clear();
+}
+
+void VideoRecorder::CompressWorker()
+{
+    while(true)
+    {
+        CompressJob* job;
+        {
+            boost::unique_lock<boost::mutex> lock(compress_mutex);
+            while( compress_queue.empty() && !compress_stop )
+                cond_queued.wait(lock);
+
+            // queued frames are written before stopping
+            if( compress_queue.empty() )
+                return;
+
+            job = compress_queue.front();
+            compress_queue.pop_front();
+        }
+
+        // predict channels from themselves for whole byte pixel formats
+        const VideoStream& strm = stream_info[job->info.stream];
+        const size_t bpp = strm.fmt.bpp;
+        const size_t stride = (bpp % 8 == 0 && bpp) ? bpp / 8 : 1;
+        const size_t row_bytes = (strm.w * bpp) % 8 == 0 ? (strm.w * bpp) / 8 : job->frame.size();
+        const size_t rows = job->frame.size() / row_bytes;
+
+        const size_t packed_size = (rows * row_bytes == job->frame.size()) ?
+            LosslessCompress(&job->frame[0], row_bytes, rows, stride, job->packed) : 0;
+
+        {
+            boost::unique_lock<boost::mutex> lock(compress_mutex);
+
+            // records are written in the order frames were given
+            while( next_write != job->seq )
+                cond_written.wait(lock);
+
+            if( write_error.empty() ) {
+                try {
+                    if( packed_size ) {
+                        WriteRecord(&job->packed[0], packed_size, PVN_RECORD_MAGIC_LOSSLESS, job->info);
+                    }else{
+                        // incompressible frames are stored as is
+                        WriteRecord(&job->frame[0], job->frame.size(), PVN_RECORD_MAGIC, job->info);
+                    }
+                } catch (VideoRecorderException& e) {
+                    write_error = e.what();
+                }
+            }
+
+            ++next_write;
+            free_jobs.push_back(job);
+        }
+
+        cond_written.notify_all();
+        cond_free.notify_one();
+    }
+}
+
 }
@@ -29,10 +29,12 @@
 #define PANGOLIN_VIDEO_RECORDER_H
 
 #include <vector>
+#include <deque>
 #include <string>
 
 #include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
 
 #include "video/pvn_video.h"
 #include "threadedfilebuf.h"
@@ -50,29 +52,91 @@ namespace pangolin
         std::string desc;
     };
 
+    //! Records streams to PVN v2 files (see pvn_video.h)
     class VideoRecorder
     {
     public:
         VideoRecorder(
             const std::string& filename,
             int stream0_width, int stream0_height, std::string stream0_fmt,
-            unsigned int buffer_size_bytes = 1024*1024*100
+            unsigned int buffer_size_bytes = 1024*1024*100,
+            double framerate = 0,
+            const ThreadedFileOptions& file_options = ThreadedFileOptions()
         );
+
+        //! Record several named streams (e.g. under/over/fused)
+        VideoRecorder(
+            const std::string& filename,
+            const std::vector<VideoStream>& streams,
+            double framerate = 0,
+            unsigned int buffer_size_bytes = 1024*1024*100,
+            const ThreadedFileOptions& file_options = ThreadedFileOptions()
+        );
+
+        //! Writes frame index
         ~VideoRecorder();
 
         // Save img (with correct format and resolution) to video, returning video frame id.
         int RecordFrame(void* img);
 
+        // Save img to stream given by info, with its per frame record. A zero
+        // host time is replaced by the current time.
+        int RecordFrame(void* img, const PvnFrameInfo& info);
+
+        const std::vector<VideoStream>& Streams() const { return stream_info; }
+
+        //! Write buffer statistics, e.g. to detect disk falling behind
+        ThreadedFileStats Stats() const { return buffer.Stats(); }
+
+        //! Losslessly compress frames (see lossless_codec.h) on worker
+        //! threads before writing. RecordFrame blocks when queue_frames
+        //! frames are waiting to be compressed.
+        void StartCompression(int workers = 2, int queue_frames = 8);
+
+        //! Compress and write queued frames, then return to writing in place
+        void StopCompression();
+
         void operator()();
 
-    protected:       
+    protected:
+        struct CompressJob
+        {
+            uint64_t seq;
+            PvnFrameInfo info;
+            std::vector<unsigned char> frame;
+            std::vector<unsigned char> packed;
+        };
+
         int frames;
         std::vector<VideoStream> stream_info;
+        double framerate;
+        uint64_t bytes_written;
+        std::vector<PvnIndexEntry> index;
 
         threadedfilebuf buffer;
         std::ostream writer;
 
+        // compression workers, CompressJob buffers are recycled
+        boost::thread_group compress_workers;
+        boost::mutex compress_mutex;
+        boost::condition_variable cond_queued;
+        boost::condition_variable cond_free;
+        boost::condition_variable cond_written;
+        std::deque<CompressJob*> compress_queue;
+        std::vector<CompressJob*> free_jobs;
+        std::vector<CompressJob*> jobs;
+        uint64_t next_seq;
+        uint64_t next_write;
+        bool compress_stop;
+        std::string write_error;
+
+        void CompressWorker();
+        void WriteRecord(const void* img, size_t size_bytes, uint32_t magic, const PvnFrameInfo& info);
+
+        void AddStream(const std::string& name, int width, int height, const std::string& fmt);
+        void Write(const void* data, size_t bytes);
         void WriteFileHeader();
+        void WriteIndex();
     };
 }
 
@@ -0,0 +1,115 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Runs rolling exposure schedules on SimVideo, dropping some frames before
+// they reach the schedule as a slow capture consumer would, and checks the
+// camera keeps exposing steps in order and each frame is identified
+// correctly. Exits non-zero on failure.
+
+#include <iostream>
+#include <vector>
+
+#include <pangolin/video/sim.h>
+#include <pangolin/video/iidc.h>
+
+using namespace pangolin;
+using namespace std;
+
+const int FRAMES = 300;
+
+// frames not seen by the schedule: isolated drops and a burst of 4
+bool Dropped(int i)
+{
+    return i % 11 == 5 || (i >= 150 && i < 154);
+}
+
+int StepOfShutter(uint32_t shutter, int n)
+{
+    for(int s = 0; s < n; ++s) {
+        if( shutter == 100u*(s+1) ) return s;
+    }
+    return -1;
+}
+
+bool RunSchedule(int n)
+{
+    SimVideo sim(64, 48, 0, 2);
+    sim.SetMetaDataFlags(META_ALL);
+
+    vector<ExposureStep> steps;
+    for(int s = 0; s < n; ++s) {
+        steps.push_back(ExposureStep(100*(s+1), 0));
+    }
+    sim.StartExposureSchedule(ExposureSchedule(steps));
+
+    vector<unsigned char> image(sim.SizeBytes());
+    sim.GrabOneShot(&image[0]);
+    sim.Start();
+
+    int identified = 0;
+    int wrong = 0;
+    int out_of_order = 0;
+    int last_out_of_order = -1;
+    int prev_step = -1;
+
+    for(int i = 0; i < FRAMES; ++i) {
+        if( !sim.GrabNext(&image[0]) ) {
+            cerr << "GrabNext failed" << endl;
+            return false;
+        }
+
+        const int exposed = StepOfShutter(sim.ReadMetaWord(&image[0], META_SHUTTER), n);
+        if( prev_step >= 0 && exposed != (prev_step+1) % n ) {
+            ++out_of_order;
+            last_out_of_order = i;
+        }
+        prev_step = exposed;
+
+        if( !Dropped(i) ) {
+            const int step = sim.ScheduleFrame(&image[0]);
+            if( step >= 0 ) ++identified;
+            if( step >= 0 && step != exposed ) ++wrong;
+        }
+    }
+    sim.Stop();
+
+    const bool ok = wrong == 0 && identified > FRAMES / 2 &&
+                    last_out_of_order < FRAMES - 40;
+    cout << n << " step schedule: " << identified << " identified, "
+         << wrong << " misidentified, "
+         << out_of_order << " out of order (last at frame " << last_out_of_order
+         << ") " << (ok ? "ok" : "FAILED") << endl;
+    return ok;
+}
+
+int main( int /*argc*/, char* /*argv*/[] )
+{
+    const bool ok3 = RunSchedule(3);
+    const bool ok5 = RunSchedule(5);
+    return (ok3 && ok5) ? 0 : 1;
+}
@@ -0,0 +1,100 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Round trips images through LosslessCompress / LosslessDecompress for
+// each pixel stride, including residuals of every value and rows narrower
+// than the stride. Exits non-zero on failure.
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <pangolin/video/lossless_codec.h>
+
+using namespace pangolin;
+using namespace std;
+
+// Smooth ramp with noise, and a random byte in 1 of 16 so that residuals
+// take every value and escapes are exercised while still compressing.
+void MakeImage(size_t row_bytes, size_t rows, vector<unsigned char>& image)
+{
+    image.resize(row_bytes * rows);
+    for(size_t y = 0; y < rows; ++y) {
+        for(size_t x = 0; x < row_bytes; ++x) {
+            const unsigned char ramp = (unsigned char)(x + 3 * y + rand() % 5);
+            image[y * row_bytes + x] = rand() % 16 ? ramp : (unsigned char)(rand() % 256);
+        }
+    }
+}
+
+// Rows narrower than a block may not compress, which is allowed
+bool RoundTrip(size_t row_bytes, size_t rows, size_t stride)
+{
+    vector<unsigned char> image;
+    MakeImage(row_bytes, rows, image);
+
+    vector<unsigned char> data;
+    const size_t size = LosslessCompress(&image[0], row_bytes, rows, stride, data);
+    if( size == 0 ) {
+        if( row_bytes < 32 ) return true;
+        cout << row_bytes << "x" << rows << " stride " << stride << ": not compressed FAILED" << endl;
+        return false;
+    }
+
+    vector<unsigned char> decoded(image.size());
+    const bool ok = LosslessDecompress(&data[0], size, &decoded[0], decoded.size()) &&
+                    decoded == image;
+    if( !ok ) {
+        cout << row_bytes << "x" << rows << " stride " << stride << ": FAILED" << endl;
+    }
+    return ok;
+}
+
+int main( int /*argc*/, char* /*argv*/[] )
+{
+    srand(1);
+
+    bool ok = true;
+    for(size_t stride = 1; stride <= 4; ++stride) {
+        ok = RoundTrip(640 * stride, 480, stride) && ok;
+        ok = RoundTrip(37 * stride + 1, 29, stride) && ok;
+        ok = RoundTrip(stride, 200, stride) && ok;
+    }
+    ok = RoundTrip(1, 500, 4) && ok;
+
+    // incompressible data is left to the caller to store raw
+    vector<unsigned char> noise(4096), data;
+    for(size_t i = 0; i < noise.size(); ++i) noise[i] = (unsigned char)(rand() % 256);
+    if( LosslessCompress(&noise[0], 64, 64, 1, data) != 0 ) {
+        cout << "noise: compressed FAILED" << endl;
+        ok = false;
+    }
+
+    cout << "lossless codec round trip " << (ok ? "ok" : "FAILED") << endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,78 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Checks Unpack12 against a per pair reference for every length up to a
+// few SIMD blocks, with the source buffer ending right after the packed
+// samples. Exits non-zero on failure.
+
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+#include <pangolin/video/pixel_convert.h>
+
+using namespace pangolin;
+using namespace std;
+
+void Reference(const unsigned char* src, size_t samples, uint16_t* dst)
+{
+    for(size_t i = 0; i < samples / 2; ++i) {
+        const unsigned p0 = (src[3*i] << 4) | (src[3*i+1] & 0xf);
+        const unsigned p1 = (src[3*i+2] << 4) | (src[3*i+1] >> 4);
+        dst[2*i+0] = (uint16_t)((p0 << 4) | (p0 >> 8));
+        dst[2*i+1] = (uint16_t)((p1 << 4) | (p1 >> 8));
+    }
+}
+
+int main( int /*argc*/, char* /*argv*/[] )
+{
+    srand(1);
+
+    bool ok = true;
+    for(size_t samples = 2; samples <= 64; samples += 2) {
+        vector<unsigned char> src(samples * 3 / 2);
+        for(size_t i = 0; i < src.size(); ++i) src[i] = (unsigned char)(rand() % 256);
+
+        vector<uint16_t> out(samples), ref(samples);
+        Unpack12(&src[0], samples, &out[0]);
+        Reference(&src[0], samples, &ref[0]);
+        if( out != ref ) {
+            cout << "Unpack12 of " << samples << " samples FAILED" << endl;
+            ok = false;
+        }
+    }
+
+    // full scale maps to full scale
+    const unsigned char white[3] = { 0xff, 0xff, 0xff };
+    uint16_t w[2];
+    Unpack12(white, 2, w);
+    ok = ok && w[0] == 65535 && w[1] == 65535;
+
+    cout << "pixel convert " << (ok ? "ok" : "FAILED") << endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,136 @@
+/* This file is part of the Pangolin HDR extension project
+ *
+ * http://github.com/akramhussein/hdr
+ *
+ * Copyright (c) 2012 Akram Hussein
+ *
+ * Permission is hereby granted, free of charge, to any person
+ * obtaining a copy of this software and associated documentation
+ * files (the "Software"), to deal in the Software without
+ * restriction, including without limitation the rights to use,
+ * copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following
+ * conditions:
+ *
+ * The above copyright notice and this permission notice shall be
+ * included in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES
+ * OF MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT
+ * HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY,
+ * WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR
+ * OTHER DEALINGS IN THE SOFTWARE.
+ */
+
+// Checks the fixed point YUV conversion against a floating point BT.601
+// reference for every Y, U, V combination, in each packed layout and
+// output format. Exits non-zero on failure.
+
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <pangolin/video/yuv_convert.h>
+
+using namespace pangolin;
+using namespace std;
+
+// largest allowed difference from the rounded reference
+const int TOLERANCE = 1;
+
+unsigned char Round8(double v)
+{
+    const double r = floor(v + 0.5);
+    return (unsigned char)(r < 0 ? 0 : (r > 255 ? 255 : r));
+}
+
+void Reference(int y, int u, int v, unsigned char rgb[3])
+{
+    const double yy = 255.0 / 219.0 * (y - 16);
+    const double cb = 255.0 / 224.0 * (u - 128);
+    const double cr = 255.0 / 224.0 * (v - 128);
+    rgb[0] = Round8(yy + 1.402 * cr);
+    rgb[1] = Round8(yy - 0.344136 * cb - 0.714136 * cr);
+    rgb[2] = Round8(yy + 1.772 * cb);
+}
+
+// One row per (u,v) pair, sweeping luma 0..255 along each row. Luma of
+// pixel x is x % 256.
+void MakeImage(const string& format, unsigned w, vector<unsigned char>& yuv)
+{
+    const unsigned h = 256 * 256;
+    const unsigned row = format == "UYYVYY411" ? w * 3 / 2 : w * 2;
+    yuv.resize((size_t)row * h);
+
+    for(unsigned r = 0; r < h; ++r) {
+        const unsigned char u = (unsigned char)(r / 256);
+        const unsigned char v = (unsigned char)(r % 256);
+        unsigned char* p = &yuv[(size_t)row * r];
+        for(unsigned x = 0; x < w; ) {
+            if( format == "YUYV422" ) {
+                *p++ = x++ % 256; *p++ = u; *p++ = x++ % 256; *p++ = v;
+            }else if( format == "UYVY422" ) {
+                *p++ = u; *p++ = x++ % 256; *p++ = v; *p++ = x++ % 256;
+            }else{
+                *p++ = u; *p++ = x++ % 256; *p++ = x++ % 256;
+                *p++ = v; *p++ = x++ % 256; *p++ = x++ % 256;
+            }
+        }
+    }
+}
+
+bool Check(const string& format, const string& out_format)
+{
+    // one extra chroma group so the last, bytewise stored pixel is checked
+    const unsigned w = format == "UYYVYY411" ? 260 : 258;
+    const unsigned h = 256 * 256;
+    const int bpp = out_format == "GRAY8" ? 1 : 3;
+
+    vector<unsigned char> yuv;
+    MakeImage(format, w, yuv);
+    vector<unsigned char> out((size_t)w * h * bpp);
+    ConvertYuv(&yuv[0], w, h, format, &out[0], out_format);
+
+    int worst = 0;
+    for(unsigned r = 0; r < h; ++r) {
+        for(unsigned x = 0; x < w; ++x) {
+            const int y = x % 256;
+            const unsigned char* p = &out[((size_t)w * r + x) * bpp];
+            if( bpp == 1 ) {
+                worst = max(worst, abs(p[0] - y));
+                continue;
+            }
+            unsigned char rgb[3];
+            Reference(y, r / 256, r % 256, rgb);
+            for(int c = 0; c < 3; ++c) {
+                const int ref = out_format == "BGR24" ? rgb[2-c] : rgb[c];
+                worst = max(worst, abs(p[c] - ref));
+            }
+        }
+    }
+
+    const bool ok = worst <= TOLERANCE;
+    cout << format << " to " << out_format << ": max error " << worst
+         << " " << (ok ? "ok" : "FAILED") << endl;
+    return ok;
+}
+
+int main( int /*argc*/, char* /*argv*/[] )
+{
+    const char* formats[] = { "YUYV422", "UYVY422", "UYYVYY411" };
+    const char* out_formats[] = { "RGB24", "BGR24", "GRAY8" };
+
+    bool ok = true;
+    for(int i = 0; i < 3; ++i) {
+        for(int j = 0; j < 3; ++j) {
+            ok = Check(formats[i], out_formats[j]) && ok;
+        }
+    }
+    return ok ? 0 : 1;
+}